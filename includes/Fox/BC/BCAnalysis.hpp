@@ -0,0 +1,139 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCAnalysis.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains analyses of instruction buffers used by the bytecode
+//  optimization passes: the registers read and written by instructions,
+//  the control flow between instructions and the liveness of registers.
+//
+//  These analyses don't support superinstructions, so they must be done
+//  before fuseSuperinstructions.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/BC/BCUtils.hpp"
+#include "Fox/BC/Instruction.hpp"
+#include "Fox/Common/LLVM.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace fox {
+  /// A set of registers
+  using RegisterSet = std::bitset<bc_limits::max_registers>;
+
+  /// The registers read and written by an instruction.
+  struct RegisterEffects {
+    /// The registers read by the instruction. For calls to builtins, these
+    /// are the arguments. For other calls, this includes every register
+    /// that can contain an argument.
+    RegisterSet reads;
+    /// The registers that contain a new value after the instruction
+    RegisterSet writes;
+    /// The registers whose value is undefined after the instruction.
+    /// Calls clobber the registers of the callee's register window.
+    RegisterSet clobbers;
+  };
+
+  /// \returns the registers read and written by \p instr
+  RegisterEffects getRegisterEffects(Instruction instr);
+
+  /// \returns pointers to the register operands of \p instr that are read
+  /// as values, so they can be replaced with other registers containing
+  /// the same values.
+  ///
+  /// The registers that are read because of their position (the arguments
+  /// of calls, the elements of ArrAppendRange) aren't included.
+  SmallVector<regaddr_t*, 3> getReadOperands(Instruction& instr);
+
+  /// \returns a pointer to the register operand of \p instr that is 
+  /// written, or nullptr if \p instr doesn't write to a register.
+  regaddr_t* getWriteOperand(Instruction& instr);
+
+  /// \returns a pointer to the base of \p instr, after which its arguments
+  /// are, or nullptr if \p instr isn't a call.
+  regaddr_t* getCallBase(Instruction& instr);
+
+  /// \returns true if the execution never continues to the instruction
+  /// that follows \p instr (it's a Jump or a return).
+  bool isTerminator(Instruction instr);
+
+  /// \returns the index of the jump instruction of the instruction at
+  /// \p idx in \p instrs: \p idx for Jump, JumpIf and JumpIfNot, the index
+  /// of the JumpOffset for compare and jumps. \returns None if the
+  /// instruction isn't a jump.
+  Optional<std::size_t> getJumpSlot(ArrayRef<Instruction> instrs,
+                                    std::size_t idx);
+
+  /// \returns the offset of the jump at \p slot (see getJumpSlot)
+  jump_offset_t getJumpOffset(Instruction slot);
+
+  /// Sets the offset of the jump at \p slot (see getJumpSlot)
+  /// to \p offset.
+  void setJumpOffset(Instruction& slot, jump_offset_t offset);
+
+  /// \returns the index of the instruction targeted by the jump at index
+  /// \p slot (see getJumpSlot). This can be the size of the buffer.
+  std::size_t getJumpTarget(ArrayRef<Instruction> instrs, std::size_t slot);
+
+  /// \returns true if the target of a jump at index \p slot can be
+  /// \p target.
+  bool canJumpTo(std::size_t slot, std::size_t target);
+
+  /// Adds the indexes of the instructions that can be executed after the
+  /// instruction at \p idx in \p instrs to \p succs. The size of the
+  /// buffer is the successor of the instructions that fall through its
+  /// end.
+  void getSuccessors(ArrayRef<Instruction> instrs, std::size_t idx,
+                     SmallVectorImpl<std::size_t>& succs);
+
+  /// \returns a vector indicating, for each index of \p instrs,
+  /// whether an instruction begins at that index (the JumpOffset and
+  /// CallTarget instructions are part of the preceding instruction).
+  std::vector<bool> getInstructionStarts(ArrayRef<Instruction> instrs);
+
+  /// \returns a vector indicating, for each index of \p instrs, whether
+  /// it's the target of a jump.
+  std::vector<bool> getJumpTargets(ArrayRef<Instruction> instrs);
+
+  /// The liveness of the registers of an instruction buffer: a register
+  /// is live after an instruction if its value can be read by another
+  /// instruction before being overwritten.
+  class LivenessAnalysis {
+    public:
+      /// Computes the liveness of the registers of \p instrs
+      LivenessAnalysis(ArrayRef<Instruction> instrs);
+
+      /// Computes the liveness of the registers of \p instrs, where
+      /// \p effects contains the effects of the instruction that begins at
+      /// each index. This is used when the effects of some instructions
+      /// are known more precisely than getRegisterEffects describes them.
+      LivenessAnalysis(ArrayRef<Instruction> instrs,
+                       ArrayRef<RegisterEffects> effects);
+
+      /// \returns the registers that are live before the instruction at
+      /// \p idx
+      const RegisterSet& getLiveIn(std::size_t idx) const {
+        assert((idx < liveIn_.size()) && "out of range");
+        return liveIn_[idx];
+      }
+
+      /// \returns the registers that are live after the instruction at
+      /// \p idx
+      const RegisterSet& getLiveOut(std::size_t idx) const {
+        assert((idx < liveOut_.size()) && "out of range");
+        return liveOut_[idx];
+      }
+
+    private:
+      std::vector<RegisterSet> liveIn_;
+      std::vector<RegisterSet> liveOut_;
+  };
+}
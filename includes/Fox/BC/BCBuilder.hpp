@@ -37,6 +37,16 @@ namespace fox {
         StableInstrIter create##ID##Instr(T1 I1);
       #define SIMPLE_INSTR(ID)\
         StableInstrIter create##ID##Instr();
+      // Fused compare and jumps also insert the JumpOffset instruction
+      // that follows them.
+      #define COMPARE_JUMP_INSTR(ID)\
+        StableInstrIter create##ID##Instr(regaddr_t lhs, regaddr_t rhs,\
+                                          jump_offset_t offset);
+      // Direct calls also insert the CallTarget instruction that follows
+      // them.
+      #define DIRECT_CALL_INSTR(ID)\
+        StableInstrIter create##ID##Instr(func_id_t func, regaddr_t base,\
+                                          regaddr_t dest);
       #include "Instruction.def"
 
       /// erases all instructions in the range [beg, end)
@@ -50,10 +60,16 @@ namespace fox {
 
       /// \returns an iterator to the last instruction inserted
       /// in the buffer. The buffer must not be empty.
+      /// Note: if the last instruction is a fused compare and jump or a 
+      /// direct call, this returns an iterator to it, not to its JumpOffset
+      /// or CallTarget.
       StableInstrIter getLastInstrIter();
 
       /// \returns an iterator to the last instruction inserted
       /// in the buffer. The buffer must not be empty.
+      /// Note: if the last instruction is a fused compare and jump or a 
+      /// direct call, this returns an iterator to it, not to its JumpOffset
+      /// or CallTarget.
       StableInstrConstIter getLastInstrIter() const;
 
       /// Adds a debug range for an instruction.
@@ -64,7 +80,9 @@ namespace fox {
       /// \returns true if we have a DebugInfo instance attached.
       bool hasDebugInfo() const;
 
-      /// Removes the last instruction added to this module.
+      /// Removes the last instruction added to this module (and its
+      /// JumpOffset or CallTarget if it's a fused compare and jump or a 
+      /// direct call)
       void popInstr();
 
       /// The Instruction vector that we are inserting into.
@@ -74,6 +92,9 @@ namespace fox {
       DebugInfo * const debugInfo = nullptr;
 
     private:
+      /// \returns the index of the last instruction in the buffer.
+      std::size_t getLastInstrIndex() const;
+
       StableInstrIter insert(Instruction instr);
   };
 }
\ No newline at end of file
@@ -12,15 +12,19 @@
 #include "Fox/BC/BCUtils.hpp"
 #include "Fox/BC/DebugInfo.hpp"
 #include "Fox/BC/Instruction.hpp"
+#include "Fox/BC/PreparedCode.hpp"
 #include "Fox/Common/LLVM.hpp"
 #include "Fox/Common/string_view.hpp"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Compiler.h"
+#include <cstdint>
 #include <iosfwd>
 #include <memory>
 
 namespace fox {
   class BCBuilder;
   class DebugInfo;
+  class JITFunction;
 
   /// A Bytecode function, which can be either a function or a global variable's
   /// initializer.
@@ -28,7 +32,8 @@ namespace fox {
     public:
       /// Creates a BCFunction
       /// \param id the ID of the function
-      BCFunction(func_id_t id) : id_(id) {}
+      BCFunction(func_id_t id);
+      ~BCFunction();
 
       BCFunction(const BCFunction&) = delete;
       BCFunction& operator=(const BCFunction&) = delete;
@@ -43,7 +48,34 @@ namespace fox {
         return instrs_.size();
       }
 
+      /// \returns the number of registers used by this function, which is
+      /// the size of its register window.
+      /// By default, this is bc_limits::max_registers.
+      std::size_t getNumRegisters() const {
+        return numRegisters_;
+      }
+
+      /// Sets the number of registers used by this function to \p num
+      void setNumRegisters(std::size_t num) {
+        assert((num <= bc_limits::max_registers) && "too many registers");
+        numRegisters_ = num;
+      }
+
+      /// \returns the number of parameters of this function. The caller
+      /// passes them in the first registers of its register window.
+      std::size_t getNumParams() const {
+        return numParams_;
+      }
+
+      /// Sets the number of parameters of this function to \p num
+      void setNumParams(std::size_t num) {
+        assert((num <= bc_limits::max_registers) && "too many parameters");
+        numParams_ = num;
+      }
+
       /// Creates a bytecode builder for this function's instruction buffer.
+      /// This discards the prepared code and the native code of this 
+      /// function.
       BCBuilder createBCBuilder();
 
       /// \returns a reference to the instruction buffer
@@ -63,6 +95,37 @@ namespace fox {
       /// if the function's ID is "0", it'd print "Function 0"
       void dump(std::ostream& out, string_view title = "Function") const;
 
+      /// \returns the prepared form of this function's code. It is created
+      /// (unprepared) on the first call.
+      /// Note: the prepared code must be discarded (see discardPreparedCode)
+      /// if the instruction buffer is modified.
+      PreparedCode& getPreparedCode() {
+        if(LLVM_LIKELY(preparedCode_))
+          return *preparedCode_;
+        return createPreparedCode();
+      }
+
+      /// Discards the prepared form of this function's code, and its
+      /// native code.
+      void discardPreparedCode();
+
+      /// \returns the native code of this function generated by the JIT,
+      /// or nullptr if it hasn't been compiled.
+      JITFunction* getJITFunction() const {
+        return jitFn_.get();
+      }
+
+      /// Sets the native code of this function to \p jitFn
+      void setJITFunction(std::unique_ptr<JITFunction> jitFn);
+
+      /// Increments the hotness counter of this function, which is used by 
+      /// the VM to decide when it should be compiled by the JIT.
+      /// \returns the new value of the counter.
+      std::uint32_t incrementHotness() {
+        if(LLVM_LIKELY(hotness_ != UINT32_MAX)) ++hotness_;
+        return hotness_;
+      }
+
       /// creates an instance of DebugInfo for this function
       /// \returns a reference to the instance created
       DebugInfo& createDebugInfo();
@@ -103,13 +166,31 @@ namespace fox {
       }
 
     private:
+      /// Creates the PreparedCode of this function.
+      PreparedCode& createPreparedCode();
+
       /// The buffer of instructions
       InstructionVector instrs_;
 
       /// The ID of this function
       const func_id_t id_ = 0;
 
+      /// The number of registers used by this function
+      std::size_t numRegisters_ = bc_limits::max_registers;
+
+      /// The number of parameters of this function
+      std::size_t numParams_ = 0;
+
       /// The (optional) debug information for this function
       std::unique_ptr<DebugInfo> debugInfo_;
+
+      /// The prepared form of this function's code, created lazily.
+      std::unique_ptr<PreparedCode> preparedCode_;
+
+      /// The native code of this function (can be null)
+      std::unique_ptr<JITFunction> jitFn_;
+
+      /// The hotness counter of this function
+      std::uint32_t hotness_ = 0;
   };
 }
\ No newline at end of file
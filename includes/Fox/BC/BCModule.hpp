@@ -15,6 +15,7 @@
 #include "Fox/BC/BCFunction.hpp"
 #include "Fox/BC/Instruction.hpp"
 #include "Fox/Common/FoxTypes.hpp"
+#include "Fox/Common/Objects.hpp"
 #include "Fox/Common/LLVM.hpp"
 #include "Fox/Common/string_view.hpp"
 #include "llvm/ADT/SmallVector.h"
@@ -146,6 +147,21 @@ namespace fox {
       /// \returns a view of the double constants vector
       ArrayRef<FoxDouble> getDoubleConstants() const;
 
+      /// Adds a new array constant into the BCModule.
+      /// This is simply a push_back operation, it does not unique the constant.
+      /// \param elemKind the kind of the elements of the array
+      /// \param elems the elements of the array. They'll be copied in the
+      ///              constant.
+      /// \returns the index of the newly inserted constant
+      std::size_t addArrayConstant(ArrayElemKind elemKind, 
+                                   ArrayRef<FoxAny> elems);
+      /// \returns the array constant identified by \p idx
+      const ArrayObject& getArrayConstant(std::size_t idx) const;
+      /// \returns the number of array constants in the module
+      std::size_t numArrayConstants() const {
+        return arrayConstants_.size();
+      }
+
       /// \returns the entry point of this BCModule
       BCFunction* getEntryPoint() {
         return entryPoint_;
@@ -200,5 +216,8 @@ namespace fox {
       SmallVector<std::string, 4> strConstants_;
       SmallVector<FoxInt, 4> intConstants_;
       SmallVector<FoxDouble, 4> doubleConstants_;
+      /// The array constants. They are never seen by the program: the VM
+      /// creates a copy of the constant every time it's loaded.
+      SmallVector<std::unique_ptr<ArrayObject>, 4> arrayConstants_;
   };
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCPassManager.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the BCPassManager, which runs a pipeline of
+//  optimization passes (see BCPasses.hpp) over BCFunctions, and the
+//  optimization levels that select the passes of the pipeline.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/Common/LLVM.hpp"
+#include "Fox/Common/string_view.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace fox {
+  class BCFunction;
+
+  /// The optimization levels of the bytecode.
+  enum class OptLevel : std::uint8_t {
+    /// No optimization: the bytecode is left as BCGen emitted it.
+    O0,
+    /// Removes redundant instructions: unreachable code, jumps to jumps
+    /// and redundant copies, replaces multiplications by constants with
+    /// cheaper instructions and moves invariant code out of loops. At this
+    /// level, BCGen also inlines the calls to small functions and
+    /// reallocates registers.
+    O1
+  };
+
+  /// The BCPassManager runs a pipeline of optimization passes over
+  /// BCFunctions.
+  class BCPassManager {
+    public:
+      /// An optimization pass, which transforms a function and returns true
+      /// if it has changed it.
+      using Pass = bool(*)(BCFunction&);
+
+      /// Creates a BCPassManager without any pass
+      BCPassManager() = default;
+
+      /// Creates a BCPassManager that runs the passes of \p level
+      explicit BCPassManager(OptLevel level);
+
+      /// Adds \p pass, named \p name, at the end of the pipeline.
+      void addPass(string_view name, Pass pass);
+
+      /// \returns the number of passes in the pipeline
+      std::size_t numPasses() const {
+        return passes_.size();
+      }
+
+      /// \returns the name of the pass at index \p idx in the pipeline
+      string_view getPassName(std::size_t idx) const {
+        return passes_[idx].name;
+      }
+
+      /// Runs every pass of the pipeline over \p fn, in order.
+      /// \returns true if \p fn has been changed.
+      bool run(BCFunction& fn) const;
+
+    private:
+      struct PassEntry {
+        string_view name;
+        Pass pass;
+      };
+
+      SmallVector<PassEntry, 8> passes_;
+  };
+}
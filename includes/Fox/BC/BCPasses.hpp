@@ -0,0 +1,115 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCPasses.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the optimization passes that transform the
+//  instruction buffer of a BCFunction. They are run by the BCPassManager.
+//
+//  inlineCalls and allocateRegisters need the module of the function, so
+//  they aren't run by the BCPassManager: BCGen runs them after the other
+//  passes.
+//
+//  Every pass keeps the jump offsets and the debug information of the
+//  function correct. Like the analyses they use (see BCAnalysis.hpp), they
+//  don't support superinstructions and must run before
+//  fuseSuperinstructions.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace fox {
+  class BCFunction;
+  class BCModule;
+
+  /// Removes the instructions of \p fn whose index is set in \p removed,
+  /// updating the jump offsets and the debug information. The jumps that
+  /// targeted a removed instruction jump to the next instruction that
+  /// isn't removed.
+  /// Note: A compare and jump or a direct call must be removed with the
+  /// instruction that follows it (its JumpOffset or CallTarget).
+  /// \returns the number of instructions removed.
+  std::size_t removeInstructions(BCFunction& fn,
+                                 const std::vector<bool>& removed);
+
+  /// Removes the instructions of \p fn that can't be executed, such as
+  /// the code that follows a Ret or a Jump and isn't the target of any
+  /// jump.
+  /// \returns true if \p fn has been changed.
+  bool removeUnreachableCode(BCFunction& fn);
+
+  /// Makes the jumps of \p fn that target an unconditional Jump jump to
+  /// the final target directly, replaces the unconditional jumps to a
+  /// return with that return, and removes the jumps to the next
+  /// instruction.
+  /// \returns true if \p fn has been changed.
+  bool threadJumps(BCFunction& fn);
+
+  /// Removes the Copy instructions of \p fn that are redundant.
+  ///
+  /// The instructions that read a copy read the register it was copied
+  /// from instead, where both registers contain the same value on every
+  /// path, and the copies that are never read are then removed.
+  /// \returns true if \p fn has been changed.
+  bool eliminateRedundantCopies(BCFunction& fn);
+
+  /// Replaces the integer multiplications and exponentiations of \p fn
+  /// by a known small constant with cheaper instructions: x*2 becomes
+  /// x+x, x*k becomes a MulIntImm, and x**1 becomes conversions between
+  /// int and double, which the JIT executes unlike PowInt.
+  ///
+  /// The constant is known when the register is only ever written by
+  /// stores of that constant, or when it's stored by one of the
+  /// instructions executed right before.
+  /// \returns true if \p fn has been changed.
+  bool reduceStrength(BCFunction& fn);
+
+  /// Moves the instructions of the loops of \p fn that compute the same
+  /// value at every iteration, such as constants and the size of an array
+  /// that isn't modified by the loop, before the loop.
+  ///
+  /// Only the instructions that can't fail and have no side effects are
+  /// moved, so the loops that are never entered behave the same. A loop is
+  /// the code between a jump and the earlier instruction it targets, when
+  /// no other jump enters it. Innermost loops are processed first, so the
+  /// code can be moved out of several nested loops.
+  /// \returns true if \p fn has been changed.
+  bool hoistLoopInvariantCode(BCFunction& fn);
+
+  /// The maximum number of instructions of the functions inlined by
+  /// inlineCalls.
+  constexpr std::size_t maxInlinedFunctionSize = 16;
+
+  /// Replaces the direct calls of \p fn, which belongs to \p module, to
+  /// small functions (of up to maxInlinedFunctionSize instructions) that
+  /// don't call other functions with the code of these functions.
+  ///
+  /// The registers of the code inlined are shifted to the register window
+  /// of the call, and it keeps the debug information of the callee. The
+  /// callees must have been optimized, and calls to functions that become
+  /// small enough once their calls are inlined can be inlined by running
+  /// this again.
+  /// \returns true if \p fn has been changed.
+  bool inlineCalls(BCFunction& fn, const BCModule& module);
+
+  /// Reallocates the registers of \p fn, which belongs to \p module, using
+  /// the live ranges of its values, so it uses as few registers as
+  /// possible.
+  ///
+  /// The values are given registers with linear scan, in the order in
+  /// which their live ranges begin. The arguments of calls stay in the
+  /// registers that follow the base of the call, but the calls are moved
+  /// down to the lowest base that doesn't clobber a live register, and
+  /// the values copied to an argument register for their last use are
+  /// placed in that register directly.
+  ///
+  /// \p fn is left unchanged if it contains an indirect call (whose
+  /// number of arguments isn't known), or if the new allocation would use
+  /// more registers.
+  /// \returns true if \p fn has been changed.
+  bool allocateRegisters(BCFunction& fn, const BCModule& module);
+}
@@ -17,6 +17,7 @@
 
 #include <cstdint>
 #include <cstddef>
+#include "Fox/Common/ArrayElemKind.hpp"
 #include "Fox/Common/BuiltinKinds.hpp"
 
 namespace llvm {
@@ -73,6 +74,10 @@ namespace fox {
 
     /// the maximum register address possible.
     constexpr regaddr_t max_regaddr = 0xFF;
+
+    /// the maximum number of registers a function can use (the size of a
+    /// full register window)
+    constexpr std::size_t max_registers = std::size_t(max_regaddr)+1;
     
     /// the minimum value that can be stored in a register using
     /// StoreSmallInt
@@ -81,5 +86,13 @@ namespace fox {
     /// the minimum value that can be stored in a register using
     /// StoreSmallInt
     constexpr std::int16_t storeSmallInt_min = -storeSmallInt_max;
+
+    /// the maximum value of the immediate operand of instructions such as
+    /// AddIntImm
+    constexpr std::int8_t immediate_max = (1 << 7)-1;
+
+    /// the minimum value of the immediate operand of instructions such as
+    /// AddIntImm
+    constexpr std::int8_t immediate_min = -immediate_max;
   }
 }
\ No newline at end of file
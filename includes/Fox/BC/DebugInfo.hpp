@@ -11,6 +11,7 @@
 #include "llvm/ADT/Optional.h"
 #include "Fox/Common/LLVM.hpp"
 #include "Fox/Common/SourceLoc.hpp"
+#include <vector>
 
 namespace fox {
   /// This class contains debug information for some instructions in a Buffer of
@@ -63,6 +64,14 @@ namespace fox {
       /// \returns a read-only view of the sorted vector containing
       /// the SourceRanges of the instructions.
       ArrayRef<IndexRangePair> getRanges() const;
+
+      /// Updates the indexes of the instructions after some of them have
+      /// been removed from the instruction buffer.
+      /// \param newIndexes the new index of each instruction
+      /// \param removed whether each instruction has been removed. The
+      ///        SourceRanges of the removed instructions are dropped.
+      void remapInstructions(ArrayRef<std::size_t> newIndexes,
+                             const std::vector<bool>& removed);
       
     private:
       template<typename T>
@@ -11,6 +11,7 @@
 
 #include "BCUtils.hpp"
 #include "llvm/Support/Compiler.h"
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 
@@ -63,11 +64,44 @@ namespace fox {
         case Opcode::JumpIf:
         case Opcode::JumpIfNot:
           return true;
+        default:
+          return isCompareAndJump();
+      }
+    }
+
+    /// \returns true if this instruction is a fused compare and jump 
+    /// (e.g. JumpIfLTInt). These instructions are followed by a JumpOffset
+    /// instruction.
+    bool isCompareAndJump() const {
+      switch (opcode) {
+        #define COMPARE_JUMP_INSTR(ID) case Opcode::ID:
+        #include "Instruction.def"
+          return true;
         default:
           return false;
       }
     }
 
+    /// \returns true if this instruction is a direct call to a function
+    /// (e.g. CallFunc). These instructions are followed by a CallTarget
+    /// instruction.
+    bool isDirectCall() const {
+      switch (opcode) {
+        #define DIRECT_CALL_INSTR(ID) case Opcode::ID:
+        #include "Instruction.def"
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    /// \returns the number of instructions used by this instruction in the
+    /// instruction buffer: 2 for instructions that are followed by a 
+    /// JumpOffset or a CallTarget, 1 for every other instruction.
+    std::size_t getLength() const {
+      return (isCompareAndJump() || isDirectCall()) ? 2 : 1;
+    }
+
     /// \returns true if this instruction is any kind of return instr
     bool isAnyRet() const {
       switch (opcode) {
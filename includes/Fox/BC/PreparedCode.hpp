@@ -0,0 +1,160 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : PreparedCode.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the PreparedCode class and the PreparedInstruction
+//  struct, which are the pre-decoded form of the bytecode that is executed
+//  by the VM.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/BC/BCUtils.hpp"
+#include "Fox/BC/Instruction.hpp"
+#include "Fox/Common/LLVM.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include <cstdint>
+#include <vector>
+
+namespace fox {
+  namespace detail {
+    /// Trait used to determine the type of an operand in a
+    /// PreparedInstruction.
+    template<typename Ty>
+    struct PreparedOperand { using type = Ty; };
+
+    /// Register addresses are widened to 16 bits.
+    template<>
+    struct PreparedOperand<std::uint8_t> { using type = std::uint16_t; };
+
+    /// 16 bits signed values (jump offsets and small integers) are
+    /// widened to 32 bits.
+    template<>
+    struct PreparedOperand<std::int16_t> { using type = std::int32_t; };
+
+    /// Immediate operands are widened to 32 bits.
+    template<>
+    struct PreparedOperand<std::int8_t> { using type = std::int32_t; };
+  }
+
+  /// A pre-decoded Instruction. This is the form of the instructions
+  /// executed by the VM.
+  ///
+  /// Like an Instruction, the operands of a PreparedInstruction can be accessed
+  /// using "object.opcode.data", e.g. instr.StoreSmallInt.value.
+  /// The only difference is that the 'offset' operand of jumps contains the
+  /// absolute index of the target of the jump in the prepared code.
+  /// Fused compare and jumps (e.g. JumpIfLTInt) also have an 'offset'
+  /// operand, which is copied from the JumpOffset instruction that follows
+  /// them. Likewise, direct calls (e.g. CallFunc) have a 'func' operand,
+  /// which is copied from the CallTarget instruction that follows them.
+  struct PreparedInstruction {
+    union {
+      /// The address of the handler of this instruction in the VM's
+      /// interpreter loop (when it uses threaded dispatch).
+      const void* handler;
+      /// The opcode of this instruction (when the VM doesn't use threaded
+      /// dispatch).
+      Opcode opcode;
+    };
+
+    union {
+      #define TERNARY_INSTR(ID, I1, T1, I2, T2, I3, T3)                       \
+      struct ID##Instr {                                                      \
+        detail::PreparedOperand<T1>::type I1;                                 \
+        detail::PreparedOperand<T2>::type I2;                                 \
+        detail::PreparedOperand<T3>::type I3;                                 \
+      };                                                                      \
+      ID##Instr ID;
+      #define BINARY_INSTR(ID, I1, T1, I2, T2)                                \
+      struct ID##Instr {                                                      \
+        detail::PreparedOperand<T1>::type I1;                                 \
+        detail::PreparedOperand<T2>::type I2;                                 \
+      };                                                                      \
+      ID##Instr ID;
+      #define UNARY_INSTR(ID, I1, T1)                                         \
+      struct ID##Instr {                                                      \
+        detail::PreparedOperand<T1>::type I1;                                 \
+      };                                                                      \
+      ID##Instr ID;
+      #define COMPARE_JUMP_INSTR(ID)                                          \
+      struct ID##Instr {                                                      \
+        detail::PreparedOperand<regaddr_t>::type lhs;                         \
+        detail::PreparedOperand<regaddr_t>::type rhs;                         \
+        detail::PreparedOperand<jump_offset_t>::type offset;                  \
+      };                                                                      \
+      ID##Instr ID;
+      #define DIRECT_CALL_INSTR(ID)                                           \
+      struct ID##Instr {                                                      \
+        detail::PreparedOperand<regaddr_t>::type base;                        \
+        detail::PreparedOperand<regaddr_t>::type dest;                        \
+        detail::PreparedOperand<func_id_t>::type func;                        \
+      };                                                                      \
+      ID##Instr ID;
+      #include "Instruction.def"
+    };
+  };
+
+  static_assert(sizeof(PreparedInstruction) <= 16, "Size of "
+    "'PreparedInstruction' object exceeds 16 bytes!");
+
+  /// The prepared form of an instruction buffer.
+  ///
+  /// It is created from an instruction buffer, but it's only
+  /// prepared when prepare() is called.
+  /// Note that this only references the instruction buffer, so it's
+  /// invalidated if the instruction buffer is modified.
+  class PreparedCode {
+    public:
+      /// Creates an unprepared PreparedCode for \p instrs
+      PreparedCode(ArrayRef<Instruction> instrs) : instrs_(instrs) {}
+
+      PreparedCode(const PreparedCode&) = delete;
+      PreparedCode& operator=(const PreparedCode&) = delete;
+
+      /// Decodes the instructions. If the code has already been prepared,
+      /// it is prepared again.
+      /// \param handlers the handler addresses, indexed by opcode. If this
+      ///        is empty, the 'opcode' field of the PreparedInstructions
+      ///        is set instead of the 'handler' field.
+      void prepare(ArrayRef<const void*> handlers = None);
+
+      /// \returns true if prepare() has been called.
+      bool isPrepared() const {
+        return prepared_;
+      }
+
+      /// \returns true if prepare() has been called with the handler
+      /// table \p handlers.
+      bool isPreparedWith(ArrayRef<const void*> handlers) const {
+        return prepared_ && (handlers_ == handlers.data());
+      }
+
+      /// \returns the instructions this was created from.
+      ArrayRef<Instruction> getInstructions() const {
+        return instrs_;
+      }
+
+      /// \returns a pointer to the first prepared instruction
+      const PreparedInstruction* begin() const {
+        assert(isPrepared() && "code has not been prepared");
+        return code_.data();
+      }
+
+      /// \returns the Instruction that \p instr was created from.
+      const Instruction* getSource(const PreparedInstruction* instr) const {
+        assert((instr >= begin()) && (instr <= (begin()+code_.size()))
+          && "instruction is not part of this code");
+        return instrs_.begin() + (instr - begin());
+      }
+
+    private:
+      ArrayRef<Instruction> instrs_;
+      std::vector<PreparedInstruction> code_;
+      /// The handler table used to prepare the code
+      const void* const* handlers_ = nullptr;
+      bool prepared_ = false;
+  };
+}
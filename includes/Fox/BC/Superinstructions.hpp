@@ -0,0 +1,37 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : Superinstructions.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the superinstruction fusion pass, which replaces
+//  frequent pairs of instructions with superinstructions.
+//  The superinstructions are described in Instruction.def (see SUPER_INSTR)
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/BC/Instruction.hpp"
+#include "Fox/Common/LLVM.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include <cstddef>
+
+namespace fox {
+  /// \returns the superinstruction which executes \p first and then 
+  /// \p second, or None if there isn't one.
+  Optional<Opcode> getSuperinstruction(Opcode first, Opcode second);
+
+  /// \returns true if \p op is a superinstruction.
+  bool isSuperinstruction(Opcode op);
+
+  /// Replaces the first instruction of every pair of instructions in 
+  /// \p instrs that has a superinstruction with that superinstruction.
+  ///
+  /// Instructions are never added or removed, so jump offsets and debug
+  /// information stay valid. The second instruction of a pair is left in 
+  /// place and can still be the target of a jump.
+  ///
+  /// \returns the number of superinstructions created.
+  std::size_t fuseSuperinstructions(MutableArrayRef<Instruction> instrs);
+}
@@ -11,8 +11,11 @@
 #pragma once
 
 #include "Fox/AST/ASTFwdDecl.hpp"
+#include "Fox/BC/BCPassManager.hpp"
 #include "Fox/BC/BCUtils.hpp"
+#include "Fox/Common/FoxAny.hpp"
 #include "Fox/Common/FoxTypes.hpp"
+#include "Fox/Common/LLVM.hpp"
 #include "Fox/Common/string_view.hpp"
 #include <memory>
 #include <unordered_map>
@@ -34,7 +37,9 @@ namespace fox {
       /// \param theModule the BCModule in which bytecode will be emitted.
       ///        The BCModule is assumed to be empty. (The data that's
       ///        already in it will not be read/considered)
-      BCGen(ASTContext& ctxt, BCModule& theModule);
+      /// \param optLevel the optimization level of the bytecode
+      BCGen(ASTContext& ctxt, BCModule& theModule, 
+            OptLevel optLevel = OptLevel::O1);
 
       /// Make this class non copyable
       BCGen(const BCGen&) = delete;
@@ -55,6 +60,22 @@ namespace fox {
       ///          in \ref theModule 's double constants array.
       constant_id_t getConstantID(FoxDouble value);
 
+      /// Adds a new array constant of kind \p elemKind containing \p elems
+      /// to \ref theModule.
+      /// \returns the identifier of the new constant in \ref theModule 's
+      ///          array constants array.
+      constant_id_t createArrayConstant(ArrayElemKind elemKind, 
+                                        ArrayRef<FoxAny> elems);
+
+      /// \returns the kind of the elements of arrays of type \p type.
+      static ArrayElemKind getArrayElemKind(ArrayType* type);
+
+      /// Emits the instruction that creates an empty array of type \p type
+      /// in \p dest, reserving enough space for \p reservedElems elements
+      /// (or as many as the instruction allows).
+      static void emitNewArray(BCBuilder& builder, regaddr_t dest, 
+                               ArrayType* type, std::size_t reservedElems);
+
       ASTContext& ctxt;
       DiagnosticEngine& diagEngine;
       BCModule& theModule;
@@ -101,6 +122,17 @@ namespace fox {
       class LocalDeclGenerator;
       class StmtGenerator;
 
+      /// Finishes the functions of \ref theModule once the unit has been
+      /// generated: inlines calls and reallocates registers if the
+      /// bytecode is optimized, then fuses superinstructions.
+      void finishFunctions();
+
+      /// The optimization level of the bytecode
+      OptLevel optLevel_;
+
+      /// The optimization passes run on every function generated
+      BCPassManager passManager_;
+
       std::unordered_map<FuncDecl*, BCFunction&> funcs_;
       std::unordered_map<VarDecl*, BCFunction&> globalInitializers_;
 
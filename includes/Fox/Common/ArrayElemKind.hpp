@@ -0,0 +1,39 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.     
+// File : ArrayElemKind.hpp                      
+// Author : Pierre van Houtryve                
+//----------------------------------------------------------------------------//
+// This file contains the ArrayElemKind enum, which describes how the 
+// elements of an ArrayObject are stored. It is also an operand of the
+// NewValueArray instruction.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+namespace fox {
+  /// The kinds of elements of ArrayObjects. Arrays of values store their 
+  /// elements unboxed, in as few bytes as their type needs.
+  enum class ArrayElemKind : std::uint8_t {
+    /// FoxInts, stored in 8 bytes.
+    Int,
+    /// FoxDoubles, stored in 8 bytes.
+    Double,
+    /// Booleans, stored in 1 byte.
+    Bool,
+    /// FoxChars, stored in 4 bytes.
+    Char,
+    /// References to Objects, stored in a pointer.
+    Ref
+  };
+
+  /// \returns the number of bytes used by an element of kind \p kind.
+  std::size_t getElemSize(ArrayElemKind kind);
+
+  const char* to_string(ArrayElemKind kind);
+  std::ostream& operator<<(std::ostream& os, ArrayElemKind kind);
+}
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <iosfwd>
 
@@ -36,6 +37,15 @@ namespace fox {
   /// Call and CallVoid to call the builtin.
   bool hasNonVoidReturnType(BuiltinKind id);
 
+  /// \returns the number of arguments of the builtin with id \p id, which
+  /// is the number of registers that follow the base of a call to it.
+  std::size_t getNumArgs(BuiltinKind id);
+
+  /// \returns true if the builtin with id \p id is pure: it doesn't print
+  /// anything or modify its arguments, so it only computes its return 
+  /// value (but it can still fail, like arrGet).
+  bool isPure(BuiltinKind id);
+
   const char* to_string(BuiltinKind id);
   std::ostream& operator<<(std::ostream& os, BuiltinKind id);
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include "FoxTypes.hpp"
 #include "BuiltinKinds.hpp"
 #include "FoxAny.hpp"
+#include <cstdint>
 #include <string>
 
 namespace fox {
@@ -26,6 +27,25 @@ namespace fox {
   struct BuiltinFnArgTypeTrait<TYPE> { static constexpr bool ignored = true;  };
   #include "Builtins.def"
 
+  /// The destination register of a call to a builtin.
+  ///
+  /// Private builtins that produce a value can take a BuiltinDest parameter
+  /// (after the VM&, if any) and return void. They then write their result 
+  /// directly in the destination register of the call instead of returning
+  /// it. BuiltinDest parameters don't use any argument register.
+  class BuiltinDest {
+    public:
+      explicit BuiltinDest(std::uint64_t* dest) : dest_(dest) {}
+
+      /// Writes \p value in the destination register.
+      void set(FoxAny value) const {
+        *dest_ = value.raw;
+      }
+
+    private:
+      std::uint64_t* dest_ = nullptr;
+  };
+
   namespace builtin {
     namespace util {
       // FIXME: These builtins all return strings, so when they're used
@@ -86,13 +106,13 @@ namespace fox {
     FoxChar getChar(VM& vm, StringObject* str, FoxInt n);
 
     /// inserts \p element in \p array
-    void arrAppend(ArrayObject* arr, FoxAny elem);
+    void arrAppend(VM& vm, ArrayObject* arr, FoxAny elem);
 
     /// \returns the size of \p arr
     FoxInt arrSize(ArrayObject* arr);
 
-    /// \returns the element at index \p n of \p arr
-    FoxAny arrGet(VM& vm, ArrayObject* arr, FoxInt n);
+    /// Writes the element at index \p n of \p arr in \p dest
+    void arrGet(VM& vm, BuiltinDest dest, ArrayObject* arr, FoxInt n);
 
     /// sets the element at index \p n of \p arr to \p val
     /// \returns \p val
@@ -103,11 +123,11 @@ namespace fox {
     /// Removes the last element of \p arr
     void arrPop(VM& vm, ArrayObject* arr);
 
-    /// \returns the first element of \p arr
-    FoxAny arrFront(VM& vm, ArrayObject* arr);
+    /// Writes the first element of \p arr in \p dest
+    void arrFront(VM& vm, BuiltinDest dest, ArrayObject* arr);
 
-    /// \returns the last element of \p arr
-    FoxAny arrBack(VM& vm, ArrayObject* arr);
+    /// Writes the last element of \p arr in \p dest
+    void arrBack(VM& vm, BuiltinDest dest, ArrayObject* arr);
 
     /// Removes every element inside arr
     void arrReset(ArrayObject* arr);
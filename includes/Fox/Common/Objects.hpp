@@ -10,10 +10,15 @@
 
 #pragma once
 
+#include "ArrayElemKind.hpp"
 #include "FoxTypes.hpp"
 #include "FoxAny.hpp"
 #include "string_view.hpp"
 #include "LLVM.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/TrailingObjects.h"
+#include <cassert>
 #include <cstddef>
 #include <string>
 #include <vector>
@@ -27,7 +32,43 @@ namespace fox {
   /// The base Object class
   class Object {
     public:
-      ObjectKind getKind() const;
+      ObjectKind getKind() const {
+        return kind_;
+      }
+
+      /// \returns true if this object has been marked as reachable by
+      /// the garbage collector.
+      bool isMarked() const {
+        return marked_;
+      }
+
+      /// Sets the garbage collector's mark of this object to \p value.
+      void setMarked(bool value) {
+        marked_ = value;
+      }
+
+      /// \returns true if this object is in the young generation of the
+      /// VM's heap (it was allocated in the Nursery and hasn't survived a
+      /// collection yet).
+      bool isYoung() const {
+        return young_;
+      }
+
+      /// Sets whether this object is in the young generation.
+      void setYoung(bool value) {
+        young_ = value;
+      }
+
+      /// \returns true if this object is in the VM's remembered set: it is
+      /// old, and may contain references to young objects.
+      bool isRemembered() const {
+        return remembered_;
+      }
+
+      /// Sets whether this object is in the VM's remembered set.
+      void setRemembered(bool value) {
+        remembered_ = value;
+      }
 
       // TODO: Allocation methods (custom operator new) ?
     protected:
@@ -35,91 +76,349 @@ namespace fox {
 
     private:
       ObjectKind kind_;
+      bool marked_ = false;
+      bool young_ = false;
+      bool remembered_ = false;
   };
 
   /// StringObject is an immutable UTF8 String.
-  ///   TODO: Trail-allocate the string's data once I get a proper allocator in
-  ///         the VM.
-  class StringObject : public Object {
+  /// The bytes of the string are allocated right after the object (they
+  /// are trailing objects), so StringObjects can only be created in 
+  /// memory allocated by the user (see create and totalSize).
+  ///
+  /// The length of the string is computed once, when it is created. 
+  /// Strings that contain non-ASCII characters also have an index of the
+  /// byte offset of every indexStride-th codepoint (allocated before the
+  /// bytes), so getChar doesn't have to decode the string from its start.
+  ///
+  /// Long concatenations are ropes: instead of bytes, they reference their
+  /// operands, so appending to a long string doesn't copy it. A rope must be
+  /// flattened before its bytes or its characters can be accessed: its
+  /// content is copied into a new, flat StringObject, which then replaces
+  /// its operands (see isFlat and setFlattened).
+  class alignas(void*) StringObject final : public Object,
+    llvm::TrailingObjects<StringObject, StringObject*, std::uint32_t, char> {
+    using TrailingObjects = llvm::TrailingObjects<StringObject, 
+      StringObject*, std::uint32_t, char>;
+    friend TrailingObjects;
     public:
-      /// creates an empty StringObject
-      StringObject();
+      /// The number of codepoints between two entries of the index.
+      static constexpr std::size_t indexStride = 64;
+
+      /// The size, in bytes, of the smallest concatenation that creates
+      /// a rope. Shorter concatenations are copied.
+      static constexpr std::size_t minRopeSize = 64;
+
+      /// \returns the number of bytes needed to create a StringObject
+      /// of \p numBytes bytes and \p length codepoints.
+      static std::size_t totalSize(std::size_t numBytes, std::size_t length) {
+        return totalSizeToAlloc<StringObject*, std::uint32_t, char>(
+          0, getIndexSize(numBytes, length), numBytes);
+      }
+
+      /// \returns the number of bytes needed to create a rope.
+      static std::size_t ropeSize() {
+        return totalSizeToAlloc<StringObject*, std::uint32_t, char>(2, 0, 0);
+      }
+
+      /// Creates a StringObject containing \p value in \p mem, which must
+      /// be at least totalSize(value.size(), length) bytes large.
+      /// \p length must be the number of codepoints in \p value.
+      static StringObject* create(void* mem, string_view value, 
+                                  std::size_t length);
 
-      /// creates a StringObject from a pre-existing string_view
-      StringObject(string_view value);
+      /// Creates a StringObject containing the concatenation of \p lhs
+      /// and \p rhs in \p mem, which must be at least 
+      /// totalSize(lhs.size()+rhs.size(), length) bytes large.
+      /// \p length must be the number of codepoints in lhs + rhs.
+      static StringObject* create(void* mem, string_view lhs, 
+                                  string_view rhs, std::size_t length);
 
-      /// \returns a const reference to the underlying string
-      const std::string& str() const;
+      /// Creates a flat StringObject with the same content as \p str, 
+      /// which can be a rope, in \p mem, which must be at least
+      /// totalSize(str->numBytes(), str->length()) bytes large.
+      static StringObject* create(void* mem, const StringObject* str);
+
+      /// Creates a rope of the concatenation of \p lhs and \p rhs in 
+      /// \p mem, which must be at least ropeSize() bytes large.
+      static StringObject* create(void* mem, StringObject* lhs, 
+                                  StringObject* rhs);
+
+      /// Creates a copy of this object (a rope is copied as a rope) in 
+      /// \p mem, which must be at least getAllocatedSize() bytes large.
+      StringObject* clone(void* mem) const;
+
+      /// \returns a view of the string. The string must be flat.
+      string_view str() const {
+        if (LLVM_UNLIKELY(isRope_))
+          return getFlattened()->str();
+        return string_view(getTrailingObjects<char>(), numBytes_);
+      }
+
+      /// Copies the bytes of the string, which doesn't have to be flat, 
+      /// to \p dest, which must be at least numBytes() bytes large.
+      void copyBytes(char* dest) const;
 
       /// \returns the size of the string in UTF8 codepoints.
-      std::size_t length() const;
+      std::size_t length() const {
+        return length_;
+      }
+
       /// \returns the size of the string in bytes
-      std::size_t numBytes() const;
+      std::size_t numBytes() const {
+        return numBytes_;
+      }
+
+      /// \returns true if the string only contains ASCII characters
+      /// (one byte per codepoint).
+      bool isASCII() const {
+        return numBytes_ == length_;
+      }
+
+      /// \returns true if this string is a rope, flattened or not.
+      bool isRope() const {
+        return isRope_;
+      }
+
+      /// \returns true if the bytes of the string can be accessed: it
+      /// isn't a rope, or it is a rope that has been flattened.
+      bool isFlat() const {
+        return !isRope_ || !getTrailingObjects<StringObject*>()[1];
+      }
 
+      /// \returns the operands of this rope. Once the rope has been 
+      /// flattened, the first one is the flat string and the second one is
+      /// null. This is empty if the string isn't a rope.
+      MutableArrayRef<StringObject*> getRopeOperands() {
+        return {getTrailingObjects<StringObject*>(), 
+                numTrailingObjects(OverloadToken<StringObject*>())};
+      }
+
+      /// Replaces the operands of this rope, which must not have been
+      /// flattened yet, with \p flat, a flat string with the same content.
+      void setFlattened(StringObject* flat);
+
+      /// \returns the \p n-th codepoint of the string. 
+      /// \p n must be smaller than length(), and the string must be flat.
       FoxChar getChar(std::size_t n) const;
 
+      /// \returns the number of bytes used by this object, including the
+      /// string's bytes and its index.
+      std::size_t getAllocatedSize() const {
+        return isRope_ ? ropeSize() : totalSize(numBytes_, length_);
+      }
+
       static bool classof(const Object* obj) {
         return obj->getKind() == ObjectKind::StringObject;
       }
 
+      // Prohibit the use of the vanilla new/delete
+      void *operator new(std::size_t) noexcept = delete;
+      void operator delete(void *) noexcept = delete;
+
     private:
-      const std::string str_;
+      StringObject(std::size_t numBytes, std::size_t length, bool isRope);
+
+      // Also, allow allocation with a placement new
+      // (needed for class using trailing objects)
+      void* operator new(std::size_t , void* mem);
+
+      StringObject(const StringObject&) = delete;
+      StringObject& operator=(const StringObject&) = delete;
+
+      /// \returns the number of entries in the index of a string of
+      /// \p numBytes bytes and \p length codepoints.
+      static std::size_t getIndexSize(std::size_t numBytes, 
+                                      std::size_t length) {
+        // ASCII strings don't need an index, and the first entry would be 
+        // the offset of the indexStride-th codepoint.
+        return (numBytes == length) ? 0 : ((length - 1) / indexStride);
+      }
+
+      std::size_t numTrailingObjects(OverloadToken<StringObject*>) const {
+        return isRope_ ? 2 : 0;
+      }
+
+      std::size_t numTrailingObjects(OverloadToken<std::uint32_t>) const {
+        return isRope_ ? 0 : getIndexSize(numBytes_, length_);
+      }
+
+      /// \returns the flat string that replaced the operands of this rope.
+      const StringObject* getFlattened() const {
+        assert(isFlat() && "rope hasn't been flattened");
+        return getTrailingObjects<StringObject*>()[0];
+      }
+
+      /// Fills the index of the string.
+      void buildIndex();
+
+      const std::uint32_t numBytes_;
+      const std::uint32_t length_;
+      const bool isRope_;
   };
 
-  /// ArrayObject is a dynamic, untyped array.
-  /// It is intended to store homogenous data -> it doesn't provide support
-  /// for storing both value/reference types at the same time. 
-  /// (It has a single "containsReference" tag, and not a full "reference map")
+  /// ArrayObject is a dynamic array.
+  /// Its elements are stored unboxed: every element uses the number of 
+  /// bytes needed by its kind (see ArrayElemKind), so a [bool] uses 1 byte
+  /// per element and a [int] 8 bytes. The elements are read and written as 
+  /// FoxAnys, so the builtins don't depend on the kind of the array.
   class ArrayObject : public Object {
     public:
       using ElemT = FoxAny;
-      using ArrayT = std::vector<ElemT>;
 
       /// Creates an empty array
-      /// \param containsReferences true if this array will contain 
-      ///                           reference types, false otherwise.
+      /// \param elemKind the kind of the elements of this array.
       /// \param minCapacity the minimum capacity that the array should have
       ///                     (enough space will be reserved to store 
       ///                      \p minCapacity elems)
-      ArrayObject(bool containsReferences, std::size_t minCapacity = 0);
+      ArrayObject(ArrayElemKind elemKind, std::size_t minCapacity = 0);
+
+      /// Moves the elements of \p other into a new array. \p other is left 
+      /// empty.
+      ArrayObject(ArrayObject&& other);
 
-      void append(ElemT elem);
+      ~ArrayObject();
 
-      ElemT& operator[](std::size_t idx);
-      const ElemT& operator[](std::size_t idx) const;
+      /// Creates an ArrayObject in \p mem, which must be at least 
+      /// sizeof(ArrayObject) bytes large. 
+      /// See the constructor for the meaning of the other parameters.
+      static ArrayObject* create(void* mem, ArrayElemKind elemKind, 
+                                 std::size_t minCapacity = 0);
+
+      /// Creates a copy of \p other in \p mem, which must be at least 
+      /// sizeof(ArrayObject) bytes large. The elements are copied at once.
+      static ArrayObject* create(void* mem, const ArrayObject* other);
+
+      void append(ElemT elem) {
+        if(LLVM_UNLIKELY(size_ == capacity_))
+          grow(size_ + 1);
+        store(size_++, elem);
+      }
+
+      /// \returns the element at index \p idx
+      ElemT operator[](std::size_t idx) const {
+        assert((idx < size_) && "out of range");
+        return load(idx);
+      }
+
+      /// Replaces the element at index \p idx with \p elem
+      void set(std::size_t idx, ElemT elem) {
+        assert((idx < size_) && "out of range");
+        store(idx, elem);
+      }
+
+      /// Grows the array so it can contain at least \p minCapacity elements
+      /// without growing again.
+      void reserve(std::size_t minCapacity) {
+        if(minCapacity > capacity_)
+          grow(minCapacity);
+      }
 
       /// Removes the last element from the array
       void pop();
 
       /// \returns the first element of the array
-      ElemT front();
+      ElemT front() const;
       /// \returns the last element of the array
-      ElemT back();
+      ElemT back() const;
 
       /// \returns the size of the array
-      std::size_t size() const;
+      std::size_t size() const {
+        return size_;
+      }
+
+      /// \returns the number of elements that the array can contain 
+      /// without growing.
+      std::size_t capacity() const {
+        return capacity_;
+      }
 
       /// removes every element inside the array
       void reset();
 
-      /// void pop_back();
-      /// void erase(std::size_t start, std::size_t num);
-      /// Element get(std::size_t elem);
+      /// \returns the kind of the elements of this array.
+      ArrayElemKind getElemKind() const {
+        return elemKind_;
+      }
 
       /// \returns true if this array contains references types.
-      bool containsReferences() const;
+      bool containsReferences() const {
+        return elemKind_ == ArrayElemKind::Ref;
+      }
+
+      /// \returns the elements of this array, which must contain elements
+      /// of type \p Ty (e.g. FoxInt for an array of ArrayElemKind::Int, 
+      /// Object* for an array of references).
+      template<typename Ty>
+      MutableArrayRef<Ty> getElements() {
+        assert((sizeof(Ty) == getElemSize(elemKind_)) 
+          && "incorrect element type");
+        return {reinterpret_cast<Ty*>(data_), size_};
+      }
 
-      /// \returns a reference to the internal array of the ArrayObject
-      ArrayT& data();
-      /// \returns a const reference to the internal array of the ArrayObject
-      const ArrayT& data() const;
+      /// \returns the number of bytes used by this object, including the
+      /// array's buffer.
+      std::size_t getAllocatedSize() const;
 
       static bool classof(const Object* obj) {
         return obj->getKind() == ObjectKind::ArrayObject;
       }
 
     private:
-      const bool containsReferences_ : 1;
-      ArrayT data_;
+      ArrayObject(const ArrayObject&) = delete;
+      ArrayObject& operator=(const ArrayObject&) = delete;
+
+      /// \returns the element at index \p idx, which can be past the end
+      /// of the array (but not past its capacity).
+      ElemT load(std::size_t idx) const {
+        switch (elemKind_) {
+          case ArrayElemKind::Int:
+            return ElemT(reinterpret_cast<const FoxInt*>(data_)[idx]);
+          case ArrayElemKind::Double:
+            return ElemT(reinterpret_cast<const FoxDouble*>(data_)[idx]);
+          case ArrayElemKind::Bool:
+            // Registers contain booleans as 64 bits 0 or 1.
+            return ElemT(std::uint64_t(data_[idx]));
+          case ArrayElemKind::Char:
+            return ElemT(std::uint64_t(
+              reinterpret_cast<const FoxChar*>(data_)[idx]));
+          case ArrayElemKind::Ref:
+            return ElemT(reinterpret_cast<Object* const*>(data_)[idx]);
+        }
+        LLVM_BUILTIN_UNREACHABLE;
+      }
+
+      /// Stores \p elem at index \p idx, which can be past the end of the 
+      /// array (but not past its capacity).
+      void store(std::size_t idx, ElemT elem) {
+        switch (elemKind_) {
+          case ArrayElemKind::Int:
+            reinterpret_cast<FoxInt*>(data_)[idx] = elem.intVal;
+            return;
+          case ArrayElemKind::Double:
+            reinterpret_cast<FoxDouble*>(data_)[idx] = elem.doubleVal;
+            return;
+          case ArrayElemKind::Bool:
+            data_[idx] = std::uint8_t(elem.boolVal);
+            return;
+          case ArrayElemKind::Char:
+            reinterpret_cast<FoxChar*>(data_)[idx] = elem.charVal;
+            return;
+          case ArrayElemKind::Ref:
+            reinterpret_cast<Object**>(data_)[idx] = elem.objectVal;
+            return;
+        }
+        LLVM_BUILTIN_UNREACHABLE;
+      }
+
+      /// Grows the buffer so it can contain at least \p minCapacity
+      /// elements.
+      void grow(std::size_t minCapacity);
+
+      const ArrayElemKind elemKind_;
+      /// The elements, whose layout depends on elemKind_.
+      std::uint8_t* data_ = nullptr;
+      std::size_t size_ = 0;
+      std::size_t capacity_ = 0;
   };
 }
\ No newline at end of file
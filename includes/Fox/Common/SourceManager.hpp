@@ -97,7 +97,7 @@ namespace fox {
         Ok,
         /// The file couldn't be found.
         NotFound,
-        /// The file had an invalid encoding. 
+        /// The file had an invalid encoding, or wasn't valid UTF8.
         /// (Currently, only ASCII and UTF8 are supported.)
         InvalidEncoding
       };
@@ -109,7 +109,7 @@ namespace fox {
       std::pair<FileID, ReadFileResult> readFile(string_view path);
 
       /// Loads (copies) a string in the SourceManager
-      /// \param str the string to load
+      /// \param str the string to load, which must be valid UTF8
       /// \param name the name the string should have
       /// \returns the FileID assigned to the string.
       FileID loadFromString(string_view str,
@@ -174,9 +174,8 @@ namespace fox {
         Data(string_view name, string_view content)
           : name(name.to_string()), content(content.to_string()) {}
 
-        template<typename Iterator>
-        Data(string_view name, Iterator begin, Iterator end)
-          : name(name.to_string()), content(begin, end) {}
+        Data(string_view name, std::string&& content)
+          : name(name.to_string()), content(std::move(content)) {}
 
         const std::string name;
         const std::string content;
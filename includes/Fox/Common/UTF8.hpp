@@ -6,11 +6,18 @@
 //----------------------------------------------------------------------------//
 // This file contains some general utility functions related to UTF-8 
 // codepoints (FoxChar) handling and UTF-8 string handling.
+//
+// isValidUTF8, countCodepoints and getCodepointOffset process the string
+// in blocks of 16 or 32 bytes with SSE2 or AVX2 when the CPU supports them
+// (this is checked once, at runtime), and fall back to a simple loop
+// otherwise.
 //----------------------------------------------------------------------------//
 
 #pragma once
 
 #include "Fox/Common/FoxTypes.hpp"
+#include "Fox/Common/string_view.hpp"
+#include <cstddef>
 #include <string>
 
 namespace fox {
@@ -19,5 +26,28 @@ namespace fox {
   /// \param ch the char to convert
   /// \param dest the destination string
   void appendFoxChar(FoxChar ch, std::string& dest);
-}
 
+  /// \returns true if \p str is valid UTF-8: it doesn't contain overlong
+  /// encodings, surrogates, codepoints above U+10FFFF or truncated
+  /// sequences.
+  bool isValidUTF8(string_view str);
+
+  /// \returns the number of codepoints in \p str, which must be valid
+  /// UTF-8.
+  std::size_t countCodepoints(string_view str);
+
+  /// \returns the offset, in bytes, of the \p n-th codepoint (starting
+  /// from 0) of \p str, which must be valid UTF-8, or str.size() if \p str
+  /// doesn't have more than \p n codepoints.
+  std::size_t getCodepointOffset(string_view str, std::size_t n);
+
+  /// \returns the size in bytes of the UTF-8 sequence that begins with
+  /// \p leadByte. \p leadByte must be the first byte of a valid sequence.
+  inline std::size_t getCodepointSize(char leadByte) {
+    unsigned char byte = static_cast<unsigned char>(leadByte);
+    if(byte < 0x80) return 1;
+    if(byte < 0xE0) return 2;
+    if(byte < 0xF0) return 3;
+    return 4;
+  }
+}
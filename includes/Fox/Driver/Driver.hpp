@@ -9,9 +9,11 @@
 
 #pragma once
 
+#include "Fox/BC/BCPassManager.hpp"
 #include "Fox/Common/DiagnosticEngine.hpp"
 #include "Fox/Common/SourceManager.hpp"
 #include "Fox/Common/string_view.hpp"
+#include <cstddef>
 #include <iosfwd>
 
 namespace fox {
@@ -54,6 +56,23 @@ namespace fox {
         bool dumpTokens     = false;
         /// Whether the input should be run using the VM.
         bool run            = false;
+        /// The optimization level of the bytecode.
+        OptLevel optLevel   = OptLevel::O1;
+        /// Whether the VM should profile the executed instructions and
+        /// print the most frequent pairs of opcodes after running the
+        /// program (needs run = true).
+        bool dumpOpcodePairs = false;
+        /// Whether the VM's JIT should be disabled.
+        bool noJIT          = false;
+        /// Whether the VM should collect garbage on every allocation.
+        bool gcStress       = false;
+        /// Whether the VM should allocate every old object with malloc.
+        bool gcDebugAlloc   = false;
+        /// The VM's GC threshold, in bytes (0 to use the default one).
+        std::size_t gcThreshold = 0;
+        /// The size of the VM's young generation, in bytes (0 to use the
+        /// default one).
+        std::size_t gcNurserySize = 0;
         /// Whether we run in verbose mode or not. 
         /// In verbose mode, the driver will emit more messages. 
         /// NOTE: This mode is still a work in progress. Currently, we
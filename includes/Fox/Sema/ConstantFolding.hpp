@@ -0,0 +1,26 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : ConstantFolding.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file declares the constant folding stage, which runs on units that
+//  have been checked by Sema without errors.
+//
+//  It replaces the expressions whose operands are literals with literals
+//  containing their result, computed exactly as the VM would compute it,
+//  and propagates the literal initializers of 'let' variables to the
+//  places where they're used. Operations that would fail at runtime (such
+//  as a division by zero) aren't folded so the VM still diagnoses them.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+namespace fox {
+  class ASTContext;
+  class UnitDecl;
+
+  /// Folds the constant expressions of \p unit. \p unit must have been
+  /// checked by Sema without errors.
+  void foldConstants(ASTContext& ctxt, UnitDecl* unit);
+}
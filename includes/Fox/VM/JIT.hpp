@@ -0,0 +1,86 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : JIT.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the JITFunction class, the native code generated by
+//  the VM's baseline JIT compiler for hot BCFunctions.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/VM/VM.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace fox {
+  class BCFunction;
+  class BCModule;
+
+  /// The native code of a BCFunction, generated by the baseline JIT.
+  ///
+  /// The JIT is a template JIT: every instruction is translated to a fixed
+  /// sequence of machine code, without any analysis or register allocation.
+  /// Registers stay in the VM's register stack, so the interpreter and the
+  /// native code can take turns executing the same function.
+  ///
+  /// Native code can be entered at any instruction, and it returns to the
+  /// interpreter when it reaches an instruction it doesn't support (calls,
+  /// returns, allocations, ...) or when an instruction would cause a runtime
+  /// error (e.g. a division by zero). The interpreter then executes that
+  /// instruction and takes care of the diagnostic, if any.
+  ///
+  /// The native code doesn't depend on a VM instance: it only uses the
+  /// register window and the global variables it is given.
+  ///
+  /// Note: The JIT is only supported on Linux x86-64. On other platforms,
+  /// compile() always returns nullptr.
+  class JITFunction {
+    public:
+      ~JITFunction();
+
+      JITFunction(const JITFunction&) = delete;
+      JITFunction& operator=(const JITFunction&) = delete;
+
+      /// \returns true if the JIT is supported on this platform
+      static bool isSupported();
+
+      /// Compiles \p fn, which belongs to \p bcModule, to native code.
+      /// \returns the compiled function, or nullptr if the JIT isn't
+      /// supported or if the executable memory couldn't be allocated.
+      static std::unique_ptr<JITFunction>
+      compile(const BCModule& bcModule, const BCFunction& fn);
+
+      /// Runs the native code starting at the instruction at index \p idx.
+      /// \param base the base register of the function's register window
+      /// \param globals the global variables
+      /// \returns the index of the instruction where the interpreter must
+      /// resume the execution of the function.
+      std::uint32_t run(VM::Register* base, VM::Register* globals,
+                        std::uint32_t idx) const {
+        return entry_(base, globals, idx);
+      }
+
+      /// \returns the size of the native code, in bytes.
+      std::size_t getCodeSize() const {
+        return codeSize_;
+      }
+
+    private:
+      using EntryFn = std::uint32_t(*)(VM::Register*, VM::Register*,
+                                       std::uint32_t);
+
+      JITFunction(void* mem, std::size_t memSize, std::size_t codeSize);
+
+      /// The executable memory
+      void* mem_ = nullptr;
+      /// The size of the executable memory
+      std::size_t memSize_ = 0;
+      /// The size of the native code in that memory
+      std::size_t codeSize_ = 0;
+      /// The entry point of the native code
+      EntryFn entry_ = nullptr;
+  };
+}
@@ -0,0 +1,151 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : Nursery.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+// This file contains the Nursery, the young generation of the VM's heap.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/Common/LLVM.hpp"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Compiler.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace fox {
+  class Object;
+
+  /// The Nursery is the young generation of the VM's heap: the area in
+  /// which new objects are allocated.
+  ///
+  /// Like CustomLinearAllocator, it is a "pointer-bump" allocator that
+  /// allocates in pools, called blocks here. Unlike CustomLinearAllocator,
+  /// it remembers the objects allocated in each block (so the garbage
+  /// collector can find them) and it reuses its blocks once they've been
+  /// emptied by the garbage collector, instead of freeing them.
+  ///
+  /// Note: The Nursery never calls the destructors of its objects, this is
+  /// done by the garbage collector.
+  class Nursery {
+    public:
+      /// The size of a block, in bytes.
+      static constexpr std::size_t blockSize = 32*1024;
+
+      /// The size of the largest object that can be allocated in the
+      /// nursery, in bytes.
+      static constexpr std::size_t maxObjectSize = blockSize/8;
+
+      /// A block of memory in which objects are allocated.
+      class Block {
+        public:
+          Block();
+          ~Block();
+
+          Block(const Block&) = delete;
+          Block& operator=(const Block&) = delete;
+
+          /// \returns true if \p ptr points inside this block
+          bool contains(const void* ptr) const {
+            auto* bytes = static_cast<const unsigned char*>(ptr);
+            return (bytes >= begin_) && (bytes < (begin_ + blockSize));
+          }
+
+          /// \returns the address of the first byte of the block
+          unsigned char* begin() const {
+            return begin_;
+          }
+
+          /// Forgets every object of the block, so its memory can be reused.
+          void reset() {
+            objects.clear();
+            pinned = false;
+          }
+
+          /// The objects allocated in this block, sorted by address
+          /// (= in allocation order).
+          std::vector<Object*> objects;
+
+          /// Whether the block contains an object that is referenced by a
+          /// root, and can thus not be emptied by a minor collection
+          /// (see VM::collectYoungGeneration).
+          bool pinned = false;
+
+        private:
+          unsigned char* const begin_;
+      };
+
+      Nursery() = default;
+
+      /// Make this class non copyable
+      Nursery(const Nursery&) = delete;
+      Nursery& operator=(const Nursery&) = delete;
+
+      /// Allocates \p size bytes for an object, with \p align alignment.
+      /// This never returns nullptr: a new block is used when the current
+      /// one is full.
+      /// \p size must not be larger than maxObjectSize.
+      LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
+      void* allocate(std::size_t size, std::size_t align) {
+        assert((size > 0) && "allocating an object of size 0");
+        assert(((align & (align - 1)) == 0)
+          && "Alignement must be a power of 2");
+        std::uintptr_t ptr = (std::uintptr_t(allocPtr_) + (align - 1))
+                           & ~std::uintptr_t(align - 1);
+        if (LLVM_UNLIKELY(!allocPtr_ 
+                          || ((ptr + size) > std::uintptr_t(endPtr_))))
+          return allocateInNewBlock(size, align);
+        allocPtr_ = reinterpret_cast<unsigned char*>(ptr + size);
+        void* mem = reinterpret_cast<void*>(ptr);
+        curBlock_->objects.push_back(static_cast<Object*>(mem));
+        return mem;
+      }
+
+      /// \returns the object of this nursery whose address is \p addr, or
+      /// nullptr if there is no such object.
+      Object* lookup(std::uintptr_t addr) const;
+
+      /// \returns the block that contains \p ptr, or nullptr if \p ptr
+      /// isn't in this nursery.
+      Block* getBlock(const void* ptr) const;
+
+      /// \returns the blocks in use, sorted by address.
+      ArrayRef<std::unique_ptr<Block>> getBlocks() const {
+        return blocks_;
+      }
+
+      /// \returns the number of objects allocated in this nursery
+      std::size_t getNumObjects() const;
+
+      /// Empties the nursery. The pinned blocks are removed from the 
+      /// nursery and returned. The other blocks are reset and reused by
+      /// future allocations.
+      SmallVector<std::unique_ptr<Block>, 4> clear();
+
+      /// Resets \p block and reuses it for future allocations. This is used
+      /// to give back blocks returned by clear() once they're empty.
+      void recycle(std::unique_ptr<Block> block);
+
+    private:
+      /// Slow path of allocate: makes a new block the current one and
+      /// allocates in it.
+      void* allocateInNewBlock(std::size_t size, std::size_t align);
+
+      /// The blocks in use, sorted by address.
+      SmallVector<std::unique_ptr<Block>, 8> blocks_;
+      /// The empty blocks, which can be used when the current block is full.
+      SmallVector<std::unique_ptr<Block>, 8> freeBlocks_;
+      /// The block in which objects are currently allocated.
+      Block* curBlock_ = nullptr;
+      /// The current allocation pointer.
+      unsigned char* allocPtr_ = nullptr;
+      /// The pointer to the end of the current block.
+      unsigned char* endPtr_ = nullptr;
+  };
+}
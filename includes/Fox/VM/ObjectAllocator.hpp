@@ -0,0 +1,162 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : ObjectAllocator.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+// This file contains the ObjectAllocator, which allocates the objects of
+// the old generation of the VM's heap.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/Common/LLVM.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Compiler.h"
+#include <cassert>
+#include <cstddef>
+
+namespace fox {
+  /// The ObjectAllocator allocates the objects of the old generation of the
+  /// VM's heap: the young objects moved out of the nursery by minor
+  /// collections, and the objects that are too large for the nursery.
+  ///
+  /// Small objects are allocated in cells of a few size classes (multiples
+  /// of cellAlign bytes). The free cells of each size class are kept in a
+  /// free list, and new cells are carved out of large chunks of memory
+  /// (the arena) by bumping a pointer. The chunks are only freed by the
+  /// destructor. Large objects are allocated with malloc.
+  ///
+  /// In debug mode (see setDebugMode), every object is allocated with
+  /// malloc and freed with free, so memory tools can find the uses of freed
+  /// objects.
+  ///
+  /// Note: Like the Nursery, the ObjectAllocator never calls the
+  /// destructors of its objects.
+  class ObjectAllocator {
+    public:
+      /// The alignment of the cells, and the difference between the sizes
+      /// of 2 consecutive size classes, in bytes.
+      static constexpr std::size_t cellAlign = 16;
+
+      /// The size of the largest object allocated in a cell, in bytes.
+      static constexpr std::size_t maxCellSize = 4096;
+
+      /// The size of the chunks of the arena, in bytes.
+      static constexpr std::size_t chunkSize = 256*1024;
+
+      ObjectAllocator() = default;
+      ~ObjectAllocator();
+
+      /// Make this class non copyable
+      ObjectAllocator(const ObjectAllocator&) = delete;
+      ObjectAllocator& operator=(const ObjectAllocator&) = delete;
+
+      /// Allocates \p size bytes for an object. The memory is aligned to
+      /// cellAlign bytes. This never returns nullptr.
+      LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
+      void* allocate(std::size_t size) {
+        assert((size > 0) && "allocating an object of size 0");
+        if(LLVM_UNLIKELY(debugMode_ || (size > maxCellSize)))
+          return allocateWithMalloc(size);
+        std::size_t sizeClass = getSizeClass(size);
+        ++numObjects_;
+        numBytes_ += getCellSize(sizeClass);
+        if (FreeCell* cell = freeLists_[sizeClass]) {
+          freeLists_[sizeClass] = cell->next;
+          return cell;
+        }
+        return allocateInArena(sizeClass);
+      }
+
+      /// Frees \p mem, which has been allocated by allocate(\p size).
+      void deallocate(void* mem, std::size_t size) {
+        assert(mem && "deallocating a null pointer");
+        if (LLVM_UNLIKELY(debugMode_ || (size > maxCellSize))) {
+          deallocateWithFree(mem, size);
+          return;
+        }
+        std::size_t sizeClass = getSizeClass(size);
+        --numObjects_;
+        numBytes_ -= getCellSize(sizeClass);
+        FreeCell* cell = static_cast<FreeCell*>(mem);
+        cell->next = freeLists_[sizeClass];
+        freeLists_[sizeClass] = cell;
+      }
+
+      /// \returns the number of objects allocated by this allocator that
+      /// haven't been freed.
+      std::size_t getNumObjects() const {
+        return numObjects_;
+      }
+
+      /// \returns the number of bytes used by the objects allocated by
+      /// this allocator that haven't been freed (the size of their cells
+      /// for small objects).
+      std::size_t getNumBytes() const {
+        return numBytes_;
+      }
+
+      /// \returns the size of the arena, in bytes. This is the memory that
+      /// has been reserved for the cells, used or not.
+      std::size_t getArenaSize() const {
+        return chunks_.size()*chunkSize;
+      }
+
+      /// \returns true if the debug mode is enabled.
+      bool isDebugModeEnabled() const {
+        return debugMode_;
+      }
+
+      /// Enables or disables the debug mode, in which every object is
+      /// allocated with malloc. This can only be done when no object is
+      /// allocated.
+      void setDebugMode(bool enabled) {
+        assert(!numObjects_ && "objects have already been allocated");
+        debugMode_ = enabled;
+      }
+
+    private:
+      /// A free cell, which contains the next free cell of its size class.
+      struct FreeCell {
+        FreeCell* next;
+      };
+
+      static constexpr std::size_t numSizeClasses = maxCellSize/cellAlign;
+
+      /// \returns the size class of the cells of objects of \p size bytes.
+      static std::size_t getSizeClass(std::size_t size) {
+        return (size - 1)/cellAlign;
+      }
+
+      /// \returns the size of the cells of \p sizeClass, in bytes.
+      static std::size_t getCellSize(std::size_t sizeClass) {
+        return (sizeClass + 1)*cellAlign;
+      }
+
+      /// Slow path of allocate: carves a cell of \p sizeClass out of the
+      /// arena, allocating a new chunk if needed.
+      void* allocateInArena(std::size_t sizeClass);
+
+      /// Allocates a large object, or any object in debug mode.
+      void* allocateWithMalloc(std::size_t size);
+
+      /// Frees an object allocated by allocateWithMalloc.
+      void deallocateWithFree(void* mem, std::size_t size);
+
+      /// The free cells of each size class
+      FreeCell* freeLists_[numSizeClasses] = {};
+      /// The chunks of the arena
+      SmallVector<void*, 4> chunks_;
+      /// The current allocation pointer in the last chunk
+      unsigned char* allocPtr_ = nullptr;
+      /// The pointer to the end of the last chunk
+      unsigned char* endPtr_ = nullptr;
+      /// The number of allocated objects
+      std::size_t numObjects_ = 0;
+      /// The number of bytes used by the allocated objects
+      std::size_t numBytes_ = 0;
+      /// Whether every object is allocated with malloc
+      bool debugMode_ = false;
+  };
+}
@@ -0,0 +1,79 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : OpcodePairProfile.hpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file contains the OpcodePairProfile class, which is used by the VM
+//  to count how many times each pair of adjacent instructions is executed.
+//----------------------------------------------------------------------------//
+
+#pragma once
+
+#include "Fox/BC/Instruction.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+namespace fox {
+  /// A dynamic profile of the instructions executed by the VM.
+  ///
+  /// It counts how many times each opcode is executed, and how many times
+  /// each pair of opcodes is executed in sequence, where the second
+  /// instruction of the pair directly follows the first in the instruction
+  /// buffer (i.e. it's not the target of a jump).
+  ///
+  /// Those pairs are the candidates for superinstructions. Note that with
+  /// threaded dispatch, the second instruction of a superinstruction isn't
+  /// dispatched, so it's not recorded.
+  class OpcodePairProfile {
+    public:
+      OpcodePairProfile();
+
+      /// The number of opcodes
+      static constexpr std::size_t numOpcodes =
+        std::size_t(Opcode::last_opcode)+1;
+
+      /// Records the execution of an instruction with opcode \p op
+      void recordInstr(Opcode op) {
+        ++opcodeCounts_[std::size_t(op)];
+      }
+
+      /// Records the execution of an instruction with opcode \p second
+      /// directly after an instruction with opcode \p first.
+      void recordPair(Opcode first, Opcode second) {
+        ++pairCounts_[getPairIndex(first, second)];
+      }
+
+      /// \returns the number of times an instruction with opcode \p op
+      /// was executed.
+      std::uint64_t getCount(Opcode op) const {
+        return opcodeCounts_[std::size_t(op)];
+      }
+
+      /// \returns the number of times an instruction with opcode \p second
+      /// was executed directly after an instruction with opcode \p first.
+      std::uint64_t getCount(Opcode first, Opcode second) const {
+        return pairCounts_[getPairIndex(first, second)];
+      }
+
+      /// \returns the total number of instructions executed
+      std::uint64_t getTotalCount() const;
+
+      /// Resets every counter to zero.
+      void reset();
+
+      /// Prints the profile to \p out: the total number of instructions
+      /// dispatched, followed by the \p maxPairs most frequent pairs.
+      void dump(std::ostream& out, std::size_t maxPairs = 20) const;
+
+    private:
+      static std::size_t getPairIndex(Opcode first, Opcode second) {
+        return (std::size_t(first)*numOpcodes) + std::size_t(second);
+      }
+
+      std::vector<std::uint64_t> opcodeCounts_;
+      std::vector<std::uint64_t> pairCounts_;
+  };
+}
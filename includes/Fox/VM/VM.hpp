@@ -15,7 +15,10 @@
 #include "Fox/Common/BuiltinKinds.hpp"
 #include "Fox/Common/FoxTypes.hpp"
 #include "Fox/Common/LLVM.hpp"
+#include "Fox/Common/Objects.hpp"
 #include "Fox/Common/string_view.hpp"
+#include "Fox/VM/Nursery.hpp"
+#include "Fox/VM/ObjectAllocator.hpp"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/PointerEmbeddedInt.h"
 #include "llvm/ADT/PointerUnion.h"
@@ -24,7 +27,7 @@
 #include <memory>
 #include <cstdint>
 #include <cstddef>
-#include <array>
+#include <vector>
 
 namespace fox {
   struct Instruction;
@@ -32,9 +35,10 @@ namespace fox {
   class Diagnostic;
   class DiagnosticEngine;
   enum class DiagID : std::uint16_t;
-  class Object;
-  class StringObject;
-  class ArrayObject;
+  class PreparedCode;
+  class OpcodePairProfile;
+  class JITFunction;
+  struct PreparedInstruction;
 
   class VM {
     public:
@@ -122,11 +126,33 @@ namespace fox {
       /// VM Interface
       ///--------------------------------------------------------------------///
 
+      /// The options of the garbage collector. They are given to the
+      /// constructor because they must be set before the initializers of
+      /// the global variables allocate objects.
+      struct GCOptions {
+        /// The GC threshold, in bytes (see setGCThreshold).
+        std::size_t threshold = defaultGCThreshold;
+        /// The size of the young generation, in bytes (see
+        /// setNurserySize).
+        std::size_t nurserySize = defaultNurserySize;
+        /// Whether every allocation triggers a collection (see 
+        /// setGCStress).
+        bool stress = false;
+        /// Whether every old object is allocated with malloc (see
+        /// setDebugAllocation).
+        bool debugAllocation = false;
+      };
+
       /// \param bcModule the bytecode module. This will serve as the context
       ///        of execution. Constants, Functions and everything else that
       ///        might be needed during the execution of bytecode will be
       ///        fetched in that module.
       VM(BCModule& bcModule);
+
+      /// \param bcModule the bytecode module (see above)
+      /// \param gcOptions the options of the garbage collector, which are
+      ///        applied before the global variables are initialized.
+      VM(BCModule& bcModule, const GCOptions& gcOptions);
       ~VM();
 
       /// Make this class non copyable
@@ -143,6 +169,8 @@ namespace fox {
       Register run(BCFunction& func);
 
       /// Executes a bytecode buffer \p instrs.
+      /// Note: \p instrs is prepared (see PreparedCode) every time
+      /// this is called.
       /// \return the return value of the executed instruction buffer.
       Register run(ArrayRef<Instruction> instrs);
 
@@ -172,6 +200,54 @@ namespace fox {
       /// longer execute code due to a runtime error)
       bool isAlive() const;
 
+      /// The default maximum call depth.
+      static constexpr std::size_t defaultMaxCallDepth = 1 << 16;
+
+      /// The default maximum size of the register stack, in registers.
+      static constexpr std::size_t defaultMaxRegisterStackSize = 1 << 20;
+
+      /// The register stack grows by multiples of this number of registers.
+      static constexpr std::size_t registerStackChunkSize = 4096;
+
+      /// \returns the maximum call depth. Calls that exceed that depth
+      /// are diagnosed as a stack overflow.
+      std::size_t getMaxCallDepth() const;
+
+      /// Sets the maximum call depth to \p depth.
+      void setMaxCallDepth(std::size_t depth);
+
+      /// \returns the maximum size of the register stack, in registers.
+      /// Calls that need a bigger stack are diagnosed as a stack overflow.
+      std::size_t getMaxRegisterStackSize() const;
+
+      /// Sets the maximum size of the register stack to \p size registers.
+      /// \p size must be large enough to contain a full register window.
+      void setMaxRegisterStackSize(std::size_t size);
+
+      /// Sets the profile in which the instructions executed by this VM
+      /// are recorded. Profiling is disabled when \p profile is null (the
+      /// default).
+      void setOpcodePairProfile(OpcodePairProfile* profile);
+
+      /// \returns the profile in which the instructions executed by this VM
+      /// are recorded, or nullptr if profiling is disabled.
+      OpcodePairProfile* getOpcodePairProfile() const;
+
+      /// The default JIT threshold.
+      static constexpr std::uint32_t defaultJITThreshold = 1000;
+
+      /// \returns the JIT threshold: the number of calls or loop iterations
+      /// after which a BCFunction is compiled to native code (see 
+      /// JITFunction). This is zero when the JIT is disabled.
+      std::uint32_t getJITThreshold() const;
+
+      /// Sets the JIT threshold to \p threshold. The JIT is disabled when
+      /// \p threshold is zero, or when the JIT isn't supported on this 
+      /// platform (see JITFunction::isSupported).
+      /// Note: the JIT is never used while profiling (see 
+      /// setOpcodePairProfile).
+      void setJITThreshold(std::uint32_t threshold);
+
       ///--------------------------------------------------------------------///
       /// Object Allocation
       ///--------------------------------------------------------------------///
@@ -180,21 +256,169 @@ namespace fox {
       LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
       StringObject* newStringObject(string_view str = string_view());
 
-      /// Loads a string constant with id \p kID and creates a 
-      /// new StringObject with its content.
+      /// Creates a new StringObject containing the concatenation of \p lhs
+      /// and \p rhs. Long concatenations create ropes, which reference 
+      /// \p lhs and \p rhs instead of copying them.
       LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
-      StringObject* newStringObjectFromK(constant_id_t kID);
+      StringObject* newStringObject(StringObject* lhs, StringObject* rhs);
+
+      /// Flattens \p str if it is a rope that hasn't been flattened yet, 
+      /// so its bytes and characters can be accessed. 
+      /// This allocates, so it can trigger a collection.
+      void flatten(StringObject* str) {
+        if(LLVM_UNLIKELY(!str->isFlat()))
+          flattenRope(str);
+      }
 
-      /// Creates a new ArrayObject intended to store value types,
-      /// with \p reservedElems reserved elements.
+      /// \returns the StringObject of the string constant with id \p kID.
+      /// It is created the first time the constant is loaded, and then
+      /// shared by every load of the constant (StringObjects are immutable).
+      LLVM_ATTRIBUTE_RETURNS_NONNULL
+      StringObject* getStringConstant(constant_id_t kID) {
+        if (LLVM_LIKELY((kID < stringConstants_.size()) 
+                        && stringConstants_[kID]))
+          return stringConstants_[kID];
+        return createStringConstant(kID);
+      }
+
+      /// Creates a new ArrayObject which contains a copy of the elements of
+      /// the array constant with id \p kID.
       LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
-      ArrayObject* newValueArrayObject(std::size_t reservedElems = 0);
+      ArrayObject* newArrayObjectFromConstant(constant_id_t kID);
+
+      /// Creates a new ArrayObject intended to store value types of kind
+      /// \p elemKind, with \p reservedElems reserved elements.
+      LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
+      ArrayObject* newValueArrayObject(ArrayElemKind elemKind,
+                                       std::size_t reservedElems = 0);
 
       /// Creates a new ArrayObject intended to store reference types,
       /// with \p reservedElems reserved elements.
       LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
       ArrayObject* newRefArrayObject(std::size_t reservedElems = 0);
 
+      ///--------------------------------------------------------------------///
+      /// Garbage Collection
+      ///--------------------------------------------------------------------///
+
+      /// The default GC threshold, in bytes.
+      static constexpr std::size_t defaultGCThreshold = 1 << 20;
+
+      /// The default size of the young generation, in bytes.
+      static constexpr std::size_t defaultNurserySize = 256 << 10;
+
+      /// Collects every object that isn't reachable from the roots: the 
+      /// register stack (which contains the arguments of the builtin being
+      /// called, if any) and the global variables.
+      /// This begins with a minor collection (see collectYoungGeneration),
+      /// so the young generation is empty afterwards.
+      /// Note: this is done automatically by the allocation functions 
+      /// (see setGCThreshold and setGCStress).
+      void collectGarbage();
+
+      /// Collects the young objects (the objects allocated since the last
+      /// collection) that aren't reachable from the roots or from the old
+      /// objects of the remembered set (see writeBarrier). The young
+      /// objects that survive become old.
+      /// Surviving objects that are only referenced by other objects are
+      /// moved out of the nursery. The objects referenced by the roots
+      /// can't be moved, so their block of the nursery is promoted to the
+      /// old generation with them.
+      /// Note: this is done automatically by the allocation functions 
+      /// (see setNurserySize).
+      void collectYoungGeneration();
+
+      /// \returns the size of the heap, in bytes. This is the size of the
+      /// objects that survived the last collection, plus the size of the 
+      /// objects allocated since (as it was when they were allocated).
+      /// String constants aren't part of the heap.
+      std::size_t getHeapSize() const;
+
+      /// \returns the number of objects in the heap.
+      std::size_t getNumObjects() const;
+
+      /// \returns the number of objects of kind \p kind in the heap.
+      std::size_t getNumObjects(ObjectKind kind) const;
+
+      /// \returns the number of young objects in the heap.
+      std::size_t getNumYoungObjects() const;
+
+      /// \returns the allocator of the old objects, which can be used to
+      /// get statistics about the old generation.
+      const ObjectAllocator& getObjectAllocator() const;
+
+      /// \returns the number of full collections (see collectGarbage) 
+      /// performed by this VM.
+      std::size_t getNumCollections() const;
+
+      /// \returns the number of minor collections (see 
+      /// collectYoungGeneration) performed by this VM, including the ones
+      /// done by full collections.
+      std::size_t getNumMinorCollections() const;
+
+      /// \returns the GC threshold: an allocation that makes the heap
+      /// grow beyond max(threshold, 2*(heap size after the last 
+      /// collection)) triggers a collection. An allocation also triggers a
+      /// collection when the nursery blocks promoted to the old generation
+      /// (see collectYoungGeneration) use more than max(threshold, 
+      /// 2*(their size after the last collection)) bytes.
+      std::size_t getGCThreshold() const;
+
+      /// Sets the GC threshold to \p threshold bytes.
+      void setGCThreshold(std::size_t threshold);
+
+      /// \returns true if the "GC stress" mode is enabled.
+      bool isGCStressEnabled() const;
+
+      /// Enables or disables the "GC stress" mode, in which every 
+      /// allocation triggers a collection. This is used to find missing
+      /// roots in tests.
+      void setGCStress(bool enabled);
+
+      /// \returns true if the debug allocation mode is enabled.
+      bool isDebugAllocationEnabled() const;
+
+      /// Enables or disables the debug allocation mode, in which every old
+      /// object is allocated with malloc (see ObjectAllocator). This can 
+      /// only be done before the VM allocates its first old object.
+      void setDebugAllocation(bool enabled);
+
+      /// \returns the size of the young generation: an allocation that 
+      /// makes the size of the young objects grow beyond it triggers a
+      /// minor collection.
+      std::size_t getNurserySize() const;
+
+      /// Sets the size of the young generation to \p size bytes.
+      void setNurserySize(std::size_t size);
+
+      /// The write barrier of the garbage collector, which must be called
+      /// after storing \p value in the array \p arr.
+      /// This adds \p arr to the remembered set when it's an old array
+      /// of references and \p value is a young object, so minor collections
+      /// can find the young objects which are only referenced by old ones.
+      void writeBarrier(ArrayObject* arr, FoxAny value) {
+        if (LLVM_UNLIKELY(!arr->isYoung() && arr->containsReferences()
+                          && value.objectVal && value.objectVal->isYoung()
+                          && !arr->isRemembered()))
+          remember(arr);
+      }
+
+      /// Appends \p value at the end of the array \p arr, and calls the
+      /// write barrier. \p arr and \p value must be reachable from the
+      /// roots, because this can trigger a collection (see reserveArray).
+      void appendToArray(ArrayObject* arr, FoxAny value) {
+        if(LLVM_UNLIKELY(arr->size() == arr->capacity()))
+          reserveArray(arr, arr->size()+1);
+        arr->append(value);
+        writeBarrier(arr, value);
+      }
+
+      /// Reserves enough space in the array \p arr, which must be 
+      /// reachable from the roots, to store \p minCapacity elements.
+      /// The memory allocated for the elements is part of the size of
+      /// the heap, so growing \p arr can trigger a collection.
+      void reserveArray(ArrayObject* arr, std::size_t minCapacity);
+
       ///--------------------------------------------------------------------///
       /// Public Member Variables
       ///--------------------------------------------------------------------///
@@ -206,36 +430,164 @@ namespace fox {
       DiagnosticEngine& diagEngine;
 
     private:
+      /// A call frame. It is pushed on the call stack when a BCFunction is
+      /// called, and contains the information needed to return to the
+      /// caller.
+      struct CallFrame {
+        CallFrame(BCFunction* fn, PreparedCode* code, 
+                  const PreparedInstruction* returnPC, Register* base,
+                  bool hasDest, regaddr_t dest) 
+          : fn(fn), code(code), returnPC(returnPC), base(base), dest(dest), 
+            hasDest(hasDest) {}
+
+        /// The caller function (can be null when running 
+        /// raw instruction buffers)
+        BCFunction* fn = nullptr;
+        /// The caller's code
+        PreparedCode* code = nullptr;
+        /// The instruction where the execution of the caller resumes
+        const PreparedInstruction* returnPC = nullptr;
+        /// The base register of the caller's register window
+        Register* base = nullptr;
+        /// The register, in the caller's window, where the return value
+        /// should be stored (if hasDest is true)
+        regaddr_t dest = 0;
+        /// Whether the return value should be stored in 'dest'
+        bool hasDest = false;
+      };
+
       /// Diagnoses a division by zero
       void diagnoseDivisionByZero();
 
       /// Diagnoses a modulo by zero
       void diagnoseModuloByZero();
 
+      /// Diagnoses a call that exceeds the maximum call depth
+      void diagnoseStackOverflow();
+
+      /// Diagnoses a call that needs a register stack bigger than its
+      /// maximum size
+      void diagnoseRegisterStackOverflow();
+
+      /// Diagnoses a subscript with an index \p idx that is negative or
+      /// out of range for an array or string of size \p size.
+      void diagnoseInvalidSubscript(std::size_t size, FoxInt idx);
+
       /// This should be called when a runtime error occurs.
       void actOnRuntimeError();
 
+      /// Executes prepared code \p code, preparing it first if needed.
+      /// This is the interpreter loop.
+      /// \return the return value of the executed code.
+      Register execute(PreparedCode& code);
+
       /// Creates the register array for the global variables and runs the
       /// initializers.
       void initGlobals();
 
+      /// Copies the content of the rope \p rope into a new flat string.
+      void flattenRope(StringObject* rope);
+
+      /// Creates the StringObject of the string constant with id \p kID.
+      LLVM_ATTRIBUTE_RETURNS_NONNULL
+      StringObject* createStringConstant(constant_id_t kID);
+
+      /// Allocates \p size bytes in the heap and creates an object of type
+      /// \p Ty in it by calling Ty::create with \p args.
+      /// Objects are allocated in the young generation, unless they're 
+      /// larger than Nursery::maxObjectSize.
+      /// \param extraSize the size of the memory that the object will 
+      ///        allocate itself (e.g. the elements of an array), which is
+      ///        part of the size of the heap.
+      template<typename Ty, typename ... Args>
+      LLVM_ATTRIBUTE_RETURNS_NONNULL
+      Ty* allocateObject(std::size_t size, std::size_t extraSize, 
+                         Args&& ... args);
+
+      /// Collects garbage if allocating an object of \p size bytes
+      /// should trigger a collection, then adds \p size to the size of
+      /// the heap (and to the size of the young generation if \p young is
+      /// true).
+      void notifyAllocation(std::size_t size, bool young);
+
+      /// Collects garbage if allocating \p size more bytes should trigger
+      /// a collection (a minor one if \p young is true and the young
+      /// generation is too large, but not the heap).
+      void collectGarbageIfNeeded(std::size_t size, bool young);
+
+      /// Adds the old object \p obj to the remembered set.
+      void remember(Object* obj);
+
+      /// Moves the young object \p obj to the old generation.
+      /// \returns the new address of the object
+      Object* evacuate(Object* obj);
+
+      /// Marks every old object reachable from the roots.
+      /// The young generation must be empty.
+      void markReachableObjects();
+
+      /// Frees every unmarked old object and clears the marks.
+      void sweep();
+
+      /// Frees every object of the heap. This is used by the destructor.
+      void freeHeap();
+
       /// \returns the number of global variables available
       std::size_t numGlobals() const;
 
-      /// Internal method to handle calls to a function
-      /// \param base the base register of the call
-      /// \returns a pointer to the register containing the return value
-      /// of the executed bytecode. nullptr if there is no return value
-      /// (void)
-      Register callFunc(regaddr_t base);
+      /// \returns true if a register window of \p numRegs registers
+      /// starting at \p base fits in the register stack.
+      bool fitsInRegisterStack(const Register* base, std::size_t numRegs) const {
+        return numRegs <= std::size_t((regStack_.data()+regStack_.size())-base);
+      }
+
+      /// \returns true if \p idx is a valid index in an array or string
+      /// of size \p size.
+      static bool isValidSubscript(std::size_t size, FoxInt idx) {
+        // Negative indexes wrap around, so a single comparison is enough.
+        return std::size_t(idx) < size;
+      }
 
-      /// Internal method to run a builtin function in the current window.
-      Register callBuiltinFunc(BuiltinKind id);
+      /// Grows the register stack so a window of \p numRegs registers
+      /// starting at \p base fits in it. This updates every pointer to the
+      /// register stack owned by the VM (the base register and the bases
+      /// of the call frames).
+      /// \returns the new address of \p base, or nullptr if the register
+      /// stack can't grow that much.
+      Register* growRegisterStack(Register* base, std::size_t numRegs);
+
+      /// Makes sure that the current register window has at least 
+      /// \p numRegs registers.
+      void reserveRegisters(std::size_t numRegs);
+
+      /// Removes every frame above \p depth from the call stack, restoring
+      /// the state of the VM to what it was before they were pushed.
+      void unwindCallStack(std::size_t depth);
+
+      /// Increments the hotness counter of \p fn, and compiles it when 
+      /// it reaches the JIT threshold.
+      /// \returns the native code of \p fn, or nullptr if it isn't
+      /// compiled.
+      JITFunction* getJITFunction(BCFunction& fn);
+
+      /// Internal method to call the builtin \p id.
+      /// \param args the first argument of the call. The other arguments 
+      /// are in subsequent registers.
+      /// \returns the return value of the builtin (a null register if 
+      /// it doesn't return anything)
+      Register callBuiltinFunc(BuiltinKind id, Register* args);
+
+      /// Internal method to call the builtin \p id and store its return 
+      /// value in \p dest.
+      /// \param args the first argument of the call. The other arguments 
+      /// are in subsequent registers.
+      void callBuiltinFunc(BuiltinKind id, Register* args, Register* dest);
 
       /// \returns a reference to the register at address \p idx in the current
       /// register window.
       Register& getReg(regaddr_t idx) {
-        assert((idx < numStackRegister) && "out-of-range");
+        assert(fitsInRegisterStack(baseReg_, std::size_t(idx)+1) 
+          && "out-of-range");
         return baseReg_[idx];
       }
 
@@ -254,25 +606,67 @@ namespace fox {
       /// The Program Counter
       const Instruction* pc_ = nullptr;
 
-      /// The number of registers on the register stack
-      static constexpr unsigned numStackRegister = 255;
       /// The register stack
-      std::array<Register, numStackRegister> regStack_;
+      std::vector<Register> regStack_;
+      /// The maximum size of the register stack
+      std::size_t maxRegStackSize_ = defaultMaxRegisterStackSize;
       /// The base register (rO) of the current function's register window.
       Register* baseReg_ = nullptr;
       /// Global variable registers
       std::unique_ptr<Register[]> globals_;
       /// The current function being called
-      BCFunction* curFn_;
+      BCFunction* curFn_ = nullptr;
+      /// The call stack
+      SmallVector<CallFrame, 16> callStack_;
+      /// The maximum size of the call stack
+      std::size_t maxCallDepth_ = defaultMaxCallDepth;
+      /// The profile of the executed instructions (null when profiling is
+      /// disabled)
+      OpcodePairProfile* profile_ = nullptr;
+      /// The JIT threshold (zero when the JIT is disabled)
+      std::uint32_t jitThreshold_ = 0;
       /// Flag indicating whether the VM is still "alive" and can execute
       /// code.
       bool isAlive_ = true;
 
-      // Temporarily, objects are simply allocated in vectors of unique_ptrs
-      // for simplicity. I'll implement a more elaborate allocation technique
-      // when the GC is implemented.
-      // For now, objects are simply never freed.
-      SmallVector<std::unique_ptr<StringObject>, 4> stringObjects_;
-      SmallVector<std::unique_ptr<ArrayObject>, 4> arrayObjects_;
+      // Objects are allocated in the nursery, and freed by the garbage
+      // collector (see collectGarbage and collectYoungGeneration).
+      /// The young generation
+      Nursery nursery_;
+      /// The old objects that were moved out of the nursery, and the large
+      /// objects. They have been allocated by objectAllocator_.
+      std::vector<Object*> oldObjects_;
+      /// The allocator of oldObjects_
+      ObjectAllocator objectAllocator_;
+      /// The blocks that were promoted to the old generation because they 
+      /// contained objects referenced by the roots.
+      SmallVector<std::unique_ptr<Nursery::Block>, 4> oldBlocks_;
+      /// The remembered set: old arrays and ropes that may contain 
+      /// references to young objects (see writeBarrier and flattenRope).
+      std::vector<Object*> rememberedSet_;
+      /// The StringObjects of the string constants, indexed by constant ID.
+      /// (null for the constants that haven't been loaded yet)
+      /// They are never collected.
+      /// They are allocated with malloc.
+      SmallVector<StringObject*, 4> stringConstants_;
+      /// The size of the heap, in bytes (see getHeapSize)
+      std::size_t heapSize_ = 0;
+      /// The size of the young objects, in bytes.
+      std::size_t youngSize_ = 0;
+      /// The size of the young generation (see getNurserySize)
+      std::size_t nurserySize_ = defaultNurserySize;
+      /// The heap size beyond which the next collection is triggered
+      std::size_t nextCollection_ = defaultGCThreshold;
+      /// The number of promoted blocks beyond which the next collection is
+      /// triggered
+      std::size_t maxOldBlocks_ = defaultGCThreshold/Nursery::blockSize;
+      /// The GC threshold (see getGCThreshold)
+      std::size_t gcThreshold_ = defaultGCThreshold;
+      /// The number of full collections performed
+      std::size_t numCollections_ = 0;
+      /// The number of minor collections performed
+      std::size_t numMinorCollections_ = 0;
+      /// Whether every allocation triggers a collection
+      bool gcStress_ = false;
   };
 }
\ No newline at end of file
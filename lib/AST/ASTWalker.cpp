@@ -160,16 +160,22 @@ namespace {
       }
 
       bool visitVarDecl(VarDecl* decl) {
-        if (Expr* init = decl->getInitExpr())
-          return doIt(init);
+        if (Expr* init = decl->getInitExpr()) {
+          if ((init = doIt(init)))
+            decl->setInitExpr(init);
+          else 
+            return false;
+        }
         return true;
       }
 
       bool visitFuncDecl(FuncDecl* decl) {
-        for (ParamDecl* param : *decl->getParams()) {
-          if (param) {
-            if (!doIt(param))
-              return false;
+        if (ParamList* params = decl->getParams()) {
+          for (ParamDecl* param : *params) {
+            if (param) {
+              if (!doIt(param))
+                return false;
+            }
           }
         }
 
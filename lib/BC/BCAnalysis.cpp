@@ -0,0 +1,407 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCAnalysis.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCAnalysis.hpp"
+#include "Fox/BC/Superinstructions.hpp"
+#include "Fox/Common/BuiltinKinds.hpp"
+#include "Fox/Common/Errors.hpp"
+
+using namespace fox;
+
+/// Adds the registers [\p first, \p end) to \p set
+static void addRegisters(RegisterSet& set, std::size_t first,
+                         std::size_t end) {
+  for(std::size_t reg = first; reg < end; ++reg)
+    set.set(reg);
+}
+
+/// Adds the effects of a call whose arguments follow \p base to
+/// \p effects. The callee's register window begins after \p base, so every
+/// register after \p base can be an argument, and is clobbered by the call.
+static void addCallEffects(RegisterEffects& effects, regaddr_t base) {
+  addRegisters(effects.reads, std::size_t(base)+1, bc_limits::max_registers);
+  addRegisters(effects.clobbers, std::size_t(base)+1,
+               bc_limits::max_registers);
+}
+
+/// Adds the effects of a call to the builtin \p id whose arguments follow
+/// \p base to \p effects. The number of arguments of builtins is known, so
+/// the call only reads them.
+static void addBuiltinCallEffects(RegisterEffects& effects, BuiltinKind id,
+                                  regaddr_t base) {
+  addRegisters(effects.reads, std::size_t(base)+1,
+               std::size_t(base)+1+getNumArgs(id));
+  addRegisters(effects.clobbers, std::size_t(base)+1,
+               bc_limits::max_registers);
+}
+
+RegisterEffects fox::getRegisterEffects(Instruction instr) {
+  assert(!isSuperinstruction(instr.opcode)
+    && "superinstructions are not supported");
+  RegisterEffects effects;
+  switch (instr.opcode) {
+    #define BINARY_REG_OP(ID) case Opcode::ID:                                \
+      effects.reads.set(instr.ID.lhs);                                        \
+      effects.reads.set(instr.ID.rhs);                                        \
+      effects.writes.set(instr.ID.dest);                                      \
+      break;
+    #define UNARY_REG_OP(ID) case Opcode::ID:                                 \
+      effects.reads.set(instr.ID.src);                                        \
+      effects.writes.set(instr.ID.dest);                                      \
+      break;
+    #define BINARY_IMM_OP(ID) case Opcode::ID:                                \
+      effects.reads.set(instr.ID.src);                                        \
+      effects.writes.set(instr.ID.dest);                                      \
+      break;
+    #define COMPARE_JUMP_INSTR(ID) case Opcode::ID:                           \
+      effects.reads.set(instr.ID.lhs);                                        \
+      effects.reads.set(instr.ID.rhs);                                        \
+      break;
+    #include "Fox/BC/Instruction.def"
+    // Instructions that only write to a register
+    #define WRITES_DEST(ID) case Opcode::ID:                                  \
+      effects.writes.set(instr.ID.dest);                                      \
+      break;
+    WRITES_DEST(StoreSmallInt)
+    WRITES_DEST(LoadIntK)
+    WRITES_DEST(LoadDoubleK)
+    WRITES_DEST(NewString)
+    WRITES_DEST(LoadStringK)
+    WRITES_DEST(LoadArrayK)
+    WRITES_DEST(NewValueArray)
+    WRITES_DEST(NewRefArray)
+    WRITES_DEST(GetGlobal)
+    WRITES_DEST(LoadFunc)
+    WRITES_DEST(LoadBuiltinFunc)
+    #undef WRITES_DEST
+    case Opcode::ArrGet:
+      effects.reads.set(instr.ArrGet.arr);
+      effects.reads.set(instr.ArrGet.idx);
+      effects.writes.set(instr.ArrGet.dest);
+      break;
+    case Opcode::ArrSet:
+      effects.reads.set(instr.ArrSet.arr);
+      effects.reads.set(instr.ArrSet.idx);
+      effects.reads.set(instr.ArrSet.val);
+      break;
+    case Opcode::ArrAppend:
+      effects.reads.set(instr.ArrAppend.arr);
+      effects.reads.set(instr.ArrAppend.val);
+      break;
+    case Opcode::ArrAppendRange:
+      effects.reads.set(instr.ArrAppendRange.arr);
+      addRegisters(effects.reads, instr.ArrAppendRange.first,
+        std::size_t(instr.ArrAppendRange.first) + instr.ArrAppendRange.n);
+      break;
+    case Opcode::ArrSize:
+      effects.reads.set(instr.ArrSize.arr);
+      effects.writes.set(instr.ArrSize.dest);
+      break;
+    case Opcode::StrLen:
+      effects.reads.set(instr.StrLen.str);
+      effects.writes.set(instr.StrLen.dest);
+      break;
+    case Opcode::StrGetChar:
+      effects.reads.set(instr.StrGetChar.str);
+      effects.reads.set(instr.StrGetChar.idx);
+      effects.writes.set(instr.StrGetChar.dest);
+      break;
+    case Opcode::SetGlobal:
+      effects.reads.set(instr.SetGlobal.src);
+      break;
+    case Opcode::JumpIf:
+      effects.reads.set(instr.JumpIf.condReg);
+      break;
+    case Opcode::JumpIfNot:
+      effects.reads.set(instr.JumpIfNot.condReg);
+      break;
+    case Opcode::Ret:
+      effects.reads.set(instr.Ret.reg);
+      break;
+    case Opcode::Call:
+      // The function called is in 'base'.
+      effects.reads.set(instr.Call.base);
+      addCallEffects(effects, instr.Call.base);
+      effects.clobbers.reset(instr.Call.dest);
+      effects.writes.set(instr.Call.dest);
+      break;
+    case Opcode::CallVoid:
+      effects.reads.set(instr.CallVoid.base);
+      addCallEffects(effects, instr.CallVoid.base);
+      break;
+    case Opcode::CallFunc:
+      addCallEffects(effects, instr.CallFunc.base);
+      effects.clobbers.reset(instr.CallFunc.dest);
+      effects.writes.set(instr.CallFunc.dest);
+      break;
+    case Opcode::CallVoidFunc:
+      addCallEffects(effects, instr.CallVoidFunc.base);
+      break;
+    case Opcode::CallBuiltin:
+      addBuiltinCallEffects(effects, instr.CallBuiltin.id,
+                            instr.CallBuiltin.base);
+      effects.clobbers.reset(instr.CallBuiltin.dest);
+      effects.writes.set(instr.CallBuiltin.dest);
+      break;
+    case Opcode::CallVoidBuiltin:
+      addBuiltinCallEffects(effects, instr.CallVoidBuiltin.id,
+                            instr.CallVoidBuiltin.base);
+      break;
+    case Opcode::NoOp:
+    case Opcode::Jump:
+    case Opcode::JumpOffset:
+    case Opcode::RetVoid:
+    case Opcode::CallTarget:
+      break;
+    default:
+      fox_unreachable("unknown opcode");
+  }
+  return effects;
+}
+
+SmallVector<regaddr_t*, 3> fox::getReadOperands(Instruction& instr) {
+  assert(!isSuperinstruction(instr.opcode)
+    && "superinstructions are not supported");
+  SmallVector<regaddr_t*, 3> operands;
+  switch (instr.opcode) {
+    #define BINARY_REG_OP(ID) case Opcode::ID:                                \
+      operands.push_back(&instr.ID.lhs);                                      \
+      operands.push_back(&instr.ID.rhs);                                      \
+      break;
+    #define UNARY_REG_OP(ID) case Opcode::ID:                                 \
+      operands.push_back(&instr.ID.src);                                      \
+      break;
+    #define BINARY_IMM_OP(ID) case Opcode::ID:                                \
+      operands.push_back(&instr.ID.src);                                      \
+      break;
+    #define COMPARE_JUMP_INSTR(ID) case Opcode::ID:                           \
+      operands.push_back(&instr.ID.lhs);                                      \
+      operands.push_back(&instr.ID.rhs);                                      \
+      break;
+    #include "Fox/BC/Instruction.def"
+    case Opcode::ArrGet:
+      operands.push_back(&instr.ArrGet.arr);
+      operands.push_back(&instr.ArrGet.idx);
+      break;
+    case Opcode::ArrSet:
+      operands.push_back(&instr.ArrSet.arr);
+      operands.push_back(&instr.ArrSet.idx);
+      operands.push_back(&instr.ArrSet.val);
+      break;
+    case Opcode::ArrAppend:
+      operands.push_back(&instr.ArrAppend.arr);
+      operands.push_back(&instr.ArrAppend.val);
+      break;
+    case Opcode::ArrAppendRange:
+      operands.push_back(&instr.ArrAppendRange.arr);
+      break;
+    case Opcode::ArrSize:
+      operands.push_back(&instr.ArrSize.arr);
+      break;
+    case Opcode::StrLen:
+      operands.push_back(&instr.StrLen.str);
+      break;
+    case Opcode::StrGetChar:
+      operands.push_back(&instr.StrGetChar.str);
+      operands.push_back(&instr.StrGetChar.idx);
+      break;
+    case Opcode::SetGlobal:
+      operands.push_back(&instr.SetGlobal.src);
+      break;
+    case Opcode::JumpIf:
+      operands.push_back(&instr.JumpIf.condReg);
+      break;
+    case Opcode::JumpIfNot:
+      operands.push_back(&instr.JumpIfNot.condReg);
+      break;
+    case Opcode::Ret:
+      operands.push_back(&instr.Ret.reg);
+      break;
+    default:
+      break;
+  }
+  return operands;
+}
+
+regaddr_t* fox::getWriteOperand(Instruction& instr) {
+  assert(!isSuperinstruction(instr.opcode)
+    && "superinstructions are not supported");
+  switch (instr.opcode) {
+    #define BINARY_REG_OP(ID) case Opcode::ID: return &instr.ID.dest;
+    #define UNARY_REG_OP(ID) case Opcode::ID: return &instr.ID.dest;
+    #define BINARY_IMM_OP(ID) case Opcode::ID: return &instr.ID.dest;
+    #include "Fox/BC/Instruction.def"
+    #define WRITES_DEST(ID) case Opcode::ID: return &instr.ID.dest;
+    WRITES_DEST(StoreSmallInt)
+    WRITES_DEST(LoadIntK)
+    WRITES_DEST(LoadDoubleK)
+    WRITES_DEST(NewString)
+    WRITES_DEST(LoadStringK)
+    WRITES_DEST(LoadArrayK)
+    WRITES_DEST(NewValueArray)
+    WRITES_DEST(NewRefArray)
+    WRITES_DEST(GetGlobal)
+    WRITES_DEST(LoadFunc)
+    WRITES_DEST(LoadBuiltinFunc)
+    WRITES_DEST(ArrGet)
+    WRITES_DEST(ArrSize)
+    WRITES_DEST(StrLen)
+    WRITES_DEST(StrGetChar)
+    WRITES_DEST(Call)
+    WRITES_DEST(CallFunc)
+    WRITES_DEST(CallBuiltin)
+    #undef WRITES_DEST
+    default:
+      return nullptr;
+  }
+}
+
+regaddr_t* fox::getCallBase(Instruction& instr) {
+  switch (instr.opcode) {
+    case Opcode::Call:            return &instr.Call.base;
+    case Opcode::CallVoid:        return &instr.CallVoid.base;
+    case Opcode::CallFunc:        return &instr.CallFunc.base;
+    case Opcode::CallVoidFunc:    return &instr.CallVoidFunc.base;
+    case Opcode::CallBuiltin:     return &instr.CallBuiltin.base;
+    case Opcode::CallVoidBuiltin: return &instr.CallVoidBuiltin.base;
+    default:                      return nullptr;
+  }
+}
+
+bool fox::isTerminator(Instruction instr) {
+  return (instr.opcode == Opcode::Jump) || instr.isAnyRet();
+}
+
+Optional<std::size_t>
+fox::getJumpSlot(ArrayRef<Instruction> instrs, std::size_t idx) {
+  Instruction instr = instrs[idx];
+  if(!instr.isAnyJump()) return None;
+  if (instr.isCompareAndJump()) {
+    assert(((idx+1) < instrs.size())
+      && (instrs[idx+1].opcode == Opcode::JumpOffset)
+      && "compare and jump not followed by a JumpOffset");
+    return idx+1;
+  }
+  return idx;
+}
+
+jump_offset_t fox::getJumpOffset(Instruction slot) {
+  switch (slot.opcode) {
+    case Opcode::Jump:        return slot.Jump.offset;
+    case Opcode::JumpIf:      return slot.JumpIf.offset;
+    case Opcode::JumpIfNot:   return slot.JumpIfNot.offset;
+    case Opcode::JumpOffset:  return slot.JumpOffset.offset;
+    default:
+      fox_unreachable("not a jump slot");
+  }
+}
+
+void fox::setJumpOffset(Instruction& slot, jump_offset_t offset) {
+  switch (slot.opcode) {
+    case Opcode::Jump:
+      slot.Jump.offset = offset;
+      break;
+    case Opcode::JumpIf:
+      slot.JumpIf.offset = offset;
+      break;
+    case Opcode::JumpIfNot:
+      slot.JumpIfNot.offset = offset;
+      break;
+    case Opcode::JumpOffset:
+      slot.JumpOffset.offset = offset;
+      break;
+    default:
+      fox_unreachable("not a jump slot");
+  }
+}
+
+std::size_t
+fox::getJumpTarget(ArrayRef<Instruction> instrs, std::size_t slot) {
+  // The offset is relative to the next instruction
+  std::ptrdiff_t target =
+    std::ptrdiff_t(slot) + 1 + getJumpOffset(instrs[slot]);
+  assert((target >= 0) && (std::size_t(target) <= instrs.size())
+    && "jump target is out of the instruction buffer");
+  return std::size_t(target);
+}
+
+bool fox::canJumpTo(std::size_t slot, std::size_t target) {
+  std::ptrdiff_t offset = std::ptrdiff_t(target) - std::ptrdiff_t(slot+1);
+  return (offset >= bc_limits::min_jump_offset)
+      && (offset <= bc_limits::max_jump_offset);
+}
+
+void fox::getSuccessors(ArrayRef<Instruction> instrs, std::size_t idx,
+                        SmallVectorImpl<std::size_t>& succs) {
+  Instruction instr = instrs[idx];
+  if(instr.isAnyRet()) return;
+  if (auto slot = getJumpSlot(instrs, idx)) {
+    succs.push_back(getJumpTarget(instrs, slot.getValue()));
+    if(instr.opcode == Opcode::Jump) return;
+  }
+  succs.push_back(idx + instr.getLength());
+}
+
+std::vector<bool> fox::getInstructionStarts(ArrayRef<Instruction> instrs) {
+  std::vector<bool> starts(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength())
+    starts[idx] = true;
+  return starts;
+}
+
+std::vector<bool> fox::getJumpTargets(ArrayRef<Instruction> instrs) {
+  std::vector<bool> targets(instrs.size()+1);
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength())
+    if (auto slot = getJumpSlot(instrs, idx))
+      targets[getJumpTarget(instrs, slot.getValue())] = true;
+  return targets;
+}
+
+/// \returns the effects of the instruction that begins at each index of
+/// \p instrs
+static std::vector<RegisterEffects> 
+getAllRegisterEffects(ArrayRef<Instruction> instrs) {
+  std::vector<RegisterEffects> effects(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size(); 
+       idx += instrs[idx].getLength())
+    effects[idx] = getRegisterEffects(instrs[idx]);
+  return effects;
+}
+
+LivenessAnalysis::LivenessAnalysis(ArrayRef<Instruction> instrs)
+  : LivenessAnalysis(instrs, getAllRegisterEffects(instrs)) {}
+
+LivenessAnalysis::LivenessAnalysis(ArrayRef<Instruction> instrs,
+                                   ArrayRef<RegisterEffects> effects)
+  : liveIn_(instrs.size()), liveOut_(instrs.size()) {
+  assert((effects.size() == instrs.size()) && "wrong number of effects");
+  std::vector<bool> starts = getInstructionStarts(instrs);
+
+  // Iterate until a fixed point is reached. The instructions are visited
+  // backwards, so only loops need more than one iteration.
+  SmallVector<std::size_t, 2> succs;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (std::size_t idx = instrs.size(); idx-- > 0;) {
+      if(!starts[idx]) continue;
+      RegisterSet liveOut;
+      succs.clear();
+      getSuccessors(instrs, idx, succs);
+      for (std::size_t succ : succs)
+        if(succ < instrs.size()) liveOut |= liveIn_[succ];
+      RegisterSet liveIn = (liveOut & ~effects[idx].writes)
+                         | effects[idx].reads;
+      if((liveIn == liveIn_[idx]) && (liveOut == liveOut_[idx])) continue;
+      liveIn_[idx] = liveIn;
+      liveOut_[idx] = liveOut;
+      changed = true;
+    }
+  }
+}
@@ -44,6 +44,30 @@ using namespace fox;
     return insert(instr);                                                      \
   }
 
+#define COMPARE_JUMP_INSTR(ID)                                                 \
+  BCBuilder::StableInstrIter                                                   \
+  BCBuilder::create##ID##Instr(regaddr_t lhs, regaddr_t rhs,                   \
+                               jump_offset_t offset) {                         \
+    Instruction instr(Opcode::ID);                                             \
+    instr.ID.lhs = lhs;                                                        \
+    instr.ID.rhs = rhs;                                                        \
+    auto iter = insert(instr);                                                 \
+    createJumpOffsetInstr(offset);                                             \
+    return iter;                                                               \
+  }
+
+#define DIRECT_CALL_INSTR(ID)                                                  \
+  BCBuilder::StableInstrIter                                                   \
+  BCBuilder::create##ID##Instr(func_id_t func, regaddr_t base,                 \
+                               regaddr_t dest) {                               \
+    Instruction instr(Opcode::ID);                                             \
+    instr.ID.base = base;                                                      \
+    instr.ID.dest = dest;                                                      \
+    auto iter = insert(instr);                                                 \
+    createCallTargetInstr(func);                                               \
+    return iter;                                                               \
+  }
+
 #include "Fox/BC/Instruction.def"
 
 //----------------------------------------------------------------------------//
@@ -66,13 +90,11 @@ bool BCBuilder::isLastInstr(StableInstrConstIter it) const {
 }
 
 BCBuilder::StableInstrIter BCBuilder::getLastInstrIter() {
-  assert(vector.size() && "not available for empty buffers");
-  return StableInstrIter(vector, vector.size()-1);
+  return StableInstrIter(vector, getLastInstrIndex());
 }
 
 BCBuilder::StableInstrConstIter BCBuilder::getLastInstrIter() const {
-  assert(vector.size() && "not available for empty buffers");
-  return StableInstrConstIter(vector, vector.size()-1);
+  return StableInstrConstIter(vector, getLastInstrIndex());
 }
 
 void BCBuilder::addDebugRange(StableInstrConstIter iter, SourceRange range) {
@@ -92,10 +114,28 @@ bool BCBuilder::hasDebugInfo() const {
 }
 
 void BCBuilder::popInstr() {
-  vector.pop_back();
+  vector.erase(vector.begin()+getLastInstrIndex(), vector.end());
+}
+
+std::size_t BCBuilder::getLastInstrIndex() const {
+  assert(vector.size() && "not available for empty buffers");
+  std::size_t idx = vector.size()-1;
+  // Skip the JumpOffset of fused compare and jumps
+  if (vector[idx].opcode == Opcode::JumpOffset) {
+    assert(idx && vector[idx-1].isCompareAndJump() 
+      && "JumpOffset doesn't follow a compare and jump");
+    --idx;
+  }
+  // Skip the CallTarget of direct calls
+  else if (vector[idx].opcode == Opcode::CallTarget) {
+    assert(idx && vector[idx-1].isDirectCall() 
+      && "CallTarget doesn't follow a direct call");
+    --idx;
+  }
+  return idx;
 }
 
 BCBuilder::StableInstrIter BCBuilder::insert(Instruction instr) {
   vector.push_back(instr);
-  return getLastInstrIter();
+  return StableInstrIter(vector, vector.size()-1);
 }
\ No newline at end of file
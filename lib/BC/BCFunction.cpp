@@ -7,14 +7,37 @@
 
 #include "Fox/BC/BCFunction.hpp"
 #include "Fox/BC/BCBuilder.hpp"
+#include "Fox/VM/JIT.hpp"
 #include "llvm/ADT/ArrayRef.h"
 
 using namespace fox;
 
+/// The constructor and destructor are out of line because unique_ptr needs
+/// to see the definition of JITFunction.
+BCFunction::BCFunction(func_id_t id) : id_(id) {}
+
+BCFunction::~BCFunction() = default;
+
 BCBuilder BCFunction::createBCBuilder() {
+  discardPreparedCode();
   return BCBuilder(instrs_, debugInfo_.get());
 }
 
+PreparedCode& BCFunction::createPreparedCode() {
+  assert(!preparedCode_ && "already has prepared code");
+  preparedCode_ = std::make_unique<PreparedCode>(instrs_);
+  return *preparedCode_;
+}
+
+void BCFunction::discardPreparedCode() {
+  preparedCode_.reset();
+  jitFn_.reset();
+}
+
+void BCFunction::setJITFunction(std::unique_ptr<JITFunction> jitFn) {
+  jitFn_ = std::move(jitFn);
+}
+
 void BCFunction::dump(std::ostream& out, string_view title) const {
   out << title << ' ' << id_ << '\n';
 
@@ -34,6 +57,7 @@ DebugInfo& BCFunction::createDebugInfo() {
 void BCFunction::removeDebugInfo() {
   assert(hasDebugInfo() 
     && "can't remove debug info if there is no debug info!");
+  debugInfo_.reset();
 }
 
 bool BCFunction::hasDebugInfo() const {
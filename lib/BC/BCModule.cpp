@@ -6,6 +6,7 @@
 //----------------------------------------------------------------------------//
 
 #include "Fox/BC/BCModule.hpp"
+#include "Fox/Common/Errors.hpp"
 #include "Fox/Common/QuotedString.hpp"
 #include "llvm/ADT/ArrayRef.h"
 
@@ -75,6 +76,21 @@ ArrayRef<FoxDouble> BCModule::getDoubleConstants() const {
   return doubleConstants_;
 }
 
+std::size_t BCModule::addArrayConstant(ArrayElemKind elemKind, 
+                                       ArrayRef<FoxAny> elems) {
+  std::size_t idx = arrayConstants_.size();
+  auto arr = std::make_unique<ArrayObject>(elemKind, elems.size());
+  for (FoxAny elem : elems)
+    arr->append(elem);
+  arrayConstants_.push_back(std::move(arr));
+  return idx;
+}
+
+const ArrayObject& BCModule::getArrayConstant(std::size_t idx) const {
+  assert((idx < arrayConstants_.size()) && "out-of-range");
+  return *arrayConstants_[idx];
+}
+
 bool BCModule::empty() const {
   return functions_.empty()
       && empty_constants();
@@ -83,7 +99,8 @@ bool BCModule::empty() const {
 bool BCModule::empty_constants() const {
   return doubleConstants_.empty()
       && intConstants_.empty() 
-      && strConstants_.empty();
+      && strConstants_.empty()
+      && arrayConstants_.empty();
 }
 
 void BCModule::dump(std::ostream& out) const {
@@ -130,6 +147,32 @@ void BCModule::dumpConstants(std::ostream& out) const {
   }
   else 
     out << "  [No String Constants]\n";
+
+  if(std::size_t size = arrayConstants_.size()) {
+    out << "  [Arrays: " << size << " constants]\n";
+    for (std::size_t idx = 0; idx < size; ++idx) {
+      const ArrayObject& arr = *arrayConstants_[idx];
+      ArrayElemKind kind = arr.getElemKind();
+      out << "    " << idx << "\t| " << kind << " [";
+      for (std::size_t k = 0, e = arr.size(); k < e; ++k) {
+        if(k) out << ", ";
+        FoxAny elem = arr[k];
+        switch (kind) {
+          case ArrayElemKind::Int:    out << elem.intVal;     break;
+          case ArrayElemKind::Double: out << elem.doubleVal;  break;
+          case ArrayElemKind::Bool:   
+            out << (elem.raw ? "true" : "false"); 
+            break;
+          case ArrayElemKind::Char:   out << elem.charVal;    break;
+          case ArrayElemKind::Ref:    
+            fox_unreachable("array constants can't contain references");
+        }
+      }
+      out << "]\n";
+    }
+  }
+  else 
+    out << "  [No Array Constants]\n";
 }
 
 void BCModule::dumpGlobVarInitializers(std::ostream& out) const {
@@ -0,0 +1,45 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCPassManager.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCPassManager.hpp"
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/Common/Errors.hpp"
+
+using namespace fox;
+
+BCPassManager::BCPassManager(OptLevel level) {
+  switch (level) {
+    case OptLevel::O0:
+      break;
+    case OptLevel::O1:
+      // Threading jumps can leave jumps and returns unreachable, and
+      // removing copies can create jumps to the next instruction, so these
+      // passes are run twice.
+      addPass("thread-jumps", threadJumps);
+      addPass("remove-unreachable-code", removeUnreachableCode);
+      addPass("eliminate-redundant-copies", eliminateRedundantCopies);
+      addPass("reduce-strength", reduceStrength);
+      addPass("hoist-loop-invariant-code", hoistLoopInvariantCode);
+      addPass("thread-jumps", threadJumps);
+      addPass("remove-unreachable-code", removeUnreachableCode);
+      break;
+    default:
+      fox_unreachable("unknown optimization level");
+  }
+}
+
+void BCPassManager::addPass(string_view name, Pass pass) {
+  assert(pass && "pass is null");
+  passes_.push_back({name, pass});
+}
+
+bool BCPassManager::run(BCFunction& fn) const {
+  bool changed = false;
+  for (const PassEntry& entry : passes_)
+    changed |= entry.pass(fn);
+  return changed;
+}
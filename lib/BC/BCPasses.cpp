@@ -0,0 +1,468 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : BCPasses.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/BCAnalysis.hpp"
+#include "Fox/BC/BCFunction.hpp"
+#include <array>
+#include <cstdint>
+
+using namespace fox;
+
+std::size_t fox::removeInstructions(BCFunction& fn,
+                                    const std::vector<bool>& removed) {
+  InstructionVector& instrs = fn.getInstructions();
+  const std::size_t size = instrs.size();
+  assert((removed.size() == size) && "wrong number of instructions");
+
+  // Compute the new index of every instruction. The index of a removed
+  // instruction is the index of the next instruction that's kept.
+  SmallVector<std::size_t, 64> newIndexes(size+1);
+  std::size_t numKept = 0;
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    newIndexes[idx] = numKept;
+    if(!removed[idx]) ++numKept;
+  }
+  newIndexes[size] = numKept;
+  if(numKept == size) return 0;
+
+  // Update the offsets of the jumps that are kept. Removing instructions
+  // only makes the jumps shorter, so the new offsets always fit.
+  for (std::size_t idx = 0; idx < size; idx += instrs[idx].getLength()) {
+    if(removed[idx]) continue;
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    assert(!removed[slot.getValue()] && "JumpOffset removed without its jump");
+    std::size_t target = newIndexes[getJumpTarget(instrs, slot.getValue())];
+    std::ptrdiff_t offset = std::ptrdiff_t(target)
+                          - std::ptrdiff_t(newIndexes[slot.getValue()] + 1);
+    setJumpOffset(instrs[slot.getValue()], jump_offset_t(offset));
+  }
+
+  // Remove the instructions
+  std::size_t dest = 0;
+  for (std::size_t idx = 0; idx < size; ++idx)
+    if(!removed[idx]) instrs[dest++] = instrs[idx];
+  instrs.resize(numKept);
+
+  if (DebugInfo* debugInfo = fn.getDebugInfo())
+    debugInfo->remapInstructions(newIndexes, removed);
+  fn.discardPreparedCode();
+  return size - numKept;
+}
+
+bool fox::removeUnreachableCode(BCFunction& fn) {
+  InstructionVector& instrs = fn.getInstructions();
+  if(instrs.empty()) return false;
+
+  // Find the reachable instructions, starting from the entry point.
+  std::vector<bool> reachable(instrs.size()+1);
+  SmallVector<std::size_t, 16> worklist;
+  SmallVector<std::size_t, 2> succs;
+  reachable[0] = true;
+  worklist.push_back(0);
+  while (!worklist.empty()) {
+    std::size_t idx = worklist.pop_back_val();
+    succs.clear();
+    getSuccessors(instrs, idx, succs);
+    for (std::size_t succ : succs) {
+      if(reachable[succ]) continue;
+      reachable[succ] = true;
+      if(succ < instrs.size()) worklist.push_back(succ);
+    }
+  }
+
+  std::vector<bool> removed(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    if(reachable[idx]) continue;
+    for (std::size_t k = 0; k < instrs[idx].getLength(); ++k)
+      removed[idx+k] = true;
+  }
+  return removeInstructions(fn, removed) != 0;
+}
+
+bool fox::threadJumps(BCFunction& fn) {
+  InstructionVector& instrs = fn.getInstructions();
+  std::vector<bool> removed(instrs.size());
+  bool changed = false;
+  bool anyRemoved = false;
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    // Follow the chain of unconditional jumps. The number of steps is
+    // bounded so infinite loops (jumps to themselves) are handled.
+    const std::size_t oldTarget = getJumpTarget(instrs, slot.getValue());
+    std::size_t target = oldTarget;
+    for (std::size_t steps = 0; steps < instrs.size(); ++steps) {
+      if((target == instrs.size()) || (instrs[target].opcode != Opcode::Jump))
+        break;
+      std::size_t next = getJumpTarget(instrs, target);
+      if(!canJumpTo(slot.getValue(), next)) break;
+      target = next;
+    }
+    if (target != oldTarget) {
+      setJumpOffset(instrs[slot.getValue()],
+        jump_offset_t(std::ptrdiff_t(target) - (slot.getValue() + 1)));
+      changed = true;
+    }
+    // An unconditional jump to a return can be replaced with the return.
+    if ((instrs[idx].opcode == Opcode::Jump) && (target < instrs.size())
+      && instrs[target].isAnyRet()) {
+      instrs[idx] = instrs[target];
+      changed = true;
+      continue;
+    }
+    // A jump to the next instruction does nothing.
+    if (target == (idx + instrs[idx].getLength())) {
+      for (std::size_t k = 0; k < instrs[idx].getLength(); ++k)
+        removed[idx+k] = true;
+      anyRemoved = true;
+    }
+  }
+  if (anyRemoved)
+    removeInstructions(fn, removed);
+  else if (changed)
+    fn.discardPreparedCode();
+  return changed || anyRemoved;
+}
+
+namespace {
+  /// The copies available at a point of a function: copyOf[reg] is the
+  /// register that contains the same value as reg because it has been
+  /// copied to reg, or -1.
+  using CopyMap = std::array<std::int16_t, bc_limits::max_registers>;
+}
+
+/// Updates \p copies after the execution of \p instr.
+static void updateCopies(Instruction instr, CopyMap& copies) {
+  if ((instr.opcode == Opcode::Copy) && (instr.Copy.dest == instr.Copy.src))
+    return;
+  // Forget the copies of, and to, the registers modified by the
+  // instruction.
+  RegisterEffects effects = getRegisterEffects(instr);
+  RegisterSet modified = effects.writes | effects.clobbers;
+  if (modified.any()) {
+    for (std::size_t reg = 0; reg < copies.size(); ++reg) {
+      if (modified[reg] || ((copies[reg] >= 0) && modified[copies[reg]]))
+        copies[reg] = -1;
+    }
+  }
+  if(instr.opcode == Opcode::Copy) copies[instr.Copy.dest] = instr.Copy.src;
+}
+
+/// Replaces the registers read by the instructions of \p instrs with the
+/// registers they were copied from, where both are known to contain the
+/// same value on every path.
+/// \returns true if an instruction has been changed.
+static bool propagateCopies(MutableArrayRef<Instruction> instrs) {
+  // Compute the copies available before each instruction. This starts
+  // with the copies available on the first path found to the instruction,
+  // and only keeps the ones available on every path until a fixed point is
+  // reached.
+  std::vector<CopyMap> copiesIn(instrs.size());
+  std::vector<bool> visited(instrs.size());
+  SmallVector<std::size_t, 2> succs;
+  if(instrs.empty()) return false;
+  copiesIn[0].fill(-1);
+  visited[0] = true;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (std::size_t idx = 0; idx < instrs.size();
+         idx += instrs[idx].getLength()) {
+      if(!visited[idx]) continue;
+      CopyMap copies = copiesIn[idx];
+      updateCopies(instrs[idx], copies);
+      succs.clear();
+      getSuccessors(instrs, idx, succs);
+      for (std::size_t succ : succs) {
+        if(succ == instrs.size()) continue;
+        CopyMap& succIn = copiesIn[succ];
+        if (!visited[succ]) {
+          visited[succ] = true;
+          succIn = copies;
+          changed = true;
+          continue;
+        }
+        for (std::size_t reg = 0; reg < succIn.size(); ++reg) {
+          if ((succIn[reg] >= 0) && (succIn[reg] != copies[reg])) {
+            succIn[reg] = -1;
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  // Replace the operands
+  changed = false;
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    if(!visited[idx]) continue;
+    const CopyMap& copies = copiesIn[idx];
+    for (regaddr_t* operand : getReadOperands(instrs[idx])) {
+      // Follow the chain of copies to the original register. A copy
+      // forgets the copies of its destination, so there are no cycles.
+      regaddr_t reg = *operand;
+      while(copies[reg] >= 0) reg = regaddr_t(copies[reg]);
+      if(reg == *operand) continue;
+      *operand = reg;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+bool fox::eliminateRedundantCopies(BCFunction& fn) {
+  InstructionVector& instrs = fn.getInstructions();
+  bool changed = propagateCopies(instrs);
+  if(changed) fn.discardPreparedCode();
+
+  // Remove the copies whose destination isn't live. This is repeated
+  // because removing a copy can make the copies it read dead.
+  while (true) {
+    LivenessAnalysis liveness(instrs);
+    std::vector<bool> removed(instrs.size());
+    bool anyRemoved = false;
+    for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+      const Instruction& instr = instrs[idx];
+      if(instr.opcode != Opcode::Copy) continue;
+      if ((instr.Copy.dest == instr.Copy.src)
+        || !liveness.getLiveOut(idx)[instr.Copy.dest]) {
+        removed[idx] = true;
+        anyRemoved = true;
+      }
+    }
+    if(!anyRemoved) break;
+    removeInstructions(fn, removed);
+    changed = true;
+  }
+  return changed;
+}
+
+namespace {
+  /// The constants known to be in the registers of a function.
+  class KnownConstants {
+    public:
+      KnownConstants(ArrayRef<Instruction> instrs) : instrs_(instrs),
+        starts_(getInstructionStarts(instrs)), 
+        targets_(getJumpTargets(instrs)) {
+        // A register contains a constant everywhere if the only 
+        // instructions that write to it store that constant, and if it 
+        // isn't a parameter (registers are always written before being
+        // read, except parameters).
+        if(instrs.empty()) return;
+        LivenessAnalysis liveness(instrs);
+        for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+          state_[reg] = liveness.getLiveIn(0)[reg] ? Unknown : NotWritten;
+        for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+          if(!starts_[idx]) continue;
+          Instruction instr = instrs[idx];
+          RegisterEffects effects = getRegisterEffects(instr);
+          RegisterSet modified = effects.writes | effects.clobbers;
+          if(modified.none()) continue;
+          for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg) {
+            if(!modified[reg] || (state_[reg] == Unknown)) continue;
+            bool isStore = (instr.opcode == Opcode::StoreSmallInt)
+                        && (instr.StoreSmallInt.dest == reg);
+            if (!isStore)
+              state_[reg] = Unknown;
+            else if (state_[reg] == NotWritten) {
+              state_[reg] = Constant;
+              values_[reg] = instr.StoreSmallInt.value;
+            }
+            else if(values_[reg] != instr.StoreSmallInt.value)
+              state_[reg] = Unknown;
+          }
+        }
+      }
+
+      /// \returns the constant in \p reg before the instruction at \p idx,
+      /// if it's known.
+      Optional<std::int16_t> get(std::size_t idx, regaddr_t reg) const {
+        if(state_[reg] == Constant) return values_[reg];
+        // Look for the instruction that wrote to the register in the
+        // instructions executed right before this one.
+        for (std::size_t steps = 0; (idx > 0) && (steps < 16); ++steps) {
+          if(targets_[idx]) return None;
+          do --idx; while(!starts_[idx]);
+          Instruction instr = instrs_[idx];
+          RegisterEffects effects = getRegisterEffects(instr);
+          if (!(effects.writes | effects.clobbers)[reg]) continue;
+          if(instr.opcode != Opcode::StoreSmallInt) return None;
+          return instr.StoreSmallInt.value;
+        }
+        return None;
+      }
+
+    private:
+      enum State : std::uint8_t { NotWritten, Constant, Unknown };
+
+      ArrayRef<Instruction> instrs_;
+      std::vector<bool> starts_;
+      std::vector<bool> targets_;
+      std::array<State, bc_limits::max_registers> state_;
+      std::array<std::int16_t, bc_limits::max_registers> values_;
+  };
+}
+
+/// \returns the instructions that compute \p src to the power of
+/// \p exponent into \p dest more cheaply than a PowInt, or an empty vector
+/// if there are none.
+static SmallVector<Instruction, 2>
+getPowIntReplacement(regaddr_t dest, regaddr_t src, std::int16_t exponent) {
+  // PowInt computes the power of the operands converted to doubles with
+  // std::pow, which returns 1 for x**0 and x itself for x**1, so x**1 is
+  // x converted to a double and back. These conversions are executed by
+  // the JIT, unlike PowInt. Other exponents aren't replaced: std::pow
+  // doesn't round x**2 like a multiplication of doubles when the square
+  // isn't exactly representable.
+  SmallVector<Instruction, 2> result;
+  if (exponent == 0) {
+    Instruction store(Opcode::StoreSmallInt);
+    store.StoreSmallInt.dest = dest;
+    store.StoreSmallInt.value = 1;
+    result.push_back(store);
+    return result;
+  }
+  if(exponent != 1) return result;
+  Instruction toDouble(Opcode::IntToDouble);
+  toDouble.IntToDouble.dest = dest;
+  toDouble.IntToDouble.src = src;
+  result.push_back(toDouble);
+  Instruction toInt(Opcode::DoubleToInt);
+  toInt.DoubleToInt.dest = dest;
+  toInt.DoubleToInt.src = dest;
+  result.push_back(toInt);
+  return result;
+}
+
+/// Replaces \p instr, a MulInt or MulIntImm that multiplies \p src by
+/// \p value, with a cheaper instruction if possible.
+/// \returns true if \p instr has been replaced.
+static bool reduceMulInt(Instruction& instr, regaddr_t src, 
+                         std::int16_t value) {
+  regaddr_t dest = *getWriteOperand(instr);
+  switch (value) {
+    case 0:
+      instr = Instruction(Opcode::StoreSmallInt);
+      instr.StoreSmallInt.dest = dest;
+      instr.StoreSmallInt.value = 0;
+      return true;
+    case 1:
+      instr = Instruction(Opcode::Copy);
+      instr.Copy.dest = dest;
+      instr.Copy.src = src;
+      return true;
+    case 2:
+      instr = Instruction(Opcode::AddInt);
+      instr.AddInt.dest = dest;
+      instr.AddInt.lhs = src;
+      instr.AddInt.rhs = src;
+      return true;
+    default:
+      if((value < bc_limits::immediate_min) 
+        || (value > bc_limits::immediate_max))
+        return false;
+      instr = Instruction(Opcode::MulIntImm);
+      instr.MulIntImm.dest = dest;
+      instr.MulIntImm.src = src;
+      instr.MulIntImm.imm = std::int8_t(value);
+      return true;
+  }
+}
+
+bool fox::reduceStrength(BCFunction& fn) {
+  InstructionVector& instrs = fn.getInstructions();
+  const std::size_t size = instrs.size();
+  KnownConstants constants(instrs);
+  // The new buffer, and the new index of every instruction.
+  InstructionVector newInstrs;
+  SmallVector<std::size_t, 64> newIndexes(size+1);
+  // The registers of the constants that are no longer read by the
+  // instructions replaced.
+  RegisterSet constantRegs;
+  bool changed = false;
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    newIndexes[idx] = newInstrs.size();
+    Instruction instr = instrs[idx];
+    if (instr.opcode == Opcode::PowInt) {
+      regaddr_t rhs = instr.PowInt.rhs;
+      auto exponent = constants.get(idx, rhs);
+      auto replacement = exponent ? 
+        getPowIntReplacement(instr.PowInt.dest, instr.PowInt.lhs, *exponent)
+        : SmallVector<Instruction, 2>();
+      if (!replacement.empty()) {
+        newInstrs.append(replacement.begin(), replacement.end());
+        constantRegs.set(rhs);
+        changed = true;
+        continue;
+      }
+    }
+    else if (instr.opcode == Opcode::MulIntImm) {
+      if((instr.MulIntImm.imm >= 0) && (instr.MulIntImm.imm <= 2))
+        changed |= reduceMulInt(instr, instr.MulIntImm.src, 
+                                instr.MulIntImm.imm);
+    }
+    else if (instr.opcode == Opcode::MulInt) {
+      regaddr_t lhs = instr.MulInt.lhs;
+      regaddr_t rhs = instr.MulInt.rhs;
+      if (auto value = constants.get(idx, rhs)) {
+        if (reduceMulInt(instr, lhs, *value)) {
+          constantRegs.set(rhs);
+          changed = true;
+        }
+      }
+      else if (auto value = constants.get(idx, lhs)) {
+        if (reduceMulInt(instr, rhs, *value)) {
+          constantRegs.set(lhs);
+          changed = true;
+        }
+      }
+    }
+    newInstrs.push_back(instr);
+  }
+  newIndexes[size] = newInstrs.size();
+  if(!changed) return false;
+
+  // Update the offsets of the jumps, which become longer when a PowInt
+  // is replaced by several instructions.
+  for (std::size_t idx = 0; idx < size; idx += instrs[idx].getLength()) {
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    std::ptrdiff_t offset = 
+        std::ptrdiff_t(newIndexes[getJumpTarget(instrs, slot.getValue())])
+      - std::ptrdiff_t(newIndexes[slot.getValue()] + 1);
+    if((offset < bc_limits::min_jump_offset)
+       || (offset > bc_limits::max_jump_offset))
+      return false;
+    setJumpOffset(newInstrs[newIndexes[slot.getValue()]], 
+                  jump_offset_t(offset));
+  }
+  instrs = std::move(newInstrs);
+  if (DebugInfo* debugInfo = fn.getDebugInfo())
+    debugInfo->remapInstructions(newIndexes, std::vector<bool>(size));
+
+  // Remove the stores of these constants that are no longer read, and the
+  // copies of a register to itself.
+  LivenessAnalysis liveness(instrs);
+  std::vector<bool> removed(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    const Instruction& instr = instrs[idx];
+    if (instr.opcode == Opcode::StoreSmallInt)
+      removed[idx] = constantRegs[instr.StoreSmallInt.dest]
+                  && !liveness.getLiveOut(idx)[instr.StoreSmallInt.dest];
+    else if(instr.opcode == Opcode::Copy)
+      removed[idx] = (instr.Copy.dest == instr.Copy.src);
+  }
+  removeInstructions(fn, removed);
+  fn.discardPreparedCode();
+  return true;
+}
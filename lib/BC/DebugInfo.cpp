@@ -26,7 +26,7 @@ Optional<SourceRange> DebugInfo::getSourceRange(std::size_t instrIdx) {
 
   auto ptr = ranges_lower_bound(instrIdx);
   // Only return "direct" hits.
-  if(ptr->first == instrIdx) 
+  if((ptr != ranges_.end()) && (ptr->first == instrIdx)) 
     return ptr->second;
   return None;
 }
@@ -34,3 +34,15 @@ Optional<SourceRange> DebugInfo::getSourceRange(std::size_t instrIdx) {
 ArrayRef<DebugInfo::IndexRangePair> DebugInfo::getRanges() const {
   return ranges_;
 }
+
+void DebugInfo::remapInstructions(ArrayRef<std::size_t> newIndexes,
+                                  const std::vector<bool>& removed) {
+  // Instructions are never reordered, so the vector stays sorted.
+  auto it = std::remove_if(ranges_.begin(), ranges_.end(), 
+    [&](const IndexRangePair& pair) {
+      return removed[pair.first];
+    });
+  ranges_.erase(it, ranges_.end());
+  for (IndexRangePair& pair : ranges_)
+    pair.first = newIndexes[pair.first];
+}
@@ -0,0 +1,231 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : Inlining.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file implements inlineCalls (see BCPasses.hpp), which replaces the
+//  direct calls to small functions with the code of these functions.
+//
+//  The code of the callee is placed in the register window the call would
+//  have given it: the registers of the callee are shifted by base+1, so
+//  its parameters are the arguments of the call. A call clobbers every
+//  register after its base, so the caller doesn't use these registers
+//  after the call. The returns of the callee copy their value to the
+//  destination of the call and jump to the code that follows the call.
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/BCAnalysis.hpp"
+#include "Fox/BC/BCFunction.hpp"
+#include "Fox/BC/BCModule.hpp"
+#include <algorithm>
+
+using namespace fox;
+
+/// \returns true if \p instr calls a function of the module.
+static bool isFunctionCall(Instruction instr) {
+  switch (instr.opcode) {
+    case Opcode::Call:
+    case Opcode::CallVoid:
+    case Opcode::CallFunc:
+    case Opcode::CallVoidFunc:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// \returns true if the calls to \p callee can be inlined into \p caller.
+/// The callee must be small, and must not call functions so it can't be
+/// recursive.
+static bool canInline(const BCFunction& caller, const BCFunction& callee) {
+  const InstructionVector& instrs = callee.getInstructions();
+  if(instrs.empty() || (instrs.size() > maxInlinedFunctionSize))
+    return false;
+  // The code inlined must keep the debug information of the callee so the
+  // runtime errors it causes are diagnosed at the right place.
+  if(caller.hasDebugInfo() && !callee.hasDebugInfo())
+    return false;
+  return std::none_of(instrs.begin(), instrs.end(), isFunctionCall);
+}
+
+/// Adds \p offset to every register operand of \p instr
+static void shiftRegisters(Instruction& instr, std::size_t offset) {
+  auto shift = [&](regaddr_t& reg) {
+    assert(((reg + offset) < bc_limits::max_registers)
+      && "register out of range");
+    reg = regaddr_t(reg + offset);
+  };
+  for (regaddr_t* operand : getReadOperands(instr))
+    shift(*operand);
+  if(regaddr_t* dest = getWriteOperand(instr))
+    shift(*dest);
+  if(regaddr_t* base = getCallBase(instr))
+    shift(*base);
+  if(instr.opcode == Opcode::ArrAppendRange)
+    shift(instr.ArrAppendRange.first);
+}
+
+namespace {
+  /// Creates the new instruction buffer of a function whose calls are
+  /// inlined.
+  class Inliner {
+    public:
+      Inliner(const BCFunction& fn) : fn_(fn) {}
+
+      /// Adds the instruction at \p idx in the function to the new buffer
+      void addInstruction(std::size_t idx) {
+        const InstructionVector& instrs = fn_.getInstructions();
+        const std::size_t newIdx = instrs_.size();
+        instrs_.push_back(instrs[idx]);
+        // The JumpOffset of a compare and jump is added right after it.
+        if (auto slot = getJumpSlot(instrs, idx)) {
+          callerJumps_.push_back({newIdx + (slot.getValue() - idx),
+                                  getJumpTarget(instrs, slot.getValue())});
+        }
+        addSourceRange(fn_.getDebugInfo(), idx, newIdx);
+      }
+
+      /// Adds the code of \p callee, whose register window begins at
+      /// \p window, to the new buffer. Its return value is copied to
+      /// \p dest if it's not None.
+      void addInlinedCode(const BCFunction& callee, std::size_t window,
+                          Optional<regaddr_t> dest) {
+        const InstructionVector& instrs = callee.getInstructions();
+        // Compute the index of every instruction of the callee in the new
+        // buffer: the returns become a copy and a jump.
+        SmallVector<std::size_t, 16> newIndexes(instrs.size()+1);
+        std::size_t newIdx = instrs_.size();
+        for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+          newIndexes[idx] = newIdx;
+          newIdx += ((instrs[idx].opcode == Opcode::Ret) && dest) ? 2 : 1;
+        }
+        newIndexes[instrs.size()] = newIdx;
+
+        // The returns jump to the end of the code, where the execution of
+        // the caller continues.
+        const std::size_t end = newIdx;
+        for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+          Instruction instr = instrs[idx];
+          if (instr.isAnyRet()) {
+            if ((instr.opcode == Opcode::Ret) && dest) {
+              Instruction copy(Opcode::Copy);
+              copy.Copy.dest = dest.getValue();
+              copy.Copy.src = regaddr_t(instr.Ret.reg + window);
+              instrs_.push_back(copy);
+            }
+            jumps_.push_back({instrs_.size(), end});
+            instrs_.push_back(Instruction(Opcode::Jump));
+            continue;
+          }
+          if (auto slot = getJumpSlot(instrs, idx)) {
+            jumps_.push_back({newIndexes[slot.getValue()],
+              newIndexes[getJumpTarget(instrs, slot.getValue())]});
+          }
+          shiftRegisters(instr, window);
+          addSourceRange(callee.getDebugInfo(), idx, instrs_.size());
+          instrs_.push_back(instr);
+        }
+        assert((instrs_.size() == end) && "wrong number of instructions");
+      }
+
+      /// Sets the offsets of the jumps of the new buffer, where
+      /// \p newIndexes contains the new index of every instruction of the
+      /// function.
+      /// \returns false if an offset doesn't fit in a jump.
+      bool resolveJumps(ArrayRef<std::size_t> newIndexes) {
+        for (const auto& jump : callerJumps_)
+          jumps_.push_back({jump.first, newIndexes[jump.second]});
+        for (const auto& jump : jumps_) {
+          std::ptrdiff_t offset = std::ptrdiff_t(jump.second)
+                                - std::ptrdiff_t(jump.first + 1);
+          if((offset < bc_limits::min_jump_offset)
+             || (offset > bc_limits::max_jump_offset))
+            return false;
+          setJumpOffset(instrs_[jump.first], jump_offset_t(offset));
+        }
+        return true;
+      }
+
+      /// \returns the new instruction buffer
+      InstructionVector& getInstructions() {
+        return instrs_;
+      }
+
+      /// \returns the SourceRanges of the instructions of the new buffer
+      ArrayRef<DebugInfo::IndexRangePair> getSourceRanges() const {
+        return ranges_;
+      }
+
+    private:
+      void addSourceRange(const DebugInfo* debugInfo, std::size_t idx,
+                          std::size_t newIdx) {
+        if(!debugInfo || !fn_.hasDebugInfo()) return;
+        auto ranges = debugInfo->getRanges();
+        auto it = std::lower_bound(ranges.begin(), ranges.end(), idx,
+          DebugInfo::IndexRangePairLessThanComparator());
+        if((it != ranges.end()) && (it->first == idx))
+          ranges_.push_back({newIdx, it->second});
+      }
+
+      const BCFunction& fn_;
+      InstructionVector instrs_;
+      /// The jumps of the new buffer and the index of their targets in the
+      /// new buffer.
+      SmallVector<std::pair<std::size_t, std::size_t>, 16> jumps_;
+      /// The jumps copied from the function and the index of their targets
+      /// in the function.
+      SmallVector<std::pair<std::size_t, std::size_t>, 16> callerJumps_;
+      SmallVector<DebugInfo::IndexRangePair, 16> ranges_;
+  };
+}
+
+bool fox::inlineCalls(BCFunction& fn, const BCModule& module) {
+  InstructionVector& instrs = fn.getInstructions();
+  const std::size_t size = instrs.size();
+  std::vector<std::size_t> newIndexes(size+1);
+  Inliner inliner(fn);
+  std::size_t numRegisters = fn.getNumRegisters();
+  bool changed = false;
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    newIndexes[idx] = inliner.getInstructions().size();
+    Instruction instr = instrs[idx];
+    const BCFunction* callee = nullptr;
+    Optional<regaddr_t> dest;
+    if (instr.opcode == Opcode::CallFunc) {
+      callee = &module.getFunction(instrs[idx+1].CallTarget.func);
+      dest = instr.CallFunc.dest;
+    }
+    else if (instr.opcode == Opcode::CallVoidFunc)
+      callee = &module.getFunction(instr.CallVoidFunc.func);
+    // The callee's register window must fit in the caller's.
+    std::size_t window = callee ? (std::size_t(*getCallBase(instr)) + 1) : 0;
+    if (!callee || !canInline(fn, *callee)
+      || ((window + callee->getNumRegisters()) > bc_limits::max_registers)) {
+      inliner.addInstruction(idx);
+      continue;
+    }
+    inliner.addInlinedCode(*callee, window, dest);
+    numRegisters = std::max(numRegisters, window + callee->getNumRegisters());
+    // Skip the CallTarget
+    if (instr.opcode == Opcode::CallFunc) {
+      ++idx;
+      newIndexes[idx] = inliner.getInstructions().size();
+    }
+    changed = true;
+  }
+  newIndexes[size] = inliner.getInstructions().size();
+  if(!changed || !inliner.resolveJumps(newIndexes)) return false;
+
+  instrs = std::move(inliner.getInstructions());
+  fn.setNumRegisters(numRegisters);
+  if (fn.hasDebugInfo()) {
+    fn.removeDebugInfo();
+    DebugInfo& debugInfo = fn.createDebugInfo();
+    for (const auto& pair : inliner.getSourceRanges())
+      debugInfo.addSourceRange(pair.first, pair.second);
+  }
+  fn.discardPreparedCode();
+  return true;
+}
@@ -35,11 +35,15 @@ const char* fox::to_string(Opcode op) {
 
 namespace {
   /// Because we use the unary+ to uprank uint8/int8 to a int (so it doesn't
-  /// print rubbish), we need to specify it for BuiltinKind so it works with
-  /// it too.
+  /// print rubbish), we need to specify it for BuiltinKind and ArrayElemKind
+  /// so it works with them too.
   BuiltinKind operator+(BuiltinKind id) {
     return id;
   }
+
+  ArrayElemKind operator+(ArrayElemKind kind) {
+    return kind;
+  }
 }
 
 void fox::dumpInstruction(std::ostream& os, Instruction instr) {
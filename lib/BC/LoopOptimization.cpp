@@ -0,0 +1,387 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : LoopOptimization.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file implements hoistLoopInvariantCode (see BCPasses.hpp), which
+//  moves the instructions that compute the same value at every iteration
+//  of a loop before that loop.
+//
+//  An instruction is invariant when none of the registers it reads are
+//  modified by the loop. When the register it writes isn't written by any
+//  other instruction of the loop and isn't read before it, it's moved as
+//  is. Otherwise, its value is placed in a register that the loop doesn't
+//  use, and the instructions that read its value are changed to read
+//  that register instead, as long as they are in the straight-line code
+//  that follows it.
+//
+//  The instructions moved are placed right before the header of the
+//  loop: the jumps that enter the loop jump to them, and the jumps of the
+//  loop that go back to the header still jump to the header.
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/BCAnalysis.hpp"
+#include "Fox/BC/BCFunction.hpp"
+#include "Fox/Common/BuiltinKinds.hpp"
+#include <algorithm>
+#include <array>
+
+using namespace fox;
+
+namespace {
+  /// A loop: the instructions between its header, the target of a
+  /// backward jump, and the last backward jump to the header (included).
+  struct Loop {
+    std::size_t header;
+    std::size_t end;
+
+    std::size_t size() const {
+      return end - header;
+    }
+
+    bool contains(std::size_t idx) const {
+      return (idx >= header) && (idx < end);
+    }
+  };
+
+  /// What the instructions of a loop can modify besides registers
+  struct LoopSideEffects {
+    /// Whether the loop can change the size of an array
+    bool resizesArrays = false;
+    /// Whether the loop can change the value of a global variable
+    bool writesGlobals = false;
+  };
+}
+
+/// \returns the loops of \p instrs in which no jump from outside of the
+/// loop can enter, the innermost loops first.
+static SmallVector<Loop, 8> findLoops(ArrayRef<Instruction> instrs) {
+  SmallVector<Loop, 8> loops;
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    std::size_t target = getJumpTarget(instrs, slot.getValue());
+    if(target > idx) continue;
+    auto it = std::find_if(loops.begin(), loops.end(),
+      [&](const Loop& loop) { return loop.header == target; });
+    if(it != loops.end())
+      it->end = std::max(it->end, slot.getValue() + 1);
+    else
+      loops.push_back({target, slot.getValue() + 1});
+  }
+
+  // Remove the loops that can be entered by jumping past their header
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    std::size_t target = getJumpTarget(instrs, slot.getValue());
+    loops.erase(std::remove_if(loops.begin(), loops.end(),
+      [&](const Loop& loop) {
+        return !loop.contains(idx) && loop.contains(target)
+            && (target != loop.header);
+      }), loops.end());
+  }
+
+  std::stable_sort(loops.begin(), loops.end(),
+    [](const Loop& lhs, const Loop& rhs) { return lhs.size() < rhs.size(); });
+  return loops;
+}
+
+/// \returns what the instructions of \p loop can modify, other than their
+/// registers.
+static LoopSideEffects getSideEffects(ArrayRef<Instruction> instrs,
+                                      const Loop& loop) {
+  LoopSideEffects effects;
+  for (std::size_t idx = loop.header; idx < loop.end;
+       idx += instrs[idx].getLength()) {
+    Instruction instr = instrs[idx];
+    switch (instr.opcode) {
+      case Opcode::ArrAppend:
+      case Opcode::ArrAppendRange:
+        effects.resizesArrays = true;
+        break;
+      case Opcode::SetGlobal:
+        effects.writesGlobals = true;
+        break;
+      case Opcode::CallBuiltin:
+        effects.resizesArrays |= !isPure(instr.CallBuiltin.id);
+        break;
+      case Opcode::CallVoidBuiltin:
+        effects.resizesArrays |= !isPure(instr.CallVoidBuiltin.id);
+        break;
+      case Opcode::Call:
+      case Opcode::CallVoid:
+      case Opcode::CallFunc:
+      case Opcode::CallVoidFunc:
+        effects.resizesArrays = true;
+        effects.writesGlobals = true;
+        break;
+      default:
+        break;
+    }
+  }
+  return effects;
+}
+
+/// \returns true if \p instr can be moved out of a loop with the side
+/// effects \p effects when its operands are invariant: it can't fail, has
+/// no side effects, and doesn't allocate a new object.
+static bool isHoistable(Instruction instr, const LoopSideEffects& effects) {
+  switch (instr.opcode) {
+    case Opcode::StoreSmallInt:
+    case Opcode::Copy:
+    case Opcode::LoadIntK:
+    case Opcode::LoadDoubleK:
+    case Opcode::LoadFunc:
+    case Opcode::LoadBuiltinFunc:
+    // Strings are immutable
+    case Opcode::StrLen:
+    case Opcode::AddInt:
+    case Opcode::AddDouble:
+    case Opcode::SubInt:
+    case Opcode::SubDouble:
+    case Opcode::MulInt:
+    case Opcode::MulDouble:
+    case Opcode::PowInt:
+    case Opcode::PowDouble:
+    case Opcode::NegInt:
+    case Opcode::NegDouble:
+    case Opcode::AddIntImm:
+    case Opcode::SubIntImm:
+    case Opcode::MulIntImm:
+    case Opcode::EqInt:
+    case Opcode::LEInt:
+    case Opcode::LTInt:
+    case Opcode::EqDouble:
+    case Opcode::LEDouble:
+    case Opcode::LTDouble:
+    case Opcode::GEDouble:
+    case Opcode::GTDouble:
+    case Opcode::LAnd:
+    case Opcode::LOr:
+    case Opcode::LNot:
+    case Opcode::IntToDouble:
+    case Opcode::DoubleToInt:
+      return true;
+    case Opcode::ArrSize:
+      return !effects.resizesArrays;
+    case Opcode::GetGlobal:
+      return !effects.writesGlobals;
+    default:
+      return false;
+  }
+}
+
+namespace {
+  /// Finds the invariant instructions of a loop and changes the code of
+  /// the loop so they can be moved before it.
+  class LoopHoister {
+    public:
+      LoopHoister(const BCFunction& fn, const Loop& loop)
+        : instrs_(fn.getInstructions()), loop_(loop),
+          liveness_(fn.getInstructions()),
+          targets_(getJumpTargets(fn.getInstructions())),
+          hoisted_(fn.getInstructions().size()),
+          numRegisters_(fn.getNumRegisters()) {
+        writeCounts_.fill(0);
+        for (std::size_t idx = loop.header; idx < loop.end;
+             idx += instrs_[idx].getLength()) {
+          RegisterEffects effects = getRegisterEffects(instrs_[idx]);
+          RegisterSet modified = effects.writes | effects.clobbers;
+          used_ |= effects.reads | modified;
+          for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+            if(modified[reg]) ++writeCounts_[reg];
+        }
+      }
+
+      /// Finds the instructions of the loop that can be moved before it.
+      /// \returns true if there are any.
+      bool run(const LoopSideEffects& effects) {
+        bool changed = false;
+        for (std::size_t idx = loop_.header; idx < loop_.end;
+             idx += instrs_[idx].getLength()) {
+          Instruction instr = instrs_[idx];
+          if(!isHoistable(instr, effects)) continue;
+          RegisterEffects regEffects = getRegisterEffects(instr);
+          if(isModified(regEffects.reads)) continue;
+          regaddr_t dest = *getWriteOperand(instr);
+          // Move the instruction as is if the loop doesn't read the value
+          // of its destination before the instruction writes it, and
+          // doesn't write it elsewhere.
+          if ((writeCounts_[dest] == 1)
+              && !liveness_.getLiveIn(loop_.header)[dest]) {
+            hoisted_[idx] = true;
+            --writeCounts_[dest];
+            changed = true;
+            continue;
+          }
+          changed |= hoistToNewRegister(idx);
+        }
+        return changed;
+      }
+
+      /// \returns the instructions of the function, where the instructions
+      /// that read the value of the instructions moved to a new register
+      /// read that register.
+      InstructionVector& getInstructions() {
+        return instrs_;
+      }
+
+      /// \returns whether each instruction of the function is moved before
+      /// the loop.
+      const std::vector<bool>& getHoisted() const {
+        return hoisted_;
+      }
+
+      /// \returns the number of registers of the function, including the
+      /// new registers.
+      std::size_t getNumRegisters() const {
+        return numRegisters_;
+      }
+
+    private:
+      /// \returns true if the loop modifies a register of \p regs
+      bool isModified(const RegisterSet& regs) const {
+        for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+          if(regs[reg] && writeCounts_[reg]) return true;
+        return false;
+      }
+
+      /// \returns a register that the loop doesn't use and whose value
+      /// isn't used after the loop, or None if there are none.
+      Optional<regaddr_t> findFreeRegister() const {
+        const RegisterSet& liveIn = liveness_.getLiveIn(loop_.header);
+        for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+          if(!used_[reg] && !liveIn[reg]) return regaddr_t(reg);
+        return None;
+      }
+
+      /// Moves the instruction at \p idx, which is invariant, to a
+      /// register that the loop doesn't use, if the instructions that read
+      /// its value are in the straight-line code that follows it.
+      /// \returns true if the instruction is moved.
+      bool hoistToNewRegister(std::size_t idx) {
+        regaddr_t dest = *getWriteOperand(instrs_[idx]);
+        auto reg = findFreeRegister();
+        if(!reg) return false;
+        // The instructions whose operands must be replaced
+        SmallVector<regaddr_t*, 8> reads;
+        for (std::size_t cur = idx + instrs_[idx].getLength(); ;
+             cur += instrs_[cur].getLength()) {
+          if(cur >= loop_.end) return false;
+          // The value can come from another path.
+          if (targets_[cur]) {
+            if(liveness_.getLiveIn(cur)[dest]) return false;
+            break;
+          }
+          Instruction& instr = instrs_[cur];
+          RegisterEffects effects = getRegisterEffects(instr);
+          if (effects.reads[dest]) {
+            std::size_t numReads = reads.size();
+            for (regaddr_t* operand : getReadOperands(instr))
+              if(*operand == dest) reads.push_back(operand);
+            // The value is read because of its position
+            if(reads.size() == numReads) return false;
+          }
+          if((effects.writes | effects.clobbers)[dest]) break;
+          if (getJumpSlot(instrs_, cur) || isTerminator(instr)) {
+            if(liveness_.getLiveOut(cur)[dest]) return false;
+            break;
+          }
+        }
+        for (regaddr_t* operand : reads)
+          *operand = *reg;
+        *getWriteOperand(instrs_[idx]) = *reg;
+        hoisted_[idx] = true;
+        --writeCounts_[dest];
+        used_.set(*reg);
+        numRegisters_ = std::max(numRegisters_, std::size_t(*reg) + 1);
+        return true;
+      }
+
+      InstructionVector instrs_;
+      const Loop& loop_;
+      LivenessAnalysis liveness_;
+      std::vector<bool> targets_;
+      std::vector<bool> hoisted_;
+      std::size_t numRegisters_;
+      /// The registers used by the instructions of the loop
+      RegisterSet used_;
+      /// The number of instructions of the loop that modify each register
+      std::array<std::uint16_t, bc_limits::max_registers> writeCounts_;
+  };
+}
+
+/// Moves the invariant instructions of \p loop, in \p fn, before it.
+/// \returns true if \p fn has been changed.
+static bool hoistLoop(BCFunction& fn, const Loop& loop) {
+  LoopHoister hoister(fn, loop);
+  if(!hoister.run(getSideEffects(fn.getInstructions(), loop)))
+    return false;
+  InstructionVector& instrs = hoister.getInstructions();
+  const std::vector<bool>& hoisted = hoister.getHoisted();
+  const std::size_t size = instrs.size();
+
+  // Create the new buffer, where the instructions moved are right before
+  // the header.
+  InstructionVector newInstrs;
+  std::vector<std::size_t> newIndexes(size+1);
+  for (std::size_t idx = 0; idx < loop.header; ++idx) {
+    newIndexes[idx] = newInstrs.size();
+    newInstrs.push_back(instrs[idx]);
+  }
+  const std::size_t preheader = newInstrs.size();
+  for (std::size_t idx = loop.header; idx < loop.end; ++idx)
+    if(hoisted[idx]) newInstrs.push_back(instrs[idx]);
+  for (std::size_t idx = loop.header; idx < size; ++idx) {
+    newIndexes[idx] = newInstrs.size();
+    if(!hoisted[idx]) newInstrs.push_back(instrs[idx]);
+  }
+  newIndexes[size] = newInstrs.size();
+
+  // The jumps that enter the loop jump to the instructions moved.
+  for (std::size_t idx = 0; idx < size; idx += instrs[idx].getLength()) {
+    auto slot = getJumpSlot(instrs, idx);
+    if(!slot) continue;
+    std::size_t target = getJumpTarget(instrs, slot.getValue());
+    std::size_t newTarget = ((target == loop.header) && !loop.contains(idx))
+                          ? preheader : newIndexes[target];
+    std::ptrdiff_t offset = std::ptrdiff_t(newTarget)
+                          - std::ptrdiff_t(newIndexes[slot.getValue()] + 1);
+    if((offset < bc_limits::min_jump_offset)
+       || (offset > bc_limits::max_jump_offset))
+      return false;
+    setJumpOffset(newInstrs[newIndexes[slot.getValue()]],
+                  jump_offset_t(offset));
+  }
+
+  fn.getInstructions() = std::move(newInstrs);
+  fn.setNumRegisters(hoister.getNumRegisters());
+  // The instructions moved can't fail, so they don't need their
+  // SourceRanges.
+  if (DebugInfo* debugInfo = fn.getDebugInfo())
+    debugInfo->remapInstructions(newIndexes, hoisted);
+  return true;
+}
+
+bool fox::hoistLoopInvariantCode(BCFunction& fn) {
+  bool changed = false;
+  // Move the code out of one loop at a time, as this changes the indexes
+  // of the instructions.
+  bool hoisted = true;
+  while (hoisted) {
+    hoisted = false;
+    for (const Loop& loop : findLoops(fn.getInstructions())) {
+      if (hoistLoop(fn, loop)) {
+        hoisted = changed = true;
+        break;
+      }
+    }
+  }
+  if(changed) fn.discardPreparedCode();
+  return changed;
+}
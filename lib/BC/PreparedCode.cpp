@@ -0,0 +1,94 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : PreparedCode.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/PreparedCode.hpp"
+#include "Fox/Common/Errors.hpp"
+
+using namespace fox;
+
+/// \returns the absolute index of the target of a jump located at index
+/// \p idx with offset \p offset in a buffer of \p size instructions.
+static std::int32_t
+resolveJump(std::size_t idx, jump_offset_t offset, std::size_t size) {
+  // The offset is relative to the next instruction
+  std::ptrdiff_t target = std::ptrdiff_t(idx) + 1 + offset;
+  // Note: jumps are allowed to target the end of the buffer. This happens
+  // when a dead jump follows the last return of a function.
+  assert((target >= 0) && (std::size_t(target) <= size)
+    && "jump target is out of the instruction buffer");
+  return static_cast<std::int32_t>(target);
+}
+
+void PreparedCode::prepare(ArrayRef<const void*> handlers) {
+  const std::size_t size = instrs_.size();
+  code_.resize(size);
+  for (std::size_t idx = 0; idx < size; ++idx) {
+    Instruction instr = instrs_[idx];
+    PreparedInstruction& prepared = code_[idx];
+    if (handlers.empty())
+      prepared.opcode = instr.opcode;
+    else {
+      assert((std::size_t(instr.opcode) < handlers.size())
+        && "no handler for this opcode");
+      prepared.handler = handlers[std::size_t(instr.opcode)];
+    }
+    // Copy the operands
+    #define SIMPLE_INSTR(ID)\
+      case Opcode::ID: break;
+    #define TERNARY_INSTR(ID, I1, T1, I2, T2, I3, T3)\
+      case Opcode::ID: prepared.ID.I1 = instr.ID.I1;\
+                       prepared.ID.I2 = instr.ID.I2;\
+                       prepared.ID.I3 = instr.ID.I3; break;
+    #define BINARY_INSTR(ID, I1, T1, I2, T2)\
+      case Opcode::ID: prepared.ID.I1 = instr.ID.I1;\
+                       prepared.ID.I2 = instr.ID.I2; break;
+    #define UNARY_INSTR(ID, I1, T1)\
+      case Opcode::ID: prepared.ID.I1 = instr.ID.I1; break;
+    switch (instr.opcode) {
+      #include "Fox/BC/Instruction.def"
+      default: fox_unreachable("unknown Opcode");
+    }
+    // Resolve the targets of jumps
+    switch (instr.opcode) {
+      case Opcode::Jump:
+        prepared.Jump.offset = resolveJump(idx, instr.Jump.offset, size);
+        break;
+      case Opcode::JumpIf:
+        prepared.JumpIf.offset = resolveJump(idx, instr.JumpIf.offset, size);
+        break;
+      case Opcode::JumpIfNot:
+        prepared.JumpIfNot.offset =
+          resolveJump(idx, instr.JumpIfNot.offset, size);
+        break;
+      // The offset of fused compare and jumps is in the JumpOffset
+      // instruction that follows them.
+      #define COMPARE_JUMP_INSTR(ID)                                          \
+      case Opcode::ID:                                                        \
+        assert(((idx+1) < size)                                               \
+          && (instrs_[idx+1].opcode == Opcode::JumpOffset)                    \
+          && "compare and jump not followed by a JumpOffset");                \
+        prepared.ID.offset =                                                  \
+          resolveJump(idx+1, instrs_[idx+1].JumpOffset.offset, size);         \
+        break;
+      // The function called by direct calls is in the CallTarget instruction
+      // that follows them.
+      #define DIRECT_CALL_INSTR(ID)                                           \
+      case Opcode::ID:                                                        \
+        assert(((idx+1) < size)                                               \
+          && (instrs_[idx+1].opcode == Opcode::CallTarget)                    \
+          && "direct call not followed by a CallTarget");                     \
+        prepared.ID.func = instrs_[idx+1].CallTarget.func;                    \
+        break;
+      #include "Fox/BC/Instruction.def"
+      default:
+        assert(!instr.isAnyJump() && "unhandled jump instruction");
+        break;
+    }
+  }
+  handlers_ = handlers.data();
+  prepared_ = true;
+}
@@ -0,0 +1,620 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : RegisterAllocation.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+//  This file implements allocateRegisters (see BCPasses.hpp), which
+//  reallocates the registers of a function with linear scan.
+//
+//  Each instruction has 2 points: the operands are read at the first one,
+//  and the result is written at the second one, so the result can be
+//  written in the register of an operand that isn't read after it.
+//  The values of the function are the webs of its registers: the points
+//  where a register is live, grouped by the control flow that connects
+//  them. The live range of a web is the interval between its first and
+//  its last point.
+//
+//  The webs are then given the lowest register that's free during their
+//  whole live range, in the order in which their live ranges begin. The
+//  elements of windows (the arguments of calls and the elements of
+//  ArrAppendRange) must be in consecutive registers, so the windows are
+//  placed after the other webs, at the lowest position that doesn't
+//  overlap the webs already placed. A call clobbers the registers after
+//  its base, so the base of a call is after every web that's live across
+//  it.
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/BCAnalysis.hpp"
+#include "Fox/BC/BCFunction.hpp"
+#include "Fox/BC/BCModule.hpp"
+#include "Fox/Common/BuiltinKinds.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+using namespace fox;
+
+/// \returns the number of arguments of the call at \p idx in \p instrs,
+/// or None if the function called isn't known.
+static Optional<std::size_t> getNumCallArgs(ArrayRef<Instruction> instrs,
+                                            std::size_t idx,
+                                            const BCModule& module) {
+  Instruction instr = instrs[idx];
+  switch (instr.opcode) {
+    case Opcode::CallFunc:
+      return module.getFunction(instrs[idx+1].CallTarget.func).getNumParams();
+    case Opcode::CallVoidFunc:
+      return module.getFunction(instr.CallVoidFunc.func).getNumParams();
+    case Opcode::CallBuiltin:
+      return getNumArgs(instr.CallBuiltin.id);
+    case Opcode::CallVoidBuiltin:
+      return getNumArgs(instr.CallVoidBuiltin.id);
+    default:
+      return None;
+  }
+}
+
+/// Computes the effects of the instructions of \p instrs in \p effects.
+/// Calls only read their arguments instead of every register after their
+/// base.
+/// \returns false if the arguments of a call aren't known.
+static bool getPreciseEffects(ArrayRef<Instruction> instrs,
+                              const BCModule& module,
+                              std::vector<RegisterEffects>& effects) {
+  effects.resize(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size();
+       idx += instrs[idx].getLength()) {
+    Instruction instr = instrs[idx];
+    effects[idx] = getRegisterEffects(instr);
+    regaddr_t* base = getCallBase(instr);
+    if(!base) continue;
+    Optional<std::size_t> numArgs = getNumCallArgs(instrs, idx, module);
+    if(!numArgs) return false;
+    std::size_t last = std::size_t(*base) + numArgs.getValue();
+    if(last > bc_limits::max_regaddr) return false;
+    effects[idx].reads.reset();
+    for (std::size_t reg = std::size_t(*base)+1; reg <= last; ++reg)
+      effects[idx].reads.set(reg);
+  }
+  return true;
+}
+
+namespace {
+  /// \returns the point where the instruction at \p idx reads its operands
+  std::size_t getReadPoint(std::size_t idx) {
+    return 2*idx;
+  }
+
+  /// \returns the point where the instruction at \p idx writes its result
+  std::size_t getWritePoint(std::size_t idx) {
+    return (2*idx)+1;
+  }
+
+  /// A web: a value of the function
+  struct Web {
+    /// \returns true if the live range of this web overlaps [start, end]
+    bool overlaps(std::size_t otherStart, std::size_t otherEnd) const {
+      return (start <= otherEnd) && (otherStart <= end);
+    }
+
+    /// The first point of the live range
+    std::size_t start = ~std::size_t(0);
+    /// The last point of the live range
+    std::size_t end = 0;
+    /// The register the web must be in because it's live when the function
+    /// begins (e.g. a parameter), or -1
+    int pinnedReg = -1;
+    /// The register allocated to the web, or -1
+    int reg = -1;
+    /// The web copied to this web, whose register is tried first, or -1
+    int copyOf = -1;
+    /// True if this web is the element of a window
+    bool inWindow = false;
+    /// The windows of the calls this web is live across
+    SmallVector<std::size_t, 2> liveAcross;
+  };
+
+  /// Webs that must be in consecutive registers: the arguments of a call
+  /// or the elements of an ArrAppendRange.
+  struct Window {
+    /// The index of the instruction
+    std::size_t idx = 0;
+    /// True if the instruction is a call
+    bool isCall = false;
+    /// The webs of the elements, in order
+    SmallVector<std::size_t, 4> elems;
+    /// The webs that are live across the call
+    SmallVector<std::size_t, 4> liveAcross;
+    /// The register of the first element, or -1
+    int first = -1;
+  };
+
+  class LinearScan {
+    public:
+      /// \param instrs the instructions
+      /// \param effects the effects of the instructions (see
+      ///        getPreciseEffects)
+      LinearScan(ArrayRef<Instruction> instrs,
+                 ArrayRef<RegisterEffects> effects);
+
+      /// Allocates a register to every web. If \p coalesceArgs is true,
+      /// the webs copied to an argument for their last use are placed in
+      /// the register of the argument.
+      /// \returns false if the allocation failed.
+      bool allocate(bool coalesceArgs);
+
+      /// Replaces the registers of \p instrs (a copy of the instructions)
+      /// with the registers allocated.
+      /// \returns true if an instruction has been changed
+      bool rewrite(MutableArrayRef<Instruction> instrs) const;
+
+      /// \returns the number of registers used by the allocation
+      std::size_t getNumRegisters() const;
+
+    private:
+      /// \returns the node of register \p reg at \p idx: its value before
+      /// the instruction, or the value written by the instruction if
+      /// \p isDef is true.
+      unsigned getNode(std::size_t idx, std::size_t reg, bool isDef) const;
+
+      /// Creates the node of register \p reg at \p idx (see getNode)
+      /// if it doesn't exist yet, and adds \p point to its range.
+      void addNode(std::size_t idx, std::size_t reg, bool isDef,
+                   std::size_t point);
+
+      /// \returns the representative of the web of \p node
+      unsigned find(unsigned node);
+
+      /// \returns the web of \p node. Only valid during an allocation.
+      Web& getWeb(unsigned node) {
+        return webs_[webOfNode_[node]];
+      }
+
+      /// \returns the web of \p node. Only valid during an allocation.
+      const Web& getWeb(unsigned node) const {
+        return webs_[webOfNode_[node]];
+      }
+
+      /// Merges the webs copied to an argument for their last use with the
+      /// argument's web.
+      void coalesceArguments();
+
+      /// Creates the webs from the nodes
+      void createWebs();
+
+      /// Creates the windows of the instructions.
+      /// \returns false if an argument is live after its call.
+      bool createWindows();
+
+      /// \returns true if register \p reg is free during the live range of
+      /// \p web
+      bool isFree(std::size_t reg, const Web& web) const;
+
+      /// Allocates register \p reg to \p web
+      void assign(Web& web, std::size_t reg);
+
+      /// Allocates the registers of the webs that aren't in windows, and of
+      /// the pinned webs.
+      bool assignWebs();
+
+      /// \returns true if the elements of \p window can begin at \p first
+      bool canPlace(const Window& window, std::size_t first) const;
+
+      /// Places the windows.
+      bool assignWindows();
+
+      ArrayRef<Instruction> instrs_;
+      ArrayRef<RegisterEffects> effects_;
+      LivenessAnalysis liveness_;
+      std::vector<bool> starts_;
+
+      /// The nodes: the value of a register at an instruction
+      std::unordered_map<std::size_t, unsigned> nodeIDs_;
+      /// The first and last point of each node
+      std::vector<std::pair<std::size_t, std::size_t>> nodeRanges_;
+      /// The union-find forest of the nodes connected by the control flow
+      std::vector<unsigned> flowParents_;
+
+      // The state of the current allocation
+      std::vector<unsigned> parents_;
+      std::vector<std::size_t> webOfNode_;
+      std::vector<Web> webs_;
+      std::vector<Window> windows_;
+      std::vector<int> windowOfInstr_;
+      /// The live ranges of the webs allocated to each register
+      std::vector<SmallVector<std::pair<std::size_t, std::size_t>, 8>>
+        occupied_;
+  };
+}
+
+LinearScan::LinearScan(ArrayRef<Instruction> instrs,
+                       ArrayRef<RegisterEffects> effects)
+  : instrs_(instrs), effects_(effects), liveness_(instrs, effects),
+    starts_(getInstructionStarts(instrs)) {
+  // Create the nodes
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    const RegisterSet& liveIn = liveness_.getLiveIn(idx);
+    const RegisterSet& liveOut = liveness_.getLiveOut(idx);
+    const RegisterSet& writes = effects_[idx].writes;
+    for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg) {
+      if (liveIn[reg]) {
+        addNode(idx, reg, false, getReadPoint(idx));
+        // The value of a register that the instruction doesn't write is
+        // live after it.
+        if(liveOut[reg] && !writes[reg])
+          addNode(idx, reg, false, getWritePoint(idx));
+      }
+      if(writes[reg])
+        addNode(idx, reg, true, getWritePoint(idx));
+    }
+  }
+
+  // Connect the value live after each instruction with the value before
+  // its successors.
+  flowParents_.resize(nodeRanges_.size());
+  for (unsigned node = 0; node < flowParents_.size(); ++node)
+    flowParents_[node] = node;
+  parents_ = flowParents_;
+  SmallVector<std::size_t, 2> succs;
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    succs.clear();
+    getSuccessors(instrs_, idx, succs);
+    const RegisterSet& liveOut = liveness_.getLiveOut(idx);
+    for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg) {
+      if(!liveOut[reg]) continue;
+      unsigned out = find(getNode(idx, reg, effects_[idx].writes[reg]));
+      for (std::size_t succ : succs) {
+        if((succ == instrs_.size()) || !liveness_.getLiveIn(succ)[reg])
+          continue;
+        unsigned in = find(getNode(succ, reg, false));
+        parents_[in] = out;
+      }
+    }
+  }
+  flowParents_ = parents_;
+}
+
+unsigned
+LinearScan::getNode(std::size_t idx, std::size_t reg, bool isDef) const {
+  auto it = nodeIDs_.find((((idx * bc_limits::max_registers) + reg) << 1)
+                          | std::size_t(isDef));
+  assert((it != nodeIDs_.end()) && "the register isn't live");
+  return it->second;
+}
+
+void LinearScan::addNode(std::size_t idx, std::size_t reg, bool isDef,
+                         std::size_t point) {
+  std::size_t key = (((idx * bc_limits::max_registers) + reg) << 1)
+                  | std::size_t(isDef);
+  auto result = nodeIDs_.insert({key, unsigned(nodeRanges_.size())});
+  if (result.second) {
+    nodeRanges_.push_back({point, point});
+    return;
+  }
+  auto& range = nodeRanges_[result.first->second];
+  range.first = std::min(range.first, point);
+  range.second = std::max(range.second, point);
+}
+
+unsigned LinearScan::find(unsigned node) {
+  while (parents_[node] != node) {
+    parents_[node] = parents_[parents_[node]];
+    node = parents_[node];
+  }
+  return node;
+}
+
+bool LinearScan::allocate(bool coalesceArgs) {
+  parents_ = flowParents_;
+  if(coalesceArgs) coalesceArguments();
+  createWebs();
+  return createWindows() && assignWebs() && assignWindows();
+}
+
+void LinearScan::coalesceArguments() {
+  // Compute the live range of every web, and find the webs that are
+  // elements of windows. The webs that are pinned or live across a call
+  // are constrained, and aren't merged with arguments so the windows can
+  // still be placed.
+  std::vector<std::pair<std::size_t, std::size_t>> ranges(nodeRanges_);
+  for (unsigned node = 0; node < nodeRanges_.size(); ++node) {
+    auto& range = ranges[find(node)];
+    range.first = std::min(range.first, nodeRanges_[node].first);
+    range.second = std::max(range.second, nodeRanges_[node].second);
+  }
+  std::vector<bool> isElem(nodeRanges_.size());
+  std::vector<bool> isConstrained(nodeRanges_.size());
+  const RegisterSet& entryLiveIn = liveness_.getLiveIn(0);
+  for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+    if(entryLiveIn[reg]) isConstrained[find(getNode(0, reg, false))] = true;
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    Instruction instr = instrs_[idx];
+    if(!getCallBase(instr)) continue;
+    const RegisterEffects& effects = effects_[idx];
+    RegisterSet liveAcross = liveness_.getLiveIn(idx)
+                           & liveness_.getLiveOut(idx) & ~effects.writes;
+    for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg) {
+      if(effects.reads[reg]) isElem[find(getNode(idx, reg, false))] = true;
+      else if (liveAcross[reg])
+        isConstrained[find(getNode(idx, reg, false))] = true;
+    }
+  }
+
+  // Merge the web of a value copied for its last use with the argument
+  // web it's copied to, if the live range of the value ends before the
+  // argument's begins.
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    Instruction instr = instrs_[idx];
+    if((instr.opcode != Opcode::Copy) || (instr.Copy.dest == instr.Copy.src))
+      continue;
+    if(liveness_.getLiveOut(idx)[instr.Copy.src]) continue;
+    unsigned src = find(getNode(idx, instr.Copy.src, false));
+    unsigned dest = find(getNode(idx, instr.Copy.dest, true));
+    if(!isElem[dest] || isElem[src] || isConstrained[src]) continue;
+    if(ranges[src].second >= ranges[dest].first) continue;
+    parents_[src] = dest;
+    ranges[dest].first = ranges[src].first;
+  }
+}
+
+void LinearScan::createWebs() {
+  webs_.clear();
+  webOfNode_.assign(nodeRanges_.size(), 0);
+  std::vector<int> webOfRoot(nodeRanges_.size(), -1);
+  for (unsigned node = 0; node < nodeRanges_.size(); ++node) {
+    unsigned root = find(node);
+    if (webOfRoot[root] < 0) {
+      webOfRoot[root] = int(webs_.size());
+      webs_.emplace_back();
+    }
+    webOfNode_[node] = std::size_t(webOfRoot[root]);
+    Web& web = webs_[webOfNode_[node]];
+    web.start = std::min(web.start, nodeRanges_[node].first);
+    web.end = std::max(web.end, nodeRanges_[node].second);
+  }
+
+  // The registers that are live when the function begins contain its
+  // parameters.
+  const RegisterSet& entryLiveIn = liveness_.getLiveIn(0);
+  for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg)
+    if(entryLiveIn[reg]) getWeb(getNode(0, reg, false)).pinnedReg = int(reg);
+
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    Instruction instr = instrs_[idx];
+    if((instr.opcode != Opcode::Copy) || (instr.Copy.dest == instr.Copy.src))
+      continue;
+    std::size_t src = webOfNode_[getNode(idx, instr.Copy.src, false)];
+    Web& dest = getWeb(getNode(idx, instr.Copy.dest, true));
+    if((dest.copyOf < 0) && (&webs_[src] != &dest)) dest.copyOf = int(src);
+  }
+}
+
+bool LinearScan::createWindows() {
+  windows_.clear();
+  windowOfInstr_.assign(instrs_.size(), -1);
+  for (std::size_t idx = 0; idx < instrs_.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    Instruction instr = instrs_[idx];
+    Window window;
+    window.idx = idx;
+    if (instr.opcode == Opcode::ArrAppendRange) {
+      std::size_t first = instr.ArrAppendRange.first;
+      for (std::size_t k = 0; k < instr.ArrAppendRange.n; ++k)
+        window.elems.push_back(webOfNode_[getNode(idx, first+k, false)]);
+    }
+    else if (regaddr_t* base = getCallBase(instr)) {
+      window.isCall = true;
+      const RegisterSet& liveIn = liveness_.getLiveIn(idx);
+      const RegisterSet& liveOut = liveness_.getLiveOut(idx);
+      const RegisterEffects& effects = effects_[idx];
+      for (std::size_t reg = 0; reg < bc_limits::max_registers; ++reg) {
+        if (effects.reads[reg]) {
+          // The arguments are clobbered by the call
+          if(liveOut[reg] && !effects.writes[reg]) return false;
+          window.elems.push_back(webOfNode_[getNode(idx, reg, false)]);
+        }
+        else if (liveIn[reg] && liveOut[reg] && !effects.writes[reg]) {
+          std::size_t web = webOfNode_[getNode(idx, reg, false)];
+          window.liveAcross.push_back(web);
+          webs_[web].liveAcross.push_back(windows_.size());
+        }
+      }
+      assert(((window.elems.size() + *base) <= bc_limits::max_regaddr)
+        && "too many arguments");
+    }
+    else
+      continue;
+    for (std::size_t elem : window.elems)
+      webs_[elem].inWindow = true;
+    windowOfInstr_[idx] = int(windows_.size());
+    windows_.push_back(window);
+  }
+  return true;
+}
+
+bool LinearScan::isFree(std::size_t reg, const Web& web) const {
+  for (const auto& range : occupied_[reg])
+    if(web.overlaps(range.first, range.second)) return false;
+  return true;
+}
+
+void LinearScan::assign(Web& web, std::size_t reg) {
+  assert((web.reg < 0) && "web already allocated");
+  web.reg = int(reg);
+  occupied_[reg].push_back({web.start, web.end});
+}
+
+bool LinearScan::assignWebs() {
+  occupied_.assign(bc_limits::max_registers, {});
+  std::vector<std::size_t> order;
+  for (std::size_t web = 0; web < webs_.size(); ++web)
+    if((webs_[web].pinnedReg >= 0) || !webs_[web].inWindow)
+      order.push_back(web);
+  // The pinned webs begin with the function, and go first.
+  std::stable_sort(order.begin(), order.end(),
+    [&](std::size_t lhs, std::size_t rhs) {
+      if(webs_[lhs].start != webs_[rhs].start)
+        return webs_[lhs].start < webs_[rhs].start;
+      return webs_[lhs].pinnedReg > webs_[rhs].pinnedReg;
+    });
+
+  for (std::size_t idx : order) {
+    Web& web = webs_[idx];
+    if (web.pinnedReg >= 0) {
+      if(!isFree(std::size_t(web.pinnedReg), web)) return false;
+      assign(web, std::size_t(web.pinnedReg));
+      continue;
+    }
+    // Try the register of the value copied to this one first, so the
+    // copy can be removed.
+    if (web.copyOf >= 0) {
+      int hint = webs_[std::size_t(web.copyOf)].reg;
+      if ((hint >= 0) && isFree(std::size_t(hint), web)) {
+        assign(web, std::size_t(hint));
+        continue;
+      }
+    }
+    std::size_t reg = 0;
+    while((reg < bc_limits::max_registers) && !isFree(reg, web)) ++reg;
+    if(reg == bc_limits::max_registers) return false;
+    assign(web, reg);
+  }
+  return true;
+}
+
+bool LinearScan::canPlace(const Window& window, std::size_t first) const {
+  if((first + window.elems.size()) > bc_limits::max_registers) return false;
+  for (std::size_t k = 0; k < window.elems.size(); ++k) {
+    const Web& elem = webs_[window.elems[k]];
+    std::size_t reg = first + k;
+    if (elem.reg >= 0) {
+      if(std::size_t(elem.reg) != reg) return false;
+      continue;
+    }
+    if(!isFree(reg, elem)) return false;
+    // The element must stay before the base of the calls it's live across
+    for (std::size_t call : elem.liveAcross) {
+      int callFirst = windows_[call].first;
+      if((callFirst >= 0) && (reg >= std::size_t(callFirst))) return false;
+    }
+  }
+  return true;
+}
+
+bool LinearScan::assignWindows() {
+  // Place the windows in the order in which their elements begin, so
+  // the windows of nested calls are placed after the elements of the
+  // windows that contain them.
+  std::vector<std::size_t> order;
+  for (std::size_t window = 0; window < windows_.size(); ++window)
+    if(!windows_[window].elems.empty()) order.push_back(window);
+  auto getStart = [&](std::size_t window) {
+    std::size_t start = ~std::size_t(0);
+    for (std::size_t elem : windows_[window].elems)
+      start = std::min(start, webs_[elem].start);
+    return start;
+  };
+  std::stable_sort(order.begin(), order.end(),
+    [&](std::size_t lhs, std::size_t rhs) {
+      return getStart(lhs) < getStart(rhs);
+    });
+
+  // Returns the lowest first register of a window: its base must be
+  // after the webs live across the call.
+  auto getLowestFirst = [&](const Window& window) {
+    std::size_t lowest = window.isCall ? 1 : 0;
+    for (std::size_t web : window.liveAcross)
+      if(webs_[web].reg >= 0)
+        lowest = std::max(lowest, std::size_t(webs_[web].reg) + 1);
+    return lowest;
+  };
+
+  for (std::size_t idx : order) {
+    Window& window = windows_[idx];
+    std::size_t first = getLowestFirst(window);
+    while((first < bc_limits::max_registers) && !canPlace(window, first))
+      ++first;
+    if(first == bc_limits::max_registers) return false;
+    for (std::size_t k = 0; k < window.elems.size(); ++k) {
+      Web& elem = webs_[window.elems[k]];
+      if(elem.reg < 0) assign(elem, first + k);
+    }
+    window.first = int(first);
+  }
+
+  // The calls without arguments only need a base after the webs live
+  // across them.
+  for (Window& window : windows_)
+    if(window.first < 0) window.first = int(getLowestFirst(window));
+  return true;
+}
+
+bool LinearScan::rewrite(MutableArrayRef<Instruction> instrs) const {
+  bool changed = false;
+  auto setReg = [&](regaddr_t& operand, std::size_t reg) {
+    if(operand == reg) return;
+    operand = regaddr_t(reg);
+    changed = true;
+  };
+  for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+    if(!starts_[idx]) continue;
+    Instruction& instr = instrs[idx];
+    for (regaddr_t* operand : getReadOperands(instr))
+      setReg(*operand, std::size_t(getWeb(getNode(idx, *operand, false)).reg));
+    if (regaddr_t* dest = getWriteOperand(instr))
+      setReg(*dest, std::size_t(getWeb(getNode(idx, *dest, true)).reg));
+    if(windowOfInstr_[idx] < 0) continue;
+    std::size_t first = std::size_t(windows_[windowOfInstr_[idx]].first);
+    if (instr.opcode == Opcode::ArrAppendRange)
+      setReg(instr.ArrAppendRange.first, first);
+    else
+      setReg(*getCallBase(instr), first-1);
+  }
+  return changed;
+}
+
+std::size_t LinearScan::getNumRegisters() const {
+  std::size_t numRegisters = 0;
+  for (const Web& web : webs_)
+    numRegisters = std::max(numRegisters, std::size_t(web.reg) + 1);
+  return numRegisters;
+}
+
+bool fox::allocateRegisters(BCFunction& fn, const BCModule& module) {
+  InstructionVector& instrs = fn.getInstructions();
+  std::vector<RegisterEffects> effects;
+  if(instrs.empty() || !getPreciseEffects(instrs, module, effects))
+    return false;
+
+  // Placing the values copied to arguments in the argument registers
+  // constrains the allocation, so try without it if it fails.
+  LinearScan scan(instrs, effects);
+  if(!scan.allocate(true) && !scan.allocate(false)) return false;
+  std::size_t numRegisters = scan.getNumRegisters();
+  if(numRegisters > fn.getNumRegisters()) return false;
+
+  InstructionVector newInstrs(instrs);
+  bool changed = scan.rewrite(newInstrs);
+  changed |= (numRegisters != fn.getNumRegisters());
+  fn.setNumRegisters(numRegisters);
+  if(!changed) return false;
+  instrs = std::move(newInstrs);
+  fn.discardPreparedCode();
+
+  // The copies of values that have been placed in the same register as
+  // their copy don't do anything.
+  std::vector<bool> removed(instrs.size());
+  for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+    const Instruction& instr = instrs[idx];
+    removed[idx] = (instr.opcode == Opcode::Copy)
+                && (instr.Copy.dest == instr.Copy.src);
+  }
+  removeInstructions(fn, removed);
+  return true;
+}
@@ -0,0 +1,51 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : Superinstructions.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/BC/Superinstructions.hpp"
+
+using namespace fox;
+
+// A superinstruction replaces its first instruction in the instruction
+// buffer without touching its operands, so both must have the same operands.
+#define SUPER_INSTR(ID, FIRST, SECOND)                                        \
+  static_assert(sizeof(Instruction::ID) == sizeof(Instruction::FIRST),        \
+    #ID " doesn't have the same operands as " #FIRST);
+#include "Fox/BC/Instruction.def"
+
+Optional<Opcode> fox::getSuperinstruction(Opcode first, Opcode second) {
+  #define SUPER_INSTR(ID, FIRST, SECOND)                                      \
+    if ((first == Opcode::FIRST) && (second == Opcode::SECOND))               \
+      return Opcode::ID;
+  #include "Fox/BC/Instruction.def"
+  return None;
+}
+
+bool fox::isSuperinstruction(Opcode op) {
+  switch (op) {
+    #define SUPER_INSTR(ID, FIRST, SECOND) case Opcode::ID:
+    #include "Fox/BC/Instruction.def"
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::size_t fox::fuseSuperinstructions(MutableArrayRef<Instruction> instrs) {
+  std::size_t count = 0;
+  for (std::size_t idx = 0; (idx+1) < instrs.size(); ++idx) {
+    Instruction& first = instrs[idx];
+    Optional<Opcode> super = 
+      getSuperinstruction(first.opcode, instrs[idx+1].opcode);
+    if(!super) continue;
+    first.opcode = super.getValue();
+    ++count;
+    // Skip the second instruction: it's executed by the superinstruction,
+    // so it can't begin another one.
+    ++idx;
+  }
+  return count;
+}
@@ -8,13 +8,18 @@
 #include "Fox/BCGen/BCGen.hpp"
 #include "Fox/AST/ASTContext.hpp"
 #include "Fox/AST/Type.hpp"
+#include "Fox/AST/Types.hpp"
+#include "Fox/BC/BCBuilder.hpp"
 #include "Fox/BC/BCModule.hpp"
+#include "Fox/Common/Errors.hpp"
+#include <algorithm>
 #include <string>
 
 using namespace fox;
 
-BCGen::BCGen(ASTContext& ctxt, BCModule& theModule) : 
-  ctxt(ctxt), diagEngine(ctxt.diagEngine), theModule(theModule) {}
+BCGen::BCGen(ASTContext& ctxt, BCModule& theModule, OptLevel optLevel) : 
+  ctxt(ctxt), diagEngine(ctxt.diagEngine), theModule(theModule),
+  optLevel_(optLevel), passManager_(optLevel) {}
 
 constant_id_t BCGen::getConstantID(string_view strview) {
   // Check if it exists in the map
@@ -66,4 +71,42 @@ constant_id_t BCGen::getConstantID(FoxDouble value) {
   auto kID = static_cast<constant_id_t>(rawID);
   map.insert({value, kID});
   return kID;
-}
\ No newline at end of file
+}
+
+constant_id_t BCGen::createArrayConstant(ArrayElemKind elemKind, 
+                                         ArrayRef<FoxAny> elems) {
+  std::size_t rawID = theModule.addArrayConstant(elemKind, elems);
+  // TODO: Replace this by a proper diagnostic
+  assert((rawID < bc_limits::max_constant_id)
+    && "cannot insert constant: limit of constant_id_t reached");
+  return static_cast<constant_id_t>(rawID);
+}
+
+ArrayElemKind BCGen::getArrayElemKind(ArrayType* type) {
+  Type elemType = type->getElementType();
+  if(elemType->isReferenceType())
+    return ArrayElemKind::Ref;
+  if(elemType->isIntType())
+    return ArrayElemKind::Int;
+  if(elemType->isDoubleType())
+    return ArrayElemKind::Double;
+  if(elemType->isBoolType())
+    return ArrayElemKind::Bool;
+  if(elemType->isCharType())
+    return ArrayElemKind::Char;
+  fox_unreachable("unknown value type");
+}
+
+void BCGen::emitNewArray(BCBuilder& builder, regaddr_t dest, ArrayType* type,
+                         std::size_t reservedElems) {
+  ArrayElemKind elemKind = getArrayElemKind(type);
+  if (elemKind == ArrayElemKind::Ref) {
+    builder.createNewRefArrayInstr(dest, 
+      std::uint16_t(std::min<std::size_t>(reservedElems, 0xFFFF)));
+    return;
+  }
+  // Arrays of values store their elements unboxed, so their kind must be
+  // known when they're created.
+  builder.createNewValueArrayInstr(dest, elemKind, 
+    std::uint8_t(std::min<std::size_t>(reservedElems, 0xFF)));
+}
@@ -16,6 +16,8 @@
 #include "Fox/AST/ASTVisitor.hpp"
 #include "Fox/BC/BCBuilder.hpp"
 #include "Fox/BC/BCModule.hpp"
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/Superinstructions.hpp"
 #include "Fox/BC/BCUtils.hpp"
 #include "Fox/Common/Errors.hpp"
 
@@ -74,10 +76,7 @@ namespace {
       }
 
       void visitArrayType(ArrayType* type, regaddr_t dest) {
-        if(type->getElementType()->isReferenceType())
-          builder.createNewRefArrayInstr(dest, /*initialSize*/ 0);
-        else
-          builder.createNewValueArrayInstr(dest, /*initialSize*/ 0);
+        BCGen::emitNewArray(builder, dest, type, /*reservedElems*/ 0);
       }
 
       void visitLValueType(LValueType*, regaddr_t) {
@@ -269,6 +268,12 @@ void BCGen::genFunc(FuncDecl* func) {
   if (builder.empty() || (!builder.getLastInstrIter()->isAnyRet()))
     builder.createRetVoidInstr();
 
+  // Tell the function how many registers it needs
+  fn.setNumRegisters(regAlloc.getMaxRegisterCount());
+
+  // Optimize it. It's finished once the whole unit has been generated.
+  passManager_.run(fn);
+
   // If this function was our entry point, set it as the entry point
   // of the BCModule we're generating.
   if (func == ctxt.getEntryPoint())
@@ -297,6 +302,47 @@ void BCGen::genGlobalVar(VarDecl* var) {
   // The last instruction in the initializer should be a "Ret" of
   // the value.
   builder.createRetInstr(dest.getAddress());
+
+  // Tell the initializer how many registers it needs
+  initializer.setNumRegisters(regAlloc.getMaxRegisterCount());
+
+  // Optimize it. It's finished once the whole unit has been generated.
+  passManager_.run(initializer);
+}
+
+void BCGen::finishFunctions() {
+  auto forEachFunction = [&](auto fn) {
+    for (auto& func : theModule.getFunctions())
+      fn(*func);
+    for (auto& init : theModule.getGlobalVarInitializers())
+      fn(*init);
+  };
+
+  if (optLevel_ != OptLevel::O0) {
+    // Inline the calls to small functions. Inlining every call of a
+    // function can make it small enough to be inlined too, so this is
+    // repeated until nothing changes. Only functions without calls are
+    // inlined, so every round removes calls, and this terminates.
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      forEachFunction([&](BCFunction& fn) {
+        if(!inlineCalls(fn, theModule)) return;
+        passManager_.run(fn);
+        changed = true;
+      });
+    }
+    // The register allocator of BCGen doesn't reuse registers as much as
+    // it could, so reallocate them using the live ranges of the values.
+    forEachFunction([&](BCFunction& fn) {
+      allocateRegisters(fn, theModule);
+    });
+  }
+
+  // Use superinstructions where possible
+  forEachFunction([&](BCFunction& fn) {
+    fuseSuperinstructions(fn.getInstructions());
+  });
 }
 
 void BCGen::genLocalDecl(BCBuilder& builder,
@@ -315,6 +361,7 @@ BCFunction& BCGen::getBCFunction(FuncDecl* func) {
   assert((theModule.numFunctions() <= bc_limits::max_func_id)
     && "Cannot gen function: too many functions in the module");
   BCFunction& fn = theModule.createFunction();
+  fn.setNumParams(func->numParams());
   fn.createDebugInfo();
   funcs_.insert({func, fn});
   return fn;
@@ -350,4 +397,5 @@ void BCGen::genUnit(UnitDecl* unit) {
     else 
       fox_unreachable("unknown top level decl kind");
   }
+  finishFunctions();
 }
\ No newline at end of file
@@ -265,9 +265,9 @@ class BCGen::ExprGenerator : public Generator,
       SmallVector<RegisterValue, 4> callRegs;
       regAlloc.allocateCallRegisters(callRegs, generators.size()+1);
 
-      // Put a reference to the builtin in the base register
+      // The base register doesn't contain anything: the builtin is an
+      // operand of the call.
       regaddr_t baseAddr = callRegs.front().getAddress();
-      builder.createLoadBuiltinFuncInstr(baseAddr, bID);
 
       // Compile the args
       for (std::size_t k = 0, size = generators.size(); k < size; ++k)
@@ -280,11 +280,12 @@ class BCGen::ExprGenerator : public Generator,
         // Choose a destination register
         dest = getDestReg(std::move(dest), callRegs);
         // Emit.
-        callInstrIter = builder.createCallInstr(baseAddr, dest.getAddress());
+        callInstrIter = 
+          builder.createCallBuiltinInstr(bID, baseAddr, dest.getAddress());
       }
       else {
         assert(!dest && "cannot have a destination if the builtin returns void");
-        callInstrIter = builder.createCallVoidInstr(baseAddr);
+        callInstrIter = builder.createCallVoidBuiltinInstr(bID, baseAddr);
       }
 
       assert(debugRange && "debugRange cannot be null");
@@ -313,7 +314,6 @@ class BCGen::ExprGenerator : public Generator,
     void 
     emitDoubleBinOp(BinOp op, regaddr_t dst, regaddr_t lhs, regaddr_t rhs,
                     SourceRange debugRange) {
-      assert((lhs != rhs) && "lhs and rhs are identical");
       // Emit
       switch (op) {
         case BinOp::Add:  // +
@@ -373,7 +373,6 @@ class BCGen::ExprGenerator : public Generator,
     // booleans and ints.
     void emitIntBinOp(BinOp op, regaddr_t dst, regaddr_t lhs, regaddr_t rhs, 
                       SourceRange debugRange) {
-      assert((lhs != rhs) && "lhs and rhs are identical");
       // Emit
       switch (op) {
         case BinOp::Add:  // +
@@ -437,11 +436,86 @@ class BCGen::ExprGenerator : public Generator,
       }
     }
 
+    // If \p expr is an integer literal whose value can be used as the
+    // immediate operand of an instruction such as AddIntImm, stores its
+    // value in \p imm and returns true.
+    static bool isImmediate(Expr* expr, std::int8_t& imm) {
+      auto lit = dyn_cast<IntegerLiteralExpr>(expr);
+      if(!lit) return false;
+      FoxInt value = lit->getValue();
+      if ((value < bc_limits::immediate_min) 
+        || (value > bc_limits::immediate_max))
+        return false;
+      imm = static_cast<std::int8_t>(value);
+      return true;
+    }
+
+    // Generates the code for an integer binary operation with an immediate
+    // operand. 
+    // \returns a dead RegisterValue (and doesn't emit anything) if \p expr
+    // can't be generated using an immediate operand.
+    RegisterValue tryEmitIntImmBinaryExpr(BinaryExpr* expr, 
+                                          RegisterValue& dest) {
+      if(!canGenToIntBinop(expr)) return RegisterValue();
+      Expr* lhs = expr->getLHS();
+      Expr* rhs = expr->getRHS();
+      BinOp op = expr->getOp();
+      std::int8_t imm = 0;
+      // The operand that will be in a register
+      Expr* regOperand = nullptr;
+      switch (op) {
+        case BinOp::Add:  // +
+        case BinOp::Mul:  // *
+          // These operations are commutative, so the immediate can be 
+          // on either side.
+          if(isImmediate(rhs, imm))
+            regOperand = lhs;
+          else if(isImmediate(lhs, imm))
+            regOperand = rhs;
+          break;
+        case BinOp::Sub:  // -
+          if(isImmediate(rhs, imm))
+            regOperand = lhs;
+          break;
+        default:
+          break;
+      }
+      if(!regOperand) return RegisterValue();
+
+      // Gen the operand
+      RegisterValue srcReg = visit(regOperand);
+      regaddr_t srcAddr = srcReg.getAddress();
+      assert(srcReg && "Generated a dead register for the operand");
+
+      // Choose the destination register
+      RegisterValue dstReg = getDestReg(std::move(dest), {srcReg});
+      regaddr_t dstAddr = dstReg.getAddress();
+
+      switch (op) {
+        case BinOp::Add:  // +
+          builder.createAddIntImmInstr(dstAddr, srcAddr, imm);
+          break;
+        case BinOp::Sub:  // -
+          builder.createSubIntImmInstr(dstAddr, srcAddr, imm);
+          break;
+        case BinOp::Mul:  // *
+          builder.createMulIntImmInstr(dstAddr, srcAddr, imm);
+          break;
+        default:
+          fox_unreachable("unhandled binary operation kind");
+      }
+      return dstReg;
+    }
+
     // Generates the code for a BinaryExpr whose type is a Numeric or
     // Boolean Binary Expr.
     RegisterValue emitNumericOrBoolBinaryExpr(BinaryExpr* expr, 
                                              RegisterValue dest) {
       assert((expr->getType()->isNumericOrBool()));
+
+      // Use an instruction with an immediate operand if possible.
+      if(RegisterValue result = tryEmitIntImmBinaryExpr(expr, dest))
+        return result;
       
       // Gen the LHS
       RegisterValue lhsReg = visit(expr->getLHS());
@@ -597,12 +671,16 @@ class BCGen::ExprGenerator : public Generator,
     emitStringSubscript(SubscriptExpr* expr, RegisterValue dest) {
       assert(expr->getBase()->getType()->isStringType() && "wrong function");
       assert(expr->getType()->isCharType() && "unexpected return type");
-      auto baseGT = getGTForExpr(expr->getBase());
-      auto indexGT = getGTForExpr(expr->getIndex());
-      // getChar has a (string, int) -> char signature.
-      return 
-        emitBuiltinCall(BuiltinKind::getChar, std::move(dest), {baseGT, indexGT}, 
-                        expr->getSourceRange());
+      RegisterValue strReg = visit(expr->getBase());
+      regaddr_t strAddr = strReg.getAddress();
+      RegisterValue idxReg = visit(expr->getIndex());
+      regaddr_t idxAddr = idxReg.getAddress();
+      RegisterValue dstReg = getDestReg(std::move(dest), {strReg, idxReg});
+      auto instr = 
+        builder.createStrGetCharInstr(dstReg.getAddress(), strAddr, idxAddr);
+      // StrGetChar checks the index, so it needs debug info.
+      builder.addDebugRange(instr, expr->getSourceRange());
+      return dstReg;
     }
 
     /// Emits a CallExpr whose callee is a BuiltinMemberRef.
@@ -633,16 +711,14 @@ class BCGen::ExprGenerator : public Generator,
 
     RegisterValue 
     emitArrayAppend(Expr* src, ArrayRef<Expr*> args, RegisterValue dest) {
-      /// Emit a call to the arrAppend builtin.
+      /// Emit an ArrAppend instruction
       assert((args.size() == 2) 
         && "incorrect number of args for arrAppend");
       assert(!dest && "array.append returns void!");
-      return emitBuiltinCall(
-        BuiltinKind::arrAppend, 
-        RegisterValue(), 
-        { getGTForExpr(args[0]), getGTForExpr(args[1]) },
-        src->getSourceRange()
-      );
+      RegisterValue arrReg = visit(args[0]);
+      RegisterValue valReg = visit(args[1]);
+      builder.createArrAppendInstr(arrReg.getAddress(), valReg.getAddress());
+      return RegisterValue();
     }
 
     RegisterValue 
@@ -687,15 +763,14 @@ class BCGen::ExprGenerator : public Generator,
 
     RegisterValue 
     emitArraySize(Expr* src, ArrayRef<Expr*> args, RegisterValue dest) {
-      /// Emit a call to the arrSize builtin.
+      /// Emit an ArrSize instruction
       assert((args.size() == 1) 
         && "incorrect number of args for arrSize");
-      return emitBuiltinCall(
-        BuiltinKind::arrSize, 
-        std::move(dest), 
-        { getGTForExpr(args[0]) },
-        src->getSourceRange()
-      );
+      RegisterValue arrReg = visit(args[0]);
+      regaddr_t arrAddr = arrReg.getAddress();
+      RegisterValue dstReg = getDestReg(std::move(dest), {arrReg});
+      builder.createArrSizeInstr(dstReg.getAddress(), arrAddr);
+      return dstReg;
     }
 
     RegisterValue 
@@ -728,15 +803,14 @@ class BCGen::ExprGenerator : public Generator,
 
     RegisterValue 
     emitStringLength(Expr* src, ArrayRef<Expr*> args, RegisterValue dest) {
-      /// Emit a call to the strLength builtin.
+      /// Emit a StrLen instruction
       assert((args.size() == 1) 
         && "incorrect number of args for strLength");
-      return emitBuiltinCall(
-        BuiltinKind::strLength, 
-        std::move(dest), 
-        { getGTForExpr(args[0]) },
-        src->getSourceRange()
-      );
+      RegisterValue strReg = visit(args[0]);
+      regaddr_t strAddr = strReg.getAddress();
+      RegisterValue dstReg = getDestReg(std::move(dest), {strReg});
+      builder.createStrLenInstr(dstReg.getAddress(), strAddr);
+      return dstReg;
     }
 
     //------------------------------------------------------------------------//
@@ -841,8 +915,10 @@ class BCGen::ExprGenerator : public Generator,
         // do anything except copying the sub expr's result if needed.
         if (auto arr = dyn_cast<ArrayLiteralExpr>(subExpr)) {
           if (arr->numElems() == 0) {
-            if(childReg != dest)
-              builder.createCopyInstr(destAddr, childReg.getAddress());
+            // NOTE: childReg might have been recycled as the dest, so
+            // compare the addresses.
+            if(childRegAddr != destAddr)
+              builder.createCopyInstr(destAddr, childRegAddr);
             return dest;
           }
         }
@@ -920,13 +996,16 @@ class BCGen::ExprGenerator : public Generator,
 
       assert(base->getType()->isArrayType() && "not an array subscript");
 
-      // arrGet takes the array as first parameter and the index second.
-      return emitBuiltinCall(
-        BuiltinKind::arrGet, 
-        std::move(dest), 
-        {getGTForExpr(base), getGTForExpr(expr->getIndex())},
-        expr->getSourceRange()
-      );
+      RegisterValue arrReg = visit(base);
+      regaddr_t arrAddr = arrReg.getAddress();
+      RegisterValue idxReg = visit(expr->getIndex());
+      regaddr_t idxAddr = idxReg.getAddress();
+      RegisterValue dstReg = getDestReg(std::move(dest), {arrReg, idxReg});
+      auto instr = 
+        builder.createArrGetInstr(dstReg.getAddress(), arrAddr, idxAddr);
+      // ArrGet checks the index, so it needs debug info.
+      builder.addDebugRange(instr, expr->getSourceRange());
+      return dstReg;
     }
 
     RegisterValue 
@@ -986,12 +1065,23 @@ class BCGen::ExprGenerator : public Generator,
       if(isa<BuiltinMemberRefExpr>(expr->getCallee()))
         return emitBuiltinTypeMemberCall(expr, std::move(dest));
 
+      // If the callee is a reference to a function or to a builtin, it
+      // doesn't need to be compiled: the function is an operand of the call.
+      Expr* callee = expr->getCallee();
+      ValueDecl* calleeDecl = nullptr;
+      if (auto declRef = dyn_cast<DeclRefExpr>(callee)) {
+        calleeDecl = declRef->getDecl();
+        if(!isa<FuncDecl>(calleeDecl) && !isa<BuiltinFuncDecl>(calleeDecl))
+          calleeDecl = nullptr;
+      }
+
       // The list of expressions to compile, in order.
       SmallVector<Expr*, 8> exprs;
       exprs.reserve(1 + expr->numArgs());
       
-      // First, the callee
-      exprs.push_back(expr->getCallee());
+      // First, the callee (unless it's called directly, in which case the
+      // base register is left empty)
+      exprs.push_back(calleeDecl ? nullptr : callee);
       // Then the args
       {
         ArrayRef<Expr*> args = expr->getArgs();
@@ -1009,23 +1099,45 @@ class BCGen::ExprGenerator : public Generator,
       // Compile the expressions
       assert(exprs.size() == regs.size());
       for (std::size_t k = 0, size = regs.size(); k < size; ++k) {
+        if(!exprs[k]) continue;
         // Move the registers out so the function can use them, but store
         // them back after.
         regs[k] = visit(exprs[k], std::move(regs[k]));
       }
 
-      // Use CallVoid for void functions
-      if (expr->getType()->isVoidType()) {
-        assert(!dest 
-          && "CallExpr has void type, but is expected to return a result");
-        builder.createCallVoidInstr(baseAddr);
-        return RegisterValue();
-      }
-      // Else just use 'Call'.
+      bool isVoid = expr->getType()->isVoidType();
+      assert((!isVoid || !dest)
+        && "CallExpr has void type, but is expected to return a result");
       // If there is no destination, any recyclable register in regs is a 
       // potential candidate for reusability.
-      dest = getDestReg(std::move(dest), regs);
-      builder.createCallInstr(baseAddr, dest.getAddress());
+      if(!isVoid)
+        dest = getDestReg(std::move(dest), regs);
+
+      BCBuilder::StableInstrConstIter callInstr;
+      // Direct calls to functions: use CallFunc/CallVoidFunc
+      if (auto func = dyn_cast_or_null<FuncDecl>(calleeDecl)) {
+        auto fID = static_cast<func_id_t>(bcGen.getBCFunction(func).getID());
+        if(isVoid)
+          callInstr = builder.createCallVoidFuncInstr(fID, baseAddr);
+        else 
+          callInstr = 
+            builder.createCallFuncInstr(fID, baseAddr, dest.getAddress());
+      }
+      // Direct calls to builtins: use CallBuiltin/CallVoidBuiltin
+      else if (auto builtin = dyn_cast_or_null<BuiltinFuncDecl>(calleeDecl)) {
+        auto bID = builtin->getBuiltinKind();
+        if(isVoid)
+          callInstr = builder.createCallVoidBuiltinInstr(bID, baseAddr);
+        else 
+          callInstr = 
+            builder.createCallBuiltinInstr(bID, baseAddr, dest.getAddress());
+      }
+      // Indirect calls: use CallVoid/Call
+      else if (isVoid)
+        callInstr = builder.createCallVoidInstr(baseAddr);
+      else
+        callInstr = builder.createCallInstr(baseAddr, dest.getAddress());
+      builder.addDebugRange(callInstr, expr->getSourceRange());
       return dest;
     }
 
@@ -1074,53 +1186,96 @@ class BCGen::ExprGenerator : public Generator,
       return dest;
     }
 
+    // If \p expr is a literal of a value type (possibly negated), stores 
+    // its value in \p value and returns true.
+    static bool getLiteralValue(Expr* expr, FoxAny& value) {
+      bool negative = false;
+      if (auto unary = dyn_cast<UnaryExpr>(expr)) {
+        if(unary->getOp() != UnOp::Minus) return false;
+        negative = true;
+        expr = unary->getChild();
+      }
+      if (auto intLit = dyn_cast<IntegerLiteralExpr>(expr)) {
+        value = FoxAny(negative ? -intLit->getValue() : intLit->getValue());
+        return true;
+      }
+      if (auto doubleLit = dyn_cast<DoubleLiteralExpr>(expr)) {
+        value = FoxAny(negative ? -doubleLit->getValue() 
+                                : doubleLit->getValue());
+        return true;
+      }
+      if(negative) return false;
+      if (auto boolLit = dyn_cast<BoolLiteralExpr>(expr)) {
+        value = FoxAny(std::uint64_t(boolLit->getValue()));
+        return true;
+      }
+      if (auto charLit = dyn_cast<CharLiteralExpr>(expr)) {
+        value = FoxAny(std::uint64_t(charLit->getValue()));
+        return true;
+      }
+      return false;
+    }
+
+    // The maximum number of elements of an array literal that are 
+    // appended at once by an ArrAppendRange.
+    static constexpr std::size_t maxArrAppendRange = 16;
+
     RegisterValue 
     visitArrayLiteralExpr(ArrayLiteralExpr* expr, RegisterValue dest) {
-      Type arrayType = expr->getType();
-      Type elemType = arrayType->castTo<ArrayType>()->getElementType();
-      bool elemTypeIsRefType = elemType->isReferenceType();
+      ArrayType* arrayType = expr->getType()->castTo<ArrayType>();
 
       dest = tryUse(std::move(dest));
       regaddr_t arrAddr = dest.getAddress();
 
-      {
-        // Use the number of elements inside the array literal as the
-        // initial size of the array, but max out at 65535 (the max of uint16,
-        // the type of the second operand);
-        auto initialSize = std::min<std::uint16_t>(expr->numElems(), 0xFFFFu);
-        // Create the array
-        if(elemTypeIsRefType)
-          builder.createNewRefArrayInstr(arrAddr, initialSize);
-        else
-          builder.createNewValueArrayInstr(arrAddr, initialSize);
+      ArrayRef<Expr*> elems = expr->getExprs();
+
+      // Array literals of values that only contain literals are array 
+      // constants: the VM creates them by copying the constant.
+      ArrayElemKind elemKind = BCGen::getArrayElemKind(arrayType);
+      if (!elems.empty() && (elemKind != ArrayElemKind::Ref)) {
+        SmallVector<FoxAny, 16> values;
+        values.reserve(elems.size());
+        for (Expr* elem : elems) {
+          FoxAny value;
+          if(!getLiteralValue(elem, value)) break;
+          values.push_back(value);
+        }
+        if (values.size() == elems.size()) {
+          builder.createLoadArrayKInstr(arrAddr, 
+            bcGen.createArrayConstant(elemKind, values));
+          return dest;
+        }
       }
 
+      // Create the array, using the number of elements inside the array 
+      // literal as its initial size.
+      BCGen::emitNewArray(builder, arrAddr, arrayType, elems.size());
+
       // Stop here if the array literal is empty.
-      if(expr->numElems() == 0) return dest;
+      if(elems.empty()) return dest;
 
-      // FIXME: Can this be made a bit more efficient?
+      // A single element is simply appended to the array.
+      if (elems.size() == 1) {
+        RegisterValue elemReg = visit(elems.front());
+        builder.createArrAppendInstr(arrAddr, elemReg.getAddress());
+        return dest;
+      }
 
-      // Setup a call to arrAppend to fill the array
-      SmallVector<RegisterValue, 4> callRegs;
-      regAlloc.allocateCallRegisters(callRegs, 3);
-
-      regaddr_t baseAddr = callRegs[0].getAddress();
-      // Base = Reference to arrAppend.
-      builder.createLoadBuiltinFuncInstr(baseAddr, BuiltinKind::arrAppend);
-
-      // arg0 = reference to the array
-      RegisterValue& arg0 = callRegs[1];
-      // FIXME: Can we avoid the copy?
-      builder.createCopyInstr(arg0.getAddress(), arrAddr);
-
-      // arg1 = the expression.
-      // We'll loop over each expression, generate them with arg1
-      // as the destination then call the base and so on.
-      RegisterValue& arg1 = callRegs[2];
-      assert(arg1 && "arg1 is dead");
-      for (Expr* elem : expr->getExprs()) {
-        arg1 = visit(elem, std::move(arg1));    // gen the expr in arg1
-        builder.createCallVoidInstr(baseAddr);  // Call arrAppend
+      // Else, generate the elements in contiguous registers, and append 
+      // them to the array at once, by groups of maxArrAppendRange elements.
+      while (!elems.empty()) {
+        ArrayRef<Expr*> group = elems.take_front(
+          (elems.size() > maxArrAppendRange) ? maxArrAppendRange 
+                                             : elems.size());
+        elems = elems.drop_front(group.size());
+
+        SmallVector<RegisterValue, maxArrAppendRange> regs;
+        regAlloc.allocateCallRegisters(regs, group.size());
+        for (std::size_t k = 0, size = group.size(); k < size; ++k)
+          regs[k] = visit(group[k], std::move(regs[k]));
+
+        builder.createArrAppendRangeInstr(arrAddr, regs.front().getAddress(),
+                                          std::uint8_t(group.size()));
       }
 
       return dest;
@@ -1187,20 +1342,19 @@ BCGen::AssignementGenerator::visitSubscriptExpr(SubscriptExpr* expr,
   assert((op == BinOp::Assign) && "Unsupported assignement type");
   op; // Avoid 'unreferenced formal parameter'
 
-  // arrSet expects the array first, the index second and the value third.
-  // It returns its third argument.
-  RegisterValue rtr = exprGen.emitBuiltinCall(
-    BuiltinKind::arrSet, 
-    std::move(dest),
-    {
-      exprGen.getGTForExpr(expr->getBase()),
-      exprGen.getGTForExpr(expr->getIndex()),
-      exprGen.getGTForExpr(src)
-    },
-    expr->getSourceRange()
-  );
-
-  return rtr;
+  // Generate the array first, the index second and the value third.
+  RegisterValue arrReg = exprGen.generate(expr->getBase());
+  RegisterValue idxReg = exprGen.generate(expr->getIndex());
+  // NOTE: The value can't be generated in 'dest' directly, because 'dest'
+  // might be the register of a variable used as the array or the index.
+  RegisterValue valReg = exprGen.generate(src);
+  auto instr = builder.createArrSetInstr(arrReg.getAddress(), 
+                                         idxReg.getAddress(), 
+                                         valReg.getAddress());
+  // ArrSet checks the index, so it needs debug info.
+  builder.addDebugRange(instr, expr->getSourceRange());
+  // The assignement's result is the value.
+  return copyInDest(std::move(dest), std::move(valReg));
 }
 
 RegisterValue BCGen::AssignementGenerator::
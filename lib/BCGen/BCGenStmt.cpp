@@ -7,7 +7,9 @@
 
 #include "Fox/BCGen/BCGen.hpp"
 #include "Fox/AST/ASTVisitor.hpp"
+#include "Fox/AST/Expr.hpp"
 #include "Fox/AST/Stmt.hpp"
+#include "Fox/AST/Types.hpp"
 #include "Fox/BC/BCBuilder.hpp"
 #include "Fox/BC/BCUtils.hpp"
 #include "Fox/Common/Errors.hpp"
@@ -57,6 +59,80 @@ class BCGen::StmtGenerator : public Generator,
         fox_unreachable("Unknown ASTNode kind");
     }
 
+    /// \returns true if \p expr is a comparison of integers that can be 
+    /// fused with a conditional jump. 
+    static bool canFuseWithJump(BinaryExpr* expr) {
+      switch (expr->getOp()) {
+        case BinaryExpr::OpKind::Eq:
+        case BinaryExpr::OpKind::NEq:
+        case BinaryExpr::OpKind::LT:
+        case BinaryExpr::OpKind::LE:
+        case BinaryExpr::OpKind::GT:
+        case BinaryExpr::OpKind::GE:
+          break;
+        default:
+          return false;
+      }
+      Type type = expr->getLHS()->getType();
+      return type->isIntType() || type->isBoolType() || type->isCharType();
+    }
+
+    /// Generates the condition \p cond followed by a conditional jump 
+    /// which is taken when the condition is false.
+    /// Comparisons of integers are fused with the jump.
+    /// \returns the jump instruction. Its offset must be fixed by the
+    /// caller.
+    StableInstrIter genJumpIfFalse(Expr* cond) {
+      BinaryExpr* binExpr = dyn_cast<BinaryExpr>(cond);
+      if (!binExpr || !canFuseWithJump(binExpr)) {
+        // The RegisterValue is intentionally discarded so it is 
+        // immediately freed
+        regaddr_t condAddr = 
+          bcGen.genExpr(builder, regAlloc, cond).getAddress();
+        return builder.createJumpIfNotInstr(condAddr, 0);
+      }
+      // Gen the operands
+      RegisterValue lhsReg = bcGen.genExpr(builder, regAlloc, binExpr->getLHS());
+      RegisterValue rhsReg = bcGen.genExpr(builder, regAlloc, binExpr->getRHS());
+      regaddr_t lhs = lhsReg.getAddress();
+      regaddr_t rhs = rhsReg.getAddress();
+      // Emit the jump that's taken when the comparison is false.
+      switch (binExpr->getOp()) {
+        case BinaryExpr::OpKind::Eq:  // ==
+          return builder.createJumpIfNotEqIntInstr(lhs, rhs, 0);
+        case BinaryExpr::OpKind::NEq: // !=
+          return builder.createJumpIfEqIntInstr(lhs, rhs, 0);
+        case BinaryExpr::OpKind::LT:  // <
+          return builder.createJumpIfNotLTIntInstr(lhs, rhs, 0);
+        case BinaryExpr::OpKind::LE:  // <=
+          return builder.createJumpIfNotLEIntInstr(lhs, rhs, 0);
+        case BinaryExpr::OpKind::GT:  // > is !(a <= b)
+          return builder.createJumpIfLEIntInstr(lhs, rhs, 0);
+        case BinaryExpr::OpKind::GE:  // >= is (b <= a)
+          return builder.createJumpIfNotLEIntInstr(rhs, lhs, 0);
+        default:
+          fox_unreachable("unhandled comparison kind");
+      }
+    }
+
+    /// Inverts the condition of a conditional jump \p jump: a JumpIf 
+    /// becomes a JumpIfNot, a JumpIfLTInt becomes a JumpIfNotLTInt, etc.
+    static void invertCondJump(StableInstrIter jump) {
+      Opcode& op = jump->opcode;
+      switch (op) {
+        #define INVERT(A, B) \
+          case Opcode::A: op = Opcode::B; break;\
+          case Opcode::B: op = Opcode::A; break;
+        INVERT(JumpIf, JumpIfNot)
+        INVERT(JumpIfEqInt, JumpIfNotEqInt)
+        INVERT(JumpIfLTInt, JumpIfNotLTInt)
+        INVERT(JumpIfLEInt, JumpIfNotLEInt)
+        #undef INVERT
+        default:
+          fox_unreachable("not a conditional jump");
+      }
+    }
+
     /// Represents a 'jump point', a point in the bytecode buffer that we
     /// want to jump to.
     /// This class is also responsible for fixing 'jump' instructions.
@@ -84,9 +160,17 @@ class BCGen::StmtGenerator : public Generator,
 
         /// Fixes a "Jump" instruction \p jump so it jumps to
         /// the JumpPoint when executed.
-        /// \p jump can be any jump: a Jump, JumpIf or JumpIfNot.
+        /// \p jump can be any jump: a Jump, JumpIf, JumpIfNot or a fused
+        /// compare and jump.
         void fixJumpInstr(StableInstrIter jump) const {
           assert(jump->isAnyJump() && "not a jump!");
+          // The offset of fused compare and jumps is stored in the
+          // JumpOffset that follows them.
+          if (jump->isCompareAndJump()) {
+            ++jump;
+            assert((jump->opcode == Opcode::JumpOffset) 
+              && "compare and jump not followed by a JumpOffset");
+          }
           // Calculate the distance + decrement it
           // (because jumps are relative to the next instruction)
           auto rawDistance = distance(jump, getTargetIter())-1;
@@ -109,6 +193,9 @@ class BCGen::StmtGenerator : public Generator,
             case Opcode::JumpIfNot:
               jump->JumpIfNot.offset = offset;
               break;
+            case Opcode::JumpOffset:
+              jump->JumpOffset.offset = offset;
+              break;
             default:
               fox_unreachable("Unknown Jump Kind!");
           }
@@ -130,13 +217,14 @@ class BCGen::StmtGenerator : public Generator,
         /// Returns an iterator to the target instruction
         ///   For Kind::BufferBeg, returns an iterator to the
         ///     beginning of the buffer.
-        ///   For Kind::AfterIter, returns (iter_+1);
+        ///   For Kind::AfterIter, returns (iter_+1), or (iter_+2) if 
+        ///     iter_ is a fused compare and jump.
         StableInstrConstIter getTargetIter() const {
           switch (kind_) {
             case Kind::BufferBeg:
               return StableInstrConstIter::getBegin(builder.vector);
             case Kind::AfterIter: 
-              return ++StableInstrConstIter(iter_);
+              return iter_ + iter_->getLength();
             default:
               fox_unreachable("unknown JumpPoint::Kind");
           }
@@ -170,14 +258,9 @@ class BCGen::StmtGenerator : public Generator,
     }
 
     void visitConditionStmt(ConditionStmt* stmt) {
-      // Gen the condition and save its address
-      // The RegisterValue is intentionally discarded so it is immediately freed
-      regaddr_t regAddr = 
-        bcGen.genExpr(builder, regAlloc, stmt->getCond()).getAddress();
-
-      // Create a "JumpIfNot" so we can jump to the else's code when the
+      // Gen the condition and a jump to the else's code when the
       // condition is false.
-      auto jumpIfFalse = builder.createJumpIfNotInstr(regAddr, 0);
+      auto jumpIfFalse = genJumpIfFalse(stmt->getCond());
 
       // Gen the 'then'
       visitCompoundStmt(stmt->getThen());
@@ -202,9 +285,10 @@ class BCGen::StmtGenerator : public Generator,
 
       // We have a else, and the then was empty
       if(isThenEmpty) {
-        // If the then is empty, remove JumpIfNot and replace it with a JumpIf
-        builder.truncate_instrs(jumpIfFalse);
-        auto jumpIfTrue = builder.createJumpIfInstr(regAddr, 0);
+        // If the then is empty, invert the jump so it skips the else
+        // when the condition is true.
+        auto jumpIfTrue = jumpIfFalse;
+        invertCondJump(jumpIfTrue);
         // Gen the 'else'
         visit(elseBody);
         // Check if we have generated something. If we didn't: remove everything
@@ -244,15 +328,9 @@ class BCGen::StmtGenerator : public Generator,
       LoopContext loopCtxt(regAlloc);
       auto loopBeg = JumpPoint::createAtEnd(builder);
 
-      // Compile the condition and save its address.
-      // The resulting RegisterValue is intentionally discarded
-      // so its register is freed directly.
-      auto condAddr = 
-        bcGen.genExpr(builder, regAlloc, stmt->getCond()).getAddress();
-
-      // When the condition is false, we skip the body so
+      // Compile the condition. When it is false, we skip the body so
       // create a jump that'll be completed later.
-      auto skipBodyJump = builder.createJumpIfNotInstr(condAddr, 0);
+      auto skipBodyJump = genJumpIfFalse(stmt->getCond());
 
       // Gen the body of the loop
       bcGen.genStmt(builder, regAlloc, stmt->getBody());
@@ -29,7 +29,7 @@ RegisterAllocator::RegisterAllocator(ParamList* params) {
     // This doesn't count as an usage of the ParamDecl, init useCount with 0
     data.useCount = 0;
     // Assign a register address equal to the index of the param
-    data.addr = biggestAllocatedReg_++;
+    data.addr = incrementBiggestAllocatedReg();
   }
 
   // Release unused parameters directly.
@@ -105,7 +105,7 @@ RegisterAllocator::allocateCallRegisters(SmallVectorImpl<RegisterValue>& dest,
     assert((biggestAllocatedReg_ != bc_limits::max_regaddr) && 
       "Can't allocate more registers for this call : "
       "Register number limit reached (too much register pressure)");
-    dest.push_back(RegisterValue(this, biggestAllocatedReg_++));
+    dest.push_back(RegisterValue(this, incrementBiggestAllocatedReg()));
   }
 }
 
@@ -120,6 +120,10 @@ regaddr_t RegisterAllocator::numbersOfRegisterInUse() const {
   return num;
 }
 
+std::size_t RegisterAllocator::getMaxRegisterCount() const {
+  return maxRegisterCount_;
+}
+
 bool RegisterAllocator::isInLoop() const {
   return curLoopContext_;
 }
@@ -186,7 +190,7 @@ regaddr_t RegisterAllocator::rawAllocateNewRegister() {
     "(too much register pressure)");
 
   // Return biggestAllocatedReg_ then increment it.
-  return biggestAllocatedReg_++;
+  return incrementBiggestAllocatedReg();
  
 }
 
@@ -282,6 +286,13 @@ void RegisterAllocator::compactFreeRegisterSet() {
   }
 }
 
+regaddr_t RegisterAllocator::incrementBiggestAllocatedReg() {
+  regaddr_t reg = biggestAllocatedReg_++;
+  if(biggestAllocatedReg_ > maxRegisterCount_)
+    maxRegisterCount_ = biggestAllocatedReg_;
+  return reg;
+}
+
 //----------------------------------------------------------------------------//
 // RegisterValue
 //----------------------------------------------------------------------------//
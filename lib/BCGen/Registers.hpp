@@ -100,6 +100,11 @@ namespace fox {
       /// \returns the number of registers currently in use
       regaddr_t numbersOfRegisterInUse() const;
 
+      /// \returns the maximum number of registers that have been in use
+      /// at the same time, which is the size of the register window
+      /// needed by the function.
+      std::size_t getMaxRegisterCount() const;
+
     private:
       friend RegisterValue;
       friend LoopContext;
@@ -178,11 +183,19 @@ namespace fox {
       /// register usage.
       void compactFreeRegisterSet();
 
+      /// Increments biggestAllocatedReg_, updating maxRegisterCount_ if
+      /// needed.
+      /// \returns the value of biggestAllocatedReg_ before the increment.
+      regaddr_t incrementBiggestAllocatedReg();
+
       /// The address of the 'highest' allocated register + 1
       ///
       /// e.g. if we have allocated 5 registers, this value will be set to 6.
       regaddr_t biggestAllocatedReg_ = 0;
 
+      /// The highest value biggestAllocatedReg_ has ever had.
+      std::size_t maxRegisterCount_ = 0;
+
       /// The set of free registers, sorted from the highest to the lowest one.
       std::set<regaddr_t, std::greater<regaddr_t> > freeRegisters_;
 
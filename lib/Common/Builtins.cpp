@@ -11,6 +11,8 @@
 #include "Fox/Common/Objects.hpp"
 #include "Fox/Common/UTF8.hpp"
 #include <iostream>
+#include <string>
+#include <type_traits>
 
 using namespace fox;
 
@@ -24,10 +26,27 @@ namespace {
     return false;
   }
 
+  // Builtins that take a BuiltinDest return their value through it.
   template<typename ... Args>
   constexpr bool isReturnTypeVoid(void(*)(Args...)) {
+    bool takesDest[] = {std::is_same<Args, BuiltinDest>::value..., false};
+    for (bool value : takesDest) {
+      if(value) return false;
+    }
     return true;
   }
+
+  // The VM and the BuiltinDest aren't passed in registers.
+  template<typename Rtr, typename ... Args>
+  constexpr std::size_t countArgs(Rtr(*)(Args...)) {
+    bool isArg[] = {!(std::is_same<Args, VM&>::value
+                   || std::is_same<Args, BuiltinDest>::value)..., false};
+    std::size_t count = 0;
+    for (bool value : isArg) {
+      if(value) ++count;
+    }
+    return count;
+  }
 }
 
 bool fox::hasNonVoidReturnType(BuiltinKind id) {
@@ -41,6 +60,39 @@ bool fox::hasNonVoidReturnType(BuiltinKind id) {
   }
 }
 
+std::size_t fox::getNumArgs(BuiltinKind id) {
+  switch (id) {
+    #define BUILTIN(FUNC) \
+    case BuiltinKind::FUNC: \
+      return countArgs(builtin::FUNC);
+    #include "Fox/Common/Builtins.def"
+    default:
+      fox_unreachable("unknown BuiltinKind");
+  }
+}
+
+bool fox::isPure(BuiltinKind id) {
+  switch (id) {
+    case BuiltinKind::charToString:
+    case BuiltinKind::intToString:
+    case BuiltinKind::doubleToString:
+    case BuiltinKind::boolToString:
+    case BuiltinKind::strConcat:
+    case BuiltinKind::charConcat:
+    case BuiltinKind::strLength:
+    case BuiltinKind::strNumBytes:
+    case BuiltinKind::getChar:
+    case BuiltinKind::arrSize:
+    case BuiltinKind::arrGet:
+    case BuiltinKind::arrFront:
+    case BuiltinKind::arrBack:
+      return true;
+    default:
+      // The print builtins, and the builtins that modify arrays.
+      return false;
+  }
+}
+
 const char* fox::to_string(BuiltinKind id) {
   switch (id) {
     #define BUILTIN(FUNC) case BuiltinKind::FUNC: return #FUNC;
@@ -99,5 +151,12 @@ void builtin::printDouble(FoxDouble value) {
 
 void builtin::printString(StringObject* str) {
   assert(str && "String is Null!");
-  std::cout << str->str();
+  if (str->isFlat()) {
+    std::cout << str->str();
+    return;
+  }
+  // Ropes can't be flattened without the VM, so copy their bytes.
+  std::string bytes(str->numBytes(), 0);
+  str->copyBytes(&bytes[0]);
+  std::cout << bytes;
 }
\ No newline at end of file
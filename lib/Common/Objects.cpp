@@ -6,8 +6,15 @@
 //----------------------------------------------------------------------------//
 
 #include "Fox/Common/Objects.hpp"
+#include "Fox/Common/Errors.hpp"
 #include "Fox/Common/UTF8.hpp"
 #include "utfcpp/utf8.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemAlloc.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
 
 using namespace fox;
 
@@ -15,91 +22,224 @@ using namespace fox;
 // Object
 //----------------------------------------------------------------------------//
 
-ObjectKind Object::getKind() const {
-  return kind_;
-}
-
 Object::Object(ObjectKind kind) : kind_(kind) {}
 
 //----------------------------------------------------------------------------//
 // StringObject
 //----------------------------------------------------------------------------//
 
-StringObject::StringObject() : StringObject(string_view()) {}
-
-StringObject::StringObject(string_view value) 
-  : Object(ObjectKind::StringObject), str_(value.to_string()) {}
+StringObject::StringObject(std::size_t numBytes, std::size_t length,
+                           bool isRope)
+  : Object(ObjectKind::StringObject), numBytes_(std::uint32_t(numBytes)),
+  length_(std::uint32_t(length)), isRope_(isRope) {
+  assert((numBytes_ == numBytes) && "string is too large");
+  assert((length <= numBytes) && "more codepoints than bytes");
+}
+
+StringObject* 
+StringObject::create(void* mem, string_view value, std::size_t length) {
+  return create(mem, value, string_view(), length);
+}
+
+StringObject* StringObject::create(void* mem, string_view lhs, 
+                                   string_view rhs, std::size_t length) {
+  StringObject* obj = new(mem) StringObject(lhs.size() + rhs.size(), length,
+                                            /*isRope*/ false);
+  char* bytes = obj->getTrailingObjects<char>();
+  std::copy(lhs.begin(), lhs.end(), bytes);
+  std::copy(rhs.begin(), rhs.end(), bytes + lhs.size());
+  assert((countCodepoints(obj->str()) == length) && "incorrect length");
+  obj->buildIndex();
+  return obj;
+}
+
+StringObject* StringObject::create(void* mem, const StringObject* str) {
+  StringObject* obj = new(mem) StringObject(str->numBytes(), str->length(),
+                                            /*isRope*/ false);
+  str->copyBytes(obj->getTrailingObjects<char>());
+  assert((countCodepoints(obj->str()) == obj->length()) 
+    && "incorrect length");
+  obj->buildIndex();
+  return obj;
+}
+
+StringObject* StringObject::create(void* mem, StringObject* lhs, 
+                                   StringObject* rhs) {
+  assert(lhs && rhs && "operand is null");
+  StringObject* obj = new(mem) StringObject(lhs->numBytes() + rhs->numBytes(),
+    lhs->length() + rhs->length(), /*isRope*/ true);
+  StringObject** operands = obj->getTrailingObjects<StringObject*>();
+  operands[0] = lhs;
+  operands[1] = rhs;
+  return obj;
+}
+
+StringObject* StringObject::clone(void* mem) const {
+  StringObject* obj = new(mem) StringObject(numBytes_, length_, isRope_);
+  // Copy every trailing object at once: the operands of a rope, or the
+  // index and the bytes of a flat string.
+  const char* begin = reinterpret_cast<const char*>(this + 1);
+  const char* end = reinterpret_cast<const char*>(this) + getAllocatedSize();
+  std::copy(begin, end, reinterpret_cast<char*>(obj + 1));
+  return obj;
+}
+
+void StringObject::copyBytes(char* dest) const {
+  // Ropes can be very deep, so they are walked with an explicit stack. The
+  // bytes are copied from the end of the string, so the left operands,
+  // which are usually the deepest, are visited last and the stack stays
+  // small when a string is built by appending to it.
+  SmallVector<const StringObject*, 16> worklist(1, this);
+  char* end = dest + numBytes_;
+  while (!worklist.empty()) {
+    const StringObject* str = worklist.pop_back_val();
+    if (str->isFlat()) {
+      string_view bytes = str->str();
+      end -= bytes.size();
+      std::copy(bytes.begin(), bytes.end(), end);
+      continue;
+    }
+    StringObject* const* operands = str->getTrailingObjects<StringObject*>();
+    worklist.push_back(operands[0]);
+    worklist.push_back(operands[1]);
+  }
+  assert((end == dest) && "incorrect number of bytes");
+}
+
+void StringObject::setFlattened(StringObject* flat) {
+  assert(!isFlat() && "string is already flat");
+  assert(flat->isFlat() && (flat->numBytes() == numBytes_) 
+    && "incorrect flat string");
+  StringObject** operands = getTrailingObjects<StringObject*>();
+  operands[0] = flat;
+  operands[1] = nullptr;
+}
 
-const std::string& StringObject::str() const {
-  return str_;
+FoxChar StringObject::getChar(std::size_t n) const {
+  assert((n < length_) && "out of range");
+  if (isRope_)
+    return getFlattened()->getChar(n);
+  const char* bytes = getTrailingObjects<char>();
+  if (isASCII())
+    return FoxChar(static_cast<unsigned char>(bytes[n]));
+  // Start from the closest indexed codepoint.
+  std::size_t offset = 0;
+  if (n >= indexStride)
+    offset = getTrailingObjects<std::uint32_t>()[(n / indexStride) - 1];
+  string_view rest(bytes + offset, numBytes_ - offset);
+  const char* it = rest.begin() + getCodepointOffset(rest, n % indexStride);
+  return utf8::peek_next(it, rest.end());
+}
+
+void StringObject::buildIndex() {
+  std::size_t indexSize = numTrailingObjects(OverloadToken<std::uint32_t>());
+  if (indexSize == 0) return;
+  std::uint32_t* index = getTrailingObjects<std::uint32_t>();
+  string_view bytes = str();
+  std::size_t offset = 0;
+  for (std::size_t k = 0; k < indexSize; ++k) {
+    offset += getCodepointOffset(bytes.substr(offset), indexStride);
+    index[k] = std::uint32_t(offset);
+  }
+}
+
+void* StringObject::operator new(std::size_t, void* mem) {
+  assert(mem);
+  return mem;
 }
 
-std::size_t StringObject::length() const {
-  return utf8::distance(str_.begin(), str_.end());
+//----------------------------------------------------------------------------//
+// ArrayElemKind
+//----------------------------------------------------------------------------//
+
+std::size_t fox::getElemSize(ArrayElemKind kind) {
+  switch (kind) {
+    case ArrayElemKind::Int:    return sizeof(FoxInt);
+    case ArrayElemKind::Double: return sizeof(FoxDouble);
+    case ArrayElemKind::Bool:   return sizeof(std::uint8_t);
+    case ArrayElemKind::Char:   return sizeof(FoxChar);
+    case ArrayElemKind::Ref:    return sizeof(Object*);
+  }
+  fox_unreachable("unknown ArrayElemKind");
 }
 
-std::size_t StringObject::numBytes() const {
-  return str_.size();
+const char* fox::to_string(ArrayElemKind kind) {
+  switch (kind) {
+    case ArrayElemKind::Int:    return "Int";
+    case ArrayElemKind::Double: return "Double";
+    case ArrayElemKind::Bool:   return "Bool";
+    case ArrayElemKind::Char:   return "Char";
+    case ArrayElemKind::Ref:    return "Ref";
+  }
+  fox_unreachable("unknown ArrayElemKind");
 }
 
-FoxChar StringObject::getChar(std::size_t n) const {
-  auto it = str_.begin();
-  auto end = str_.end();
-  utf8::advance(it, n, end);
-  return utf8::peek_next(it, end);
+std::ostream& fox::operator<<(std::ostream& os, ArrayElemKind kind) {
+  return os << to_string(kind);
 }
 
 //----------------------------------------------------------------------------//
 // ArrayObject
 //----------------------------------------------------------------------------//
 
-
-fox::ArrayObject::ArrayObject(bool containsReferences, std::size_t minCapacity) 
-  : Object(ObjectKind::ArrayObject), containsReferences_(containsReferences) {
+ArrayObject::ArrayObject(ArrayElemKind elemKind, std::size_t minCapacity) 
+  : Object(ObjectKind::ArrayObject), elemKind_(elemKind) {
   if(minCapacity != 0)
-    data_.reserve(minCapacity);
+    grow(minCapacity);
 }
 
-void ArrayObject::append(ElemT elem) {
-  data_.push_back(elem);
+ArrayObject::ArrayObject(ArrayObject&& other)
+  : Object(ObjectKind::ArrayObject), elemKind_(other.elemKind_),
+  data_(other.data_), size_(other.size_), capacity_(other.capacity_) {
+  other.data_ = nullptr;
+  other.size_ = other.capacity_ = 0;
 }
 
-ArrayObject::ElemT& ArrayObject::operator[](std::size_t idx) {
-  return data_[idx];
+ArrayObject::~ArrayObject() {
+  std::free(data_);
 }
 
-const ArrayObject::ElemT& ArrayObject::operator[](std::size_t idx) const {
-  return data_[idx];
+ArrayObject* ArrayObject::create(void* mem, ArrayElemKind elemKind, 
+                                 std::size_t minCapacity) {
+  return new(mem) ArrayObject(elemKind, minCapacity);
 }
 
-void ArrayObject::pop() {
-  data_.pop_back();
+ArrayObject* ArrayObject::create(void* mem, const ArrayObject* other) {
+  ArrayObject* arr = new(mem) ArrayObject(other->elemKind_, other->size_);
+  if (other->size_) {
+    std::memcpy(arr->data_, other->data_, 
+                other->size_ * getElemSize(other->elemKind_));
+  }
+  arr->size_ = other->size_;
+  return arr;
 }
 
-ArrayObject::ElemT ArrayObject::front() {
-  return data_.front();
+void ArrayObject::pop() {
+  assert(size_ && "array is empty");
+  --size_;
 }
 
-ArrayObject::ElemT ArrayObject::back() {
-  return data_.back();
+ArrayObject::ElemT ArrayObject::front() const {
+  return (*this)[0];
 }
 
-std::size_t ArrayObject::size() const {
-  return data_.size();
+ArrayObject::ElemT ArrayObject::back() const {
+  return (*this)[size_-1];
 }
 
 void ArrayObject::reset() {
-  data_.clear();
-}
-
-bool ArrayObject::containsReferences() const {
-  return containsReferences_;
+  size_ = 0;
 }
 
-ArrayObject::ArrayT& ArrayObject::data() {
-  return data_;
+std::size_t ArrayObject::getAllocatedSize() const {
+  return sizeof(ArrayObject) + (capacity_ * getElemSize(elemKind_));
 }
 
-const ArrayObject::ArrayT& ArrayObject::data() const {
-  return data_;
+void ArrayObject::grow(std::size_t minCapacity) {
+  // Double the capacity, like std::vector, so appends are amortized O(1).
+  std::size_t newCapacity = std::max<std::size_t>(capacity_*2, 4);
+  newCapacity = std::max(newCapacity, minCapacity);
+  data_ = static_cast<std::uint8_t*>(
+    llvm::safe_realloc(data_, newCapacity * getElemSize(elemKind_)));
+  capacity_ = newCapacity;
 }
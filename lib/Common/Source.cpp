@@ -8,6 +8,7 @@
 #include "Fox/Common/SourceLoc.hpp"
 #include "Fox/Common/SourceManager.hpp"
 #include "Fox/Common/Errors.hpp"
+#include "Fox/Common/UTF8.hpp"
 #include "utfcpp/utf8.hpp"
 #include <fstream>
 #include <sstream>
@@ -269,10 +270,9 @@ SourceManager::calculateLineAndColumn(const Data* data,
   }
   else {
     line = entry.second;
-    auto str_beg = data->content.c_str(); // Pointer to the first 
-                                          // character of the string
-    auto raw_col = utf8::distance(str_beg + entry.first, str_beg + idx);
-    col = static_cast<col_type>(raw_col + 1);
+    string_view lineStr(data->content.c_str() + entry.first, 
+                        idx - entry.first);
+    col = static_cast<col_type>(countCodepoints(lineStr) + 1);
   }
 
   // Return, adding back the extra column if needed
@@ -362,19 +362,11 @@ SourceManager::advance(SourceLoc loc, std::size_t count) const {
   auto raw = loc.getRawIndex();
   assert(isIndexValid(data, raw));
   
-  // Prepare the iterators
-  auto cur = data->content.begin()+raw;
-  auto next = cur;
-  auto end = data->content.end();
-
-  if (cur != end) {
-    // If this isn't a past-the-end SourceLoc
-    for (std::size_t k = 0; k < count; k++) {
-      if(next == end) break;
-      utf8::next(next, end);
-    }
-    // Calculate the offset
-    std::size_t offset = std::distance(cur, next);
+  if (raw != data->content.size()) {
+    // If this isn't a past-the-end SourceLoc, calculate the offset of
+    // the count-th codepoint (or of the end of the file).
+    string_view rest = string_view(data->content).substr(raw);
+    std::size_t offset = getCodepointOffset(rest, count);
     // Recompose the SourceLoc
     return SourceLoc(file, raw+offset);
   }
@@ -398,13 +390,10 @@ SourceManager::getLengthInCodepoints(SourceRange range) const {
   assert(isIndexValid(data, beg.getRawIndex()) && "a is not valid");
   assert(isIndexValid(data, end.getRawIndex()) && "b is not valid");
 
-  // Calculate the needed iterators
-  string_view source = data->content;
-  auto begIt = source.begin()+beg.getRawIndex();
-  auto endIt = source.begin()+end.getRawIndex();
-
   // Calculate the distance 
-  std::size_t distance = utf8::distance(begIt, endIt);
+  string_view source = data->content;
+  std::size_t distance = countCodepoints(source.substr(beg.getRawIndex(),
+    end.getRawIndex() - beg.getRawIndex()));
   assert(distance && "distance is zero!");
   // Return distance+1, because distance doesn't count the first
   // character.
@@ -465,16 +454,21 @@ SourceManager::readFile(string_view path) {
   if(!checkEncoding(in, size))
     return {FileID(), ReadFileResult::InvalidEncoding};
 
-  // Create the iterators
+  // Read the file
   auto beg = (std::istreambuf_iterator<char>(in));
   auto end = (std::istreambuf_iterator<char>());
+  std::string content(beg, end);
+  // Check that it's valid UTF8
+  if(!isValidUTF8(content))
+    return {FileID(), ReadFileResult::InvalidEncoding};
   // Insert the data
-  FileID file = insertData(std::make_unique<Data>(path, beg, end));
+  FileID file = insertData(std::make_unique<Data>(path, std::move(content)));
   return {file, ReadFileResult::Ok};
 }
 
 FileID 
 SourceManager::loadFromString(string_view str, string_view name) {
+  assert(isValidUTF8(str) && "string is not valid UTF8");
   return insertData(std::make_unique<Data>(name, str));
 }
 
@@ -7,9 +7,458 @@
 
 #include "Fox/Common/UTF8.hpp"
 #include "utfcpp/utf8.hpp"
+#include "llvm/Support/MathExtras.h"
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define FOX_UTF8_USE_SSE2 1
+  #include <emmintrin.h>
+#else
+  #define FOX_UTF8_USE_SSE2 0
+#endif
+
+// The AVX2 functions are compiled with the 'target' attribute, so the rest
+// of Fox doesn't need to be compiled with -mavx2. This is only supported by
+// GCC and Clang.
+#if FOX_UTF8_USE_SSE2 && defined(__GNUC__)
+  #define FOX_UTF8_USE_AVX2 1
+  #define FOX_UTF8_AVX2 __attribute__((target("avx2")))
+  #include <immintrin.h>
+#else
+  #define FOX_UTF8_USE_AVX2 0
+#endif
 
 using namespace fox;
 
 void fox::appendFoxChar(FoxChar ch, std::string& dest) {
   utf8::append(ch, std::back_inserter(dest));
-}
\ No newline at end of file
+}
+
+//----------------------------------------------------------------------------//
+// Block functions
+//----------------------------------------------------------------------------//
+// The functions below process the string in blocks, and have one
+// implementation per instruction set. The scalar versions handle the end of
+// the string, which doesn't fill a whole block.
+//----------------------------------------------------------------------------//
+
+namespace {
+  /// \returns true if \p byte is a continuation byte (10xxxxxx).
+  bool isContinuationByte(char byte) {
+    return (static_cast<unsigned char>(byte) & 0xC0) == 0x80;
+  }
+
+  /// \returns true if \p byte is an ASCII character.
+  bool isASCII(char byte) {
+    return !(static_cast<unsigned char>(byte) & 0x80);
+  }
+
+  /// The block functions of an instruction set.
+  struct BlockFunctions {
+    /// \returns true if [it, end) is valid UTF-8.
+    bool (*isValid)(const char* it, const char* end);
+
+    /// \returns the number of bytes of [it, end) that aren't continuation
+    /// bytes (the number of codepoints, if the string is valid).
+    std::size_t (*countLeadBytes)(const char* it, const char* end);
+
+    /// Skips the blocks at the beginning of [it, end) while they contain
+    /// \p n lead bytes or less, and subtracts their lead bytes from \p n.
+    /// \returns a pointer to the first byte that hasn't been skipped.
+    const char* (*skipLeadBytes)(const char* it, const char* end, 
+                                 std::size_t& n);
+  };
+
+  /// Checks the non-ASCII UTF-8 sequence that begins at \p it.
+  /// \returns a pointer past the end of the sequence, or nullptr if it is 
+  /// invalid.
+  const char* checkSequence(const char* it, const char* end) {
+    unsigned char lead = static_cast<unsigned char>(*it);
+    std::size_t size = 0;
+    std::uint32_t cp = 0;
+    std::uint32_t minCP = 0;
+    // 0x80-0xBF are continuation bytes, and 0xC0-0xC1 would always begin 
+    // an overlong encoding.
+    if(lead < 0xC2) 
+      return nullptr;
+    if(lead < 0xE0) {
+      size = 2;
+      cp = lead & 0x1F;
+      minCP = 0x80;
+    }
+    else if(lead < 0xF0) {
+      size = 3;
+      cp = lead & 0x0F;
+      minCP = 0x800;
+    }
+    else if(lead < 0xF5) {
+      size = 4;
+      cp = lead & 0x07;
+      minCP = 0x10000;
+    }
+    else 
+      return nullptr;
+    if(std::size_t(end - it) < size)
+      return nullptr;
+    for(std::size_t k = 1; k < size; ++k) {
+      if(!isContinuationByte(it[k]))
+        return nullptr;
+      cp = (cp << 6) | (static_cast<unsigned char>(it[k]) & 0x3F);
+    }
+    // Reject overlong encodings, surrogates and codepoints beyond U+10FFFF
+    if((cp < minCP) || (cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF)))
+      return nullptr;
+    return it + size;
+  }
+
+  /// Checks [it, end) one sequence at a time, using \p skipASCII to skip 
+  /// runs of ASCII characters.
+  /// \returns true if [it, end) is valid UTF-8.
+  bool checkSequences(const char* it, const char* end, 
+                      const char* (*skipASCII)(const char*, const char*)) {
+    while((it = skipASCII(it, end)) != end) {
+      // Check the non-ASCII sequences until the next ASCII character.
+      do {
+        it = checkSequence(it, end);
+        if(!it) return false;
+      } while((it != end) && !isASCII(*it));
+    }
+    return true;
+  }
+
+  const char* skipASCIIScalar(const char* it, const char* end) {
+    while((it != end) && isASCII(*it))
+      ++it;
+    return it;
+  }
+
+  std::size_t countLeadBytesScalar(const char* it, const char* end) {
+    std::size_t count = 0;
+    for(; it != end; ++it)
+      count += !isContinuationByte(*it);
+    return count;
+  }
+
+  #if !FOX_UTF8_USE_SSE2
+  bool isValidScalar(const char* it, const char* end) {
+    return checkSequences(it, end, skipASCIIScalar);
+  }
+
+  const char* skipLeadBytesScalar(const char* it, const char*, std::size_t&) {
+    // getCodepointOffset does the rest of the work one byte at a time.
+    return it;
+  }
+  #endif
+
+  #if FOX_UTF8_USE_SSE2
+  // Lead bytes are the bytes that aren't in [0x80, 0xBF], which is 
+  // [-128, -65] when they're compared as signed chars.
+  constexpr char maxContinuationByte = -65;
+
+  __m128i loadBlock16(const char* it) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+  }
+
+  /// \returns a mask of the lead bytes of the 16 bytes at \p it
+  unsigned getLeadBytesMask16(const char* it) {
+    __m128i isLead = _mm_cmpgt_epi8(loadBlock16(it), 
+                                    _mm_set1_epi8(maxContinuationByte));
+    return unsigned(_mm_movemask_epi8(isLead));
+  }
+
+  const char* skipASCIISSE2(const char* it, const char* end) {
+    for(; (end - it) >= 16; it += 16) {
+      // The mask of the bytes whose high bit is set.
+      unsigned mask = unsigned(_mm_movemask_epi8(loadBlock16(it)));
+      if(mask)
+        return it + llvm::countTrailingZeros(mask);
+    }
+    return skipASCIIScalar(it, end);
+  }
+
+  bool isValidSSE2(const char* it, const char* end) {
+    // SSE2 doesn't have byte shuffles, so only the ASCII characters are 
+    // checked 16 at a time.
+    return checkSequences(it, end, skipASCIISSE2);
+  }
+
+  std::size_t countLeadBytesSSE2(const char* it, const char* end) {
+    std::size_t count = 0;
+    const __m128i maxCont = _mm_set1_epi8(maxContinuationByte);
+    while((end - it) >= 16) {
+      // Count the lead bytes in 16 8-bit counters, for at most 255 blocks
+      // so they can't overflow, then add them up.
+      __m128i counters = _mm_setzero_si128();
+      for(int k = 0; (k < 255) && ((end - it) >= 16); ++k, it += 16) {
+        // The comparison gives -1 for lead bytes.
+        counters = _mm_sub_epi8(counters, 
+                                _mm_cmpgt_epi8(loadBlock16(it), maxCont));
+      }
+      __m128i sums = _mm_sad_epu8(counters, _mm_setzero_si128());
+      count += std::size_t(_mm_cvtsi128_si32(sums)) 
+             + std::size_t(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+    }
+    return count + countLeadBytesScalar(it, end);
+  }
+
+  const char* 
+  skipLeadBytesSSE2(const char* it, const char* end, std::size_t& n) {
+    for(; (end - it) >= 16; it += 16) {
+      std::size_t count = llvm::countPopulation(getLeadBytesMask16(it));
+      if(count > n) break;
+      n -= count;
+    }
+    return it;
+  }
+  #endif
+
+  #if FOX_UTF8_USE_AVX2
+  FOX_UTF8_AVX2 __m256i loadBlock32(const char* it) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(it));
+  }
+
+  /// \returns the 16 bytes of \p table, in both lanes.
+  FOX_UTF8_AVX2 __m256i makeTable(std::uint8_t t0, std::uint8_t t1, 
+    std::uint8_t t2, std::uint8_t t3, std::uint8_t t4, std::uint8_t t5, 
+    std::uint8_t t6, std::uint8_t t7, std::uint8_t t8, std::uint8_t t9, 
+    std::uint8_t t10, std::uint8_t t11, std::uint8_t t12, std::uint8_t t13, 
+    std::uint8_t t14, std::uint8_t t15) {
+    return _mm256_setr_epi8(
+      t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15,
+      t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14, t15);
+  }
+
+  /// \returns the high nibble of every byte of \p v
+  FOX_UTF8_AVX2 __m256i getHighNibbles(__m256i v) {
+    return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+  }
+
+  /// \returns the bytes of \p input shifted by \p N bytes, with the last
+  /// bytes of \p prev shifted in.
+  template<int N>
+  FOX_UTF8_AVX2 __m256i getPrevBytes(__m256i input, __m256i prev) {
+    return _mm256_alignr_epi8(input, 
+      _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+  }
+
+  /// The UTF-8 validation algorithm of "Validating UTF-8 In Less Than One
+  /// Instruction Per Byte" (John Keiser, Daniel Lemire, 2021), which finds
+  /// every invalid pair of bytes with 3 table lookups.
+  /// \returns a vector that isn't zero if \p input, which comes after 
+  /// \p prev, contains an error.
+  FOX_UTF8_AVX2 __m256i checkBlockAVX2(__m256i input, __m256i prev) {
+    // The errors that can be found by looking at 2 consecutive bytes
+    constexpr std::uint8_t tooShort   = 1 << 0; // 11______ 0_______
+                                                // 11______ 11______
+    constexpr std::uint8_t tooLong    = 1 << 1; // 0_______ 10______
+    constexpr std::uint8_t overlong3  = 1 << 2; // 11100000 100_____
+    constexpr std::uint8_t tooLarge   = 1 << 3; // 11110100 1001____
+                                                // 11110100 101_____
+                                                // 11110101 1001____
+                                                // 11110101 101_____
+                                                // 1111011_ 1001____
+                                                // 1111011_ 101_____
+                                                // 11111___ 1001____
+                                                // 11111___ 101_____
+    constexpr std::uint8_t surrogate  = 1 << 4; // 11101101 101_____
+    constexpr std::uint8_t overlong2  = 1 << 5; // 1100000_ 10______
+    constexpr std::uint8_t tooLarge1000 = 1 << 6; // 11110101 1000____
+                                                  // 1111011_ 1000____
+                                                  // 11111___ 1000____
+    constexpr std::uint8_t overlong4  = 1 << 6; // 11110000 1000____
+    constexpr std::uint8_t twoConts   = 1 << 7; // 10______ 10______
+    // The errors that don't depend on the low nibble of the first byte
+    constexpr std::uint8_t carry = tooShort | tooLong | twoConts;
+
+    __m256i prev1 = getPrevBytes<1>(input, prev);
+    __m256i byte1High = _mm256_shuffle_epi8(makeTable(
+      // 0_______ ________ <ASCII in byte 1>
+      tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong,
+      // 10______ ________ <continuation in byte 1>
+      twoConts, twoConts, twoConts, twoConts,
+      // 1100____ ________ <two byte lead in byte 1>
+      tooShort | overlong2,
+      // 1101____ ________ <two byte lead in byte 1>
+      tooShort,
+      // 1110____ ________ <three byte lead in byte 1>
+      tooShort | overlong3 | surrogate,
+      // 1111____ ________ <four+ byte lead in byte 1>
+      tooShort | tooLarge | tooLarge1000 | overlong4
+    ), getHighNibbles(prev1));
+    __m256i byte1Low = _mm256_shuffle_epi8(makeTable(
+      // ____0000 ________
+      carry | overlong3 | overlong2 | overlong4,
+      // ____0001 ________
+      carry | overlong2,
+      // ____001_ ________
+      carry, carry,
+      // ____0100 ________
+      carry | tooLarge,
+      // ____0101 ________
+      carry | tooLarge | tooLarge1000,
+      // ____011_ ________
+      carry | tooLarge | tooLarge1000, carry | tooLarge | tooLarge1000,
+      // ____1___ ________
+      carry | tooLarge | tooLarge1000, carry | tooLarge | tooLarge1000,
+      carry | tooLarge | tooLarge1000, carry | tooLarge | tooLarge1000,
+      carry | tooLarge | tooLarge1000,
+      // ____1101 ________
+      carry | tooLarge | tooLarge1000 | surrogate,
+      carry | tooLarge | tooLarge1000, carry | tooLarge | tooLarge1000
+    ), _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+    __m256i byte2High = _mm256_shuffle_epi8(makeTable(
+      // ________ 0_______ <ASCII in byte 2>
+      tooShort, tooShort, tooShort, tooShort, 
+      tooShort, tooShort, tooShort, tooShort,
+      // ________ 1000____
+      tooLong | overlong2 | twoConts | overlong3 | tooLarge1000 | overlong4,
+      // ________ 1001____
+      tooLong | overlong2 | twoConts | overlong3 | tooLarge,
+      // ________ 101_____
+      tooLong | overlong2 | twoConts | surrogate | tooLarge,
+      tooLong | overlong2 | twoConts | surrogate | tooLarge,
+      // ________ 11______
+      tooShort, tooShort, tooShort, tooShort
+    ), getHighNibbles(input));
+    __m256i specialCases = 
+      _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+    // The third and fourth bytes of 3 and 4 bytes sequences must be 
+    // continuation bytes, which were marked as twoConts errors above.
+    // Only 111_____ and 1111____ are >= 0x80 after these subtractions.
+    __m256i isThirdByte = _mm256_subs_epu8(getPrevBytes<2>(input, prev),
+                                           _mm256_set1_epi8(0xE0u - 0x80));
+    __m256i isFourthByte = _mm256_subs_epu8(getPrevBytes<3>(input, prev),
+                                            _mm256_set1_epi8(0xF0u - 0x80));
+    __m256i mustBeCont = _mm256_and_si256(
+      _mm256_or_si256(isThirdByte, isFourthByte), 
+      _mm256_set1_epi8(char(0x80)));
+    return _mm256_xor_si256(mustBeCont, specialCases);
+  }
+
+  /// \returns a vector that isn't zero if \p input ends with an incomplete
+  /// sequence.
+  FOX_UTF8_AVX2 __m256i isIncompleteAVX2(__m256i input) {
+    // The last byte can't be a lead byte, the second-to-last byte can't be
+    // the lead byte of a 3 or 4 bytes sequence, etc.
+    const __m256i maxValue = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 
+      char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+    return _mm256_subs_epu8(input, maxValue);
+  }
+
+  FOX_UTF8_AVX2 bool isValidAVX2(const char* it, const char* end) {
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    __m256i prevIncomplete = _mm256_setzero_si256();
+    // The end of the string is copied in a block padded with zeroes 
+    // (ASCII characters), so truncated sequences are errors.
+    alignas(32) char lastBlock[32] = {};
+    bool isLastBlock = false;
+    while(!isLastBlock) {
+      __m256i input;
+      if((end - it) >= 32) {
+        input = loadBlock32(it);
+        it += 32;
+      }
+      else {
+        std::copy(it, end, lastBlock);
+        input = _mm256_load_si256(reinterpret_cast<const __m256i*>(lastBlock));
+        isLastBlock = true;
+      }
+      if(_mm256_movemask_epi8(input) == 0) {
+        // Only ASCII characters, so the only possible error is an 
+        // incomplete sequence at the end of the previous block.
+        error = _mm256_or_si256(error, prevIncomplete);
+        prevIncomplete = _mm256_setzero_si256();
+      }
+      else {
+        error = _mm256_or_si256(error, checkBlockAVX2(input, prev));
+        prevIncomplete = isIncompleteAVX2(input);
+      }
+      prev = input;
+    }
+    return _mm256_testz_si256(error, error);
+  }
+
+  FOX_UTF8_AVX2 
+  std::size_t countLeadBytesAVX2(const char* it, const char* end) {
+    std::size_t count = 0;
+    const __m256i maxCont = _mm256_set1_epi8(maxContinuationByte);
+    while((end - it) >= 32) {
+      __m256i counters = _mm256_setzero_si256();
+      for(int k = 0; (k < 255) && ((end - it) >= 32); ++k, it += 32) {
+        counters = _mm256_sub_epi8(counters, 
+                                   _mm256_cmpgt_epi8(loadBlock32(it), maxCont));
+      }
+      __m256i sums = _mm256_sad_epu8(counters, _mm256_setzero_si256());
+      count += std::size_t(_mm256_extract_epi64(sums, 0))
+             + std::size_t(_mm256_extract_epi64(sums, 1))
+             + std::size_t(_mm256_extract_epi64(sums, 2))
+             + std::size_t(_mm256_extract_epi64(sums, 3));
+    }
+    return count + countLeadBytesSSE2(it, end);
+  }
+
+  FOX_UTF8_AVX2 const char* 
+  skipLeadBytesAVX2(const char* it, const char* end, std::size_t& n) {
+    const __m256i maxCont = _mm256_set1_epi8(maxContinuationByte);
+    for(; (end - it) >= 32; it += 32) {
+      __m256i isLead = _mm256_cmpgt_epi8(loadBlock32(it), maxCont);
+      std::size_t count = 
+        llvm::countPopulation(unsigned(_mm256_movemask_epi8(isLead)));
+      if(count > n) break;
+      n -= count;
+    }
+    return skipLeadBytesSSE2(it, end, n);
+  }
+  #endif
+
+  BlockFunctions selectBlockFunctions() {
+    #if FOX_UTF8_USE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+      return {isValidAVX2, countLeadBytesAVX2, skipLeadBytesAVX2};
+    #endif
+    #if FOX_UTF8_USE_SSE2
+    // SSE2 is always available on x86-64.
+    return {isValidSSE2, countLeadBytesSSE2, skipLeadBytesSSE2};
+    #else
+    return {isValidScalar, countLeadBytesScalar, skipLeadBytesScalar};
+    #endif
+  }
+
+  /// \returns the block functions of the best instruction set supported
+  /// by the CPU.
+  const BlockFunctions& getBlockFunctions() {
+    static const BlockFunctions functions = selectBlockFunctions();
+    return functions;
+  }
+}
+
+//----------------------------------------------------------------------------//
+// String functions
+//----------------------------------------------------------------------------//
+
+bool fox::isValidUTF8(string_view str) {
+  return getBlockFunctions().isValid(str.data(), str.data() + str.size());
+}
+
+std::size_t fox::countCodepoints(string_view str) {
+  return getBlockFunctions().countLeadBytes(str.data(), 
+                                            str.data() + str.size());
+}
+
+std::size_t fox::getCodepointOffset(string_view str, std::size_t n) {
+  const char* beg = str.data();
+  const char* end = beg + str.size();
+  const char* it = getBlockFunctions().skipLeadBytes(beg, end, n);
+  // The n-th lead byte from 'it' is the beginning of the codepoint.
+  for(; it != end; ++it) {
+    if(isContinuationByte(*it)) continue;
+    if(n == 0) break;
+    --n;
+  }
+  return std::size_t(it - beg);
+}
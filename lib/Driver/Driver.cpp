@@ -18,10 +18,13 @@
 #include "Fox/Common/DiagnosticVerifier.hpp"
 #include "Fox/Lexer/Lexer.hpp"
 #include "Fox/Parser/Parser.hpp"
+#include "Fox/Sema/ConstantFolding.hpp"
 #include "Fox/Sema/Sema.hpp"
 #include "Fox/VM/VM.hpp"
+#include "Fox/VM/OpcodePairProfile.hpp"
 #include "llvm/ADT/Optional.h"
 #include <chrono>
+#include <cstdint>
 #include <fstream>
 
 // Some includes are only needed when assertions are enabled.
@@ -177,8 +180,14 @@ int Driver::processFile(string_view path) {
   if(!needsToGenerateBytecode())
     return finish(diagEngine.hadAnyError());
 
+  // Fold the constant expressions unless optimizations are disabled
+  if (options.optLevel != OptLevel::O0) {
+    auto timer = createTimer(*this, "Constant Folding");
+    foldConstants(ctxt, unit);
+  }
+
   BCModule theModule(sourceMgr, diagEngine);
-  BCGen generator(ctxt, theModule);
+  BCGen generator(ctxt, theModule, options.optLevel);
   generator.genUnit(unit);
 
   // Dump the bytecode if needed
@@ -198,6 +207,20 @@ int Driver::processFile(string_view path) {
   return finish(EXIT_SUCCESS);
 }
 
+/// Parses a size \p str (a positive decimal number) into \p result.
+/// \returns false if \p str isn't a valid size.
+static bool parseSize(string_view str, std::size_t& result) {
+  if(str.empty()) return false;
+  result = 0;
+  for (char c : str) {
+    if(c < '0' || c > '9') return false;
+    std::size_t digit = std::size_t(c - '0');
+    if(result > ((SIZE_MAX - digit) / 10)) return false;
+    result = (result * 10) + digit;
+  }
+  return true;
+}
+
 int Driver::main(int argc, char* argv[]) {
   // Must have 2 args, first is executable path, second should
   // be filepath => argc must be >= 2
@@ -211,6 +234,8 @@ int Driver::main(int argc, char* argv[]) {
   if((filepath.front() == '"') && (filepath.back() == '"'))
     filepath = filepath.substr(1, filepath.size()-2);
 
+  const string_view gcThresholdArg = "-gc-threshold=";
+  const string_view gcNurserySizeArg = "-gc-nursery-size=";
   for(int idx = 2; idx < argc; ++idx) {
     string_view str(argv[idx]);
     if (str == "-verify")
@@ -227,6 +252,34 @@ int Driver::main(int argc, char* argv[]) {
       options.dumpTokens = true;
     else if(str == "-run") 
       options.run = true;
+    else if(str == "-O0")
+      options.optLevel = OptLevel::O0;
+    else if(str == "-O1" || str == "-O")
+      options.optLevel = OptLevel::O1;
+    else if(str == "-dump-opcode-pairs")
+      options.dumpOpcodePairs = true;
+    else if(str == "-no-jit")
+      options.noJIT = true;
+    else if(str == "-gc-stress")
+      options.gcStress = true;
+    else if(str == "-gc-debug-alloc")
+      options.gcDebugAlloc = true;
+    else if (str.substr(0, gcThresholdArg.size()) == gcThresholdArg) {
+      string_view value = str.substr(gcThresholdArg.size());
+      if (!parseSize(value, options.gcThreshold) || !options.gcThreshold) {
+        diagEngine.report(DiagID::invalid_argument_value, SourceLoc())
+          .addArg(value).addArg(gcThresholdArg);
+        return false;
+      }
+    }
+    else if (str.substr(0, gcNurserySizeArg.size()) == gcNurserySizeArg) {
+      string_view value = str.substr(gcNurserySizeArg.size());
+      if (!parseSize(value, options.gcNurserySize) || !options.gcNurserySize) {
+        diagEngine.report(DiagID::invalid_argument_value, SourceLoc())
+          .addArg(value).addArg(gcNurserySizeArg);
+        return false;
+      }
+    }
     else if(str == "-v" || str == "-verbose")
       options.verbose = true;
     else {
@@ -278,8 +331,25 @@ int Driver::run(ASTContext& ctxt, FileID mainFile, BCModule& theModule) {
   assert(entryType && entryType->getReturnType()->isIntType() 
     && "Entry Point's type is not () -> int");
 #endif
-  VM vm(theModule);
+  VM::GCOptions gcOptions;
+  if (options.gcThreshold)
+    gcOptions.threshold = options.gcThreshold;
+  if (options.gcNurserySize)
+    gcOptions.nurserySize = options.gcNurserySize;
+  gcOptions.stress = options.gcStress;
+  gcOptions.debugAllocation = options.gcDebugAlloc;
+  VM vm(theModule, gcOptions);
+  if (options.noJIT)
+    vm.setJITThreshold(0);
+  // Profile the program if needed
+  Optional<OpcodePairProfile> profile;
+  if (options.dumpOpcodePairs) {
+    profile.emplace();
+    vm.setOpcodePairProfile(profile.getPointer());
+  }
   VM::Register reg = vm.run(*entryPoint);
+  if (profile)
+    profile->dump(out);
   if(!vm.isAlive())
     return EXIT_FAILURE;
 
@@ -12,6 +12,7 @@
 #include "Fox/Common/DiagnosticEngine.hpp"
 #include "Fox/Common/SourceManager.hpp"
 #include "Fox/Common/Errors.hpp"
+#include "Fox/Common/UTF8.hpp"
 #include "utfcpp/utf8.hpp"
 #include <cctype>
 
@@ -465,15 +466,18 @@ FoxChar Lexer::getCurChar() const {
 
 FoxChar Lexer::peekNextChar() const {
   // TODO: Cache this somewhere.
-  auto it = curPtr_;
-  utf8::advance(it, 1, fileEnd_);
+  if(isEOF()) return 0;
+  // The SourceManager only contains valid UTF8, so the size of the
+  // current character can be deduced from its first byte.
+  auto it = curPtr_ + getCodepointSize(*curPtr_);
   if(it != fileEnd_)
     return utf8::peek_next(it, fileEnd_);
   return 0;
 }
 
 bool Lexer::advance() {
-  utf8::next(curPtr_, fileEnd_);
+  assert(!isEOF() && "advancing past the end of the file");
+  curPtr_ += getCodepointSize(*curPtr_);
   return !isEOF();
 }
 
@@ -497,7 +501,6 @@ SourceRange Lexer::getCurtokRange() const {
 
 string_view Lexer::getCurtokStringView() const {
   if(curPtr_ == fileEnd_) return string_view(curPtr_, 0);
-  const char* it = curPtr_;
-  utf8::advance(it, 1, fileEnd_);
+  const char* it = curPtr_ + getCodepointSize(*curPtr_);
   return string_view(tokBegPtr_, std::distance(tokBegPtr_, it));
 }
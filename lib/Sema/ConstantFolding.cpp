@@ -0,0 +1,438 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : ConstantFolding.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/Sema/ConstantFolding.hpp"
+#include "Fox/AST/ASTContext.hpp"
+#include "Fox/AST/ASTWalker.hpp"
+#include "Fox/AST/Decl.hpp"
+#include "Fox/AST/Expr.hpp"
+#include "Fox/AST/Types.hpp"
+#include "Fox/Common/Builtins.hpp"
+#include "Fox/Common/FoxTypes.hpp"
+#include "Fox/Common/UTF8.hpp"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+using namespace fox;
+
+namespace {
+  using BinOp = BinaryExpr::OpKind;
+  using UnOp = UnaryExpr::OpKind;
+
+  /// The ASTWalker that folds the expressions. Expressions are folded
+  /// after their children, so whole trees of constant operations are
+  /// folded bottom-up.
+  class ConstantFolder : public ASTWalker {
+    public:
+      ConstantFolder(ASTContext& ctxt) : ctxt(ctxt) {}
+
+      ASTContext& ctxt;
+
+      Expr* handleExprPost(Expr* expr) override {
+        Expr* folded = nullptr;
+        if (auto binary = dyn_cast<BinaryExpr>(expr))
+          folded = foldBinaryExpr(binary);
+        else if (auto unary = dyn_cast<UnaryExpr>(expr))
+          folded = foldUnaryExpr(unary);
+        else if (auto cast = dyn_cast<CastExpr>(expr))
+          folded = foldCastExpr(cast);
+        else if (auto declRef = dyn_cast<DeclRefExpr>(expr))
+          folded = propagateDeclRefExpr(declRef);
+        return folded ? folded : expr;
+      }
+
+    private:
+      //----------------------------------------------------------------------//
+      // Literal creation
+      //----------------------------------------------------------------------//
+
+      template<typename Literal, typename Value>
+      Expr* createLiteral(Value value, Expr* original) {
+        Expr* lit = Literal::create(ctxt, value, original->getSourceRange());
+        lit->setType(original->getType()->getRValue());
+        return lit;
+      }
+
+      /// Creates a literal containing the integral \p value (an int or a
+      /// bool, like the VM registers) of the type of \p original.
+      Expr* createIntegralLiteral(FoxInt value, Expr* original) {
+        Type type = original->getType()->getRValue();
+        if(type->isBoolType())
+          return createLiteral<BoolLiteralExpr>(value != 0, original);
+        if(type->isIntType())
+          return createLiteral<IntegerLiteralExpr>(value, original);
+        return nullptr;
+      }
+
+      Expr* createStringLiteral(string_view value, SourceRange range) {
+        if(value.size()) value = ctxt.allocateCopy(value);
+        Expr* lit = StringLiteralExpr::create(ctxt, value, range);
+        lit->setType(StringType::get(ctxt));
+        return lit;
+      }
+
+      /// \returns a copy of the literal \p lit located at \p original
+      Expr* cloneLiteral(Expr* lit, Expr* original) {
+        if (auto intLit = dyn_cast<IntegerLiteralExpr>(lit))
+          return createLiteral<IntegerLiteralExpr>(intLit->getValue(), original);
+        if (auto doubleLit = dyn_cast<DoubleLiteralExpr>(lit))
+          return createLiteral<DoubleLiteralExpr>(doubleLit->getValue(),
+                                                  original);
+        if (auto boolLit = dyn_cast<BoolLiteralExpr>(lit))
+          return createLiteral<BoolLiteralExpr>(boolLit->getValue(), original);
+        if (auto charLit = dyn_cast<CharLiteralExpr>(lit))
+          return createLiteral<CharLiteralExpr>(charLit->getValue(), original);
+        if (auto strLit = dyn_cast<StringLiteralExpr>(lit))
+          return createLiteral<StringLiteralExpr>(strLit->getValue(), original);
+        return nullptr;
+      }
+
+      //----------------------------------------------------------------------//
+      // Literal values
+      //----------------------------------------------------------------------//
+
+      /// \returns the literal initializer of the 'let' variable referenced by
+      /// \p expr if there's one, else \p expr. The returned expression must
+      /// be cloned to be inserted in the AST.
+      static Expr* getConstant(Expr* expr) {
+        auto declRef = dyn_cast<DeclRefExpr>(expr);
+        if(!declRef) return expr;
+        auto var = dyn_cast<VarDecl>(declRef->getDecl());
+        if(!var || !var->isLet() || !var->hasInitExpr()) return expr;
+        Expr* init = var->getInitExpr();
+        return isa<AnyLiteralExpr>(init) ? init : expr;
+      }
+
+      /// If \p expr is an int, bool or char literal, stores its value in
+      /// \p value and returns true. These are all stored as integers in the
+      /// VM registers, and compared as such.
+      static bool getIntegralValue(Expr* expr, FoxInt& value) {
+        if (auto intLit = dyn_cast<IntegerLiteralExpr>(expr)) {
+          value = intLit->getValue();
+          return true;
+        }
+        if (auto boolLit = dyn_cast<BoolLiteralExpr>(expr)) {
+          value = boolLit->getValue();
+          return true;
+        }
+        if (auto charLit = dyn_cast<CharLiteralExpr>(expr)) {
+          value = FoxInt(charLit->getValue());
+          return true;
+        }
+        return false;
+      }
+
+      /// If \p expr is a string or char literal, appends its value to
+      /// \p str and returns true.
+      static bool appendStringValue(Expr* expr, std::string& str) {
+        if (auto strLit = dyn_cast<StringLiteralExpr>(expr)) {
+          str.append(strLit->getValue().data(), strLit->getValue().size());
+          return true;
+        }
+        if (auto charLit = dyn_cast<CharLiteralExpr>(expr)) {
+          appendFoxChar(charLit->getValue(), str);
+          return true;
+        }
+        return false;
+      }
+
+      /// \returns true if \p value can be converted to a FoxInt.
+      /// (The conversion of the other values isn't defined)
+      static bool isConvertibleToInt(FoxDouble value) {
+        // 2^63 is exactly representable as a double
+        const FoxDouble limit = 9223372036854775808.0;
+        return (value >= -limit) && (value < limit);
+      }
+
+      //----------------------------------------------------------------------//
+      // Operations
+      //----------------------------------------------------------------------//
+      // These compute the result of the operations exactly as the VM does.
+      // They return false when the operation can't be folded, either
+      // because it fails at runtime (and the VM must diagnose it) or because
+      // its result depends on the host.
+      //----------------------------------------------------------------------//
+
+      /// Integer binary operations (DivInt, PowInt, LEInt, LAnd, ...)
+      static bool foldIntBinOp(BinOp op, FoxInt lhs, FoxInt rhs,
+                               FoxInt& result) {
+        // Arithmetic wraps around like the VM's, which uses the
+        // instructions of the host.
+        using UInt = std::uint64_t;
+        switch (op) {
+          case BinOp::Add:  // +
+            result = FoxInt(UInt(lhs) + UInt(rhs));
+            return true;
+          case BinOp::Sub:  // -
+            result = FoxInt(UInt(lhs) - UInt(rhs));
+            return true;
+          case BinOp::Mul:  // *
+            result = FoxInt(UInt(lhs) * UInt(rhs));
+            return true;
+          case BinOp::Div:  // /
+          case BinOp::Mod:  // %
+            // Divisions by zero are diagnosed at runtime, and the
+            // division of the smallest int by -1 overflows.
+            if(rhs == 0) return false;
+            if((lhs == std::numeric_limits<FoxInt>::min()) && (rhs == -1))
+              return false;
+            result = (op == BinOp::Div) ? (lhs / rhs) : (lhs % rhs);
+            return true;
+          case BinOp::Pow: {  // **
+            // PowInt uses the floating-point std::pow
+            FoxDouble value = std::pow(lhs, rhs);
+            if(!isConvertibleToInt(value)) return false;
+            result = FoxInt(value);
+            return true;
+          }
+          case BinOp::LE:   // <=
+            result = (lhs <= rhs);
+            return true;
+          case BinOp::GE:   // >=
+            result = (lhs >= rhs);
+            return true;
+          case BinOp::LT:   // <
+            result = (lhs < rhs);
+            return true;
+          case BinOp::GT:   // >
+            result = (lhs > rhs);
+            return true;
+          case BinOp::Eq:   // ==
+            result = (lhs == rhs);
+            return true;
+          case BinOp::NEq:  // !=
+            result = (lhs != rhs);
+            return true;
+          case BinOp::LAnd: // &&
+            result = (lhs && rhs);
+            return true;
+          case BinOp::LOr:  // ||
+            result = (lhs || rhs);
+            return true;
+          default:
+            return false;
+        }
+      }
+
+      /// Double binary operations that return a double (AddDouble,
+      /// ModDouble, ...)
+      static bool foldDoubleArithOp(BinOp op, FoxDouble lhs, FoxDouble rhs,
+                                    FoxDouble& result) {
+        switch (op) {
+          case BinOp::Add:  // +
+            result = lhs + rhs;
+            return true;
+          case BinOp::Sub:  // -
+            result = lhs - rhs;
+            return true;
+          case BinOp::Mul:  // *
+            result = lhs * rhs;
+            return true;
+          case BinOp::Div:  // /
+            // Divisions by zero are diagnosed at runtime
+            if(rhs == 0) return false;
+            result = lhs / rhs;
+            return true;
+          case BinOp::Mod:  // %
+            // Modulos by zero are diagnosed at runtime
+            if(rhs == 0) return false;
+            result = std::fmod(lhs, rhs);
+            return true;
+          case BinOp::Pow:  // **
+            result = std::pow(lhs, rhs);
+            return true;
+          default:
+            return false;
+        }
+      }
+
+      /// Double comparisons (LEDouble, EqDouble, ...)
+      static bool foldDoubleComparison(BinOp op, FoxDouble lhs, FoxDouble rhs,
+                                       bool& result) {
+        switch (op) {
+          case BinOp::LE:   // <=
+            result = (lhs <= rhs);
+            return true;
+          case BinOp::GE:   // >=
+            result = (lhs >= rhs);
+            return true;
+          case BinOp::LT:   // <
+            result = (lhs < rhs);
+            return true;
+          case BinOp::GT:   // >
+            result = (lhs > rhs);
+            return true;
+          case BinOp::Eq:   // ==
+            result = (lhs == rhs);
+            return true;
+          case BinOp::NEq:  // != is compiled as !(a == b)
+            result = !(lhs == rhs);
+            return true;
+          default:
+            return false;
+        }
+      }
+
+      //----------------------------------------------------------------------//
+      // Folding
+      //----------------------------------------------------------------------//
+      // These functions return the expression that should replace the
+      // expression, or nullptr if it can't be folded.
+      //----------------------------------------------------------------------//
+
+      Expr* foldBinaryExpr(BinaryExpr* expr) {
+        if(expr->isAssignement()) return nullptr;
+        // Concatenations of strings and chars
+        if(expr->isConcat()) return foldConcat(expr);
+
+        Expr* lhs = getConstant(expr->getLHS());
+        Expr* rhs = getConstant(expr->getRHS());
+
+        // Operations on ints, bools and chars
+        FoxInt lhsInt = 0, rhsInt = 0, intResult = 0;
+        if (getIntegralValue(lhs, lhsInt) && getIntegralValue(rhs, rhsInt)) {
+          if(!foldIntBinOp(expr->getOp(), lhsInt, rhsInt, intResult))
+            return nullptr;
+          return createIntegralLiteral(intResult, expr);
+        }
+
+        // Operations on doubles
+        auto lhsDouble = dyn_cast<DoubleLiteralExpr>(lhs);
+        auto rhsDouble = dyn_cast<DoubleLiteralExpr>(rhs);
+        if(!lhsDouble || !rhsDouble) return nullptr;
+        if (expr->getType()->isBoolType()) {
+          bool result = false;
+          if(!foldDoubleComparison(expr->getOp(), lhsDouble->getValue(),
+                                   rhsDouble->getValue(), result))
+            return nullptr;
+          return createLiteral<BoolLiteralExpr>(result, expr);
+        }
+        FoxDouble result = 0;
+        if(!foldDoubleArithOp(expr->getOp(), lhsDouble->getValue(),
+                              rhsDouble->getValue(), result))
+          return nullptr;
+        return createLiteral<DoubleLiteralExpr>(result, expr);
+      }
+
+      Expr* foldConcat(BinaryExpr* expr) {
+        Expr* lhs = getConstant(expr->getLHS());
+        Expr* rhs = getConstant(expr->getRHS());
+        std::string str;
+        if (appendStringValue(lhs, str)) {
+          if(!appendStringValue(rhs, str)) return nullptr;
+          return createStringLiteral(str, expr->getSourceRange());
+        }
+        // Concatenations are left-associative, so (x + "a") + "b" is
+        // folded into x + "ab", which has the same result.
+        auto lhsConcat = dyn_cast<BinaryExpr>(lhs);
+        if(!lhsConcat || !lhsConcat->isConcat()) return nullptr;
+        Expr* middle = getConstant(lhsConcat->getRHS());
+        if(!appendStringValue(middle, str) || !appendStringValue(rhs, str))
+          return nullptr;
+        expr->setLHS(lhsConcat->getLHS());
+        expr->setRHS(createStringLiteral(str, SourceRange(
+          lhsConcat->getRHS()->getBeginLoc(), expr->getRHS()->getEndLoc())));
+        return expr;
+      }
+
+      Expr* foldUnaryExpr(UnaryExpr* expr) {
+        Expr* child = getConstant(expr->getChild());
+        switch (expr->getOp()) {
+          case UnOp::LNot: // !
+            if (auto boolLit = dyn_cast<BoolLiteralExpr>(child))
+              return createLiteral<BoolLiteralExpr>(!boolLit->getValue(), expr);
+            return nullptr;
+          case UnOp::Minus: // -
+            if (auto intLit = dyn_cast<IntegerLiteralExpr>(child)) {
+              auto value = FoxInt(-std::uint64_t(intLit->getValue()));
+              return createLiteral<IntegerLiteralExpr>(value, expr);
+            }
+            if (auto doubleLit = dyn_cast<DoubleLiteralExpr>(child))
+              return createLiteral<DoubleLiteralExpr>(-doubleLit->getValue(),
+                                                      expr);
+            return nullptr;
+          case UnOp::Plus: // + is a no-op
+            return cloneLiteral(child, expr);
+          case UnOp::ToString: // $
+            return foldToString(expr);
+          default:
+            return nullptr;
+        }
+      }
+
+      /// Folds the $ operator using the conversions of the
+      /// intToString, doubleToString, ... builtins.
+      Expr* foldToString(UnaryExpr* expr) {
+        namespace util = builtin::util;
+        Expr* child = getConstant(expr->getChild());
+        if(isa<StringLiteralExpr>(child)) return cloneLiteral(child, expr);
+        std::string str;
+        if (auto intLit = dyn_cast<IntegerLiteralExpr>(child))
+          str = util::to_string(intLit->getValue());
+        else if (auto doubleLit = dyn_cast<DoubleLiteralExpr>(child))
+          str = util::to_string(doubleLit->getValue());
+        else if (auto boolLit = dyn_cast<BoolLiteralExpr>(child))
+          str = util::to_string(boolLit->getValue());
+        else if (auto charLit = dyn_cast<CharLiteralExpr>(child))
+          str = util::to_string(charLit->getValue());
+        else 
+          return nullptr;
+        return createStringLiteral(str, expr->getSourceRange());
+      }
+
+      Expr* foldCastExpr(CastExpr* expr) {
+        Expr* child = getConstant(expr->getChild());
+        if(expr->isUseless()) return cloneLiteral(child, expr);
+        Type type = expr->getType();
+        // Int -> Double (IntToDouble)
+        if (auto intLit = dyn_cast<IntegerLiteralExpr>(child)) {
+          if(!type->isDoubleType()) return nullptr;
+          return createLiteral<DoubleLiteralExpr>(
+            FoxDouble(intLit->getValue()), expr);
+        }
+        // Double -> Int (DoubleToInt)
+        if (auto doubleLit = dyn_cast<DoubleLiteralExpr>(child)) {
+          if(!type->isIntType()) return nullptr;
+          if(!isConvertibleToInt(doubleLit->getValue())) return nullptr;
+          return createLiteral<IntegerLiteralExpr>(
+            FoxInt(doubleLit->getValue()), expr);
+        }
+        return nullptr;
+      }
+
+      /// Replaces references to global 'let' variables initialized with a
+      /// literal with that literal.
+      ///
+      /// This replaces a GetGlobal with a constant. The references to 
+      /// local variables read a register, which is cheaper than loading
+      /// a constant, so they're only replaced when the operation that
+      /// uses them can be folded (see getConstant).
+      Expr* propagateDeclRefExpr(DeclRefExpr* expr) {
+        if(!expr->getDecl()->isGlobal()) return nullptr;
+        Expr* init = getConstant(expr);
+        if(init == expr) return nullptr;
+        // Loading the empty string allocates a new string, so
+        // references to such variables are kept.
+        if (auto strLit = dyn_cast<StringLiteralExpr>(init))
+          if(strLit->getValue().empty()) return nullptr;
+        return cloneLiteral(init, expr);
+      }
+  };
+}
+
+void fox::foldConstants(ASTContext& ctxt, UnitDecl* unit) {
+  ConstantFolder folder(ctxt);
+  // Fold the initializers of the global variables first, so they can be
+  // propagated to the functions that are declared before them.
+  for (Decl* decl : unit->getDecls()) {
+    if(isa<VarDecl>(decl))
+      folder.walk(decl);
+  }
+  folder.walk(unit);
+}
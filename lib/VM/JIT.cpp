@@ -0,0 +1,595 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : JIT.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/VM/JIT.hpp"
+#include "Fox/BC/BCFunction.hpp"
+#include "Fox/BC/BCModule.hpp"
+#include "Fox/BC/Instruction.hpp"
+#include "Fox/Common/Errors.hpp"
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+// The JIT generates x86-64 machine code for the System V calling convention,
+// and uses mmap/mprotect to allocate executable memory. FOX_VM_JIT is set
+// by the build system (see the FOX_VM_JIT CMake option).
+#if defined(FOX_VM_JIT) && defined(__x86_64__) && defined(__linux__)
+  #define FOX_VM_USE_JIT 1
+  #include <sys/mman.h>
+  #include <unistd.h>
+#else
+  #define FOX_VM_USE_JIT 0
+#endif
+
+using namespace fox;
+
+#if FOX_VM_USE_JIT
+namespace {
+  /// Generates the native code of a BCFunction.
+  ///
+  /// The native code is called like this C function:
+  ///   std::uint32_t entry(Register* base, Register* globals,
+  ///                       std::uint32_t idx)
+  /// So 'base' is in rdi, 'globals' in rsi and 'idx' in edx.
+  /// The code starts by jumping to the code of the instruction 'idx'
+  /// using a table of entry points, which is stored after the code.
+  /// The code only uses rax, rcx, rdx, xmm0 and xmm1, which don't need
+  /// to be saved.
+  ///
+  /// Every instruction which isn't supported becomes an exit: it returns
+  /// its own index to the interpreter, which will execute it.
+  class JITCompiler {
+    public:
+      JITCompiler(const BCModule& bcModule, ArrayRef<Instruction> instrs)
+        : bcModule(bcModule), instrs(instrs) {}
+
+      /// Generates the code. The entry table is not generated, but
+      /// instrOffsets contains the offset of the code of every instruction
+      /// in the code buffer, plus the offset of the end of the code.
+      void compile();
+
+      /// Emits the code that jumps to the entry point of the instruction
+      /// whose index is in edx, using the table at \p tableOffset.
+      void emitPrologue(std::size_t tableOffset);
+
+      /// The code buffer
+      std::vector<std::uint8_t> code;
+      /// The offset of the code of each instruction in the code buffer.
+      std::vector<std::size_t> instrOffsets;
+
+    private:
+      /// A jump whose target hasn't been generated yet.
+      struct Fixup {
+        /// The offset of the 32 bits relative displacement to patch
+        std::size_t offset;
+        /// The index of the target instruction
+        std::size_t target;
+      };
+
+      /// The size of the prologue, in bytes
+      static constexpr std::size_t prologueSize = 12;
+
+      /// Generates the code of the instruction at index \p idx
+      void compileInstr(std::size_t idx);
+
+      /// \returns the index of the target of the jump at index \p idx,
+      /// with offset \p offset.
+      std::size_t getJumpTarget(std::size_t idx, jump_offset_t offset) const;
+
+      //----------------------------------------------------------------------//
+      // Machine code emission
+      //----------------------------------------------------------------------//
+
+      void emit(std::initializer_list<std::uint8_t> bytes) {
+        code.insert(code.end(), bytes);
+      }
+
+      void emit32(std::uint32_t value) {
+        for(int k = 0; k < 4; ++k)
+          code.push_back(std::uint8_t(value >> (k*8)));
+      }
+
+      void emit64(std::uint64_t value) {
+        for(int k = 0; k < 8; ++k)
+          code.push_back(std::uint8_t(value >> (k*8)));
+      }
+
+      /// Emits the ModRM byte of an operand [BASE+disp32] (BASE is 7 for
+      /// rdi, 6 for rsi) with register \p reg, followed by the displacement.
+      void emitMem(std::uint8_t reg, std::uint8_t base, std::uint32_t disp) {
+        emit({std::uint8_t(0x80 | (reg << 3) | base)});
+        emit32(disp);
+      }
+
+      /// The displacement of the register \p reg from the base register
+      static std::uint32_t regDisp(regaddr_t reg) {
+        return std::uint32_t(reg) * sizeof(VM::Register);
+      }
+
+      /// Register numbers used in ModRM bytes
+      enum : std::uint8_t { rax = 0, rcx = 1, rdx = 2, rsi = 6, rdi = 7 };
+
+      /// mov GPR, [rdi+reg*8]
+      void emitLoad(std::uint8_t gpr, regaddr_t reg) {
+        emit({0x48, 0x8B});
+        emitMem(gpr, rdi, regDisp(reg));
+      }
+
+      /// mov [rdi+reg*8], GPR
+      void emitStore(regaddr_t reg, std::uint8_t gpr) {
+        emit({0x48, 0x89});
+        emitMem(gpr, rdi, regDisp(reg));
+      }
+
+      /// movsd XMM, [rdi+reg*8]
+      void emitLoadDouble(std::uint8_t xmm, regaddr_t reg) {
+        emit({0xF2, 0x0F, 0x10});
+        emitMem(xmm, rdi, regDisp(reg));
+      }
+
+      /// movsd [rdi+reg*8], xmm0
+      void emitStoreDouble(regaddr_t reg) {
+        emit({0xF2, 0x0F, 0x11});
+        emitMem(0, rdi, regDisp(reg));
+      }
+
+      /// mov rax, imm64 then mov [rdi+reg*8], rax
+      void emitStoreImm64(regaddr_t reg, std::uint64_t value) {
+        emit({0x48, 0xB8});
+        emit64(value);
+        emitStore(reg, rax);
+      }
+
+      /// movzx eax, al then mov [rdi+reg*8], rax
+      void emitStoreBool(regaddr_t reg) {
+        emit({0x0F, 0xB6, 0xC0});
+        emitStore(reg, rax);
+      }
+
+      /// Emits a Jcc (or a jmp if \p cc is 0) to the instruction at
+      /// index \p target. The condition codes are the second byte of the
+      /// 'Jcc rel32' opcode (e.g. 0x84 for je).
+      void emitJump(std::uint8_t cc, std::size_t target) {
+        if(cc) emit({0x0F, cc});
+        else   emit({0xE9});
+        fixups_.push_back({code.size(), target});
+        emit32(0);
+      }
+
+      /// Emits a return to the interpreter at the instruction at \p idx
+      void emitExit(std::size_t idx) {
+        // mov eax, idx
+        emit({0xB8});
+        emit32(std::uint32_t(idx));
+        // ret
+        emit({0xC3});
+      }
+
+      /// Emits a return to the interpreter at the instruction at \p idx
+      /// if ZF is set (e.g. after a 'test' instruction).
+      void emitExitIfZero(std::size_t idx) {
+        // jnz over the exit, which is 6 bytes long.
+        emit({0x75, 0x06});
+        emitExit(idx);
+      }
+
+      /// Emits 'dest = lhs OP rhs' for integers, where \p op are the bytes
+      /// of 'OP rax, rcx'.
+      void emitIntBinOp(const Instruction& instr,
+                        std::initializer_list<std::uint8_t> op) {
+        emitLoad(rax, instr.AddInt.lhs);
+        emitLoad(rcx, instr.AddInt.rhs);
+        emit(op);
+        emitStore(instr.AddInt.dest, rax);
+      }
+
+      /// Emits 'dest = src OP imm' for integers, where \p op are the bytes
+      /// of 'OP rax, imm32' without the immediate.
+      void emitIntImmOp(const Instruction& instr,
+                        std::initializer_list<std::uint8_t> op) {
+        emitLoad(rax, instr.AddIntImm.src);
+        emit(op);
+        emit32(std::uint32_t(std::int32_t(instr.AddIntImm.imm)));
+        emitStore(instr.AddIntImm.dest, rax);
+      }
+
+      /// Emits 'dest = lhs OP rhs' for doubles, where \p op is the third
+      /// byte of 'OPsd xmm0, xmm1'.
+      void emitDoubleBinOp(const Instruction& instr, std::uint8_t op) {
+        emitLoadDouble(0, instr.AddDouble.lhs);
+        emitLoadDouble(1, instr.AddDouble.rhs);
+        emit({0xF2, 0x0F, op, 0xC1});
+        emitStoreDouble(instr.AddDouble.dest);
+      }
+
+      /// Emits 'dest = (lhs CC rhs)' for integers, where \p setcc is the
+      /// second byte of 'SETcc al'.
+      void emitIntComp(const Instruction& instr, std::uint8_t setcc) {
+        emitLoad(rax, instr.EqInt.lhs);
+        // cmp rax, [rdi+rhs]
+        emit({0x48, 0x3B});
+        emitMem(rax, rdi, regDisp(instr.EqInt.rhs));
+        emit({0x0F, setcc, 0xC0});
+        emitStoreBool(instr.EqInt.dest);
+      }
+
+      /// Emits 'dest = (lhs CC rhs)' for doubles, where \p setcc is the
+      /// second byte of 'SETcc al'. If \p swap is true, the operands of the
+      /// comparison are swapped.
+      void emitDoubleComp(const Instruction& instr, std::uint8_t setcc,
+                          bool swap) {
+        emitLoadDouble(0, instr.EqDouble.lhs);
+        emitLoadDouble(1, instr.EqDouble.rhs);
+        // ucomisd xmm0, xmm1 (or xmm1, xmm0 if swapped)
+        emit({0x66, 0x0F, 0x2E, std::uint8_t(swap ? 0xC8 : 0xC1)});
+        emit({0x0F, setcc, 0xC0});
+        emitStoreBool(instr.EqDouble.dest);
+      }
+
+      /// Emits a fused compare and jump at index \p idx, where \p cc is
+      /// the condition code of the jump.
+      void emitCompareAndJump(std::size_t idx, std::uint8_t cc) {
+        const Instruction& instr = instrs[idx];
+        assert(((idx+1) < instrs.size())
+          && (instrs[idx+1].opcode == Opcode::JumpOffset)
+          && "compare and jump not followed by a JumpOffset");
+        emitLoad(rax, instr.JumpIfEqInt.lhs);
+        // cmp rax, [rdi+rhs]
+        emit({0x48, 0x3B});
+        emitMem(rax, rdi, regDisp(instr.JumpIfEqInt.rhs));
+        // The JumpOffset doesn't generate any code, so we simply fall
+        // through to the next instruction if we don't jump.
+        emitJump(cc, getJumpTarget(idx+1, instrs[idx+1].JumpOffset.offset));
+      }
+
+      const BCModule& bcModule;
+      ArrayRef<Instruction> instrs;
+      std::vector<Fixup> fixups_;
+  };
+}
+
+/// \returns the first instruction executed by \p op if it's a
+/// superinstruction, else returns \p op.
+static Opcode getFirstInstruction(Opcode op) {
+  switch (op) {
+    #define SUPER_INSTR(ID, FIRST, SECOND)\
+      case Opcode::ID: return Opcode::FIRST;
+    #include "Fox/BC/Instruction.def"
+    default: return op;
+  }
+}
+
+std::size_t
+JITCompiler::getJumpTarget(std::size_t idx, jump_offset_t offset) const {
+  // The offset is relative to the next instruction
+  std::ptrdiff_t target = std::ptrdiff_t(idx) + 1 + offset;
+  assert((target >= 0) && (std::size_t(target) <= instrs.size())
+    && "jump target is out of the instruction buffer");
+  return std::size_t(target);
+}
+
+void JITCompiler::compile() {
+  // Leave some space for the prologue.
+  code.resize(prologueSize);
+  instrOffsets.reserve(instrs.size()+1);
+  for (std::size_t idx = 0; idx < instrs.size(); ++idx) {
+    instrOffsets.push_back(code.size());
+    compileInstr(idx);
+  }
+  // Jumps can target the end of the buffer. This can't happen at runtime,
+  // but the jump still needs a target.
+  instrOffsets.push_back(code.size());
+  emitExit(instrs.size());
+  // Resolve the jumps
+  for (const Fixup& fixup : fixups_) {
+    std::int32_t rel = std::int32_t(instrOffsets[fixup.target])
+                     - std::int32_t(fixup.offset + 4);
+    std::memcpy(&code[fixup.offset], &rel, sizeof(rel));
+  }
+}
+
+void JITCompiler::emitPrologue(std::size_t tableOffset) {
+  std::vector<std::uint8_t> body = std::move(code);
+  code.clear();
+  // mov edx, edx (zero-extends idx)
+  emit({0x89, 0xD2});
+  // lea rcx, [rip+table]
+  emit({0x48, 0x8D, 0x0D});
+  emit32(std::uint32_t(std::int32_t(tableOffset) - std::int32_t(9)));
+  // jmp [rcx+rdx*8]
+  emit({0xFF, 0x24, 0xD1});
+  assert((code.size() == prologueSize) && "incorrect prologue size");
+  std::copy(code.begin(), code.end(), body.begin());
+  code = std::move(body);
+}
+
+void JITCompiler::compileInstr(std::size_t idx) {
+  Instruction instr = instrs[idx];
+  // Superinstructions have the operands of their first instruction, and
+  // their second instruction is the next one. Just compile the first one.
+  instr.opcode = getFirstInstruction(instr.opcode);
+  switch (instr.opcode) {
+    case Opcode::NoOp:
+    case Opcode::JumpOffset:
+    case Opcode::CallTarget:
+      // JumpOffsets are handled by the compare and jump that precedes them,
+      // and CallTargets by the interpreter, which executes direct calls.
+      break;
+    case Opcode::StoreSmallInt:
+      // mov qword [rdi+dest], imm32
+      emit({0x48, 0xC7});
+      emitMem(0, rdi, regDisp(instr.StoreSmallInt.dest));
+      emit32(std::uint32_t(std::int32_t(instr.StoreSmallInt.value)));
+      break;
+    case Opcode::Copy:
+      emitLoad(rax, instr.Copy.src);
+      emitStore(instr.Copy.dest, rax);
+      break;
+    case Opcode::LoadIntK:
+      emitStoreImm64(instr.LoadIntK.dest,
+        VM::Register(bcModule.getIntConstant(instr.LoadIntK.kID)).raw);
+      break;
+    case Opcode::LoadDoubleK:
+      emitStoreImm64(instr.LoadDoubleK.dest,
+        VM::Register(bcModule.getDoubleConstant(instr.LoadDoubleK.kID)).raw);
+      break;
+    case Opcode::GetGlobal:
+      // mov rax, [rsi+id*8]
+      emit({0x48, 0x8B});
+      emitMem(rax, rsi, std::uint32_t(instr.GetGlobal.id) * 8);
+      emitStore(instr.GetGlobal.dest, rax);
+      break;
+    case Opcode::SetGlobal:
+      emitLoad(rax, instr.SetGlobal.src);
+      // mov [rsi+id*8], rax
+      emit({0x48, 0x89});
+      emitMem(rax, rsi, std::uint32_t(instr.SetGlobal.id) * 8);
+      break;
+    case Opcode::AddInt:
+      // add rax, rcx
+      emitIntBinOp(instr, {0x48, 0x01, 0xC8});
+      break;
+    case Opcode::SubInt:
+      // sub rax, rcx
+      emitIntBinOp(instr, {0x48, 0x29, 0xC8});
+      break;
+    case Opcode::MulInt:
+      // imul rax, rcx
+      emitIntBinOp(instr, {0x48, 0x0F, 0xAF, 0xC1});
+      break;
+    case Opcode::DivInt:
+    case Opcode::ModInt:
+      // The interpreter diagnoses divisions by zero.
+      emitLoad(rax, instr.DivInt.lhs);
+      emitLoad(rcx, instr.DivInt.rhs);
+      // test rcx, rcx
+      emit({0x48, 0x85, 0xC9});
+      emitExitIfZero(idx);
+      // cqo then idiv rcx
+      emit({0x48, 0x99, 0x48, 0xF7, 0xF9});
+      // The quotient is in rax, the remainder in rdx.
+      emitStore(instr.DivInt.dest,
+                (instr.opcode == Opcode::DivInt) ? rax : rdx);
+      break;
+    case Opcode::AddDouble:
+      emitDoubleBinOp(instr, 0x58);
+      break;
+    case Opcode::SubDouble:
+      emitDoubleBinOp(instr, 0x5C);
+      break;
+    case Opcode::MulDouble:
+      emitDoubleBinOp(instr, 0x59);
+      break;
+    case Opcode::DivDouble:
+      // The interpreter diagnoses divisions by zero. The divisor is
+      // +0.0 or -0.0 if it's zero once shifted left by one.
+      emitLoad(rcx, instr.DivDouble.rhs);
+      // add rcx, rcx
+      emit({0x48, 0x01, 0xC9});
+      emitExitIfZero(idx);
+      emitDoubleBinOp(instr, 0x5E);
+      break;
+    case Opcode::AddIntImm:
+      // add rax, imm32
+      emitIntImmOp(instr, {0x48, 0x05});
+      break;
+    case Opcode::SubIntImm:
+      // sub rax, imm32
+      emitIntImmOp(instr, {0x48, 0x2D});
+      break;
+    case Opcode::MulIntImm:
+      // imul rax, rax, imm32
+      emitIntImmOp(instr, {0x48, 0x69, 0xC0});
+      break;
+    case Opcode::NegInt:
+      emitLoad(rax, instr.NegInt.src);
+      // neg rax
+      emit({0x48, 0xF7, 0xD8});
+      emitStore(instr.NegInt.dest, rax);
+      break;
+    case Opcode::NegDouble:
+      emitLoad(rax, instr.NegDouble.src);
+      // btc rax, 63 (flips the sign bit)
+      emit({0x48, 0x0F, 0xBA, 0xF8, 0x3F});
+      emitStore(instr.NegDouble.dest, rax);
+      break;
+    case Opcode::EqInt:
+      // sete al
+      emitIntComp(instr, 0x94);
+      break;
+    case Opcode::LEInt:
+      // setle al
+      emitIntComp(instr, 0x9E);
+      break;
+    case Opcode::LTInt:
+      // setl al
+      emitIntComp(instr, 0x9C);
+      break;
+    case Opcode::EqDouble:
+      emitLoadDouble(0, instr.EqDouble.lhs);
+      emitLoadDouble(1, instr.EqDouble.rhs);
+      // ucomisd xmm0, xmm1, then sete al, setnp cl, and al, cl
+      // (the operands are unordered if one of them is NaN)
+      emit({0x66, 0x0F, 0x2E, 0xC1});
+      emit({0x0F, 0x94, 0xC0, 0x0F, 0x9B, 0xC1, 0x20, 0xC8});
+      emitStoreBool(instr.EqDouble.dest);
+      break;
+    // The unordered case (NaN) clears 'above' and 'above or equal', so
+    // 'lhs < rhs' is computed as 'rhs > lhs'.
+    case Opcode::LEDouble:
+      // setae al
+      emitDoubleComp(instr, 0x93, /*swap*/ true);
+      break;
+    case Opcode::LTDouble:
+      // seta al
+      emitDoubleComp(instr, 0x97, /*swap*/ true);
+      break;
+    case Opcode::GEDouble:
+      // setae al
+      emitDoubleComp(instr, 0x93, /*swap*/ false);
+      break;
+    case Opcode::GTDouble:
+      // seta al
+      emitDoubleComp(instr, 0x97, /*swap*/ false);
+      break;
+    case Opcode::LAnd:
+    case Opcode::LOr:
+      emitLoad(rax, instr.LAnd.lhs);
+      emitLoad(rcx, instr.LAnd.rhs);
+      // test rax, rax; setne al; test rcx, rcx; setne cl
+      emit({0x48, 0x85, 0xC0, 0x0F, 0x95, 0xC0});
+      emit({0x48, 0x85, 0xC9, 0x0F, 0x95, 0xC1});
+      // and al, cl (or al, cl)
+      emit({std::uint8_t((instr.opcode == Opcode::LAnd) ? 0x20 : 0x08), 0xC8});
+      emitStoreBool(instr.LAnd.dest);
+      break;
+    case Opcode::LNot:
+      emitLoad(rax, instr.LNot.src);
+      // test rax, rax; sete al
+      emit({0x48, 0x85, 0xC0, 0x0F, 0x94, 0xC0});
+      emitStoreBool(instr.LNot.dest);
+      break;
+    case Opcode::JumpIf:
+    case Opcode::JumpIfNot:
+      // cmp qword [rdi+condReg], 0
+      emit({0x48, 0x83});
+      emitMem(7, rdi, regDisp(instr.JumpIf.condReg));
+      emit({0x00});
+      // jne (JumpIf) or je (JumpIfNot)
+      emitJump((instr.opcode == Opcode::JumpIf) ? 0x85 : 0x84,
+               getJumpTarget(idx, instr.JumpIf.offset));
+      break;
+    case Opcode::Jump:
+      emitJump(0, getJumpTarget(idx, instr.Jump.offset));
+      break;
+    case Opcode::JumpIfEqInt:
+      // je
+      emitCompareAndJump(idx, 0x84);
+      break;
+    case Opcode::JumpIfNotEqInt:
+      // jne
+      emitCompareAndJump(idx, 0x85);
+      break;
+    case Opcode::JumpIfLTInt:
+      // jl
+      emitCompareAndJump(idx, 0x8C);
+      break;
+    case Opcode::JumpIfNotLTInt:
+      // jge
+      emitCompareAndJump(idx, 0x8D);
+      break;
+    case Opcode::JumpIfLEInt:
+      // jle
+      emitCompareAndJump(idx, 0x8E);
+      break;
+    case Opcode::JumpIfNotLEInt:
+      // jg
+      emitCompareAndJump(idx, 0x8F);
+      break;
+    case Opcode::IntToDouble:
+      emitLoad(rax, instr.IntToDouble.src);
+      // cvtsi2sd xmm0, rax
+      emit({0xF2, 0x48, 0x0F, 0x2A, 0xC0});
+      emitStoreDouble(instr.IntToDouble.dest);
+      break;
+    case Opcode::DoubleToInt:
+      emitLoadDouble(0, instr.DoubleToInt.src);
+      // cvttsd2si rax, xmm0
+      emit({0xF2, 0x48, 0x0F, 0x2C, 0xC0});
+      emitStore(instr.DoubleToInt.dest, rax);
+      break;
+    case Opcode::LoadFunc: {
+      const BCFunction& fn = bcModule.getFunction(instr.LoadFunc.func);
+      emitStoreImm64(instr.LoadFunc.dest,
+        VM::Register(const_cast<BCFunction*>(&fn)).raw);
+      break;
+    }
+    case Opcode::LoadBuiltinFunc:
+      emitStoreImm64(instr.LoadBuiltinFunc.dest,
+        VM::Register(instr.LoadBuiltinFunc.id).raw);
+      break;
+    default:
+      // Everything else is executed by the interpreter: calls, returns,
+      // allocations and the operations that call into the C++ library.
+      emitExit(idx);
+      break;
+  }
+}
+
+bool JITFunction::isSupported() {
+  return true;
+}
+
+std::unique_ptr<JITFunction>
+JITFunction::compile(const BCModule& bcModule, const BCFunction& fn) {
+  JITCompiler compiler(bcModule, fn.getInstructions());
+  compiler.compile();
+  // The entry table is stored after the code, aligned on 8 bytes.
+  std::size_t tableOffset = (compiler.code.size() + 7) & ~std::size_t(7);
+  std::size_t tableSize = compiler.instrOffsets.size() * sizeof(void*);
+  compiler.emitPrologue(tableOffset);
+  // Allocate the memory, rounded up to a multiple of the page size.
+  std::size_t pageSize = std::size_t(sysconf(_SC_PAGESIZE));
+  std::size_t memSize = ((tableOffset + tableSize + pageSize - 1)
+                      / pageSize) * pageSize;
+  void* mem = mmap(nullptr, memSize, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) return nullptr;
+  // Copy the code and create the table
+  auto* bytes = static_cast<std::uint8_t*>(mem);
+  std::memcpy(bytes, compiler.code.data(), compiler.code.size());
+  auto* table = reinterpret_cast<std::uint8_t**>(bytes + tableOffset);
+  for(std::size_t k = 0; k < compiler.instrOffsets.size(); ++k)
+    table[k] = bytes + compiler.instrOffsets[k];
+  // Make it executable
+  if (mprotect(mem, memSize, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, memSize);
+    return nullptr;
+  }
+  return std::unique_ptr<JITFunction>(
+    new JITFunction(mem, memSize, compiler.code.size()));
+}
+
+JITFunction::JITFunction(void* mem, std::size_t memSize, std::size_t codeSize)
+  : mem_(mem), memSize_(memSize), codeSize_(codeSize),
+    entry_(reinterpret_cast<EntryFn>(mem)) {}
+
+JITFunction::~JITFunction() {
+  munmap(mem_, memSize_);
+}
+#else
+bool JITFunction::isSupported() {
+  return false;
+}
+
+std::unique_ptr<JITFunction>
+JITFunction::compile(const BCModule&, const BCFunction&) {
+  return nullptr;
+}
+
+JITFunction::~JITFunction() = default;
+#endif
@@ -0,0 +1,98 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : Nursery.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/VM/Nursery.hpp"
+#include "llvm/Support/MemAlloc.h"
+#include <algorithm>
+#include <cstdlib>
+
+using namespace fox;
+
+//----------------------------------------------------------------------------//
+// Nursery::Block
+//----------------------------------------------------------------------------//
+
+Nursery::Block::Block()
+  : begin_(static_cast<unsigned char*>(llvm::safe_malloc(blockSize))) {}
+
+Nursery::Block::~Block() {
+  std::free(begin_);
+}
+
+//----------------------------------------------------------------------------//
+// Nursery
+//----------------------------------------------------------------------------//
+
+Object* Nursery::lookup(std::uintptr_t addr) const {
+  Block* block = getBlock(reinterpret_cast<const void*>(addr));
+  if(!block) return nullptr;
+  auto& objects = block->objects;
+  auto it = std::lower_bound(objects.begin(), objects.end(),
+                             reinterpret_cast<Object*>(addr));
+  if((it != objects.end()) && (std::uintptr_t(*it) == addr))
+    return *it;
+  return nullptr;
+}
+
+Nursery::Block* Nursery::getBlock(const void* ptr) const {
+  auto* bytes = static_cast<const unsigned char*>(ptr);
+  // Find the first block that begins after ptr: ptr can only be in the
+  // block that precedes it.
+  auto it = std::upper_bound(blocks_.begin(), blocks_.end(), bytes,
+    [](const unsigned char* bytes, const std::unique_ptr<Block>& block) {
+      return bytes < block->begin();
+    });
+  if(it == blocks_.begin()) return nullptr;
+  Block* block = (--it)->get();
+  return block->contains(ptr) ? block : nullptr;
+}
+
+std::size_t Nursery::getNumObjects() const {
+  std::size_t total = 0;
+  for (auto& block : blocks_)
+    total += block->objects.size();
+  return total;
+}
+
+SmallVector<std::unique_ptr<Nursery::Block>, 4> Nursery::clear() {
+  SmallVector<std::unique_ptr<Block>, 4> pinnedBlocks;
+  for (auto& block : blocks_) {
+    if(block->pinned)
+      pinnedBlocks.push_back(std::move(block));
+    else
+      recycle(std::move(block));
+  }
+  blocks_.clear();
+  curBlock_ = nullptr;
+  allocPtr_ = endPtr_ = nullptr;
+  return pinnedBlocks;
+}
+
+void Nursery::recycle(std::unique_ptr<Block> block) {
+  assert(block && "block is null");
+  block->reset();
+  freeBlocks_.push_back(std::move(block));
+}
+
+void* Nursery::allocateInNewBlock(std::size_t size, std::size_t align) {
+  assert((size <= maxObjectSize) && "object too large for the nursery");
+  std::unique_ptr<Block> block;
+  if (freeBlocks_.empty())
+    block = std::make_unique<Block>();
+  else
+    block = freeBlocks_.pop_back_val();
+  curBlock_ = block.get();
+  allocPtr_ = block->begin();
+  endPtr_ = block->begin() + blockSize;
+  // Keep the blocks sorted by address so getBlock can use a binary search.
+  auto it = std::upper_bound(blocks_.begin(), blocks_.end(), block,
+    [](const std::unique_ptr<Block>& lhs, const std::unique_ptr<Block>& rhs) {
+      return lhs->begin() < rhs->begin();
+    });
+  blocks_.insert(it, std::move(block));
+  return allocate(size, align);
+}
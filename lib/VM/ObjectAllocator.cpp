@@ -0,0 +1,52 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : ObjectAllocator.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/VM/ObjectAllocator.hpp"
+#include "llvm/Support/MemAlloc.h"
+#include <cstdlib>
+
+using namespace fox;
+
+ObjectAllocator::~ObjectAllocator() {
+  for (void* chunk : chunks_)
+    std::free(chunk);
+}
+
+void* ObjectAllocator::allocateInArena(std::size_t sizeClass) {
+  std::size_t cellSize = getCellSize(sizeClass);
+  if (std::size_t(endPtr_ - allocPtr_) < cellSize) {
+    // Put what's left of the current chunk in the free list of its size,
+    // so it isn't wasted.
+    if (std::size_t remaining = std::size_t(endPtr_ - allocPtr_)) {
+      FreeCell* cell = reinterpret_cast<FreeCell*>(allocPtr_);
+      std::size_t remainingClass = getSizeClass(remaining);
+      assert((getCellSize(remainingClass) == remaining)
+        && "the chunk isn't divided in cells");
+      cell->next = freeLists_[remainingClass];
+      freeLists_[remainingClass] = cell;
+    }
+    void* chunk = llvm::safe_malloc(chunkSize);
+    chunks_.push_back(chunk);
+    allocPtr_ = static_cast<unsigned char*>(chunk);
+    endPtr_ = allocPtr_ + chunkSize;
+  }
+  void* mem = allocPtr_;
+  allocPtr_ += cellSize;
+  return mem;
+}
+
+void* ObjectAllocator::allocateWithMalloc(std::size_t size) {
+  ++numObjects_;
+  numBytes_ += size;
+  return llvm::safe_malloc(size);
+}
+
+void ObjectAllocator::deallocateWithFree(void* mem, std::size_t size) {
+  --numObjects_;
+  numBytes_ -= size;
+  std::free(mem);
+}
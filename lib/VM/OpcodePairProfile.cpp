@@ -0,0 +1,59 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : OpcodePairProfile.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+
+#include "Fox/VM/OpcodePairProfile.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+
+using namespace fox;
+
+OpcodePairProfile::OpcodePairProfile()
+  : opcodeCounts_(numOpcodes), pairCounts_(numOpcodes*numOpcodes) {}
+
+std::uint64_t OpcodePairProfile::getTotalCount() const {
+  return std::accumulate(opcodeCounts_.begin(), opcodeCounts_.end(),
+                         std::uint64_t(0));
+}
+
+void OpcodePairProfile::reset() {
+  std::fill(opcodeCounts_.begin(), opcodeCounts_.end(), 0);
+  std::fill(pairCounts_.begin(), pairCounts_.end(), 0);
+}
+
+void OpcodePairProfile::dump(std::ostream& out, std::size_t maxPairs) const {
+  std::uint64_t total = getTotalCount();
+  out << "Opcode Pair Profile:\n";
+  out << "  " << total << " instructions dispatched\n";
+  // Collect the indexes of the pairs that have been executed, and sort
+  // them by decreasing count. Ties are sorted by index so the output
+  // is stable.
+  std::vector<std::size_t> pairs;
+  for (std::size_t idx = 0; idx < pairCounts_.size(); ++idx) {
+    if(pairCounts_[idx]) pairs.push_back(idx);
+  }
+  std::sort(pairs.begin(), pairs.end(), [&](std::size_t a, std::size_t b) {
+    if(pairCounts_[a] != pairCounts_[b])
+      return pairCounts_[a] > pairCounts_[b];
+    return a < b;
+  });
+  if(pairs.size() > maxPairs)
+    pairs.resize(maxPairs);
+  for (std::size_t idx : pairs) {
+    Opcode first = Opcode(idx / numOpcodes);
+    Opcode second = Opcode(idx % numOpcodes);
+    std::uint64_t count = pairCounts_[idx];
+    auto oldFlags = out.flags();
+    auto oldPrecision = out.precision();
+    out << "  " << to_string(first) << " + " << to_string(second) << ": "
+        << count << " (" << std::fixed << std::setprecision(2)
+        << (100.0 * double(count) / double(total)) << "%)\n";
+    out.flags(oldFlags);
+    out.precision(oldPrecision);
+  }
+}
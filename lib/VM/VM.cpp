@@ -6,34 +6,62 @@
 //----------------------------------------------------------------------------//
 
 #include "Fox/VM/VM.hpp"
+#include "Fox/VM/JIT.hpp"
+#include "Fox/VM/OpcodePairProfile.hpp"
 #include "Fox/BC/Instruction.hpp"
 #include "Fox/BC/BCModule.hpp"
 #include "Fox/BC/BCFunction.hpp"
+#include "Fox/BC/PreparedCode.hpp"
 #include "Fox/Common/Errors.hpp"
 #include "Fox/Common/Builtins.hpp"
 #include "Fox/Common/Objects.hpp"
 #include "Fox/Common/STLExtras.hpp"
+#include "Fox/Common/UTF8.hpp"
+#include "llvm/Support/MemAlloc.h"
+#include <algorithm>
 #include <cmath>
 #include <type_traits>
 #include <iterator>
-#include <tuple>
+#include <utility>
+
+// Threaded dispatch requires the "labels as values" extension, which is
+// supported by GCC and Clang. FOX_VM_THREADED_DISPATCH is set by the build
+// system (see the FOX_VM_THREADED_DISPATCH CMake option).
+#if defined(FOX_VM_THREADED_DISPATCH) && defined(__GNUC__)
+  #define FOX_VM_USE_THREADED_DISPATCH 1
+#else
+  #define FOX_VM_USE_THREADED_DISPATCH 0
+#endif
 
 using namespace fox;
 
-VM::VM(BCModule& theModule) 
+VM::VM(BCModule& theModule) : VM(theModule, GCOptions()) {}
+
+VM::VM(BCModule& theModule, const GCOptions& gcOptions)
   : bcModule(theModule), diagEngine(bcModule.diagEngine) {
+  /// Configure the GC before the initializers of the globals allocate
+  /// anything.
+  setGCThreshold(gcOptions.threshold);
+  setNurserySize(gcOptions.nurserySize);
+  setGCStress(gcOptions.stress);
+  setDebugAllocation(gcOptions.debugAllocation);
+  /// Allocate the first chunk of the register stack. It grows as needed.
+  regStack_.resize(registerStackChunkSize);
   /// The base register will simply be the first register in the
   /// stack.
   baseReg_ = regStack_.data();
+  /// Enable the JIT if it's supported
+  setJITThreshold(defaultJITThreshold);
   /// Initialize the global variables
   initGlobals();
 }
 
-/// Out of line because unique_ptr needs to see the definition of
-/// StringObject and others.
-VM::~VM() = default;
+VM::~VM() {
+  freeHeap();
+}
 
 VM::Register VM::run(BCFunction& func, ArrayRef<Register> args) {
+  reserveRegisters(std::max(func.getNumRegisters(), args.size()));
   /// Copy the args into registers r0 -> rN
   if(args.size()) {
     regaddr_t k = 0;
@@ -45,296 +73,743 @@ VM::Register VM::run(BCFunction& func, ArrayRef<Register> args) {
 }
 
 VM::Register VM::run(BCFunction& func) {
+  reserveRegisters(func.getNumRegisters());
   auto oldFn = curFn_;
   curFn_ = &func;
 
-  auto rtr = run(func.getInstructions());
+  auto rtr = execute(func.getPreparedCode());
 
   curFn_ = oldFn;
 
   return rtr;
 }
 
-// This is where most of the magic happens!
 VM::Register VM::run(ArrayRef<Instruction> instrs) {
-  pc_ = instrs.begin();
-  Instruction instr;
-  do {
-    // Fetch the current instruction
-    instr = *pc_;
-    // Macros used to implement repetitive operations
-    #define TRIVIAL_TAC_BINOP_IMPL(ID, MEMB, OP)\
-      getReg(instr.ID.dest).MEMB = \
-      getReg(instr.ID.lhs).MEMB OP getReg(instr.ID.rhs).MEMB
-    #define TRIVIAL_TAC_COMP_IMPL(ID, MEMB, OP)\
-      getReg(instr.ID.dest).raw = \
-      getReg(instr.ID.lhs).MEMB OP getReg(instr.ID.rhs).MEMB
-    switch (instr.opcode) {
-      case Opcode::NoOp: 
-        // NoOp: no-op: do nothing.
-        continue;
-      case Opcode::StoreSmallInt:
-        // StoreSmallInt dest value: Stores value in dest (value: int16)
-        getReg(instr.StoreSmallInt.dest).intVal = instr.StoreSmallInt.value;
-        continue;
-      case Opcode::Copy:
-        // Copy dest src : dest = src
-        getReg(instr.Copy.dest).raw = getReg(instr.Copy.src).raw;
-        continue;
-      case Opcode::LoadIntK:
-        // Copies the integer constant 'kID' into the register 'dest'
-        getReg(instr.LoadIntK.dest).intVal =
-          bcModule.getIntConstant(instr.LoadIntK.kID);
-        continue;
-      case Opcode::LoadDoubleK:
-        // Copies the double constant 'kID' into the register 'dest'
-        getReg(instr.LoadDoubleK.dest).doubleVal =
-          bcModule.getDoubleConstant(instr.LoadDoubleK.kID);
-        continue;
-      case Opcode::NewString:
-        // Create a new string and put a pointer to it in 'dest'
-        getReg(instr.NewString.dest).object = newStringObject();
-        continue;
-      case Opcode::LoadStringK:
-        // Create a new string from a string constant 'kID' stored in bcModule
-        // and put a pointer to it in 'dest'
-        getReg(instr.LoadStringK.dest).object =
-          newStringObjectFromK(instr.LoadStringK.kID);
-        continue;
-      case Opcode::NewValueArray:
-        // Creates a new ArrayObject of values with n reserved elements and
-        // stores a reference to it in dest.
-        getReg(instr.NewValueArray.dest).object =
-          newValueArrayObject(instr.NewValueArray.n);
-        continue;
-      case Opcode::NewRefArray:
-        // Creates a new ArrayObject of references with n reserved elements and
-        // stores a reference to it in dest.
-        getReg(instr.NewRefArray.dest).object =
-          newRefArrayObject(instr.NewRefArray.n);
-        continue;
-      case Opcode::GetGlobal:
-        // Stores the content of the global variable 'id' in 'dest'
-        getReg(instr.GetGlobal.dest) = getGlobal(instr.GetGlobal.id);
-        continue;
-      case Opcode::SetGlobal:
-        // Stores the content of 'src' in the global variable 'id'
-        getGlobal(instr.SetGlobal.id) = getReg(instr.SetGlobal.src);
-        continue;
-      case Opcode::AddInt: 
-        // AddInt dest lhs rhs: dest = lhs + rhs (FoxInts)
-        TRIVIAL_TAC_BINOP_IMPL(AddInt, intVal, +);
-        continue;
-      case Opcode::AddDouble:
-        // AddDouble dest lhs rhs: dest = lhs + rhs (FoxDoubles)
-        TRIVIAL_TAC_BINOP_IMPL(AddDouble, doubleVal, +);
-        continue;
-      case Opcode::SubInt:
-        // SubInt dest lhs rhs: dest = lhs - rhs (FoxInts)
-        TRIVIAL_TAC_BINOP_IMPL(SubInt, intVal, -);
-        continue;
-      case Opcode::SubDouble:
-        // SubDouble dest lhs rhs: dest = lhs - rhs (FoxDoubles)
-        TRIVIAL_TAC_BINOP_IMPL(SubDouble, doubleVal, -);
-        continue;
-      case Opcode::MulInt:
-        // DivInt dest lhs rhs: dest = lhs * rhs (FoxInts)
-        TRIVIAL_TAC_BINOP_IMPL(MulInt, intVal, *);
-        continue;
-      case Opcode::MulDouble:
-        // MulDouble dest lhs rhs: dest = lhs * rhs (FoxDoubles)
-        TRIVIAL_TAC_BINOP_IMPL(MulDouble, doubleVal, *);
-        continue;
-      case Opcode::DivInt: {
-        // DivInt dest lhs rhs: dest = lhs / rhs (FoxDoubles)
-        FoxInt& lhs  = getReg(instr.DivInt.lhs).intVal;
-        FoxInt& rhs  = getReg(instr.DivInt.rhs).intVal;
-        FoxInt& dest = getReg(instr.DivInt.dest).intVal;
-        if (rhs == 0) {
-          diagnoseDivisionByZero();
-          continue;
-        }
-        dest = lhs / rhs;
-        continue;
+  // We don't know how many registers the code uses, so give it a full
+  // register window.
+  reserveRegisters(bc_limits::max_registers);
+  PreparedCode code(instrs);
+  // This code doesn't belong to a function.
+  auto oldFn = curFn_;
+  curFn_ = nullptr;
+
+  auto rtr = execute(code);
+
+  curFn_ = oldFn;
+
+  return rtr;
+}
+
+// This is where most of the magic happens!
+//
+// The VM executes prepared code (see PreparedCode.hpp). The code is prepared
+// by this function the first time it's executed.
+//
+// The interpreter loop can be compiled in two ways:
+//  - Using threaded dispatch (FOX_VM_USE_THREADED_DISPATCH == 1): every
+//    handler ends by fetching the next instruction and jumping directly to
+//    its handler, whose address is stored in the prepared instruction.
+//    This uses the "labels as values" GNU extension.
+//  - Using a switch inside a loop. This is the portable fallback.
+//
+// Calls to BCFunctions don't recurse into this function: they push a
+// CallFrame on the call stack and continue executing in the callee's code.
+// Returns pop the frame and resume the caller's code. This function only 
+// returns when the code it was called with returns, or when a runtime error
+// occurs.
+//
+// The program counter is kept in a local variable so it can live in a
+// machine register. It is written back to pc_ (VM_SAVE_PC) before anything
+// that can observe it: builtin calls, diagnostics and returns.
+//
+// When the JIT is enabled, BCFunctions are compiled to native code once 
+// they've been called, or have looped, often enough (see the JIT threshold).
+// The interpreter enters the native code of the current function when it's
+// called, when a call it made returns and when it jumps backwards. The
+// native code returns the index of the instruction where the interpreter 
+// resumes: an instruction it doesn't support (e.g. a call), or an
+// instruction that needs to emit a diagnostic.
+//
+// When an OpcodePairProfile is set, every instruction is recorded in it 
+// before being executed. With threaded dispatch, this doesn't cost anything
+// when profiling is disabled: the code is prepared with a table in which 
+// every handler is the profiling handler, which then jumps to the real 
+// handler.
+VM::Register VM::execute(PreparedCode& entryCode) {
+  // Macros used to implement repetitive operations
+  #define TRIVIAL_TAC_BINOP_IMPL(ID, MEMB, OP)\
+    getReg(pc->ID.dest).MEMB = \
+    getReg(pc->ID.lhs).MEMB OP getReg(pc->ID.rhs).MEMB
+  #define TRIVIAL_TAC_COMP_IMPL(ID, MEMB, OP)\
+    getReg(pc->ID.dest).raw = \
+    getReg(pc->ID.lhs).MEMB OP getReg(pc->ID.rhs).MEMB
+  #define TRIVIAL_IMM_BINOP_IMPL(ID, OP)\
+    getReg(pc->ID.dest).intVal = getReg(pc->ID.src).intVal OP pc->ID.imm
+  // Fused compare and jumps skip their JumpOffset when they don't jump.
+  #define COMPARE_AND_JUMP_IMPL(ID, NOT, OP)\
+    if (NOT(getReg(pc->ID.lhs).intVal OP getReg(pc->ID.rhs).intVal)) {\
+      VM_JUMP(pc->ID.offset);\
+    }\
+    pc += 2; VM_DISPATCH()
+  // Macros used to abstract the dispatch technique
+  //  VM_CASE(ID)             The handler of the instruction ID
+  //  VM_NEXT()               Moves to the next instruction
+  //  VM_NEXT_FUSED(SECOND)   Moves to the next instruction, which is the 
+  //                          second instruction SECOND of a superinstruction.
+  //  VM_JUMP(IDX)            Moves to the instruction at index IDX
+  //  VM_DISPATCH_BEGIN/END   Encloses the handlers.
+  //  VM_PREPARE(CODE)        Prepares CODE for execution.
+  //  VM_SAVE_PC()            Writes the local program counter back to pc_
+  //  VM_ERROR_EXIT()         Stops the execution after a runtime error.
+  //  VM_CALL(BASE, HAS_DEST, DEST)  
+  //                          Calls the function in BASE, storing the 
+  //                          return value in DEST if HAS_DEST is true.
+  //  VM_CALL_FUNC(CALLEE, BASE, HAS_DEST, DEST, RETURN_PC)
+  //                          Calls the BCFunction CALLEE with the args
+  //                          that follow BASE, storing the return value in
+  //                          DEST if HAS_DEST is true, and resumes at 
+  //                          RETURN_PC when it returns.
+  //  VM_CALL_BUILTIN(ID, BASE, HAS_DEST, DEST)
+  //                          Calls the builtin ID with the args that
+  //                          follow BASE, storing the return value in DEST
+  //                          if HAS_DEST is true.
+  //  VM_RETURN(VALUE)        Returns VALUE from the current function.
+  //  VM_PROFILE_INSTR()      Records the instruction at pc in the profile.
+  //  VM_ENTER_JIT(JIT, IDX)  Runs the native code JIT of the current 
+  //                          function starting at the instruction at index
+  //                          IDX, then resumes where it stopped.
+  #define VM_SAVE_PC() pc_ = code->getSource(pc)
+  #define VM_JUMP(IDX) pc = codeBegin + (IDX); VM_DISPATCH()
+  #define VM_ERROR_EXIT() unwindCallStack(entryDepth); return Register()
+  #define VM_ENTER_JIT(JIT, IDX)                                              \
+    pc = codeBegin + (JIT)->run(baseReg_, globals_.get(), std::uint32_t(IDX));\
+    VM_DISPATCH()
+  #define VM_CALL_BUILTIN(ID, BASE, HAS_DEST, DEST)                           \
+    VM_SAVE_PC();                                                             \
+    if (HAS_DEST)                                                             \
+      callBuiltinFunc(ID, getRegPtr(BASE)+1, getRegPtr(DEST));                \
+    else                                                                      \
+      callBuiltinFunc(ID, getRegPtr(BASE)+1);                                 \
+    if (!isAlive_) {                                                          \
+      VM_ERROR_EXIT();                                                        \
+    }                                                                         \
+    if (useJIT && curFn_) {                                                   \
+      if (JITFunction* jit = curFn_->getJITFunction()) {                      \
+        VM_ENTER_JIT(jit, (pc+1)-codeBegin);                                  \
+      }                                                                       \
+    }                                                                         \
+    VM_NEXT()
+  #define VM_CALL_FUNC(CALLEE, BASE, HAS_DEST, DEST, RETURN_PC)               \
+    if (callStack_.size() >= maxCallDepth_) {                                 \
+      VM_SAVE_PC();                                                           \
+      diagnoseStackOverflow();                                                \
+      VM_ERROR_EXIT();                                                        \
+    }                                                                         \
+    BCFunction* callee = (CALLEE);                                            \
+    Register* calleeBase = getRegPtr(BASE)+1;                                 \
+    if (LLVM_UNLIKELY(!fitsInRegisterStack(calleeBase,                        \
+                                           callee->getNumRegisters()))) {     \
+      calleeBase = growRegisterStack(calleeBase, callee->getNumRegisters());  \
+      if (!calleeBase) {                                                      \
+        VM_SAVE_PC();                                                         \
+        diagnoseRegisterStackOverflow();                                      \
+        VM_ERROR_EXIT();                                                      \
+      }                                                                       \
+    }                                                                         \
+    callStack_.emplace_back(curFn_, code, RETURN_PC, baseReg_, HAS_DEST,      \
+                            DEST);                                            \
+    curFn_ = callee;                                                          \
+    baseReg_ = calleeBase;                                                    \
+    code = &(curFn_->getPreparedCode());                                      \
+    if (!code->isPreparedWith(handlers))                                      \
+      VM_PREPARE(*code);                                                      \
+    pc = codeBegin = code->begin();                                           \
+    if (useJIT) {                                                             \
+      if (JITFunction* jit = getJITFunction(*curFn_)) {                       \
+        VM_ENTER_JIT(jit, 0);                                                 \
+      }                                                                       \
+    }                                                                         \
+    VM_DISPATCH()
+  #define VM_CALL(BASE, HAS_DEST, DEST)                                       \
+    FunctionRef funcRef = getReg(BASE).funcRef;                               \
+    if (funcRef.isBuiltin()) {                                                \
+      VM_CALL_BUILTIN(funcRef.getBuiltinKind(), BASE, HAS_DEST, DEST);        \
+    }                                                                         \
+    VM_CALL_FUNC(funcRef.getBCFunction(), BASE, HAS_DEST, DEST, pc+1)
+  #define VM_RETURN(VALUE)                                                    \
+    if (callStack_.size() == entryDepth) {                                    \
+      VM_SAVE_PC();                                                           \
+      return VALUE;                                                           \
+    }                                                                         \
+    Register rtr = VALUE;                                                     \
+    const CallFrame& frame = callStack_.back();                               \
+    curFn_ = frame.fn;                                                        \
+    code = frame.code;                                                        \
+    codeBegin = code->begin();                                                \
+    pc = frame.returnPC;                                                      \
+    baseReg_ = frame.base;                                                    \
+    if (frame.hasDest)                                                        \
+      getReg(frame.dest) = rtr;                                               \
+    callStack_.pop_back();                                                    \
+    if (useJIT && curFn_) {                                                   \
+      if (JITFunction* jit = curFn_->getJITFunction()) {                      \
+        VM_ENTER_JIT(jit, pc-codeBegin);                                      \
+      }                                                                       \
+    }                                                                         \
+    VM_DISPATCH()
+  #define VM_PROFILE_INSTR()                                                  \
+    Opcode profOp = code->getSource(pc)->opcode;                              \
+    profile->recordInstr(profOp);                                             \
+    if ((code == profCode) && (pc == (profPC+1)))                             \
+      profile->recordPair(code->getSource(profPC)->opcode, profOp);           \
+    profCode = code;                                                          \
+    profPC = pc
+  #if FOX_VM_USE_THREADED_DISPATCH
+    // The table of handlers, indexed by opcode.
+    static const void* const dispatchTable[] = {
+      #define INSTR(ID) &&handle_##ID,
+      #include "Fox/BC/Instruction.def"
+    };
+    static_assert((sizeof(dispatchTable)/sizeof(dispatchTable[0])) ==
+      (static_cast<std::size_t>(Opcode::last_opcode)+1),
+      "dispatchTable doesn't have a handler for every opcode");
+    // The table used when profiling: every opcode is handled by the
+    // profiling handler.
+    static const void* const profilingTable[] = {
+      #define INSTR(ID) &&profile_instr,
+      #include "Fox/BC/Instruction.def"
+    };
+    const ArrayRef<const void*> handlers = profile_ 
+      ? ArrayRef<const void*>(profilingTable) 
+      : ArrayRef<const void*>(dispatchTable);
+    #define VM_PREPARE(CODE) (CODE).prepare(handlers)
+    #define VM_CASE(ID) handle_##ID
+    #define VM_DISPATCH() goto *pc->handler
+    #define VM_NEXT() ++pc; VM_DISPATCH()
+    #define VM_NEXT_FUSED(SECOND) ++pc; goto handle_##SECOND
+    #define VM_DISPATCH_BEGIN VM_DISPATCH(); {
+    #define VM_DISPATCH_END }
+  #else
+    const ArrayRef<const void*> handlers = None;
+    #define VM_PREPARE(CODE) (CODE).prepare()
+    #define VM_CASE(ID) case Opcode::ID
+    #define VM_DISPATCH() continue
+    #define VM_NEXT() ++pc; VM_DISPATCH()
+    #define VM_NEXT_FUSED(SECOND) VM_NEXT()
+    #define VM_DISPATCH_BEGIN for(;;) {                                     \
+      if (LLVM_UNLIKELY(profile)) {                                           \
+        VM_PROFILE_INSTR();                                                   \
+      }                                                                       \
+      switch (pc->opcode) {
+    #define VM_DISPATCH_END                                                   \
+      default: fox_unreachable("illegal or unimplemented instruction found"); \
+    } }
+  #endif
+  // The depth of the call stack when we entered this function
+  const std::size_t entryDepth = callStack_.size();
+  // The code being executed
+  PreparedCode* code = &entryCode;
+  if (!code->isPreparedWith(handlers))
+    VM_PREPARE(*code);
+  const PreparedInstruction* codeBegin = code->begin();
+  const PreparedInstruction* pc = codeBegin;
+  // The profile, and the last instruction recorded in it.
+  OpcodePairProfile* const profile = profile_;
+  const PreparedCode* profCode = nullptr;
+  const PreparedInstruction* profPC = nullptr;
+  // Whether the JIT is used. It's never used while profiling, because
+  // native code doesn't record the instructions it executes.
+  const bool useJIT = jitThreshold_ && !profile;
+  VM_SAVE_PC();
+  if (useJIT && curFn_) {
+    assert((code == &(curFn_->getPreparedCode())) 
+      && "executing code that doesn't belong to the current function");
+    if (JITFunction* jit = getJITFunction(*curFn_))
+      pc = codeBegin + jit->run(baseReg_, globals_.get(), 0);
+  }
+  VM_DISPATCH_BEGIN
+    VM_CASE(NoOp): 
+      // NoOp: no-op: do nothing.
+      VM_NEXT();
+    VM_CASE(StoreSmallInt):
+      // StoreSmallInt dest value: Stores value in dest (value: int16)
+      getReg(pc->StoreSmallInt.dest).intVal = pc->StoreSmallInt.value;
+      VM_NEXT();
+    VM_CASE(Copy):
+      // Copy dest src : dest = src
+      getReg(pc->Copy.dest).raw = getReg(pc->Copy.src).raw;
+      VM_NEXT();
+    VM_CASE(LoadIntK):
+      // Copies the integer constant 'kID' into the register 'dest'
+      getReg(pc->LoadIntK.dest).intVal =
+        bcModule.getIntConstant(pc->LoadIntK.kID);
+      VM_NEXT();
+    VM_CASE(LoadDoubleK):
+      // Copies the double constant 'kID' into the register 'dest'
+      getReg(pc->LoadDoubleK.dest).doubleVal =
+        bcModule.getDoubleConstant(pc->LoadDoubleK.kID);
+      VM_NEXT();
+    VM_CASE(NewString):
+      // Create a new string and put a pointer to it in 'dest'
+      getReg(pc->NewString.dest).object = newStringObject();
+      VM_NEXT();
+    VM_CASE(LoadStringK):
+      // Put a pointer to the (shared) StringObject of the string constant 
+      // 'kID' in 'dest'
+      getReg(pc->LoadStringK.dest).object =
+        getStringConstant(pc->LoadStringK.kID);
+      VM_NEXT();
+    VM_CASE(LoadArrayK):
+      // Creates a copy of the array constant 'kID' and stores a reference to
+      // it in dest.
+      getReg(pc->LoadArrayK.dest).object =
+        newArrayObjectFromConstant(pc->LoadArrayK.kID);
+      VM_NEXT();
+    VM_CASE(NewValueArray):
+      // Creates a new ArrayObject of values of kind elemKind with n reserved
+      // elements and stores a reference to it in dest.
+      getReg(pc->NewValueArray.dest).object =
+        newValueArrayObject(pc->NewValueArray.elemKind, pc->NewValueArray.n);
+      VM_NEXT();
+    VM_CASE(NewRefArray):
+      // Creates a new ArrayObject of references with n reserved elements and
+      // stores a reference to it in dest.
+      getReg(pc->NewRefArray.dest).object =
+        newRefArrayObject(pc->NewRefArray.n);
+      VM_NEXT();
+    VM_CASE(GetGlobal):
+      // Stores the content of the global variable 'id' in 'dest'
+      getReg(pc->GetGlobal.dest) = getGlobal(pc->GetGlobal.id);
+      VM_NEXT();
+    VM_CASE(SetGlobal):
+      // Stores the content of 'src' in the global variable 'id'.
+      // The global variables are roots of every minor collection, so this
+      // doesn't need a write barrier.
+      getGlobal(pc->SetGlobal.id) = getReg(pc->SetGlobal.src);
+      VM_NEXT();
+    VM_CASE(ArrGet): {
+      // ArrGet dest arr idx: dest = arr[idx]
+      ArrayObject* arr = cast<ArrayObject>(getReg(pc->ArrGet.arr).object);
+      FoxInt idx = getReg(pc->ArrGet.idx).intVal;
+      if (LLVM_UNLIKELY(!isValidSubscript(arr->size(), idx))) {
+        VM_SAVE_PC();
+        diagnoseInvalidSubscript(arr->size(), idx);
+        VM_ERROR_EXIT();
       }
-      case Opcode::DivDouble: {
-        // DivDouble dest lhs rhs: dest = lhs / rhs (FoxDoubles)
-        FoxDouble& lhs  = getReg(instr.DivDouble.lhs).doubleVal;
-        FoxDouble& rhs  = getReg(instr.DivDouble.rhs).doubleVal;
-        FoxDouble& dest = getReg(instr.DivDouble.dest).doubleVal;
-        if (rhs == 0) {
-          diagnoseDivisionByZero();
-          continue;
-        }
-        dest = lhs / rhs;
-        continue;
+      getReg(pc->ArrGet.dest).raw = (*arr)[std::size_t(idx)].raw;
+      VM_NEXT();
+    }
+    VM_CASE(ArrSet): {
+      // ArrSet arr idx val: arr[idx] = val
+      ArrayObject* arr = cast<ArrayObject>(getReg(pc->ArrSet.arr).object);
+      FoxInt idx = getReg(pc->ArrSet.idx).intVal;
+      if (LLVM_UNLIKELY(!isValidSubscript(arr->size(), idx))) {
+        VM_SAVE_PC();
+        diagnoseInvalidSubscript(arr->size(), idx);
+        VM_ERROR_EXIT();
       }
-      case Opcode::ModInt: {
-        // ModInt dest lhs rhs: dest = lhs % rhs (FoxInts)
-        FoxInt& lhs  = getReg(instr.ModInt.lhs).intVal;
-        FoxInt& rhs  = getReg(instr.ModInt.rhs).intVal;
-        FoxInt& dest = getReg(instr.ModInt.dest).intVal;
-        if (rhs == 0) {
-          diagnoseModuloByZero();
-          continue;
-        }
-        dest = lhs % rhs;
-        continue;
+      FoxAny val(getReg(pc->ArrSet.val).raw);
+      arr->set(std::size_t(idx), val);
+      writeBarrier(arr, val);
+      VM_NEXT();
+    }
+    VM_CASE(ArrAppend): {
+      // ArrAppend arr val: Appends val at the end of arr
+      ArrayObject* arr = cast<ArrayObject>(getReg(pc->ArrAppend.arr).object);
+      FoxAny val(getReg(pc->ArrAppend.val).raw);
+      appendToArray(arr, val);
+      VM_NEXT();
+    }
+    VM_CASE(ArrAppendRange): {
+      // ArrAppendRange arr first n: Appends the n registers that begin
+      // at first at the end of arr.
+      ArrayObject* arr = 
+        cast<ArrayObject>(getReg(pc->ArrAppendRange.arr).object);
+      regaddr_t first = pc->ArrAppendRange.first;
+      std::size_t n = pc->ArrAppendRange.n;
+      reserveArray(arr, arr->size() + n);
+      for (std::size_t k = 0; k < n; ++k) {
+        FoxAny val(getReg(regaddr_t(first + k)).raw);
+        appendToArray(arr, val);
       }
-      case Opcode::ModDouble: {
-        // ModDouble dest lhs rhs: dest = lhs % rhs (FoxDoubles)
-        FoxDouble& lhs  = getReg(instr.ModDouble.lhs).doubleVal;
-        FoxDouble& rhs  = getReg(instr.ModDouble.rhs).doubleVal;
-        FoxDouble& dest = getReg(instr.ModDouble.dest).doubleVal;
-        if (rhs == 0) {
-          diagnoseModuloByZero();
-          continue;
-        }
-        dest = std::fmod(lhs, rhs);
-        continue;
+      VM_NEXT();
+    }
+    VM_CASE(ArrSize):
+      // ArrSize dest arr: dest = the size of arr
+      getReg(pc->ArrSize.dest).intVal =
+        FoxInt(cast<ArrayObject>(getReg(pc->ArrSize.arr).object)->size());
+      VM_NEXT();
+    VM_CASE(StrLen):
+      // StrLen dest str: dest = the length of str (in codepoints)
+      getReg(pc->StrLen.dest).intVal =
+        FoxInt(cast<StringObject>(getReg(pc->StrLen.str).object)->length());
+      VM_NEXT();
+    VM_CASE(StrGetChar): {
+      // StrGetChar dest str idx: dest = str[idx]
+      StringObject* str =
+        cast<StringObject>(getReg(pc->StrGetChar.str).object);
+      FoxInt idx = getReg(pc->StrGetChar.idx).intVal;
+      std::size_t length = str->length();
+      if (LLVM_UNLIKELY(!isValidSubscript(length, idx))) {
+        VM_SAVE_PC();
+        diagnoseInvalidSubscript(length, idx);
+        VM_ERROR_EXIT();
+      }
+      flatten(str);
+      getReg(pc->StrGetChar.dest).raw =
+        std::uint64_t(str->getChar(std::size_t(idx)));
+      VM_NEXT();
+    }
+    VM_CASE(AddInt): 
+      // AddInt dest lhs rhs: dest = lhs + rhs (FoxInts)
+      TRIVIAL_TAC_BINOP_IMPL(AddInt, intVal, +);
+      VM_NEXT();
+    VM_CASE(AddDouble):
+      // AddDouble dest lhs rhs: dest = lhs + rhs (FoxDoubles)
+      TRIVIAL_TAC_BINOP_IMPL(AddDouble, doubleVal, +);
+      VM_NEXT();
+    VM_CASE(SubInt):
+      // SubInt dest lhs rhs: dest = lhs - rhs (FoxInts)
+      TRIVIAL_TAC_BINOP_IMPL(SubInt, intVal, -);
+      VM_NEXT();
+    VM_CASE(SubDouble):
+      // SubDouble dest lhs rhs: dest = lhs - rhs (FoxDoubles)
+      TRIVIAL_TAC_BINOP_IMPL(SubDouble, doubleVal, -);
+      VM_NEXT();
+    VM_CASE(MulInt):
+      // DivInt dest lhs rhs: dest = lhs * rhs (FoxInts)
+      TRIVIAL_TAC_BINOP_IMPL(MulInt, intVal, *);
+      VM_NEXT();
+    VM_CASE(MulDouble):
+      // MulDouble dest lhs rhs: dest = lhs * rhs (FoxDoubles)
+      TRIVIAL_TAC_BINOP_IMPL(MulDouble, doubleVal, *);
+      VM_NEXT();
+    VM_CASE(DivInt): {
+      // DivInt dest lhs rhs: dest = lhs / rhs (FoxDoubles)
+      FoxInt& lhs  = getReg(pc->DivInt.lhs).intVal;
+      FoxInt& rhs  = getReg(pc->DivInt.rhs).intVal;
+      FoxInt& dest = getReg(pc->DivInt.dest).intVal;
+      if (rhs == 0) {
+        VM_SAVE_PC();
+        diagnoseDivisionByZero();
+        VM_ERROR_EXIT();
+      }
+      dest = lhs / rhs;
+      VM_NEXT();
+    }
+    VM_CASE(DivDouble): {
+      // DivDouble dest lhs rhs: dest = lhs / rhs (FoxDoubles)
+      FoxDouble& lhs  = getReg(pc->DivDouble.lhs).doubleVal;
+      FoxDouble& rhs  = getReg(pc->DivDouble.rhs).doubleVal;
+      FoxDouble& dest = getReg(pc->DivDouble.dest).doubleVal;
+      if (rhs == 0) {
+        VM_SAVE_PC();
+        diagnoseDivisionByZero();
+        VM_ERROR_EXIT();
+      }
+      dest = lhs / rhs;
+      VM_NEXT();
+    }
+    VM_CASE(ModInt): {
+      // ModInt dest lhs rhs: dest = lhs % rhs (FoxInts)
+      FoxInt& lhs  = getReg(pc->ModInt.lhs).intVal;
+      FoxInt& rhs  = getReg(pc->ModInt.rhs).intVal;
+      FoxInt& dest = getReg(pc->ModInt.dest).intVal;
+      if (rhs == 0) {
+        VM_SAVE_PC();
+        diagnoseModuloByZero();
+        VM_ERROR_EXIT();
+      }
+      dest = lhs % rhs;
+      VM_NEXT();
+    }
+    VM_CASE(ModDouble): {
+      // ModDouble dest lhs rhs: dest = lhs % rhs (FoxDoubles)
+      FoxDouble& lhs  = getReg(pc->ModDouble.lhs).doubleVal;
+      FoxDouble& rhs  = getReg(pc->ModDouble.rhs).doubleVal;
+      FoxDouble& dest = getReg(pc->ModDouble.dest).doubleVal;
+      if (rhs == 0) {
+        VM_SAVE_PC();
+        diagnoseModuloByZero();
+        VM_ERROR_EXIT();
+      }
+      dest = std::fmod(lhs, rhs);
+      VM_NEXT();
+    }
+    VM_CASE(PowInt):
+      // PowInt dest lhs rhs: dest = pow(lhs, rhs) (FoxInts)
+      getReg(pc->PowInt.dest).intVal = static_cast<FoxInt>(
+        std::pow(
+          getReg(pc->PowInt.lhs).intVal, 
+          getReg(pc->PowInt.rhs).intVal
+        )
+      );
+      VM_NEXT();
+    VM_CASE(PowDouble):
+      // PowDouble dest lhs rhs: dest = pow(lhs, rhs) (FoxDoubles)
+      getReg(pc->PowDouble.dest).doubleVal = static_cast<FoxDouble>(
+        std::pow(
+          getReg(pc->PowDouble.lhs).doubleVal, 
+          getReg(pc->PowDouble.rhs).doubleVal
+        )
+      );
+      VM_NEXT();
+    VM_CASE(AddIntImm):
+      // AddIntImm dest src imm : dest = src + imm (FoxInts)
+      TRIVIAL_IMM_BINOP_IMPL(AddIntImm, +);
+      VM_NEXT();
+    VM_CASE(SubIntImm):
+      // SubIntImm dest src imm : dest = src - imm (FoxInts)
+      TRIVIAL_IMM_BINOP_IMPL(SubIntImm, -);
+      VM_NEXT();
+    VM_CASE(MulIntImm):
+      // MulIntImm dest src imm : dest = src * imm (FoxInts)
+      TRIVIAL_IMM_BINOP_IMPL(MulIntImm, *);
+      VM_NEXT();
+    VM_CASE(NegInt):
+      // NegInt dest src : dest = -src (FoxInts)
+      getReg(pc->NegInt.dest).intVal = -getReg(pc->NegInt.src).intVal;
+      VM_NEXT();
+    VM_CASE(NegDouble):
+      // NegDouble dest src : dest = -src (FoxDoubles)
+      getReg(pc->NegDouble.dest).doubleVal = 
+        -getReg(pc->NegDouble.src).doubleVal;
+      VM_NEXT();
+    VM_CASE(EqInt):
+      // EqInt dest lhs rhs: dest = (lhs == rhs) 
+      //          (lhs/rhs: FoxInts, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(EqInt, intVal, ==);
+      VM_NEXT();
+    VM_CASE(LEInt):
+      // LEInt dest lhs rhs: dest = (lhs <= rhs) 
+      //          (lhs/rhs: FoxInts, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(LEInt, intVal, <=);
+      VM_NEXT();
+    VM_CASE(LTInt):
+      // LTInt dest lhs rhs: dest = (lhs < rhs) 
+      //          (lhs/rhs: FoxInts, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(LTInt, intVal, <);
+      VM_NEXT();
+    VM_CASE(EqDouble):
+      // EqDouble dest lhs rhs: dest = (lhs == rhs) 
+      //          (lhs/rhs: FoxDoubles, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(EqDouble, doubleVal, ==);
+      VM_NEXT();
+    VM_CASE(LEDouble):
+      // LEDouble dest lhs rhs: dest = (lhs <= rhs) 
+      //          (lhs/rhs: FoxDoubles, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(LEDouble, doubleVal, <=);
+      VM_NEXT();
+    VM_CASE(LTDouble):
+      // LTDouble dest lhs rhs: dest = (lhs < rhs) 
+      //          (lhs/rhs: FoxDoubles, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(LTDouble, doubleVal, <);
+      VM_NEXT();
+    VM_CASE(GEDouble):
+      // GEDouble dest lhs rhs: dest = (lhs >= rhs) 
+      //          (lhs/rhs: FoxDoubles, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(GEDouble, doubleVal, >=);
+      VM_NEXT();
+    VM_CASE(GTDouble):
+      // GTDouble dest lhs rhs: dest = (lhs > rhs) 
+      //          (lhs/rhs: FoxDoubles, dest: raw)
+      TRIVIAL_TAC_COMP_IMPL(GTDouble, doubleVal, >);
+      VM_NEXT();
+    VM_CASE(LOr):
+      // LOr dest lhs rhs: dest = (lhs || rhs) (raw registers)
+      getReg(pc->LOr.dest).raw =
+        (getReg(pc->LOr.lhs).raw || getReg(pc->LOr.rhs).raw);
+      VM_NEXT();
+    VM_CASE(LAnd):
+      // LAnd dest lhs rhs: dest = (lhs && rhs) (raw registers)
+      getReg(pc->LAnd.dest).raw =
+        (getReg(pc->LAnd.lhs).raw && getReg(pc->LAnd.rhs).raw);
+      VM_NEXT();
+    VM_CASE(LNot):
+      // LNot dest src: dest = !src
+      getReg(pc->LNot.dest).raw = !getReg(pc->LNot.src).raw;
+      VM_NEXT();
+    VM_CASE(JumpIf):
+      // JumpIf condReg offset : Add offset (int16) to pc 
+      //    if condReg != 0
+      //  (in prepared code, offset is the index of the target)
+      if(getReg(pc->JumpIf.condReg).raw) {
+        VM_JUMP(pc->JumpIf.offset);
       }
-      case Opcode::PowInt:
-        // PowInt dest lhs rhs: dest = pow(lhs, rhs) (FoxInts)
-        getReg(instr.PowInt.dest).intVal = static_cast<FoxInt>(
-          std::pow(
-            getReg(instr.PowInt.lhs).intVal, 
-            getReg(instr.PowInt.rhs).intVal
-          )
-        );
-        continue;
-      case Opcode::PowDouble:
-        // PowDouble dest lhs rhs: dest = pow(lhs, rhs) (FoxDoubles)
-        getReg(instr.PowDouble.dest).doubleVal = static_cast<FoxDouble>(
-          std::pow(
-            getReg(instr.PowDouble.lhs).doubleVal, 
-            getReg(instr.PowDouble.rhs).doubleVal
-          )
-        );
-        continue;
-      case Opcode::NegInt:
-        // NegInt dest src : dest = -src (FoxInts)
-        getReg(instr.NegInt.dest).intVal = -getReg(instr.NegInt.src).intVal;
-        continue;
-      case Opcode::NegDouble:
-        // NegDouble dest src : dest = -src (FoxDoubles)
-        getReg(instr.NegDouble.dest).doubleVal = 
-          -getReg(instr.NegDouble.src).doubleVal;
-        continue;
-      case Opcode::EqInt:
-        // EqInt dest lhs rhs: dest = (lhs == rhs) 
-        //          (lhs/rhs: FoxInts, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(EqInt, intVal, ==);
-        continue;
-      case Opcode::LEInt:
-        // LEInt dest lhs rhs: dest = (lhs <= rhs) 
-        //          (lhs/rhs: FoxInts, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(LEInt, intVal, <=);
-        continue;
-      case Opcode::LTInt:
-        // LTInt dest lhs rhs: dest = (lhs < rhs) 
-        //          (lhs/rhs: FoxInts, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(LTInt, intVal, <);
-        continue;
-      case Opcode::EqDouble:
-        // EqDouble dest lhs rhs: dest = (lhs == rhs) 
-        //          (lhs/rhs: FoxDoubles, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(EqDouble, doubleVal, ==);
-        continue;
-      case Opcode::LEDouble:
-        // LEDouble dest lhs rhs: dest = (lhs <= rhs) 
-        //          (lhs/rhs: FoxDoubles, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(LEDouble, doubleVal, <=);
-        continue;
-      case Opcode::LTDouble:
-        // LTDouble dest lhs rhs: dest = (lhs < rhs) 
-        //          (lhs/rhs: FoxDoubles, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(LTDouble, doubleVal, <);
-        continue;
-      case Opcode::GEDouble:
-        // GEDouble dest lhs rhs: dest = (lhs >= rhs) 
-        //          (lhs/rhs: FoxDoubles, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(GEDouble, doubleVal, >=);
-        continue;
-      case Opcode::GTDouble:
-        // GTDouble dest lhs rhs: dest = (lhs > rhs) 
-        //          (lhs/rhs: FoxDoubles, dest: raw)
-        TRIVIAL_TAC_COMP_IMPL(GTDouble, doubleVal, >);
-        continue;
-      case Opcode::LOr:
-        // LOr dest lhs rhs: dest = (lhs || rhs) (raw registers)
-        getReg(instr.LOr.dest).raw =
-          (getReg(instr.LOr.lhs).raw || getReg(instr.LOr.rhs).raw);
-        continue;
-      case Opcode::LAnd:
-        // LAnd dest lhs rhs: dest = (lhs && rhs) (raw registers)
-        getReg(instr.LAnd.dest).raw =
-          (getReg(instr.LAnd.lhs).raw && getReg(instr.LAnd.rhs).raw);
-        continue;
-      case Opcode::LNot:
-        // LNot dest src: dest = !src
-        getReg(instr.LNot.dest).raw = !getReg(instr.LNot.src).raw;
-        continue;
-      case Opcode::JumpIf:
-        // JumpIf condReg offset : Add offset (int16) to pc 
-        //    if condReg != 0
-        if(getReg(instr.JumpIf.condReg).raw)
-          pc_ += instr.JumpIf.offset;
-        continue;
-      case Opcode::JumpIfNot:
-        // JumpIfNot condReg offset : Add offset (int16) to pc 
-        //    if condReg == 0
-        if(!getReg(instr.JumpIfNot.condReg).raw)
-          pc_ += instr.JumpIfNot.offset;
-        continue;
-      case Opcode::Jump:
-        // Jump offset: Add offset (int16) to pc
-        pc_ += instr.Jump.offset;
-        continue;
-      case Opcode::IntToDouble:
-        // IntToDouble dest src: dest = (src as FoxDouble) (src FoxInt)
-        getReg(instr.IntToDouble.dest).doubleVal =
-          FoxDouble(getReg(instr.IntToDouble.src).intVal);
-        continue;
-      case Opcode::DoubleToInt:
-        // DoubleToInt dest src: dest = (src as FoxInt) (src: FoxDouble)
-        getReg(instr.DoubleToInt.dest).intVal =
-          FoxInt(getReg(instr.DoubleToInt.src).doubleVal);
-        continue;
-      case Opcode::RetVoid:
-        return VM::Register();
-      case Opcode::Ret:
-        return getReg(instr.Ret.reg);
-      case Opcode::LoadFunc:
-        // LoadFunc dest func : loads a reference to the function with the
-        //  ID 'func' in 'dest'.
-        getReg(instr.LoadFunc.dest).funcRef =
-          &(bcModule.getFunction(instr.LoadFunc.func));
-        continue;
-      case Opcode::LoadBuiltinFunc:
-        // LoadBuiltinFunc dest id : loads a reference to the
-        //                           builtin 'id' in 'dest'
-        getReg(instr.LoadBuiltinFunc.dest).funcRef = instr.LoadBuiltinFunc.id;
-        continue;
-      case Opcode::CallVoid:
-        // CallVoid base : calls a function located in 'base'.
-        //  Args are in subsequent registers.
-        callFunc(instr.CallVoid.base);
-        continue;
-      case Opcode::Call:
-      {
-        // CallVoid base dest : calls a function located in 'base'
-        //  Args are in subsequent registers.
-        //  Stores the result in 'dest'
-        getReg(instr.Call.dest) = callFunc(instr.CallVoid.base);
-        continue;
+      VM_NEXT();
+    VM_CASE(JumpIfNot):
+      // JumpIfNot condReg offset : Add offset (int16) to pc 
+      //    if condReg == 0
+      //  (in prepared code, offset is the index of the target)
+      if(!getReg(pc->JumpIfNot.condReg).raw) {
+        VM_JUMP(pc->JumpIfNot.offset);
       }
-      default:
-        fox_unreachable("illegal or unimplemented instruction found");
+      VM_NEXT();
+    VM_CASE(Jump):
+      // Jump offset: Add offset (int16) to pc
+      //  (in prepared code, offset is the index of the target)
+      // Backward jumps close loops: enter the native code of the function
+      // at the target of the jump if the function is hot.
+      if (useJIT && curFn_ && (pc->Jump.offset <= (pc-codeBegin))) {
+        if (JITFunction* jit = getJITFunction(*curFn_)) {
+          VM_ENTER_JIT(jit, pc->Jump.offset);
+        }
+      }
+      VM_JUMP(pc->Jump.offset);
+    // Fused compare and jumps: 
+    //  JumpIfXXX lhs rhs, followed by JumpOffset offset: Add offset (int16) 
+    //    to the pc of the JumpOffset if the comparison is true (FoxInts).
+    //  (in prepared code, offset is the index of the target)
+    VM_CASE(JumpIfEqInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfEqInt,     , ==);
+    VM_CASE(JumpIfNotEqInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfNotEqInt, !, ==);
+    VM_CASE(JumpIfLTInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfLTInt,     , <);
+    VM_CASE(JumpIfNotLTInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfNotLTInt, !, <);
+    VM_CASE(JumpIfLEInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfLEInt,     , <=);
+    VM_CASE(JumpIfNotLEInt):
+      COMPARE_AND_JUMP_IMPL(JumpIfNotLEInt, !, <=);
+    VM_CASE(JumpOffset):
+      // JumpOffset offset: the offset of the preceding compare and jump.
+      fox_unreachable("JumpOffset instructions are never executed");
+    VM_CASE(IntToDouble):
+      // IntToDouble dest src: dest = (src as FoxDouble) (src FoxInt)
+      getReg(pc->IntToDouble.dest).doubleVal =
+        FoxDouble(getReg(pc->IntToDouble.src).intVal);
+      VM_NEXT();
+    VM_CASE(DoubleToInt):
+      // DoubleToInt dest src: dest = (src as FoxInt) (src: FoxDouble)
+      getReg(pc->DoubleToInt.dest).intVal =
+        FoxInt(getReg(pc->DoubleToInt.src).doubleVal);
+      VM_NEXT();
+    VM_CASE(RetVoid): {
+      // RetVoid: returns from the current function
+      VM_RETURN(Register());
+    }
+    VM_CASE(Ret): {
+      // Ret reg: returns from the current function with the value in 'reg'
+      VM_RETURN(getReg(pc->Ret.reg));
+    }
+    VM_CASE(LoadFunc):
+      // LoadFunc dest func : loads a reference to the function with the
+      //  ID 'func' in 'dest'.
+      getReg(pc->LoadFunc.dest).funcRef =
+        &(bcModule.getFunction(pc->LoadFunc.func));
+      VM_NEXT();
+    VM_CASE(LoadBuiltinFunc):
+      // LoadBuiltinFunc dest id : loads a reference to the
+      //                           builtin 'id' in 'dest'
+      getReg(pc->LoadBuiltinFunc.dest).funcRef = pc->LoadBuiltinFunc.id;
+      VM_NEXT();
+    VM_CASE(CallVoid): {
+      // CallVoid base : calls a function located in 'base'.
+      //  Args are in subsequent registers.
+      VM_CALL(pc->CallVoid.base, false, 0);
+    }
+    VM_CASE(Call): {
+      // Call base dest : calls a function located in 'base'
+      //  Args are in subsequent registers.
+      //  Stores the result in 'dest'
+      VM_CALL(pc->Call.base, true, pc->Call.dest);
+    }
+    VM_CASE(CallFunc): {
+      // CallFunc base dest, followed by CallTarget func: calls the function
+      //  'func'. Args are in the registers that follow 'base'.
+      //  Stores the result in 'dest'
+      VM_CALL_FUNC(&(bcModule.getFunction(pc->CallFunc.func)), 
+                   pc->CallFunc.base, true, pc->CallFunc.dest, pc+2);
     }
-    #undef TRIVIAL_TAC_BINOP_IMPL
-    #undef TRIVIAL_TAC_COMP_IMPL
-  } while(isAlive_ && ++pc_);
-  return Register();
+    VM_CASE(CallVoidFunc): {
+      // CallVoidFunc func base : calls the function 'func'.
+      //  Args are in the registers that follow 'base'.
+      VM_CALL_FUNC(&(bcModule.getFunction(pc->CallVoidFunc.func)),
+                   pc->CallVoidFunc.base, false, 0, pc+1);
+    }
+    VM_CASE(CallTarget):
+      // CallTarget func: the function called by the preceding CallFunc.
+      fox_unreachable("CallTarget instructions are never executed");
+    VM_CASE(CallBuiltin): {
+      // CallBuiltin id base dest : calls the builtin 'id'.
+      //  Args are in the registers that follow 'base'.
+      //  Stores the result in 'dest'
+      VM_CALL_BUILTIN(pc->CallBuiltin.id, pc->CallBuiltin.base, true, 
+                      pc->CallBuiltin.dest);
+    }
+    VM_CASE(CallVoidBuiltin): {
+      // CallVoidBuiltin id base : calls the builtin 'id'.
+      //  Args are in the registers that follow 'base'.
+      VM_CALL_BUILTIN(pc->CallVoidBuiltin.id, pc->CallVoidBuiltin.base, 
+                      false, 0);
+    }
+    // Superinstructions: execute the first instruction of the pair, then 
+    // go directly to the handler of the second one, which is the next 
+    // instruction. (With the switch, this is just a normal dispatch)
+    VM_CASE(StoreSmallInt_ModInt):
+      getReg(pc->StoreSmallInt_ModInt.dest).intVal = 
+        pc->StoreSmallInt_ModInt.value;
+      VM_NEXT_FUSED(ModInt);
+    VM_CASE(StoreSmallInt_EqInt):
+      getReg(pc->StoreSmallInt_EqInt.dest).intVal = 
+        pc->StoreSmallInt_EqInt.value;
+      VM_NEXT_FUSED(EqInt);
+    VM_CASE(StoreSmallInt_JumpIfNotEqInt):
+      getReg(pc->StoreSmallInt_JumpIfNotEqInt.dest).intVal = 
+        pc->StoreSmallInt_JumpIfNotEqInt.value;
+      VM_NEXT_FUSED(JumpIfNotEqInt);
+    VM_CASE(StoreSmallInt_JumpIfNotLTInt):
+      getReg(pc->StoreSmallInt_JumpIfNotLTInt.dest).intVal = 
+        pc->StoreSmallInt_JumpIfNotLTInt.value;
+      VM_NEXT_FUSED(JumpIfNotLTInt);
+    VM_CASE(LoadIntK_JumpIfNotLEInt):
+      getReg(pc->LoadIntK_JumpIfNotLEInt.dest).intVal =
+        bcModule.getIntConstant(pc->LoadIntK_JumpIfNotLEInt.kID);
+      VM_NEXT_FUSED(JumpIfNotLEInt);
+    VM_CASE(AddIntImm_Jump):
+      TRIVIAL_IMM_BINOP_IMPL(AddIntImm_Jump, +);
+      VM_NEXT_FUSED(Jump);
+    VM_CASE(SubIntImm_CallFunc):
+      TRIVIAL_IMM_BINOP_IMPL(SubIntImm_CallFunc, -);
+      VM_NEXT_FUSED(CallFunc);
+    VM_CASE(LAnd_JumpIfNot):
+      getReg(pc->LAnd_JumpIfNot.dest).raw =
+        (getReg(pc->LAnd_JumpIfNot.lhs).raw && 
+         getReg(pc->LAnd_JumpIfNot.rhs).raw);
+      VM_NEXT_FUSED(JumpIfNot);
+    VM_CASE(AddInt_Ret):
+      TRIVIAL_TAC_BINOP_IMPL(AddInt_Ret, intVal, +);
+      VM_NEXT_FUSED(Ret);
+  VM_DISPATCH_END
+  #if FOX_VM_USE_THREADED_DISPATCH
+    profile_instr: {
+      // Records the instruction and jumps to its real handler.
+      VM_PROFILE_INSTR();
+      goto *dispatchTable[std::size_t(profOp)];
+    }
+  #endif
+  #undef TRIVIAL_TAC_BINOP_IMPL
+  #undef TRIVIAL_TAC_COMP_IMPL
+  #undef TRIVIAL_IMM_BINOP_IMPL
+  #undef COMPARE_AND_JUMP_IMPL
+  #undef VM_CASE
+  #undef VM_NEXT
+  #undef VM_NEXT_FUSED
+  #undef VM_PREPARE
+  #undef VM_ERROR_EXIT
+  #undef VM_ENTER_JIT
+  #undef VM_CALL
+  #undef VM_CALL_FUNC
+  #undef VM_CALL_BUILTIN
+  #undef VM_RETURN
+  #undef VM_PROFILE_INSTR
+  #undef VM_SAVE_PC
+  #undef VM_JUMP
+  #undef VM_DISPATCH
+  #undef VM_DISPATCH_BEGIN
+  #undef VM_DISPATCH_END
+  fox_unreachable("fell off the end of the interpreter loop");
 }
 
 const Instruction* VM::getPC() const {
@@ -345,41 +820,97 @@ ArrayRef<VM::Register> VM::getRegisterStack() const {
   return regStack_;
 }
 
+template<typename Ty, typename ... Args>
+LLVM_ATTRIBUTE_RETURNS_NONNULL
+Ty* VM::allocateObject(std::size_t size, std::size_t extraSize, 
+                       Args&& ... args) {
+  // Large objects are allocated directly in the old generation, with the
+  // objects moved out of the nursery.
+  if (LLVM_UNLIKELY(size > Nursery::maxObjectSize)) {
+    notifyAllocation(size + extraSize, /*young*/ false);
+    Ty* obj = Ty::create(objectAllocator_.allocate(size), 
+                         std::forward<Args>(args)...);
+    oldObjects_.push_back(obj);
+    return obj;
+  }
+  notifyAllocation(size + extraSize, /*young*/ true);
+  void* mem = nursery_.allocate(size, alignof(Ty));
+  Ty* obj = Ty::create(mem, std::forward<Args>(args)...);
+  obj->setYoung(true);
+  return obj;
+}
+
 LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
 StringObject* VM::newStringObject(string_view str) {
-  stringObjects_.emplace_back(std::make_unique<StringObject>(str));
-  StringObject* ptr = stringObjects_.back().get();
-  assert(ptr && "Pointer to allocated object is nullptr");
-  return ptr;
+  std::size_t length = countCodepoints(str);
+  return allocateObject<StringObject>(
+    StringObject::totalSize(str.size(), length), 0, str, length);
 }
 
 LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS
-StringObject* VM::newStringObjectFromK(constant_id_t kID) {
-  const auto& str = bcModule.getStringConstant(kID);
-  stringObjects_.emplace_back(std::make_unique<StringObject>(str));
-  StringObject* ptr = stringObjects_.back().get();
-  assert(ptr && "Pointer to allocated object is nullptr");
-  return ptr;
+StringObject* VM::newStringObject(StringObject* lhs, StringObject* rhs) {
+  // The lengths of the operands are known, so the string doesn't have
+  // to be decoded.
+  std::size_t numBytes = lhs->numBytes() + rhs->numBytes();
+  std::size_t length = lhs->length() + rhs->length();
+  // Long strings are usually built by appending to them, so copying them
+  // would make building them quadratic.
+  if (numBytes >= StringObject::minRopeSize)
+    return allocateObject<StringObject>(StringObject::ropeSize(), 0, lhs, rhs);
+  // Short strings can't contain a rope, so their operands are flat.
+  return allocateObject<StringObject>(StringObject::totalSize(numBytes, 
+    length), 0, lhs->str(), rhs->str(), length);
+}
+
+void VM::flattenRope(StringObject* rope) {
+  assert(!rope->isFlat() && "string is already flat");
+  // The rope is passed to allocateObject, and not its operands, because 
+  // they can be moved by a collection before the flat string is created.
+  StringObject* flat = allocateObject<StringObject>(
+    StringObject::totalSize(rope->numBytes(), rope->length()), 0, 
+    const_cast<const StringObject*>(rope));
+  rope->setFlattened(flat);
+  // The rope can be old, and now references a young object.
+  if(!rope->isYoung() && flat->isYoung() && !rope->isRemembered())
+    remember(rope);
+}
+
+LLVM_ATTRIBUTE_RETURNS_NONNULL
+StringObject* VM::createStringConstant(constant_id_t kID) {
+  // Constants can be added to the module after the VM's creation, so
+  // the vector is resized as needed.
+  if(kID >= stringConstants_.size())
+    stringConstants_.resize(kID+1);
+  auto& obj = stringConstants_[kID];
+  assert(!obj && "constant has already been created");
+  string_view str = bcModule.getStringConstant(kID);
+  std::size_t length = countCodepoints(str);
+  obj = StringObject::create(
+    llvm::safe_malloc(StringObject::totalSize(str.size(), length)), str, 
+    length);
+  return obj;
 }
 
 LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS 
-ArrayObject* VM::newValueArrayObject(std::size_t reservedElems) {
-  arrayObjects_.emplace_back(
-    std::make_unique<ArrayObject>(/*containsReferences*/ false, reservedElems)
-  );
-  ArrayObject* ptr = arrayObjects_.back().get();
-  assert(ptr && "Pointer to allocated object is nullptr");
-  return ptr;
+ArrayObject* VM::newArrayObjectFromConstant(constant_id_t kID) {
+  const ArrayObject& constant = bcModule.getArrayConstant(kID);
+  return allocateObject<ArrayObject>(sizeof(ArrayObject), 
+    constant.size()*getElemSize(constant.getElemKind()), &constant);
+}
+
+LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS 
+ArrayObject* VM::newValueArrayObject(ArrayElemKind elemKind,
+                                     std::size_t reservedElems) {
+  assert((elemKind != ArrayElemKind::Ref) && "not a value type");
+  return allocateObject<ArrayObject>(sizeof(ArrayObject), 
+    reservedElems*getElemSize(elemKind), elemKind, reservedElems);
 }
 
 LLVM_ATTRIBUTE_RETURNS_NONNULL LLVM_ATTRIBUTE_RETURNS_NOALIAS 
 ArrayObject* VM::newRefArrayObject(std::size_t reservedElems) {
-  arrayObjects_.emplace_back(
-    std::make_unique<ArrayObject>(/*containsReferences*/ true, reservedElems)
-  );
-  ArrayObject* ptr = arrayObjects_.back().get();
-  assert(ptr && "Pointer to allocated object is nullptr");
-  return ptr;
+  return allocateObject<ArrayObject>(sizeof(ArrayObject), 
+    reservedElems*getElemSize(ArrayElemKind::Ref), ArrayElemKind::Ref, 
+    reservedElems);
 }
 
 MutableArrayRef<VM::Register> VM::getRegisterStack() {
@@ -415,32 +946,89 @@ std::size_t VM::numGlobals() const {
   return bcModule.numGlobals();
 }
 
-VM::Register VM::callFunc(regaddr_t base) {
-  Register* basePtr = getRegPtr(base);
-  FunctionRef& fnRef = basePtr->funcRef;
+void VM::setOpcodePairProfile(OpcodePairProfile* profile) {
+  profile_ = profile;
+}
 
-  // Backup the current register window position
-  Register* previousBase = baseReg_;
-  // Slide the window so it begins at basePtr+1
-  baseReg_ = basePtr+1;
+OpcodePairProfile* VM::getOpcodePairProfile() const {
+  return profile_;
+}
 
-  // Backup the current program counter and the instrsBeg_
-  // pointer.
-  auto oldPC = pc_;
+std::uint32_t VM::getJITThreshold() const {
+  return jitThreshold_;
+}
 
-  Register rtr;
-  if(fnRef.isBCFunction()) 
-    rtr = run(*fnRef.getBCFunction());           // normal functions
-  else if(fnRef.isBuiltin())  
-    rtr = callBuiltinFunc(fnRef.getBuiltinKind());  // builtin functions
-  else 
-    fox_unreachable("unknown FunctionRef kind");
+void VM::setJITThreshold(std::uint32_t threshold) {
+  jitThreshold_ = JITFunction::isSupported() ? threshold : 0;
+}
 
-  // Restore the window and pc pointers
-  baseReg_ = previousBase;
-  pc_ = oldPC;
+JITFunction* VM::getJITFunction(BCFunction& fn) {
+  if(JITFunction* jit = fn.getJITFunction()) 
+    return jit;
+  if(fn.incrementHotness() != jitThreshold_) 
+    return nullptr;
+  fn.setJITFunction(JITFunction::compile(bcModule, fn));
+  return fn.getJITFunction();
+}
 
-  return rtr;
+std::size_t VM::getMaxCallDepth() const {
+  return maxCallDepth_;
+}
+
+void VM::setMaxCallDepth(std::size_t depth) {
+  assert(depth && "the maximum call depth cannot be zero");
+  maxCallDepth_ = depth;
+}
+
+std::size_t VM::getMaxRegisterStackSize() const {
+  return maxRegStackSize_;
+}
+
+void VM::setMaxRegisterStackSize(std::size_t size) {
+  assert((size >= bc_limits::max_registers) 
+    && "the register stack must be able to contain a full register window");
+  maxRegStackSize_ = size;
+}
+
+VM::Register* VM::growRegisterStack(Register* base, std::size_t numRegs) {
+  Register* oldData = regStack_.data();
+  std::size_t baseIdx = std::size_t(base - oldData);
+  std::size_t minSize = baseIdx + numRegs;
+  if(minSize <= regStack_.size()) return base;
+  if(minSize > maxRegStackSize_) return nullptr;
+  // Grow in chunks, at least doubling the size of the stack so deep 
+  // recursion doesn't reallocate on every other call.
+  std::size_t newSize = ((minSize + registerStackChunkSize - 1) 
+                      / registerStackChunkSize) * registerStackChunkSize;
+  newSize = std::max(newSize, regStack_.size() * 2);
+  newSize = std::min(newSize, maxRegStackSize_);
+  regStack_.resize(newSize);
+  // Rebase the pointers to the register stack if it moved
+  Register* newData = regStack_.data();
+  if (newData != oldData) {
+    baseReg_ = newData + (baseReg_ - oldData);
+    for (CallFrame& frame : callStack_)
+      frame.base = newData + (frame.base - oldData);
+  }
+  return newData + baseIdx;
+}
+
+void VM::reserveRegisters(std::size_t numRegs) {
+  if(fitsInRegisterStack(baseReg_, numRegs)) return;
+  LLVM_ATTRIBUTE_UNUSED Register* base = growRegisterStack(baseReg_, numRegs);
+  assert(base && "register stack is too small to contain the register "
+    "window");
+}
+
+void VM::unwindCallStack(std::size_t depth) {
+  assert((depth <= callStack_.size()) && "call stack is not that deep");
+  if(depth == callStack_.size()) return;
+  // Restore the state of the VM to what it was before the first frame 
+  // we're removing was pushed.
+  const CallFrame& frame = callStack_[depth];
+  curFn_ = frame.fn;
+  baseReg_ = frame.base;
+  callStack_.erase(callStack_.begin()+depth, callStack_.end());
 }
 
 namespace {
@@ -486,69 +1074,139 @@ namespace {
                             , value.raw);
   #undef REG_CONVERT
 
+  /// Describes how an argument of type Ty is passed to a builtin.
   template<typename Ty>
-  struct ArgCaster {
-    static Ty cast(VM&, VM::Register*& base) {
-      return RegCast<Ty>::regToType(*(base++));
+  struct BuiltinArg {
+    /// The number of argument registers used by the argument
+    static constexpr std::size_t numRegs = 1;
+
+    /// \returns the argument, which is in the register \p arg.
+    static Ty get(VM&, VM::Register* arg, VM::Register*) {
+      return RegCast<Ty>::regToType(*arg);
     }
   };
 
   template<>
-  struct ArgCaster<VM&> {
+  struct BuiltinArg<VM&> {
+    static constexpr std::size_t numRegs = 0;
+
     /// Just returns the VM instance
-    static VM& cast(VM& vm, VM::Register*&) {
+    static VM& get(VM& vm, VM::Register*, VM::Register*) {
       return vm;
     }
   };
 
+  template<>
+  struct BuiltinArg<BuiltinDest> {
+    static constexpr std::size_t numRegs = 0;
+
+    /// Returns the destination register of the call
+    static BuiltinDest get(VM&, VM::Register*, VM::Register* dest) {
+      assert(dest && "no destination register");
+      return BuiltinDest(&(dest->raw));
+    }
+  };
+
+  /// \returns the index of the register of the argument at index \p idx of 
+  /// a builtin that takes arguments of type Args, relative to the first
+  /// argument register.
+  template<typename ... Args>
+  constexpr std::size_t getArgRegIndex(std::size_t idx) {
+    const std::size_t numRegs[] = {BuiltinArg<Args>::numRegs..., 0};
+    std::size_t reg = 0;
+    for (std::size_t k = 0; k < idx; ++k)
+      reg += numRegs[k];
+    return reg;
+  }
+
   //--------------------------------------------------------------------------//
-  // doBuiltinCall overloads
+  // Builtin trampolines
   //--------------------------------------------------------------------------//
 
-  /// Calls a builtin that takes arguments and returns something
+  /// Calls \p fn with the arguments that begin at \p args. The index of the
+  /// register of each argument is computed at compile time, so this compiles
+  /// down to a load per argument and a direct call.
+  template<typename Rtr, typename ... Args, std::size_t ... Idx>
+  Rtr invokeBuiltin(Rtr(*fn)(Args...), VM& vm, VM::Register* args, 
+                    VM::Register* dest, std::index_sequence<Idx...>) {
+    return fn(BuiltinArg<Args>::get(vm, 
+      args + std::integral_constant<std::size_t, 
+                                    getArgRegIndex<Args...>(Idx)>::value,
+      dest)...);
+  }
+
+  /// Calls a builtin that returns something and returns its return value.
   template<typename Rtr, typename ... Args>
-  VM::Register doBuiltinCall(VM& vm, VM::Register* base, Rtr(*fn)(Args...)) {
-    // Create a tuple of arguments
-    std::tuple<Args...> args{ArgCaster<Args>::cast(vm, base)...};
-    // Apply
-    auto result = apply(fn, args);
-    // Cast the return value to a VM::Reg
-    return RegCast<Rtr>::template typeToReg(result);
+  VM::Register callBuiltin(Rtr(*fn)(Args...), VM& vm, VM::Register* args) {
+    return RegCast<Rtr>::typeToReg(
+      invokeBuiltin(fn, vm, args, nullptr, std::index_sequence_for<Args...>()));
   }
 
-  /// Calls a builtin that takes arguments but doesn't return anything
+  /// Calls a builtin that doesn't return anything, or that writes its 
+  /// result in its BuiltinDest, and returns that result (or a null register)
   template<typename ... Args>
-  VM::Register doBuiltinCall(VM& vm, VM::Register* base, void(*fn)(Args...)) {
-    // Create a tuple of arguments
-    std::tuple<Args...> args{ArgCaster<Args>::cast(vm, base)...};
-    // Apply
-    apply(fn, args);
-    // Simply returns null register for void function calls
-    return VM::Register();
+  VM::Register callBuiltin(void(*fn)(Args...), VM& vm, VM::Register* args) {
+    VM::Register rtr;
+    invokeBuiltin(fn, vm, args, &rtr, std::index_sequence_for<Args...>());
+    return rtr;
   }
 
-  /// Calls a simple builtin that doesn't take any argument and
-  /// just returns a value
-  template<typename Rtr>
-  VM::Register doBuiltinCall(VM&, VM::Register*, Rtr(*fn)()) {
-    return RegCast<Rtr>::template from_reg(fn());
+  /// Calls a builtin that returns something and stores its return value
+  /// in \p dest.
+  template<typename Rtr, typename ... Args>
+  void callBuiltin(Rtr(*fn)(Args...), VM& vm, VM::Register* args, 
+                   VM::Register* dest) {
+    *dest = RegCast<Rtr>::typeToReg(
+      invokeBuiltin(fn, vm, args, dest, std::index_sequence_for<Args...>()));
   }
 
-  /// Calls a simple builtin that doesn't take any argument and does not
-  /// return anything.
-  VM::Register doBuiltinCall(VM&, VM::Register*, void(*fn)()) {
-    fn();
-    return VM::Register();
+  /// Calls a builtin that doesn't return anything, or that writes its
+  /// result directly in \p dest.
+  template<typename ... Args>
+  void callBuiltin(void(*fn)(Args...), VM& vm, VM::Register* args, 
+                   VM::Register* dest) {
+    invokeBuiltin(fn, vm, args, dest, std::index_sequence_for<Args...>());
   }
-}
 
-VM::Register VM::callBuiltinFunc(BuiltinKind id) {
-  switch (id) {
-    #define BUILTIN(FUNC)\
-      case BuiltinKind::FUNC:   \
-        return doBuiltinCall(*this, getRegPtr(0), builtin::FUNC);
+  /// The type of the trampolines that return the return value of the builtin
+  using BuiltinFn = VM::Register(*)(VM&, VM::Register*);
+  /// The type of the trampolines that store the return value of the builtin
+  /// in a destination register.
+  using BuiltinDestFn = void(*)(VM&, VM::Register*, VM::Register*);
+
+  #define BUILTIN(FUNC)                                                       \
+    VM::Register call_##FUNC(VM& vm, VM::Register* args) {                    \
+      return callBuiltin(builtin::FUNC, vm, args);                            \
+    }                                                                         \
+    void call_##FUNC##_dest(VM& vm, VM::Register* args,                       \
+                            VM::Register* dest) {                             \
+      callBuiltin(builtin::FUNC, vm, args, dest);                             \
+    }
+  #include "Fox/Common/Builtins.def"
+
+  /// The trampolines of the builtins, indexed by BuiltinKind.
+  const BuiltinFn builtinTable[] = {
+    #define BUILTIN(FUNC) &call_##FUNC,
     #include "Fox/Common/Builtins.def"
-    default:
-      fox_unreachable("Unknown BuiltinKind");
-  }
+  };
+
+  /// The trampolines of the builtins that store the return value in a
+  /// destination register, indexed by BuiltinKind.
+  const BuiltinDestFn builtinDestTable[] = {
+    #define BUILTIN(FUNC) &call_##FUNC##_dest,
+    #include "Fox/Common/Builtins.def"
+  };
+
+  constexpr std::size_t numBuiltins = 
+    sizeof(builtinTable)/sizeof(builtinTable[0]);
+}
+
+VM::Register VM::callBuiltinFunc(BuiltinKind id, Register* args) {
+  assert((std::size_t(id) < numBuiltins) && "Unknown BuiltinKind");
+  return builtinTable[std::size_t(id)](*this, args);
+}
+
+void VM::callBuiltinFunc(BuiltinKind id, Register* args, Register* dest) {
+  assert((std::size_t(id) < numBuiltins) && "Unknown BuiltinKind");
+  builtinDestTable[std::size_t(id)](*this, args, dest);
 }
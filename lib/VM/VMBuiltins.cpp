@@ -35,7 +35,7 @@ StringObject* builtin::boolToString(VM& vm, bool value) {
 StringObject* builtin::strConcat(VM& vm, StringObject* lhs, StringObject* rhs) {
   assert(lhs && "LHS is null");
   assert(rhs && "RHS is null");
-  return vm.newStringObject(lhs->str() + rhs->str());
+  return vm.newStringObject(lhs, rhs);
 }
 
 StringObject* builtin::charConcat(VM& vm, FoxChar lhs, FoxChar rhs) {
@@ -78,12 +78,13 @@ FoxChar builtin::getChar(VM& vm, StringObject* str, FoxInt n) {
   if(!checkSubscript(vm, str->length(), n))
     return 0;
   // Do the subscript
+  vm.flatten(str);
   return str->getChar(static_cast<std::size_t>(n));
 }
 
-void builtin::arrAppend(ArrayObject* arr, FoxAny elem) {
+void builtin::arrAppend(VM& vm, ArrayObject* arr, FoxAny elem) {
   assert(arr && "array is null");
-  arr->append(elem);
+  vm.appendToArray(arr, elem);
 }
 
 FoxInt builtin::arrSize(ArrayObject* arr) {
@@ -91,16 +92,17 @@ FoxInt builtin::arrSize(ArrayObject* arr) {
   return arr->size();
 }
 
-FoxAny builtin::arrGet(VM& vm, ArrayObject* arr, FoxInt n) {
+void builtin::arrGet(VM& vm, BuiltinDest dest, ArrayObject* arr, FoxInt n) {
   if(!checkSubscript(vm, arr->size(), n))
-    return FoxAny();
-  return (*arr)[n];
+    return;
+  dest.set((*arr)[n]);
 }
 
 FoxAny builtin::arrSet(VM& vm, ArrayObject* arr, FoxInt n, FoxAny val) {
   if(!checkSubscript(vm, arr->size(), n))
     return FoxAny();
-  (*arr)[n] = val;
+  arr->set(n, val);
+  vm.writeBarrier(arr, val);
   return val;
 }
 
@@ -120,16 +122,16 @@ void builtin::arrPop(VM& vm, ArrayObject* arr) {
   arr->pop();
 }
 
-FoxAny builtin::arrFront(VM& vm, ArrayObject* arr) {
+void builtin::arrFront(VM& vm, BuiltinDest dest, ArrayObject* arr) {
   assert(arr && "array is null");
-  if(checkIfEmptyArrayForCall(vm, arr, "array.front")) return FoxAny();
-  return arr->front();
+  if(checkIfEmptyArrayForCall(vm, arr, "array.front")) return;
+  dest.set(arr->front());
 }
 
-FoxAny builtin::arrBack(VM& vm, ArrayObject* arr) {
+void builtin::arrBack(VM& vm, BuiltinDest dest, ArrayObject* arr) {
   assert(arr && "array is null");
-  if(checkIfEmptyArrayForCall(vm, arr, "array.back")) return FoxAny();
-  return arr->back();
+  if(checkIfEmptyArrayForCall(vm, arr, "array.back")) return;
+  dest.set(arr->back());
 }
 
 void builtin::arrReset(ArrayObject * arr) {
@@ -35,4 +35,19 @@ void VM::diagnoseDivisionByZero() {
 
 void VM::diagnoseModuloByZero() {
   diagnose(DiagID::runtime_mod_zero);
-}
\ No newline at end of file
+}
+
+void VM::diagnoseStackOverflow() {
+  diagnose(DiagID::runtime_stack_overflow).addArg(maxCallDepth_);
+}
+
+void VM::diagnoseRegisterStackOverflow() {
+  diagnose(DiagID::runtime_register_stack_overflow).addArg(maxRegStackSize_);
+}
+
+void VM::diagnoseInvalidSubscript(std::size_t size, FoxInt idx) {
+  if (idx < 0)
+    diagnose(DiagID::runtime_subscript_negative_index).addArg(idx);
+  else
+    diagnose(DiagID::runtime_subscript_out_of_range).addArg(size).addArg(idx);
+}
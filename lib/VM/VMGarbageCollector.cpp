@@ -0,0 +1,476 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.
+// File : VMGarbageCollector.cpp
+// Author : Pierre van Houtryve
+//----------------------------------------------------------------------------//
+// Implements the VM's generational garbage collector.
+//
+// New objects are allocated in the young generation (the Nursery) by
+// bumping a pointer. Most of them die young (e.g. the temporary strings
+// created by conversions and concatenations), so the young generation is
+// collected on its own by minor collections. The old generation is only
+// collected by full collections, which are mark and sweep collections that
+// begin with a minor collection. The old objects that don't live in a
+// promoted block of the nursery are allocated by the ObjectAllocator, which
+// reuses the memory of the objects freed by the sweep.
+//
+// Registers are untagged, so we can't know which registers contain
+// references. The roots are thus found by checking, for every register in
+// the register stack and every global variable, if its value is the address
+// of an object of the heap. This can keep an object alive if an integer or
+// a double happens to have the same value as its address, but it can't
+// free an object that is still used. Objects are traced precisely: only
+// the elements of arrays that contain references and the operands of ropes
+// are followed.
+//
+// Since a register that looks like a reference might not be one, the
+// objects referenced by the roots can't be moved. Minor collections are
+// thus "mostly copying": the surviving young objects that are only
+// referenced by other objects are moved out of the nursery, and the blocks
+// of the nursery that contain an object referenced by a root are promoted
+// to the old generation as a whole.
+//
+// The young objects referenced by old objects are found using the
+// remembered set, which is maintained by the write barrier (see
+// VM::writeBarrier) and by VM::flattenRope. The global variables are roots
+// of every minor collection, so they don't need a write barrier.
+//----------------------------------------------------------------------------//
+
+#include "Fox/VM/VM.hpp"
+#include "Fox/Common/Errors.hpp"
+#include "Fox/Common/Objects.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+using namespace fox;
+
+/// Calls the destructor of \p obj, without freeing its memory.
+static void destroyObject(Object* obj) {
+  switch (obj->getKind()) {
+    #define OBJECT(CLASS) case ObjectKind::CLASS:\
+      static_cast<CLASS*>(obj)->~CLASS(); return;
+    #include "Fox/Common/Objects.def"
+  }
+  fox_unreachable("unknown ObjectKind");
+}
+
+/// \returns the size of the memory in which \p obj has been created, 
+/// which doesn't include the memory allocated by the object itself (e.g.
+/// the elements of an array).
+static std::size_t getObjectSize(const Object* obj) {
+  switch (obj->getKind()) {
+    case ObjectKind::StringObject:
+      return static_cast<const StringObject*>(obj)->getAllocatedSize();
+    case ObjectKind::ArrayObject:
+      return sizeof(ArrayObject);
+  }
+  fox_unreachable("unknown ObjectKind");
+}
+
+/// Destroys \p obj and frees it with \p allocator, which allocated it.
+static void deleteObject(Object* obj, ObjectAllocator& allocator) {
+  std::size_t size = getObjectSize(obj);
+  destroyObject(obj);
+  allocator.deallocate(obj, size);
+}
+
+/// Moves \p obj to a new object allocated by \p allocator.
+/// \returns the new object
+static Object* moveObject(Object* obj, ObjectAllocator& allocator) {
+  void* mem = allocator.allocate(getObjectSize(obj));
+  switch (obj->getKind()) {
+    case ObjectKind::StringObject:
+      return static_cast<StringObject*>(obj)->clone(mem);
+    case ObjectKind::ArrayObject:
+      return new(mem) ArrayObject(std::move(*static_cast<ArrayObject*>(obj)));
+  }
+  fox_unreachable("unknown ObjectKind");
+}
+
+/// \returns true if \p obj can contain references to other objects.
+static bool hasReferences(Object* obj) {
+  if (ArrayObject* arr = dyn_cast<ArrayObject>(obj))
+    return arr->containsReferences();
+  return cast<StringObject>(obj)->isRope();
+}
+
+/// Replaces every reference \p ref contained in \p obj with \p fn(ref).
+template<typename Fn>
+static void updateReferences(Object* obj, Fn fn) {
+  if (ArrayObject* arr = dyn_cast<ArrayObject>(obj)) {
+    for (Object*& elem : arr->getElements<Object*>()) {
+      if(elem)
+        elem = fn(elem);
+    }
+    return;
+  }
+  for (StringObject*& operand : cast<StringObject>(obj)->getRopeOperands()) {
+    if(operand)
+      operand = cast<StringObject>(fn(operand));
+  }
+}
+
+/// \returns the number of bytes used by \p obj
+static std::size_t getAllocatedSize(const Object* obj) {
+  switch (obj->getKind()) {
+    #define OBJECT(CLASS) case ObjectKind::CLASS:\
+      return static_cast<const CLASS*>(obj)->getAllocatedSize();
+    #include "Fox/Common/Objects.def"
+  }
+  fox_unreachable("unknown ObjectKind");
+}
+
+void VM::collectGarbage() {
+  // Empty the young generation, so only the old one has to be collected.
+  collectYoungGeneration();
+  markReachableObjects();
+  sweep();
+  ++numCollections_;
+  // Let the heap grow to twice its current size, so the cost of the
+  // collections is proportional to the number of allocations.
+  nextCollection_ = std::max(gcThreshold_, heapSize_*2);
+  // The same goes for the promoted blocks, which can be mostly empty.
+  maxOldBlocks_ = std::max(gcThreshold_/Nursery::blockSize, 
+                           oldBlocks_.size()*2);
+}
+
+void VM::collectYoungGeneration() {
+  ++numMinorCollections_;
+
+  // The objects with references that have been reached, but whose
+  // references haven't been visited yet.
+  SmallVector<Object*, 16> worklist;
+  // The new address of the objects that have been moved out of the nursery
+  std::unordered_map<Object*, Object*> forwarding;
+
+  auto pushIfHasReferences = [&](Object* obj) {
+    if(hasReferences(obj))
+      worklist.push_back(obj);
+  };
+
+  // Marks the young object referenced by a root, and pins its block.
+  auto visitRoot = [&](Register reg) {
+    Object* obj = nursery_.lookup(std::uintptr_t(reg.raw));
+    if(!obj || obj->isMarked()) return;
+    obj->setMarked(true);
+    nursery_.getBlock(obj)->pinned = true;
+    pushIfHasReferences(obj);
+  };
+
+  // Visit the register stack. Every register window, including the window
+  // of the current function and the arguments of the builtin being called,
+  // is below the end of the current window.
+  std::size_t stackSize = std::min<std::size_t>(
+    (baseReg_ - regStack_.data()) + bc_limits::max_registers,
+    regStack_.size()
+  );
+  for(std::size_t k = 0; k < stackSize; ++k)
+    visitRoot(regStack_[k]);
+
+  // Visit the global variables
+  if (globals_) {
+    for(std::size_t k = 0, size = numGlobals(); k < size; ++k)
+      visitRoot(globals_[k]);
+  }
+
+  // Marks a young object referenced by another object, and moves it out of
+  // the nursery unless its block is pinned. This is only done once every
+  // root has been visited, so we know which blocks are pinned.
+  // Returns the address of the object after the collection.
+  auto visitReference = [&](Object* obj) -> Object* {
+    if(!obj->isYoung()) return obj;
+    if (obj->isMarked()) {
+      auto it = forwarding.find(obj);
+      return (it == forwarding.end()) ? obj : it->second;
+    }
+    obj->setMarked(true);
+    if (!nursery_.getBlock(obj)->pinned) {
+      Object* newObj = evacuate(obj);
+      forwarding[obj] = newObj;
+      obj = newObj;
+    }
+    pushIfHasReferences(obj);
+    return obj;
+  };
+
+  // Visit the old objects that may reference young objects
+  for (Object* obj : rememberedSet_) {
+    updateReferences(obj, visitReference);
+    obj->setRemembered(false);
+  }
+  rememberedSet_.clear();
+
+  // Trace the objects with references
+  while (!worklist.empty())
+    updateReferences(worklist.pop_back_val(), visitReference);
+
+  // The objects that survived in the pinned blocks become old, and
+  // every other object of the nursery is either dead or has been moved.
+  heapSize_ -= youngSize_;
+  youngSize_ = 0;
+  for (auto& block : nursery_.getBlocks()) {
+    if (!block->pinned) {
+      for (Object* obj : block->objects)
+        destroyObject(obj);
+      continue;
+    }
+    auto isDead = [&](Object* obj) {
+      if (!obj->isMarked()) {
+        destroyObject(obj);
+        return true;
+      }
+      obj->setMarked(false);
+      obj->setYoung(false);
+      heapSize_ += getAllocatedSize(obj);
+      return false;
+    };
+    auto& objects = block->objects;
+    objects.erase(std::remove_if(objects.begin(), objects.end(), isDead),
+                  objects.end());
+  }
+  for (auto& block : nursery_.clear())
+    oldBlocks_.push_back(std::move(block));
+}
+
+std::size_t VM::getHeapSize() const {
+  return heapSize_;
+}
+
+std::size_t VM::getNumObjects() const {
+  std::size_t total = nursery_.getNumObjects() + oldObjects_.size();
+  for (auto& block : oldBlocks_)
+    total += block->objects.size();
+  return total;
+}
+
+std::size_t VM::getNumObjects(ObjectKind kind) const {
+  auto isOfKind = [&](const Object* obj) {
+    return obj->getKind() == kind;
+  };
+  std::size_t total = std::count_if(oldObjects_.begin(), oldObjects_.end(), 
+                                    isOfKind);
+  for (auto& block : nursery_.getBlocks()) {
+    total += std::count_if(block->objects.begin(), block->objects.end(),
+                           isOfKind);
+  }
+  for (auto& block : oldBlocks_) {
+    total += std::count_if(block->objects.begin(), block->objects.end(),
+                           isOfKind);
+  }
+  return total;
+}
+
+std::size_t VM::getNumYoungObjects() const {
+  return nursery_.getNumObjects();
+}
+
+const ObjectAllocator& VM::getObjectAllocator() const {
+  return objectAllocator_;
+}
+
+std::size_t VM::getNumCollections() const {
+  return numCollections_;
+}
+
+std::size_t VM::getNumMinorCollections() const {
+  return numMinorCollections_;
+}
+
+std::size_t VM::getGCThreshold() const {
+  return gcThreshold_;
+}
+
+void VM::setGCThreshold(std::size_t threshold) {
+  gcThreshold_ = threshold;
+  nextCollection_ = threshold;
+  maxOldBlocks_ = threshold/Nursery::blockSize;
+}
+
+bool VM::isGCStressEnabled() const {
+  return gcStress_;
+}
+
+void VM::setGCStress(bool enabled) {
+  gcStress_ = enabled;
+}
+
+bool VM::isDebugAllocationEnabled() const {
+  return objectAllocator_.isDebugModeEnabled();
+}
+
+void VM::setDebugAllocation(bool enabled) {
+  objectAllocator_.setDebugMode(enabled);
+}
+
+std::size_t VM::getNurserySize() const {
+  return nurserySize_;
+}
+
+void VM::setNurserySize(std::size_t size) {
+  nurserySize_ = size;
+}
+
+void VM::notifyAllocation(std::size_t size, bool young) {
+  collectGarbageIfNeeded(size, young);
+  heapSize_ += size;
+  if(young)
+    youngSize_ += size;
+}
+
+void VM::collectGarbageIfNeeded(std::size_t size, bool young) {
+  if (gcStress_ || ((heapSize_ + size) > nextCollection_) 
+      || (oldBlocks_.size() > maxOldBlocks_))
+    collectGarbage();
+  else if(young && ((youngSize_ + size) > nurserySize_))
+    collectYoungGeneration();
+}
+
+void VM::reserveArray(ArrayObject* arr, std::size_t minCapacity) {
+  if(minCapacity <= arr->capacity()) return;
+  std::size_t oldSize = arr->getAllocatedSize();
+  arr->reserve(minCapacity);
+  // The elements have been reallocated with malloc, so the array hasn't
+  // moved. Its growth is added to the heap before checking whether it
+  // must be collected, because a collection computes the size of the
+  // surviving objects again.
+  std::size_t growth = arr->getAllocatedSize() - oldSize;
+  bool young = arr->isYoung();
+  heapSize_ += growth;
+  if(young)
+    youngSize_ += growth;
+  collectGarbageIfNeeded(0, young);
+}
+
+void VM::remember(Object* obj) {
+  assert(!obj->isYoung() && !obj->isRemembered()
+    && "object can't be added to the remembered set");
+  obj->setRemembered(true);
+  rememberedSet_.push_back(obj);
+}
+
+Object* VM::evacuate(Object* obj) {
+  assert(obj->isYoung() && "object is already old");
+  Object* newObj = moveObject(obj, objectAllocator_);
+  newObj->setMarked(false);
+  newObj->setYoung(false);
+  oldObjects_.push_back(newObj);
+  heapSize_ += getAllocatedSize(newObj);
+  return newObj;
+}
+
+void VM::markReachableObjects() {
+  assert(!nursery_.getNumObjects() && rememberedSet_.empty()
+    && "the young generation isn't empty");
+  // Collect the addresses of every object in the heap, sorted so we
+  // can quickly check if a register contains one of them.
+  std::vector<Object*> heapObjects(oldObjects_.begin(), oldObjects_.end());
+  for (auto& block : oldBlocks_) {
+    heapObjects.insert(heapObjects.end(),
+                       block->objects.begin(), block->objects.end());
+  }
+  std::sort(heapObjects.begin(), heapObjects.end());
+
+  // The objects that have been marked, but whose references haven't been
+  // marked yet.
+  SmallVector<Object*, 16> worklist;
+
+  auto mark = [&](Object* obj) {
+    if(obj->isMarked()) return obj;
+    obj->setMarked(true);
+    // Only arrays of references and ropes have to be traced.
+    if(hasReferences(obj))
+      worklist.push_back(obj);
+    return obj;
+  };
+
+  auto markIfObject = [&](Register reg) {
+    Object* obj = reg.object;
+    if(std::binary_search(heapObjects.begin(), heapObjects.end(), obj))
+      mark(obj);
+  };
+
+  // Mark the objects in the register stack. Every register window,
+  // including the window of the current function and the arguments of
+  // the builtin being called, is below the end of the current window.
+  std::size_t stackSize = std::min<std::size_t>(
+    (baseReg_ - regStack_.data()) + bc_limits::max_registers,
+    regStack_.size()
+  );
+  for(std::size_t k = 0; k < stackSize; ++k)
+    markIfObject(regStack_[k]);
+
+  // Mark the objects in the global variables
+  if (globals_) {
+    for(std::size_t k = 0, size = numGlobals(); k < size; ++k)
+      markIfObject(globals_[k]);
+  }
+
+  // Trace the objects with references
+  while (!worklist.empty())
+    updateReferences(worklist.pop_back_val(), mark);
+}
+
+void VM::sweep() {
+  heapSize_ = 0;
+  // Destroys the unmarked objects and clears the marks of the others.
+  auto isDead = [&](Object* obj) {
+    if(!obj->isMarked()) return true;
+    obj->setMarked(false);
+    heapSize_ += getAllocatedSize(obj);
+    return false;
+  };
+
+  oldObjects_.erase(std::remove_if(oldObjects_.begin(), oldObjects_.end(),
+    [&](Object* obj) {
+      if(!isDead(obj)) return false;
+      deleteObject(obj, objectAllocator_);
+      return true;
+    }), oldObjects_.end());
+
+  // The objects of the promoted blocks are destroyed in place, and the
+  // blocks are given back to the nursery once they're empty.
+  SmallVector<std::unique_ptr<Nursery::Block>, 4> liveBlocks;
+  for (auto& block : oldBlocks_) {
+    auto& objects = block->objects;
+    objects.erase(std::remove_if(objects.begin(), objects.end(),
+      [&](Object* obj) {
+        if(!isDead(obj)) return false;
+        destroyObject(obj);
+        return true;
+      }), objects.end());
+    if(objects.empty())
+      nursery_.recycle(std::move(block));
+    else
+      liveBlocks.push_back(std::move(block));
+  }
+  oldBlocks_ = std::move(liveBlocks);
+
+  // String constants are never collected, but they can be marked when
+  // they're in an array.
+  for (auto& obj : stringConstants_) {
+    if(obj) obj->setMarked(false);
+  }
+}
+
+void VM::freeHeap() {
+  for (auto& block : nursery_.getBlocks()) {
+    for (Object* obj : block->objects)
+      destroyObject(obj);
+  }
+  nursery_.clear();
+  for (Object* obj : oldObjects_)
+    deleteObject(obj, objectAllocator_);
+  oldObjects_.clear();
+  for (auto& block : oldBlocks_) {
+    for (Object* obj : block->objects)
+      destroyObject(obj);
+  }
+  oldBlocks_.clear();
+  rememberedSet_.clear();
+  for (StringObject* obj : stringConstants_)
+    std::free(obj);
+  stringConstants_.clear();
+}
@@ -4,23 +4,30 @@
 // File : BCTests.cpp                      
 // Author : Pierre van Houtryve                
 //----------------------------------------------------------------------------//
-//  Tests for Opcodes, Instructions, DebugInfo, BCModule, BCBuilder and 
-//  BCFunction.
+//  Tests for Opcodes, Instructions, DebugInfo, BCModule, BCBuilder, 
+//  BCFunction, PreparedCode and Superinstructions.
 //----------------------------------------------------------------------------//
 
 #include "gtest/gtest.h"
+#include "Fox/BC/BCAnalysis.hpp"
 #include "Fox/BC/BCBuilder.hpp"
 #include "Fox/BC/BCFunction.hpp"
 #include "Fox/BC/BCModule.hpp"
+#include "Fox/BC/BCPasses.hpp"
+#include "Fox/BC/BCPassManager.hpp"
 #include "Fox/BC/BCUtils.hpp"
 #include "Fox/BC/DebugInfo.hpp"
 #include "Fox/BC/Instruction.hpp"
+#include "Fox/BC/PreparedCode.hpp"
+#include "Fox/BC/Superinstructions.hpp"
+#include "Fox/Common/BuiltinKinds.hpp"
 #include "Fox/Common/DiagnosticEngine.hpp"
 #include "Fox/Common/FoxTypes.hpp"
 #include "Fox/Common/LLVM.hpp"
 #include "Fox/Common/SourceManager.hpp"
 #include "llvm/ADT/ArrayRef.h"
 #include <sstream>
+#include <vector>
 
 using namespace fox;
 
@@ -83,6 +90,9 @@ TEST(InstructionTest, isAnyJump) {
   TEST_JUMP(JumpIf);
   TEST_JUMP(JumpIfNot);
   TEST_JUMP(Jump);
+  TEST_JUMP(JumpIfLTInt);
+  TEST_JUMP(JumpIfNotEqInt);
+  TEST_NONJUMP(JumpOffset);
   TEST_NONJUMP(StoreSmallInt);
   TEST_NONJUMP(AddInt);
   TEST_NONJUMP(LNot);
@@ -184,6 +194,61 @@ TEST(BCBuilderTest, UnaryInstr) {
   }
 }
 
+TEST(BCBuilderTest, ImmInstr) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  auto it = builder.createAddIntImmInstr(1, 2, -127);
+  EXPECT_EQ(it->opcode, Opcode::AddIntImm);
+  EXPECT_EQ(it->AddIntImm.dest, 1);
+  EXPECT_EQ(it->AddIntImm.src, 2);
+  EXPECT_EQ(it->AddIntImm.imm, -127);
+}
+
+TEST(BCBuilderTest, CompareAndJumpInstr) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createNoOpInstr();
+  auto it = builder.createJumpIfLTIntInstr(1, 2, -300);
+  // The JumpOffset must have been inserted too
+  ASSERT_EQ(instrs.size(), 3u);
+  EXPECT_EQ(it->opcode, Opcode::JumpIfLTInt);
+  EXPECT_TRUE(it->isCompareAndJump());
+  EXPECT_EQ(it->JumpIfLTInt.lhs, 1);
+  EXPECT_EQ(it->JumpIfLTInt.rhs, 2);
+  EXPECT_EQ(instrs[2].opcode, Opcode::JumpOffset);
+  EXPECT_EQ(instrs[2].JumpOffset.offset, -300);
+  // The last instruction is the compare and jump, not its JumpOffset
+  EXPECT_TRUE(builder.isLastInstr(it));
+  // Popping it removes the JumpOffset too
+  builder.popInstr();
+  ASSERT_EQ(instrs.size(), 1u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::NoOp);
+}
+
+TEST(BCBuilderTest, DirectCallInstr) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createNoOpInstr();
+  auto it = builder.createCallFuncInstr(300, 1, 2);
+  // The CallTarget must have been inserted too
+  ASSERT_EQ(instrs.size(), 3u);
+  EXPECT_EQ(it->opcode, Opcode::CallFunc);
+  EXPECT_TRUE(it->isDirectCall());
+  EXPECT_FALSE(it->isCompareAndJump());
+  EXPECT_EQ(it->getLength(), 2u);
+  EXPECT_EQ(it->CallFunc.base, 1);
+  EXPECT_EQ(it->CallFunc.dest, 2);
+  EXPECT_EQ(instrs[2].opcode, Opcode::CallTarget);
+  EXPECT_EQ(instrs[2].CallTarget.func, 300);
+  // The last instruction is the call, not its CallTarget
+  EXPECT_TRUE(builder.isLastInstr(it));
+  // Popping it removes the CallTarget too
+  builder.popInstr();
+  ASSERT_EQ(instrs.size(), 1u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::NoOp);
+  EXPECT_EQ(instrs[0].getLength(), 1u);
+}
+
 TEST(BCBuilderTest, createdInstrIterators) {
   InstructionVector instrs;
   BCBuilder builder(instrs);
@@ -341,6 +406,10 @@ TEST_F(BCModuleTest, dump) {
   // The string must be constructed with an explicit size 
   // because it contains a '\0'
   theModule.addStringConstant(std::string("\n\t\r\\'\"\0", 7));
+  theModule.addArrayConstant(ArrayElemKind::Int, 
+                             {FoxAny(FoxInt(1)), FoxAny(FoxInt(-2))});
+  theModule.addArrayConstant(ArrayElemKind::Bool, 
+                             {FoxAny(std::uint64_t(0)), FoxAny(true)});
   {
     // Check the final dump
     std::stringstream ss;
@@ -357,6 +426,9 @@ TEST_F(BCModuleTest, dump) {
       "  [Strings: 2 constants]\n"
       "    0\t| \"foobar\"\n"
       "    1\t| \"\\n\\t\\r\\\\'\\\"\\0\"\n"
+      "  [Arrays: 2 constants]\n"
+      "    0\t| Int [1, -2]\n"
+      "    1\t| Bool [false, true]\n"
       "[Globals: 3]\n"
       "Initializer of Global 0\n"
       "    0\t| NoOp\n"
@@ -438,6 +510,721 @@ TEST(BCFunctionTest, dump) {
   }
 }
 
+TEST(BCFunctionTest, preparedCode) {
+  BCFunction fn(42);
+  fn.createBCBuilder().createRetVoidInstr();
+  PreparedCode* code = &fn.getPreparedCode();
+  EXPECT_FALSE(code->isPrepared());
+  code->prepare();
+  EXPECT_TRUE(code->isPrepared());
+  // The same code should be returned until the function is modified.
+  EXPECT_EQ(code, &fn.getPreparedCode());
+  fn.createBCBuilder().createRetVoidInstr();
+  EXPECT_FALSE(fn.getPreparedCode().isPrepared());
+  EXPECT_EQ(fn.getPreparedCode().getInstructions().size(), 2u);
+}
+
+//----------------------------------------------------------------------------//
+// PreparedCode tests
+//----------------------------------------------------------------------------//
+
+TEST(PreparedCodeTest, operands) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createStoreSmallIntInstr(1, -42);
+  builder.createAddIntInstr(2, 3, 4);
+  builder.createLoadIntKInstr(5, 4242);
+  builder.createRetVoidInstr();
+
+  PreparedCode code(instrs);
+  code.prepare();
+  const PreparedInstruction* prepared = code.begin();
+  EXPECT_EQ(prepared[0].opcode, Opcode::StoreSmallInt);
+  EXPECT_EQ(prepared[0].StoreSmallInt.dest, 1);
+  EXPECT_EQ(prepared[0].StoreSmallInt.value, -42);
+  EXPECT_EQ(prepared[1].opcode, Opcode::AddInt);
+  EXPECT_EQ(prepared[1].AddInt.dest, 2);
+  EXPECT_EQ(prepared[1].AddInt.lhs, 3);
+  EXPECT_EQ(prepared[1].AddInt.rhs, 4);
+  EXPECT_EQ(prepared[2].opcode, Opcode::LoadIntK);
+  EXPECT_EQ(prepared[2].LoadIntK.dest, 5);
+  EXPECT_EQ(prepared[2].LoadIntK.kID, 4242);
+  EXPECT_EQ(prepared[3].opcode, Opcode::RetVoid);
+  // Check that the prepared instructions are mapped to their source
+  for (std::size_t idx = 0; idx < instrs.size(); ++idx)
+    EXPECT_EQ(code.getSource(prepared+idx), instrs.begin()+idx);
+}
+
+TEST(PreparedCodeTest, jumps) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createJumpInstr(2);       // 0 -> 3
+  builder.createNoOpInstr();        // 1
+  builder.createJumpIfInstr(1, -3); // 2 -> 0
+  builder.createJumpIfNotInstr(2, 0); // 3 -> 4
+  builder.createRetVoidInstr();     // 4
+
+  PreparedCode code(instrs);
+  code.prepare();
+  const PreparedInstruction* prepared = code.begin();
+  EXPECT_EQ(prepared[0].Jump.offset, 3);
+  EXPECT_EQ(prepared[2].JumpIf.condReg, 1);
+  EXPECT_EQ(prepared[2].JumpIf.offset, 0);
+  EXPECT_EQ(prepared[3].JumpIfNot.condReg, 2);
+  EXPECT_EQ(prepared[3].JumpIfNot.offset, 4);
+}
+
+TEST(PreparedCodeTest, compareAndJumps) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createNoOpInstr();                  // 0
+  builder.createJumpIfLEIntInstr(1, 2, 1);    // 1 -> 4
+  builder.createNoOpInstr();                  // 3
+  builder.createJumpIfNotEqIntInstr(3, 4, -6);// 4 -> 0
+  builder.createRetVoidInstr();               // 6
+
+  PreparedCode code(instrs);
+  code.prepare();
+  const PreparedInstruction* prepared = code.begin();
+  EXPECT_EQ(prepared[1].opcode, Opcode::JumpIfLEInt);
+  EXPECT_EQ(prepared[1].JumpIfLEInt.lhs, 1);
+  EXPECT_EQ(prepared[1].JumpIfLEInt.rhs, 2);
+  EXPECT_EQ(prepared[1].JumpIfLEInt.offset, 4);
+  EXPECT_EQ(prepared[2].opcode, Opcode::JumpOffset);
+  EXPECT_EQ(prepared[4].JumpIfNotEqInt.lhs, 3);
+  EXPECT_EQ(prepared[4].JumpIfNotEqInt.rhs, 4);
+  EXPECT_EQ(prepared[4].JumpIfNotEqInt.offset, 0);
+}
+
+TEST(PreparedCodeTest, handlers) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createNoOpInstr();
+  builder.createRetVoidInstr();
+
+  // Use the addresses of the elements of an array as handlers
+  int fakeHandlers[std::size_t(Opcode::last_opcode)+1];
+  SmallVector<const void*, 8> handlers;
+  for (auto& handler : fakeHandlers)
+    handlers.push_back(&handler);
+
+  PreparedCode code(instrs);
+  code.prepare(handlers);
+  const PreparedInstruction* prepared = code.begin();
+  EXPECT_EQ(prepared[0].handler, handlers[std::size_t(Opcode::NoOp)]);
+  EXPECT_EQ(prepared[1].handler, handlers[std::size_t(Opcode::RetVoid)]);
+}
+
+//----------------------------------------------------------------------------//
+// Superinstructions tests
+//----------------------------------------------------------------------------//
+
+TEST(SuperinstructionsTest, getSuperinstruction) {
+  EXPECT_EQ(getSuperinstruction(Opcode::StoreSmallInt, Opcode::ModInt), 
+            Opcode::StoreSmallInt_ModInt);
+  EXPECT_EQ(getSuperinstruction(Opcode::AddInt, Opcode::Ret), 
+            Opcode::AddInt_Ret);
+  EXPECT_FALSE(getSuperinstruction(Opcode::ModInt, Opcode::StoreSmallInt));
+  EXPECT_FALSE(getSuperinstruction(Opcode::Ret, Opcode::AddInt));
+  EXPECT_TRUE(isSuperinstruction(Opcode::SubIntImm_CallFunc));
+  EXPECT_FALSE(isSuperinstruction(Opcode::SubIntImm));
+  EXPECT_FALSE(isSuperinstruction(Opcode::Call));
+}
+
+TEST(SuperinstructionsTest, fuse) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createStoreSmallIntInstr(0, 3);     // 0
+  builder.createStoreSmallIntInstr(1, 3);     // 1
+  builder.createModIntInstr(0, 0, 1);         // 2
+  builder.createStoreSmallIntInstr(1, 3);     // 3
+  builder.createEqIntInstr(0, 0, 1);          // 4
+  builder.createAddIntInstr(0, 0, 1);         // 5
+  builder.createRetInstr(0);                  // 6
+
+  EXPECT_EQ(fuseSuperinstructions(instrs), 3u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::StoreSmallInt);
+  EXPECT_EQ(instrs[1].opcode, Opcode::StoreSmallInt_ModInt);
+  EXPECT_EQ(instrs[1].StoreSmallInt_ModInt.dest, 1);
+  EXPECT_EQ(instrs[1].StoreSmallInt_ModInt.value, 3);
+  EXPECT_EQ(instrs[2].opcode, Opcode::ModInt);
+  EXPECT_EQ(instrs[3].opcode, Opcode::StoreSmallInt_EqInt);
+  EXPECT_EQ(instrs[4].opcode, Opcode::EqInt);
+  EXPECT_EQ(instrs[5].opcode, Opcode::AddInt_Ret);
+  EXPECT_EQ(instrs[5].AddInt_Ret.dest, 0);
+  EXPECT_EQ(instrs[5].AddInt_Ret.lhs, 0);
+  EXPECT_EQ(instrs[5].AddInt_Ret.rhs, 1);
+  EXPECT_EQ(instrs[6].opcode, Opcode::Ret);
+
+  // Fusing again doesn't do anything
+  EXPECT_EQ(fuseSuperinstructions(instrs), 0u);
+}
+
+//----------------------------------------------------------------------------//
+// BCAnalysis tests
+//----------------------------------------------------------------------------//
+
+TEST(BCAnalysisTest, registerEffects) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createAddIntInstr(0, 1, 2);
+  builder.createArrAppendRangeInstr(3, 4, 2);
+  builder.createCallBuiltinInstr(BuiltinKind::printInt, 5, 1);
+  builder.createRetInstr(0);
+
+  RegisterEffects add = getRegisterEffects(instrs[0]);
+  EXPECT_EQ(add.reads.count(), 2u);
+  EXPECT_TRUE(add.reads[1] && add.reads[2]);
+  EXPECT_EQ(add.writes.count(), 1u);
+  EXPECT_TRUE(add.writes[0]);
+  EXPECT_TRUE(add.clobbers.none());
+  EXPECT_EQ(getReadOperands(instrs[0]).size(), 2u);
+
+  // ArrAppendRange reads its array and the range of elements
+  RegisterEffects append = getRegisterEffects(instrs[1]);
+  EXPECT_EQ(append.reads.count(), 3u);
+  EXPECT_TRUE(append.reads[3] && append.reads[4] && append.reads[5]);
+  // The elements aren't operands that can be replaced
+  EXPECT_EQ(getReadOperands(instrs[1]).size(), 1u);
+
+  // Calls clobber every register after their base, and calls to
+  // builtins only read their arguments.
+  RegisterEffects call = getRegisterEffects(instrs[2]);
+  EXPECT_EQ(call.reads.count(), 1u);
+  EXPECT_TRUE(call.reads[6]);
+  EXPECT_TRUE(call.clobbers[6] && !call.clobbers[5]);
+  EXPECT_TRUE(call.clobbers[bc_limits::max_regaddr]);
+  EXPECT_TRUE(call.writes[1]);
+  EXPECT_TRUE(getReadOperands(instrs[2]).empty());
+
+  EXPECT_TRUE(isTerminator(instrs[3]));
+  EXPECT_FALSE(isTerminator(instrs[0]));
+}
+
+TEST(BCAnalysisTest, controlFlow) {
+  InstructionVector instrs;
+  BCBuilder builder(instrs);
+  builder.createStoreSmallIntInstr(0, 0);       // 0
+  builder.createJumpIfNotLTIntInstr(0, 1, 2);   // 1, 2
+  builder.createAddIntImmInstr(0, 0, 1);        // 3
+  builder.createJumpInstr(-4);                  // 4
+  builder.createRetInstr(0);                    // 5
+
+  EXPECT_FALSE(getJumpSlot(instrs, 0).hasValue());
+  EXPECT_EQ(getJumpSlot(instrs, 1), std::size_t(2));
+  EXPECT_EQ(getJumpSlot(instrs, 4), std::size_t(4));
+  EXPECT_EQ(getJumpTarget(instrs, 2), 5u);
+  EXPECT_EQ(getJumpTarget(instrs, 4), 1u);
+  EXPECT_TRUE(canJumpTo(4, 0));
+  EXPECT_FALSE(canJumpTo(0, 1 << 16));
+
+  SmallVector<std::size_t, 2> succs;
+  getSuccessors(instrs, 1, succs);
+  EXPECT_EQ(succs, (SmallVector<std::size_t, 2>{5, 3}));
+  succs.clear();
+  getSuccessors(instrs, 4, succs);
+  EXPECT_EQ(succs, (SmallVector<std::size_t, 2>{1}));
+  succs.clear();
+  getSuccessors(instrs, 5, succs);
+  EXPECT_TRUE(succs.empty());
+
+  std::vector<bool> starts = getInstructionStarts(instrs);
+  EXPECT_EQ(starts, std::vector<bool>({true, true, false, true, true, true}));
+  std::vector<bool> targets = getJumpTargets(instrs);
+  EXPECT_EQ(targets, 
+            std::vector<bool>({false, true, false, false, false, true, false}));
+
+  // Register 0 is live in the whole loop, register 1 is only read by the
+  // comparison.
+  LivenessAnalysis liveness(instrs);
+  EXPECT_FALSE(liveness.getLiveIn(0)[0]);
+  EXPECT_TRUE(liveness.getLiveIn(0)[1]);
+  EXPECT_TRUE(liveness.getLiveOut(0)[0]);
+  EXPECT_TRUE(liveness.getLiveOut(3)[0]);
+  EXPECT_TRUE(liveness.getLiveOut(3)[1]);
+  EXPECT_TRUE(liveness.getLiveIn(5)[0]);
+  EXPECT_FALSE(liveness.getLiveIn(5)[1]);
+  EXPECT_TRUE(liveness.getLiveOut(5).none());
+}
+
+//----------------------------------------------------------------------------//
+// BCPasses tests
+//----------------------------------------------------------------------------//
+
+TEST(BCPassesTest, removeInstructions) {
+  SourceRange aRange(SourceLoc(FileID(), 42));
+  SourceRange bRange(SourceLoc(FileID(), 84));
+
+  BCFunction fn(0);
+  fn.createDebugInfo();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createJumpIfInstr(0, 3);                        // 0
+  auto a = builder.createDivIntInstr(1, 1, 2);            // 1
+  builder.createNoOpInstr();                              // 2
+  auto b = builder.createModIntInstr(1, 1, 2);            // 3
+  builder.createJumpIfNotLEIntInstr(1, 2, -5);            // 4, 5
+  builder.createRetInstr(1);                              // 6
+  builder.addDebugRange(a, aRange);
+  builder.addDebugRange(b, bRange);
+
+  // Remove the DivInt, the NoOp and the ModInt. The jump to the ModInt
+  // now targets the compare and jump, and the jump to the DivInt targets
+  // the compare and jump too.
+  std::vector<bool> removed = {false, true, true, true, false, false, false};
+  EXPECT_EQ(removeInstructions(fn, removed), 3u);
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 4u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::JumpIf);
+  EXPECT_EQ(instrs[0].JumpIf.offset, 0);
+  EXPECT_EQ(instrs[1].opcode, Opcode::JumpIfNotLEInt);
+  EXPECT_EQ(instrs[2].JumpOffset.offset, -2);
+  EXPECT_EQ(instrs[3].opcode, Opcode::Ret);
+  // The SourceRanges of the removed instructions are removed
+  EXPECT_TRUE(fn.getDebugInfo()->getRanges().empty());
+}
+
+TEST(BCPassesTest, removeInstructionsDebugInfo) {
+  SourceRange aRange(SourceLoc(FileID(), 42));
+  SourceRange bRange(SourceLoc(FileID(), 84));
+
+  BCFunction fn(0);
+  fn.createDebugInfo();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createNoOpInstr();                              // 0
+  auto a = builder.createDivIntInstr(1, 1, 2);            // 1
+  builder.createNoOpInstr();                              // 2
+  auto b = builder.createModIntInstr(1, 1, 2);            // 3
+  builder.createRetInstr(1);                              // 4
+  builder.addDebugRange(a, aRange);
+  builder.addDebugRange(b, bRange);
+
+  std::vector<bool> removed = {true, false, true, false, false};
+  EXPECT_EQ(removeInstructions(fn, removed), 2u);
+  // The SourceRanges follow their instructions
+  DebugInfo* debugInfo = fn.getDebugInfo();
+  EXPECT_EQ(debugInfo->getRanges().size(), 2u);
+  EXPECT_EQ(debugInfo->getSourceRange(0), aRange);
+  EXPECT_EQ(debugInfo->getSourceRange(1), bRange);
+
+  // Removing nothing doesn't change anything
+  EXPECT_EQ(removeInstructions(fn, std::vector<bool>(3)), 0u);
+  EXPECT_EQ(fn.numInstructions(), 3u);
+}
+
+TEST(BCPassesTest, removeUnreachableCode) {
+  BCFunction fn(0);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createJumpIfNotInstr(0, 2);         // 0
+  builder.createRetInstr(1);                  // 1
+  builder.createJumpInstr(1);                 // 2: unreachable
+  builder.createRetInstr(2);                  // 3
+  builder.createRetInstr(3);                  // 4: unreachable
+  builder.createCallVoidFuncInstr(0, 4);      // 5: unreachable
+
+  EXPECT_TRUE(removeUnreachableCode(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 3u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::JumpIfNot);
+  EXPECT_EQ(instrs[0].JumpIfNot.offset, 1);
+  EXPECT_EQ(instrs[1].Ret.reg, 1);
+  EXPECT_EQ(instrs[2].Ret.reg, 2);
+
+  EXPECT_FALSE(removeUnreachableCode(fn));
+}
+
+TEST(BCPassesTest, threadJumps) {
+  BCFunction fn(0);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createJumpIfInstr(0, 2);            // 0: jumps to 3, 6, then 7
+  builder.createJumpInstr(3);                 // 1: jumps to 5
+  builder.createStoreSmallIntInstr(1, 0);     // 2
+  builder.createJumpInstr(2);                 // 3: jumps to 6
+  builder.createStoreSmallIntInstr(1, 1);     // 4
+  builder.createRetInstr(1);                  // 5
+  builder.createJumpInstr(0);                 // 6: jumps to 7
+  builder.createJumpInstr(-1);                // 7: infinite loop
+
+  EXPECT_TRUE(threadJumps(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  // The jumps to the next instruction are removed, and the jumps to a 
+  // return are replaced with the return.
+  ASSERT_EQ(instrs.size(), 7u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::JumpIf);
+  EXPECT_EQ(getJumpTarget(instrs, 0), 6u);
+  EXPECT_EQ(instrs[1].opcode, Opcode::Ret);
+  EXPECT_EQ(instrs[1].Ret.reg, 1);
+  EXPECT_EQ(instrs[3].opcode, Opcode::Jump);
+  EXPECT_EQ(getJumpTarget(instrs, 3), 6u);
+  EXPECT_EQ(instrs[6].opcode, Opcode::Jump);
+  EXPECT_EQ(getJumpTarget(instrs, 6), 6u);
+
+  EXPECT_FALSE(threadJumps(fn));
+}
+
+TEST(BCPassesTest, eliminateRedundantCopies) {
+  BCFunction fn(0);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createCopyInstr(2, 0);                            // 0: dead
+  builder.createCopyInstr(3, 1);                            // 1
+  builder.createCopyInstr(2, 3);                            // 2: propagated
+  builder.createAddIntInstr(4, 2, 3);                       // 3
+  builder.createCopyInstr(6, 4);                            // 4: argument
+  builder.createCallVoidBuiltinInstr(BuiltinKind::printInt, 5); // 5
+  builder.createJumpIfNotInstr(0, 1);                       // 6
+  builder.createCopyInstr(3, 4);                            // 7
+  builder.createRetInstr(3);                                // 8
+
+  EXPECT_TRUE(eliminateRedundantCopies(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 7u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::Copy);
+  EXPECT_EQ(instrs[0].Copy.dest, 3);
+  EXPECT_EQ(instrs[0].Copy.src, 1);
+  // The copies of register 1 are read directly
+  EXPECT_EQ(instrs[1].opcode, Opcode::AddInt);
+  EXPECT_EQ(instrs[1].AddInt.lhs, 1);
+  EXPECT_EQ(instrs[1].AddInt.rhs, 1);
+  // The arguments of calls must be copied
+  EXPECT_EQ(instrs[2].opcode, Opcode::Copy);
+  EXPECT_EQ(instrs[2].Copy.dest, 6);
+  EXPECT_EQ(instrs[4].opcode, Opcode::JumpIfNot);
+  EXPECT_EQ(instrs[4].JumpIfNot.offset, 1);
+  // Register 3 is read after the jump, so the copy to it is kept.
+  EXPECT_EQ(instrs[5].opcode, Opcode::Copy);
+  EXPECT_EQ(instrs[6].Ret.reg, 3);
+
+  EXPECT_FALSE(eliminateRedundantCopies(fn));
+}
+
+TEST(BCPassesTest, reduceStrength) {
+  BCFunction fn(0);
+  fn.setNumParams(1);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(1, 1);     // 0: removed
+  builder.createJumpIfInstr(0, 1);            // 1: jumps to 3
+  builder.createStoreSmallIntInstr(0, 3);     // 2
+  builder.createPowIntInstr(2, 0, 1);         // 3: r0**1
+  builder.createStoreSmallIntInstr(3, 8);     // 4: removed
+  builder.createMulIntInstr(2, 3, 2);         // 5: 8*r2
+  builder.createMulIntImmInstr(2, 2, 1);      // 6: removed
+  builder.createRetInstr(2);                  // 7
+
+  EXPECT_TRUE(reduceStrength(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 6u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::JumpIf);
+  EXPECT_EQ(getJumpTarget(instrs, 0), 2u);
+  EXPECT_EQ(instrs[1].opcode, Opcode::StoreSmallInt);
+  // Register 1 only ever contains 1, so the power is computed with
+  // conversions.
+  EXPECT_EQ(instrs[2].opcode, Opcode::IntToDouble);
+  EXPECT_EQ(instrs[2].IntToDouble.dest, 2);
+  EXPECT_EQ(instrs[2].IntToDouble.src, 0);
+  EXPECT_EQ(instrs[3].opcode, Opcode::DoubleToInt);
+  EXPECT_EQ(instrs[4].opcode, Opcode::MulIntImm);
+  EXPECT_EQ(instrs[4].MulIntImm.dest, 2);
+  EXPECT_EQ(instrs[4].MulIntImm.src, 2);
+  EXPECT_EQ(instrs[4].MulIntImm.imm, 8);
+  EXPECT_EQ(instrs[5].opcode, Opcode::Ret);
+
+  EXPECT_FALSE(reduceStrength(fn));
+}
+
+TEST(BCPassesTest, reduceStrengthImmediateRange) {
+  BCFunction fn(0);
+  fn.setNumParams(1);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(1, -127);  // 0: removed
+  builder.createMulIntInstr(2, 0, 1);         // 1: r0*-127
+  builder.createStoreSmallIntInstr(1, -128);  // 2
+  builder.createMulIntInstr(2, 2, 1);         // 3: r2*-128 is kept
+  builder.createRetInstr(2);                  // 4
+
+  EXPECT_TRUE(reduceStrength(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 4u);
+  EXPECT_EQ(instrs[0].opcode, Opcode::MulIntImm);
+  EXPECT_EQ(instrs[0].MulIntImm.imm, -127);
+  // -128 doesn't fit in an immediate operand.
+  EXPECT_EQ(instrs[1].opcode, Opcode::StoreSmallInt);
+  EXPECT_EQ(instrs[2].opcode, Opcode::MulInt);
+
+  EXPECT_FALSE(reduceStrength(fn));
+}
+
+TEST(BCPassesTest, reduceStrengthKnownConstants) {
+  BCFunction fn(0);
+  fn.setNumParams(1);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(1, 3);     // 0
+  builder.createPowIntInstr(2, 0, 1);         // 1: r0**3 is kept
+  builder.createStoreSmallIntInstr(1, 2);     // 2: removed
+  builder.createMulIntInstr(2, 2, 1);         // 3: r2*2
+  builder.createMulIntInstr(2, 2, 0);         // 4: r0 isn't known
+  builder.createRetInstr(2);                  // 5
+
+  EXPECT_TRUE(reduceStrength(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 5u);
+  EXPECT_EQ(instrs[1].opcode, Opcode::PowInt);
+  EXPECT_EQ(instrs[2].opcode, Opcode::AddInt);
+  EXPECT_EQ(instrs[2].AddInt.lhs, 2);
+  EXPECT_EQ(instrs[2].AddInt.rhs, 2);
+  EXPECT_EQ(instrs[3].opcode, Opcode::MulInt);
+
+  EXPECT_FALSE(reduceStrength(fn));
+}
+
+TEST(BCPassesTest, hoistLoopInvariantCode) {
+  BCFunction fn(0);
+  fn.setNumParams(2);
+  fn.setNumRegisters(5);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(2, 0);       // 0
+  builder.createStrLenInstr(3, 0);              // 1: header, hoisted
+  builder.createJumpIfNotLTIntInstr(2, 3, 5);   // 2, 3: jumps to 9
+  builder.createStoreSmallIntInstr(4, 1);       // 4: hoisted to r5
+  builder.createAddIntInstr(2, 2, 4);           // 5
+  builder.createArrSizeInstr(4, 1);             // 6: hoisted
+  builder.createAddIntInstr(2, 2, 4);           // 7
+  builder.createJumpInstr(-8);                  // 8: jumps to 1
+  builder.createRetInstr(2);                    // 9
+
+  EXPECT_TRUE(hoistLoopInvariantCode(fn));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 10u);
+  EXPECT_EQ(instrs[1].opcode, Opcode::StrLen);
+  // Register 4 is also written by the ArrSize, so the constant is moved
+  // to a new register.
+  EXPECT_EQ(instrs[2].opcode, Opcode::StoreSmallInt);
+  EXPECT_EQ(instrs[2].StoreSmallInt.dest, 5);
+  EXPECT_EQ(instrs[3].opcode, Opcode::ArrSize);
+  EXPECT_EQ(instrs[3].ArrSize.dest, 4);
+  EXPECT_EQ(instrs[4].opcode, Opcode::JumpIfNotLTInt);
+  EXPECT_EQ(getJumpTarget(instrs, 5), 9u);
+  EXPECT_EQ(instrs[6].AddInt.rhs, 5);
+  EXPECT_EQ(instrs[7].AddInt.rhs, 4);
+  // The loop jumps back to its header, after the code moved.
+  EXPECT_EQ(getJumpTarget(instrs, 8), 4u);
+  EXPECT_EQ(fn.getNumRegisters(), 6u);
+
+  EXPECT_FALSE(hoistLoopInvariantCode(fn));
+}
+
+TEST(BCPassesTest, hoistLoopInvariantCodeSideEffects) {
+  BCFunction fn(0);
+  fn.setNumParams(1);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(1, 0);       // 0
+  builder.createArrSizeInstr(2, 0);             // 1: header
+  builder.createJumpIfNotLTIntInstr(1, 2, 3);   // 2, 3: jumps to 7
+  builder.createArrAppendInstr(0, 1);           // 4: changes the size
+  builder.createAddIntImmInstr(1, 1, 1);        // 5
+  builder.createJumpInstr(-6);                  // 6: jumps to 1
+  builder.createRetInstr(1);                    // 7
+  EXPECT_FALSE(hoistLoopInvariantCode(fn));
+
+  // Only the builtins that aren't pure can modify their arguments.
+  EXPECT_TRUE(isPure(BuiltinKind::arrSize));
+  EXPECT_TRUE(isPure(BuiltinKind::strConcat));
+  EXPECT_FALSE(isPure(BuiltinKind::arrPop));
+  EXPECT_FALSE(isPure(BuiltinKind::printInt));
+}
+
+namespace {
+  class RegisterAllocationTest : public BCModuleTest {};
+}
+
+TEST_F(RegisterAllocationTest, linearScan) {
+  BCFunction& callee = theModule.createFunction();
+  callee.setNumParams(2);
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(3, 1);       // 0
+  builder.createStoreSmallIntInstr(5, 2);       // 1: live across the call
+  builder.createCopyInstr(8, 3);                // 2: last use of 3
+  builder.createStoreSmallIntInstr(9, 4);       // 3
+  builder.createCallFuncInstr(callee.getID(), 7, 6); // 4, 5
+  builder.createAddIntInstr(6, 6, 5);           // 6
+  builder.createRetInstr(6);                    // 7
+  fn.setNumRegisters(10);
+
+  EXPECT_TRUE(allocateRegisters(fn, theModule));
+  EXPECT_EQ(fn.getNumRegisters(), 3u);
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 7u);
+  // The register live across the call is before its base, and the value
+  // copied to the first argument is placed in the argument's register.
+  EXPECT_EQ(instrs[0].StoreSmallInt.dest, 1);
+  EXPECT_EQ(instrs[1].StoreSmallInt.dest, 0);
+  EXPECT_EQ(instrs[2].StoreSmallInt.dest, 2);
+  EXPECT_EQ(instrs[3].opcode, Opcode::CallFunc);
+  EXPECT_EQ(instrs[3].CallFunc.base, 0);
+  EXPECT_EQ(instrs[3].CallFunc.dest, 1);
+  EXPECT_EQ(instrs[5].AddInt.dest, 0);
+  EXPECT_EQ(instrs[5].AddInt.lhs, 1);
+  EXPECT_EQ(instrs[5].AddInt.rhs, 0);
+  EXPECT_EQ(instrs[6].Ret.reg, 0);
+
+  EXPECT_FALSE(allocateRegisters(fn, theModule));
+}
+
+TEST_F(RegisterAllocationTest, params) {
+  BCFunction& fn = theModule.createFunction();
+  fn.setNumParams(2);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(4, 0);               // 0
+  builder.createCopyInstr(6, 1);                        // 1
+  builder.createCallVoidBuiltinInstr(BuiltinKind::printInt, 5); // 2
+  builder.createAddIntInstr(2, 0, 4);                   // 3
+  builder.createRetInstr(2);                            // 4
+  fn.setNumRegisters(7);
+
+  EXPECT_EQ(getNumArgs(BuiltinKind::printInt), 1u);
+  EXPECT_TRUE(allocateRegisters(fn, theModule));
+  EXPECT_EQ(fn.getNumRegisters(), 4u);
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 5u);
+  // The parameters stay in their registers, so the argument is copied.
+  EXPECT_EQ(instrs[0].StoreSmallInt.dest, 2);
+  EXPECT_EQ(instrs[1].Copy.dest, 3);
+  EXPECT_EQ(instrs[1].Copy.src, 1);
+  EXPECT_EQ(instrs[2].CallVoidBuiltin.base, 2);
+  EXPECT_EQ(instrs[3].AddInt.dest, 0);
+  EXPECT_EQ(instrs[3].AddInt.lhs, 0);
+  EXPECT_EQ(instrs[3].AddInt.rhs, 2);
+  EXPECT_EQ(instrs[4].Ret.reg, 0);
+}
+
+TEST_F(RegisterAllocationTest, indirectCalls) {
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createLoadBuiltinFuncInstr(4, BuiltinKind::printInt);
+  builder.createStoreSmallIntInstr(5, 0);
+  builder.createCallVoidInstr(4);
+  builder.createRetVoidInstr();
+  fn.setNumRegisters(6);
+
+  // The arguments of indirect calls aren't known
+  EXPECT_FALSE(allocateRegisters(fn, theModule));
+  EXPECT_EQ(fn.getNumRegisters(), 6u);
+}
+
+namespace {
+  class InliningTest : public BCModuleTest {};
+}
+
+TEST_F(InliningTest, inlineCalls) {
+  // abs(x): if x < 0 { return -x } return x
+  BCFunction& callee = theModule.createFunction();
+  callee.setNumParams(1);
+  SourceRange calleeRange(SourceLoc(FileID(), 42));
+  {
+    BCBuilder builder = callee.createBCBuilder();
+    builder.createStoreSmallIntInstr(1, 0);     // 0
+    builder.createJumpIfNotLTIntInstr(0, 1, 2); // 1, 2
+    builder.createNegIntInstr(1, 0);            // 3
+    builder.createRetInstr(1);                  // 4
+    builder.createRetInstr(0);                  // 5
+    callee.setNumRegisters(2);
+    callee.createDebugInfo().addSourceRange(3, calleeRange);
+  }
+
+  BCFunction& fn = theModule.createFunction();
+  SourceRange fnRange(SourceLoc(FileID(), 84));
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(3, -5);                   // 0
+  builder.createCallFuncInstr(callee.getID(), 2, 0);         // 1, 2
+  builder.createDivIntInstr(0, 0, 0);                        // 3
+  builder.createRetInstr(0);                                 // 4
+  fn.setNumRegisters(4);
+  DebugInfo& debugInfo = fn.createDebugInfo();
+  debugInfo.addSourceRange(1, fnRange);
+  debugInfo.addSourceRange(3, fnRange);
+
+  EXPECT_TRUE(inlineCalls(fn, theModule));
+  InstructionVector& instrs = fn.getInstructions();
+  ASSERT_EQ(instrs.size(), 11u);
+  // The registers of the callee are after the base of the call
+  EXPECT_EQ(fn.getNumRegisters(), 5u);
+  EXPECT_EQ(instrs[1].StoreSmallInt.dest, 4);
+  EXPECT_EQ(instrs[2].JumpIfNotLTInt.lhs, 3);
+  EXPECT_EQ(instrs[2].JumpIfNotLTInt.rhs, 4);
+  EXPECT_EQ(getJumpTarget(instrs, 3), 7u);
+  EXPECT_EQ(instrs[4].NegInt.dest, 4);
+  // The returns copy their value to the destination of the call and jump
+  // to the code that follows the call.
+  EXPECT_EQ(instrs[5].Copy.dest, 0);
+  EXPECT_EQ(instrs[5].Copy.src, 4);
+  EXPECT_EQ(getJumpTarget(instrs, 6), 9u);
+  EXPECT_EQ(instrs[7].Copy.dest, 0);
+  EXPECT_EQ(instrs[7].Copy.src, 3);
+  EXPECT_EQ(getJumpTarget(instrs, 8), 9u);
+  EXPECT_EQ(instrs[9].opcode, Opcode::DivInt);
+  // The debug information of both functions is kept
+  EXPECT_EQ(fn.getDebugInfo()->getRanges().size(), 2u);
+  EXPECT_EQ(fn.getDebugInfo()->getSourceRange(4), calleeRange);
+  EXPECT_EQ(fn.getDebugInfo()->getSourceRange(9), fnRange);
+
+  // fn doesn't call functions anymore, so its calls can be inlined, but
+  // the calls to functions that call functions (like this recursive
+  // function) can't.
+  BCFunction& caller = theModule.createFunction();
+  BCBuilder callerBuilder = caller.createBCBuilder();
+  callerBuilder.createCallVoidFuncInstr(fn.getID(), 0);
+  callerBuilder.createCallVoidFuncInstr(caller.getID(), 0);
+  callerBuilder.createRetVoidInstr();
+  caller.setNumRegisters(1);
+  EXPECT_TRUE(inlineCalls(caller, theModule));
+  EXPECT_EQ(caller.getNumRegisters(), 6u);
+  EXPECT_EQ(caller.numInstructions(), 13u);
+  EXPECT_EQ(caller.getInstructions()[11].opcode, Opcode::CallVoidFunc);
+  EXPECT_FALSE(inlineCalls(caller, theModule));
+}
+
+TEST_F(InliningTest, largeFunctions) {
+  BCFunction& callee = theModule.createFunction();
+  BCBuilder calleeBuilder = callee.createBCBuilder();
+  for (std::size_t k = 0; k < maxInlinedFunctionSize; ++k)
+    calleeBuilder.createStoreSmallIntInstr(0, 0);
+  calleeBuilder.createRetVoidInstr();
+  callee.setNumRegisters(1);
+
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createCallVoidFuncInstr(callee.getID(), 0);
+  builder.createRetVoidInstr();
+  fn.setNumRegisters(1);
+  EXPECT_FALSE(inlineCalls(fn, theModule));
+  EXPECT_EQ(fn.numInstructions(), 2u);
+}
+
+TEST(BCPassManagerTest, optLevels) {
+  EXPECT_EQ(BCPassManager().numPasses(), 0u);
+  EXPECT_EQ(BCPassManager(OptLevel::O0).numPasses(), 0u);
+  BCPassManager o1(OptLevel::O1);
+  EXPECT_NE(o1.numPasses(), 0u);
+
+  BCFunction fn(0);
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createCopyInstr(1, 0);
+  builder.createJumpInstr(1);
+  builder.createRetInstr(0);
+  builder.createRetInstr(1);
+  EXPECT_FALSE(BCPassManager(OptLevel::O0).run(fn));
+  EXPECT_EQ(fn.numInstructions(), 4u);
+  EXPECT_TRUE(o1.run(fn));
+  ASSERT_EQ(fn.numInstructions(), 1u);
+  EXPECT_EQ(fn.getInstructions()[0].opcode, Opcode::Ret);
+  EXPECT_EQ(fn.getInstructions()[0].Ret.reg, 0);
+  EXPECT_FALSE(o1.run(fn));
+
+  BCPassManager custom;
+  custom.addPass("thread-jumps", threadJumps);
+  ASSERT_EQ(custom.numPasses(), 1u);
+  EXPECT_EQ(custom.getPassName(0), "thread-jumps");
+}
+
 //----------------------------------------------------------------------------//
 // DebugInfo tests
 //----------------------------------------------------------------------------//
@@ -478,5 +1265,13 @@ TEST(DebugInfoTest, debugInfoTest) {
       return result.getValue() == expected;
     return false;
   };
+  EXPECT_TRUE(check(aIdx, aRange));
+  EXPECT_TRUE(check(bIdx, bRange));
+  EXPECT_TRUE(check(cIdx, cRange));
+  // Instructions without debug info, including ones that come after the 
+  // last instruction with debug info.
+  EXPECT_FALSE(dbg.getSourceRange(0).hasValue());
+  EXPECT_FALSE(dbg.getSourceRange(44).hasValue());
+  EXPECT_FALSE(dbg.getSourceRange(cIdx+1).hasValue());
 }
 
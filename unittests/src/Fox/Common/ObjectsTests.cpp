@@ -7,20 +7,169 @@
 
 #include "gtest/gtest.h"
 #include "Fox/Common/Objects.hpp"
+#include "Fox/Common/UTF8.hpp"
+#include <memory>
+#include <string>
+#include <vector>
 
 using namespace fox;
 
 TEST(ObjectTest, RTTI) {
-  StringObject object;
-  EXPECT_EQ(object.getKind(), ObjectKind::StringObject);
-  EXPECT_TRUE(StringObject::classof(&object));
+  alignas(StringObject) char mem[sizeof(StringObject)];
+  StringObject* object = StringObject::create(mem, "", 0);
+  EXPECT_EQ(object->getKind(), ObjectKind::StringObject);
+  EXPECT_TRUE(StringObject::classof(object));
 }
 
 TEST(ObjectTest, stringObject) {
   static constexpr char fooStr[] = "Foo is better than Bar!";
-  StringObject emptyObj;
-  StringObject fooObj(fooStr);
+  constexpr std::size_t fooSize = sizeof(fooStr)-1;
+  alignas(StringObject) char emptyMem[sizeof(StringObject)];
+  alignas(StringObject) char fooMem[64];
+  ASSERT_LE(StringObject::totalSize(fooSize, fooSize), sizeof(fooMem));
+  StringObject* emptyObj = StringObject::create(emptyMem, "", 0);
+  StringObject* fooObj = StringObject::create(fooMem, fooStr, fooSize);
 
-  EXPECT_EQ(emptyObj.str(), "");
-  EXPECT_EQ(fooObj.str(), fooStr);
-}
\ No newline at end of file
+  EXPECT_EQ(emptyObj->str(), "");
+  EXPECT_EQ(emptyObj->length(), 0u);
+  EXPECT_EQ(fooObj->str(), fooStr);
+  EXPECT_EQ(fooObj->numBytes(), fooSize);
+  EXPECT_TRUE(fooObj->isASCII());
+  EXPECT_EQ(fooObj->getChar(4), FoxChar('i'));
+  EXPECT_EQ(fooObj->getAllocatedSize(), 
+            StringObject::totalSize(fooSize, fooSize));
+}
+
+TEST(ObjectTest, stringObjectConcat) {
+  alignas(StringObject) char mem[64];
+  ASSERT_LE(StringObject::totalSize(8, 7), sizeof(mem));
+  StringObject* obj = StringObject::create(mem, "Foo", "Bär!", 7);
+  EXPECT_EQ(obj->str(), "FooBär!");
+  EXPECT_EQ(obj->numBytes(), 8u);
+  EXPECT_EQ(obj->length(), 7u);
+  EXPECT_FALSE(obj->isASCII());
+  EXPECT_EQ(obj->getChar(4), FoxChar(0xE4));
+  EXPECT_EQ(obj->getChar(6), FoxChar('!'));
+}
+
+TEST(ObjectTest, stringObjectIndex) {
+  // A string long enough to have an index, with characters of 1, 2 and 3 
+  // bytes.
+  std::vector<FoxChar> chars;
+  std::string str;
+  for (std::size_t k = 0; k < 5*StringObject::indexStride + 3; ++k) {
+    FoxChar ch = (k % 3 == 0) ? 'a' : ((k % 3 == 1) ? 0xE9 : 0x3042);
+    chars.push_back(ch);
+    appendFoxChar(ch, str);
+  }
+  EXPECT_EQ(countCodepoints(str), chars.size());
+  std::size_t size = StringObject::totalSize(str.size(), chars.size());
+  // The index is part of the allocated size.
+  EXPECT_GT(size, StringObject::totalSize(str.size(), str.size()));
+  std::unique_ptr<char[]> mem(new char[size]);
+  StringObject* obj = StringObject::create(mem.get(), str, chars.size());
+  EXPECT_EQ(obj->str(), str);
+  EXPECT_EQ(obj->length(), chars.size());
+  EXPECT_EQ(obj->getAllocatedSize(), size);
+  for (std::size_t k = 0; k < chars.size(); ++k)
+    EXPECT_EQ(obj->getChar(k), chars[k]) << "codepoint " << k;
+}
+
+TEST(ObjectTest, stringObjectRope) {
+  static constexpr char fooStr[] = "Foo";
+  static constexpr char barStr[] = u8"Bär!";
+  alignas(StringObject) char fooMem[64], barMem[64], ropeMem[64];
+  ASSERT_LE(StringObject::ropeSize(), sizeof(ropeMem));
+  StringObject* foo = StringObject::create(fooMem, fooStr, 3);
+  StringObject* bar = StringObject::create(barMem, barStr, 4);
+  StringObject* rope = StringObject::create(ropeMem, foo, bar);
+  EXPECT_TRUE(rope->isRope());
+  EXPECT_FALSE(rope->isFlat());
+  EXPECT_EQ(rope->numBytes(), 8u);
+  EXPECT_EQ(rope->length(), 7u);
+  EXPECT_EQ(rope->getAllocatedSize(), StringObject::ropeSize());
+  char bytes[8];
+  rope->copyBytes(bytes);
+  EXPECT_EQ(string_view(bytes, 8), u8"FooBär!");
+
+  // A clone of the rope is also a rope.
+  alignas(StringObject) char cloneMem[64];
+  StringObject* clone = rope->clone(cloneMem);
+  EXPECT_FALSE(clone->isFlat());
+  EXPECT_EQ(clone->getRopeOperands()[0], foo);
+  EXPECT_EQ(clone->getRopeOperands()[1], bar);
+
+  // Flatten the rope
+  alignas(StringObject) char flatMem[64];
+  ASSERT_LE(StringObject::totalSize(8, 7), sizeof(flatMem));
+  StringObject* flat = StringObject::create(flatMem, rope);
+  EXPECT_FALSE(flat->isRope());
+  EXPECT_EQ(flat->str(), u8"FooBär!");
+  rope->setFlattened(flat);
+  EXPECT_TRUE(rope->isFlat());
+  EXPECT_EQ(rope->getRopeOperands()[0], flat);
+  EXPECT_EQ(rope->getRopeOperands()[1], nullptr);
+  EXPECT_EQ(rope->str(), u8"FooBär!");
+  EXPECT_EQ(rope->getChar(4), FoxChar(0xE4));
+}
+
+TEST(ObjectTest, arrayObjectElemKinds) {
+  alignas(ArrayObject) char mem[sizeof(ArrayObject)];
+  // Every kind of element is stored in as few bytes as possible, and read
+  // back as it was written.
+  {
+    ArrayObject* arr = ArrayObject::create(mem, ArrayElemKind::Bool, 16);
+    EXPECT_FALSE(arr->containsReferences());
+    EXPECT_EQ(arr->getAllocatedSize(), sizeof(ArrayObject) + 16);
+    arr->append(FoxAny(std::uint64_t(1)));
+    arr->append(FoxAny(std::uint64_t(0)));
+    EXPECT_EQ((*arr)[0].raw, 1u);
+    EXPECT_EQ((*arr)[1].raw, 0u);
+    arr->set(1, FoxAny(true));
+    EXPECT_EQ(arr->back().raw, 1u);
+    arr->~ArrayObject();
+  }
+  {
+    ArrayObject* arr = ArrayObject::create(mem, ArrayElemKind::Char, 4);
+    EXPECT_EQ(arr->getAllocatedSize(), sizeof(ArrayObject) + 16);
+    arr->append(FoxAny(FoxChar(0x1F600)));
+    EXPECT_EQ(arr->front().raw, 0x1F600u);
+    arr->~ArrayObject();
+  }
+  {
+    ArrayObject* arr = ArrayObject::create(mem, ArrayElemKind::Double);
+    arr->append(FoxAny(FoxDouble(-0.5)));
+    EXPECT_EQ(arr->front().doubleVal, -0.5);
+    arr->~ArrayObject();
+  }
+  {
+    ArrayObject* arr = ArrayObject::create(mem, ArrayElemKind::Int);
+    EXPECT_EQ(arr->capacity(), 0u);
+    for (FoxInt k = 0; k < 100; ++k)
+      arr->append(FoxAny(-k));
+    EXPECT_GE(arr->capacity(), 100u);
+    EXPECT_EQ(arr->size(), 100u);
+    EXPECT_EQ(arr->getElements<FoxInt>()[42], -42);
+    arr->pop();
+    EXPECT_EQ(arr->back().intVal, -98);
+    // Moving the array moves its elements.
+    alignas(ArrayObject) char otherMem[sizeof(ArrayObject)];
+    ArrayObject* other = new(otherMem) ArrayObject(std::move(*arr));
+    EXPECT_EQ(arr->size(), 0u);
+    EXPECT_EQ(other->size(), 99u);
+    EXPECT_EQ((*other)[7].intVal, -7);
+    // Copying the array copies its elements.
+    alignas(ArrayObject) char copyMem[sizeof(ArrayObject)];
+    ArrayObject* copy = ArrayObject::create(copyMem, other);
+    EXPECT_EQ(copy->size(), 99u);
+    EXPECT_EQ(copy->capacity(), 99u);
+    copy->set(7, FoxAny(FoxInt(7)));
+    EXPECT_EQ((*other)[7].intVal, -7);
+    EXPECT_EQ((*copy)[98].intVal, -98);
+    copy->~ArrayObject();
+    other->reset();
+    EXPECT_EQ(other->size(), 0u);
+    arr->~ArrayObject();
+    other->~ArrayObject();
+  }
+}
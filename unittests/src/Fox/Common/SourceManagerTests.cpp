@@ -182,4 +182,12 @@ TEST(SourceManagerTest, CompleteRangeToString) {
   EXPECT_EQ(cr_c.to_string(/*printFileName*/ false), "1:6-1:6");
   EXPECT_EQ(cr_c.to_string(/*printFileName*/ true), testFilePath + ":1:6-1:6");
 
-}
\ No newline at end of file
+}
+
+TEST(SourceManagerTest, InvalidUTF8) {
+  std::string path = test::getPath("sourcemanager/invalid_utf8.txt");
+  SourceManager srcMgr;
+  auto result = srcMgr.readFile(path);
+  EXPECT_FALSE(result.first);
+  EXPECT_EQ(result.second, SourceManager::ReadFileResult::InvalidEncoding);
+}
@@ -0,0 +1,111 @@
+//----------------------------------------------------------------------------//
+// Part of the Fox project, licensed under the MIT license.
+// See LICENSE.txt in the project root for license information.     
+// File : UTF8Tests.cpp                      
+// Author : Pierre van Houtryve                
+//----------------------------------------------------------------------------//
+//  (Unit) Tests for the UTF-8 utilities, compared to utfcpp.
+//----------------------------------------------------------------------------//
+
+#include "gtest/gtest.h"
+#include "Fox/Common/UTF8.hpp"
+#include "utfcpp/utf8.hpp"
+#include <random>
+#include <string>
+
+using namespace fox;
+
+namespace {
+  /// Creates a string of \p numChars codepoints of 1 to 4 bytes.
+  std::string createMixedString(std::size_t numChars) {
+    static constexpr FoxChar chars[] = {'a', 0xE9, 'b', 0x3042, 0x1F98A, 'c'};
+    std::string str;
+    for (std::size_t k = 0; k < numChars; ++k)
+      appendFoxChar(chars[k % 6], str);
+    return str;
+  }
+}
+
+TEST(UTF8Test, countCodepoints) {
+  EXPECT_EQ(countCodepoints(""), 0u);
+  EXPECT_EQ(countCodepoints("Foo"), 3u);
+  EXPECT_EQ(countCodepoints("おはよう。"), 5u);
+  // Strings of every size around the size of the blocks
+  for (std::size_t k = 0; k < 200; ++k) {
+    std::string str = createMixedString(k);
+    EXPECT_EQ(countCodepoints(str), k);
+    std::string ascii(k, 'x');
+    EXPECT_EQ(countCodepoints(ascii), k);
+  }
+  // Large enough for the 8-bit counters to be added up several times
+  std::string large = createMixedString(100000);
+  EXPECT_EQ(countCodepoints(large), 100000u);
+}
+
+TEST(UTF8Test, getCodepointOffset) {
+  EXPECT_EQ(getCodepointOffset("", 0), 0u);
+  EXPECT_EQ(getCodepointOffset("", 5), 0u);
+  EXPECT_EQ(getCodepointOffset("Foo", 2), 2u);
+  EXPECT_EQ(getCodepointOffset("Foo", 3), 3u);
+  EXPECT_EQ(getCodepointOffset("おはよう。", 2), 6u);
+  std::string str = createMixedString(300);
+  const char* it = str.data();
+  const char* end = it + str.size();
+  for (std::size_t k = 0; k < 300; ++k) {
+    EXPECT_EQ(getCodepointOffset(str, k), std::size_t(it - str.data()))
+      << "codepoint " << k;
+    utf8::next(it, end);
+  }
+  EXPECT_EQ(getCodepointOffset(str, 300), str.size());
+  EXPECT_EQ(getCodepointOffset(str, 1000), str.size());
+}
+
+TEST(UTF8Test, isValidUTF8) {
+  EXPECT_TRUE(isValidUTF8(""));
+  EXPECT_TRUE(isValidUTF8("Foo"));
+  EXPECT_TRUE(isValidUTF8("おはよう。"));
+  EXPECT_TRUE(isValidUTF8(createMixedString(1000)));
+  // Invalid sequences, with ASCII padding so they are found by the SIMD 
+  // loops and by the scalar loops.
+  const char* invalid[] = {
+    "\x80",             // Lone continuation byte
+    "\xC3",             // Truncated sequence
+    "\xE3\x81",         // Truncated sequence
+    "\xC0\xAF",         // Overlong encoding of '/'
+    "\xE0\x80\xAF",     // Overlong encoding of '/'
+    "\xED\xA0\x80",     // Surrogate (U+D800)
+    "\xF4\x90\x80\x80", // U+110000
+    "\xF8\x88\x80\x80", // 5-byte sequence
+    "\xC3\x28",         // Invalid continuation byte
+  };
+  for (const char* seq : invalid) {
+    for (std::size_t padding : {0, 5, 16, 31, 32, 70}) {
+      std::string str = std::string(padding, 'x') + seq;
+      EXPECT_FALSE(isValidUTF8(str)) << "padding " << padding;
+      EXPECT_FALSE(utf8::is_valid(str.begin(), str.end()));
+      str += std::string(padding, 'y');
+      EXPECT_FALSE(isValidUTF8(str)) << "padding " << padding;
+    }
+  }
+  // The largest valid codepoints
+  EXPECT_TRUE(isValidUTF8("\xF4\x8F\xBF\xBF"));
+  EXPECT_TRUE(isValidUTF8("\xEF\xBF\xBF"));
+}
+
+TEST(UTF8Test, isValidUTF8MatchesUtfcpp) {
+  // Corrupt valid strings, and check that the result is the same as utfcpp.
+  std::mt19937 rng(42);
+  for (int k = 0; k < 5000; ++k) {
+    std::string str = createMixedString(rng() % 80);
+    if (!str.empty()) {
+      std::size_t pos = rng() % str.size();
+      switch (rng() % 3) {
+        case 0: str[pos] = char(rng()); break;
+        case 1: str.erase(pos, 1); break;
+        case 2: str.insert(pos, 1, char(0x80 | (rng() & 0x7F))); break;
+      }
+    }
+    EXPECT_EQ(isValidUTF8(str), utf8::is_valid(str.begin(), str.end()))
+      << "iteration " << k;
+  }
+}
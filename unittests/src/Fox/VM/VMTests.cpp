@@ -11,12 +11,20 @@
 #include "Fox/BC/Instruction.hpp"
 #include "Fox/BC/BCBuilder.hpp"
 #include "Fox/BC/BCModule.hpp"
+#include "Fox/BC/DebugInfo.hpp"
+#include "Fox/BC/Superinstructions.hpp"
+#include "Fox/VM/JIT.hpp"
+#include "Fox/VM/ObjectAllocator.hpp"
+#include "Fox/VM/OpcodePairProfile.hpp"
 #include "Fox/VM/VM.hpp"
 #include "Fox/Common/DiagnosticEngine.hpp"
+#include "Fox/Common/Errors.hpp"
 #include "Fox/Common/FoxTypes.hpp"
 #include "Fox/Common/Objects.hpp"
 #include "Fox/Common/SourceManager.hpp"
+#include "Fox/Common/UTF8.hpp"
 #include <sstream>
+#include <string>
 
 using namespace fox;
 
@@ -97,6 +105,30 @@ TEST_F(VMTest, IntArithmetic) {
   EXPECT_EQ(getReg(10), 16384)    << "Bad NegInt";
 }
 
+TEST_F(VMTest, IntImmArithmetic) {
+  FoxInt r0 = 1000;
+  // r1 = r0 + 127 --> 1127
+  builder.createAddIntImmInstr(1, 0, 127);
+  // r2 = r0 + -127 --> 873
+  builder.createAddIntImmInstr(2, 0, -127);
+  // r3 = r0 - 5 --> 995
+  builder.createSubIntImmInstr(3, 0, 5);
+  // r4 = r0 * -3 --> -3000
+  builder.createMulIntImmInstr(4, 0, -3);
+  builder.createRetVoidInstr();
+  // Prepare the VM & Load the code
+  VM vm(theModule);
+  auto regs = vm.getRegisterStack();
+  regs[0].intVal = r0;
+  // Run the code
+  vm.run(instrs);
+  // Check the computed values
+  EXPECT_EQ(regs[1].intVal, 1127)   << "Bad AddIntImm";
+  EXPECT_EQ(regs[2].intVal, 873)    << "Bad AddIntImm";
+  EXPECT_EQ(regs[3].intVal, 995)    << "Bad SubIntImm";
+  EXPECT_EQ(regs[4].intVal, -3000)  << "Bad MulIntImm";
+}
+
 TEST_F(VMTest, DoubleArithmetic) {
   FoxDouble r0 = -3.14;
   FoxDouble r1 = 3.333333333333;
@@ -331,6 +363,136 @@ TEST_F(VMTest, JumpIfNot) {
   EXPECT_EQ(vm.getPC(), instrs.begin()+3u) << "Bad JumpIfNot";
 }
 
+TEST_F(VMTest, CompareAndJumps) {
+  // Runs a compare and jump with operands lhs and rhs, and returns
+  // true if it jumped.
+  auto jumps = [&](Opcode op, FoxInt lhs, FoxInt rhs) {
+    InstructionVector code;
+    BCBuilder builder(code);
+    // 0 JumpIfXXX r0 r1
+    // 1 JumpOffset 1
+    // 2 RetVoid 
+    // 3 RetVoid    // PC ends up here if the jump is taken
+    switch (op) {
+      #define COMPARE_JUMP_INSTR(ID)\
+        case Opcode::ID: builder.create##ID##Instr(0, 1, 1); break;
+      #include "Fox/BC/Instruction.def"
+      default: fox_unreachable("not a compare and jump");
+    }
+    builder.createRetVoidInstr();
+    builder.createRetVoidInstr();
+    VM vm(theModule);
+    auto regs = vm.getRegisterStack();
+    regs[0].intVal = lhs;
+    regs[1].intVal = rhs;
+    vm.run(code);
+    return vm.getPC() == (code.begin()+3);
+  };
+  EXPECT_TRUE(jumps(Opcode::JumpIfEqInt, 3, 3));
+  EXPECT_FALSE(jumps(Opcode::JumpIfEqInt, 3, 4));
+  EXPECT_TRUE(jumps(Opcode::JumpIfNotEqInt, 3, 4));
+  EXPECT_FALSE(jumps(Opcode::JumpIfNotEqInt, 3, 3));
+  EXPECT_TRUE(jumps(Opcode::JumpIfLTInt, -4, 3));
+  EXPECT_FALSE(jumps(Opcode::JumpIfLTInt, 3, 3));
+  EXPECT_TRUE(jumps(Opcode::JumpIfNotLTInt, 3, 3));
+  EXPECT_FALSE(jumps(Opcode::JumpIfNotLTInt, -4, 3));
+  EXPECT_TRUE(jumps(Opcode::JumpIfLEInt, 3, 3));
+  EXPECT_FALSE(jumps(Opcode::JumpIfLEInt, 4, 3));
+  EXPECT_TRUE(jumps(Opcode::JumpIfNotLEInt, 4, 3));
+  EXPECT_FALSE(jumps(Opcode::JumpIfNotLEInt, 3, 3));
+}
+
+TEST_F(VMTest, Superinstructions) {
+  theModule.addIntConstant(30);
+  // Counts the multiples of 3 between 1 and 30
+  builder.createStoreSmallIntInstr(0, 1);       // 0  r0 = i = 1
+  builder.createStoreSmallIntInstr(1, 0);       // 1  r1 = count = 0
+  builder.createLoadIntKInstr(2, 0);            // 2  r2 = 30
+  builder.createJumpIfNotLEIntInstr(0, 2, 9);   // 3  if !(i <= 30) goto 14
+  builder.createStoreSmallIntInstr(3, 3);       // 5
+  builder.createModIntInstr(3, 0, 3);           // 6  r3 = i % 3
+  builder.createStoreSmallIntInstr(4, 0);       // 7
+  builder.createEqIntInstr(4, 3, 4);            // 8  r4 = (r3 == 0)
+  builder.createLAndInstr(4, 4, 4);             // 9
+  builder.createJumpIfNotInstr(4, 1);           // 10 if !r4 goto 12
+  builder.createAddIntImmInstr(1, 1, 1);        // 11 count++
+  builder.createAddIntImmInstr(0, 0, 1);        // 12 i++
+  builder.createJumpInstr(-11);                 // 13 goto 3
+  builder.createStoreSmallIntInstr(5, 10);      // 14
+  builder.createJumpIfNotEqIntInstr(1, 5, 1);   // 15 if count != 10 goto 18
+  builder.createStoreSmallIntInstr(6, 1);       // 17 r6 = 1
+  builder.createStoreSmallIntInstr(7, 0);       // 18
+  builder.createJumpIfNotLTIntInstr(7, 1, 1);   // 19 if !(0 < count) goto 22
+  builder.createStoreSmallIntInstr(8, 1);       // 21 r8 = 1
+  builder.createRetVoidInstr();                 // 22
+
+  EXPECT_EQ(fuseSuperinstructions(instrs), 7u);
+  EXPECT_EQ(instrs[2].opcode, Opcode::LoadIntK_JumpIfNotLEInt);
+  EXPECT_EQ(instrs[5].opcode, Opcode::StoreSmallInt_ModInt);
+  EXPECT_EQ(instrs[7].opcode, Opcode::StoreSmallInt_EqInt);
+  EXPECT_EQ(instrs[9].opcode, Opcode::LAnd_JumpIfNot);
+  EXPECT_EQ(instrs[12].opcode, Opcode::AddIntImm_Jump);
+  EXPECT_EQ(instrs[14].opcode, Opcode::StoreSmallInt_JumpIfNotEqInt);
+  EXPECT_EQ(instrs[18].opcode, Opcode::StoreSmallInt_JumpIfNotLTInt);
+
+  VM vm(theModule);
+  vm.run(instrs);
+  auto regs = vm.getRegisterStack();
+  EXPECT_EQ(regs[0].intVal, 31);
+  EXPECT_EQ(regs[1].intVal, 10);
+  EXPECT_EQ(regs[6].intVal, 1);
+  EXPECT_EQ(regs[8].intVal, 1);
+  EXPECT_EQ(vm.getPC(), instrs.begin()+22);
+}
+
+TEST_F(VMTest, OpcodePairProfile) {
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(0, 3);   // 0
+  builder.createStoreSmallIntInstr(1, 4);   // 1
+  builder.createAddIntInstr(2, 0, 1);       // 2
+  builder.createJumpInstr(1);               // 3 goto 5
+  builder.createNoOpInstr();                // 4
+  builder.createRetVoidInstr();             // 5
+
+  VM vm(theModule);
+  EXPECT_EQ(vm.getOpcodePairProfile(), nullptr);
+  // Run it once without profiling so the code is already prepared
+  // when profiling is enabled.
+  vm.run(fn);
+
+  OpcodePairProfile profile;
+  vm.setOpcodePairProfile(&profile);
+  EXPECT_EQ(vm.getOpcodePairProfile(), &profile);
+  vm.run(fn);
+  vm.setOpcodePairProfile(nullptr);
+  // This run should not be recorded.
+  vm.run(fn);
+
+  EXPECT_EQ(profile.getTotalCount(), 5u);
+  EXPECT_EQ(profile.getCount(Opcode::StoreSmallInt), 2u);
+  EXPECT_EQ(profile.getCount(Opcode::AddInt), 1u);
+  EXPECT_EQ(profile.getCount(Opcode::NoOp), 0u);
+  EXPECT_EQ(profile.getCount(Opcode::RetVoid), 1u);
+  EXPECT_EQ(profile.getCount(Opcode::StoreSmallInt, Opcode::StoreSmallInt), 
+            1u);
+  EXPECT_EQ(profile.getCount(Opcode::StoreSmallInt, Opcode::AddInt), 1u);
+  EXPECT_EQ(profile.getCount(Opcode::AddInt, Opcode::Jump), 1u);
+  // The RetVoid doesn't follow the Jump in the instruction buffer
+  EXPECT_EQ(profile.getCount(Opcode::Jump, Opcode::RetVoid), 0u);
+
+  std::stringstream ss;
+  profile.dump(ss, 2);
+  EXPECT_EQ(ss.str(), 
+    "Opcode Pair Profile:\n"
+    "  5 instructions dispatched\n"
+    "  StoreSmallInt + StoreSmallInt: 1 (20.00%)\n"
+    "  StoreSmallInt + AddInt: 1 (20.00%)\n");
+
+  profile.reset();
+  EXPECT_EQ(profile.getTotalCount(), 0u);
+  EXPECT_EQ(profile.getCount(Opcode::AddInt, Opcode::Jump), 0u);
+}
 
 TEST_F(VMTest, Casts) {
   FoxInt r0 = 42000;
@@ -472,6 +634,8 @@ TEST_F(VMTest, NewStringAndLoadStringK) {
   builder.createLoadStringKInstr(1, 1);
   // create a blank string in r2
   builder.createNewStringInstr(2);
+  // load k0 into r3
+  builder.createLoadStringKInstr(3, 0);
   builder.createRetVoidInstr();
 
   VM vm(theModule);
@@ -486,6 +650,8 @@ TEST_F(VMTest, NewStringAndLoadStringK) {
   EXPECT_EQ(getReg(0)->str(), foo);
   EXPECT_EQ(getReg(1)->str(), bar);
   EXPECT_EQ(getReg(2)->str(), "");
+  // Every load of a constant loads the same object
+  EXPECT_EQ(getReg(3), getReg(0));
 }
 
 TEST_F(VMTest, RetRetVoid) {
@@ -603,15 +769,227 @@ TEST_F(VMTest, call) {
   EXPECT_EQ(getReg(3), (r1*2) + (r2*2)) << "incorrect return value";
 }
 
+TEST_F(VMTest, directCalls) {
+  // f0 calls f1 with CallFunc, then f2 with CallVoidFunc
+  BCFunction& f0 = theModule.createFunction();
+  BCFunction& f1 = theModule.createFunction();
+  BCFunction& f2 = theModule.createFunction();
+  FoxInt r1 = 4;
+  FoxInt r2 = 8;
+  {
+    BCBuilder builder = f0.createBCBuilder();
+    // r0 = base (unused), args are in r1 and r2
+    // r3 will contain the return value.
+    builder.createStoreSmallIntInstr(1, r1);
+    builder.createStoreSmallIntInstr(2, r2);
+    builder.createCallFuncInstr(f1.getID(), 0, 3);
+    // r4 = base (unused), the arg is in r5.
+    builder.createCopyInstr(5, 3);
+    builder.createCallVoidFuncInstr(f2.getID(), 4);
+    builder.createRetVoidInstr();
+  }
+  // f1 multiplies its parameters by two and returns their sum.
+  {
+    BCBuilder builder = f1.createBCBuilder();
+    builder.createAddIntInstr(0, 0, 0);
+    builder.createAddIntInstr(1, 1, 1);
+    builder.createAddIntInstr(2, 0, 1);
+    builder.createRetInstr(2);
+  }
+  // f2 doubles its parameter
+  {
+    BCBuilder builder = f2.createBCBuilder();
+    builder.createAddIntInstr(0, 0, 0);
+    builder.createRetVoidInstr();
+  }
+  VM vm(theModule);
+  vm.run(f0);
+  EXPECT_TRUE(vm.isAlive());
+  auto getReg = [&](std::size_t idx) {
+    return vm.getRegisterStack()[idx].intVal;
+  };
+  EXPECT_EQ(getReg(1), r1*2)                  << "incorrect value for r1";
+  EXPECT_EQ(getReg(2), r2*2)                  << "incorrect value for r2";
+  EXPECT_EQ(getReg(3), (r1*2) + (r2*2))       << "incorrect return value";
+  EXPECT_EQ(getReg(5), ((r1*2) + (r2*2))*2)   << "incorrect value for r5";
+}
+
+TEST_F(VMTest, directBuiltinCalls) {
+  BCFunction& fn = theModule.createFunction();
+  {
+    BCBuilder builder = fn.createBCBuilder();
+    // r0 = base (unused), the arg is in r1.
+    // r2 will contain the return value.
+    builder.createStoreSmallIntInstr(1, 42);
+    builder.createCallBuiltinInstr(BuiltinKind::intToString, 0, 2);
+    // r3 = base (unused), the args are in r4 and r5.
+    builder.createNewValueArrayInstr(4, ArrayElemKind::Int, 0);
+    builder.createStoreSmallIntInstr(5, 7);
+    builder.createCallVoidBuiltinInstr(BuiltinKind::arrAppend, 3);
+    builder.createRetInstr(2);
+  }
+  VM vm(theModule);
+  VM::Register rtr = vm.run(fn);
+  EXPECT_TRUE(vm.isAlive());
+  StringObject* str = dyn_cast<StringObject>(rtr.object);
+  ASSERT_NE(str, nullptr);
+  EXPECT_EQ(str->str(), "42");
+  ArrayObject* arr = cast<ArrayObject>(vm.getRegisterStack()[4].object);
+  ASSERT_EQ(arr->size(), 1u);
+  EXPECT_EQ((*arr)[0].intVal, 7);
+}
+
+TEST_F(VMTest, builtinsWithDest) {
+  // arrGet and arrBack write their result directly in the destination
+  // register of the call.
+  EXPECT_TRUE(hasNonVoidReturnType(BuiltinKind::arrGet));
+  EXPECT_TRUE(hasNonVoidReturnType(BuiltinKind::arrBack));
+  EXPECT_FALSE(hasNonVoidReturnType(BuiltinKind::arrAppend));
+  BCFunction& fn = theModule.createFunction();
+  {
+    BCBuilder builder = fn.createBCBuilder();
+    // r0 = [5, 7]
+    builder.createNewValueArrayInstr(0, ArrayElemKind::Int, 2);
+    builder.createCopyInstr(2, 0);
+    builder.createStoreSmallIntInstr(3, 5);
+    builder.createCallVoidBuiltinInstr(BuiltinKind::arrAppend, 1);
+    builder.createStoreSmallIntInstr(3, 7);
+    builder.createCallVoidBuiltinInstr(BuiltinKind::arrAppend, 1);
+    // r4 = arrGet(r0, 1) (direct call)
+    builder.createCopyInstr(2, 0);
+    builder.createStoreSmallIntInstr(3, 1);
+    builder.createCallBuiltinInstr(BuiltinKind::arrGet, 1, 4);
+    // r5 = arrBack(r0) (indirect call)
+    builder.createLoadBuiltinFuncInstr(1, BuiltinKind::arrBack);
+    builder.createCopyInstr(2, 0);
+    builder.createCallInstr(1, 5);
+    builder.createRetVoidInstr();
+  }
+  VM vm(theModule);
+  vm.run(fn);
+  EXPECT_TRUE(vm.isAlive());
+  auto regs = vm.getRegisterStack();
+  EXPECT_EQ(regs[4].intVal, 7);
+  EXPECT_EQ(regs[5].intVal, 7);
+}
+
+// Creates a function that calls itself recursively 'count' times, where
+// 'count' is the value in r0, and returns 'count'. 
+// The call instruction has debug info.
+static BCFunction& createRecursiveFunction(BCModule& theModule, 
+                                           SourceRange range) {
+  BCFunction& fn = theModule.createFunction();
+  DebugInfo& debugInfo = fn.createDebugInfo();
+  BCBuilder builder = fn.createBCBuilder();
+  // if(r0 == 0) return 0
+  builder.createStoreSmallIntInstr(1, 0);         // 0
+  builder.createEqIntInstr(1, 0, 1);              // 1
+  builder.createJumpIfNotInstr(1, 1);             // 2
+  builder.createRetInstr(0);                      // 3
+  // return fn(r0-1)+1
+  builder.createLoadFuncInstr(1, fn.getID());     // 4
+  builder.createStoreSmallIntInstr(3, 1);         // 5
+  builder.createSubIntInstr(2, 0, 3);             // 6
+  builder.createCallInstr(1, 2);                  // 7
+  debugInfo.addSourceRange(7, range);
+  // (r3 was overwritten by the callee)
+  builder.createStoreSmallIntInstr(3, 1);         // 8
+  builder.createAddIntInstr(2, 2, 3);             // 9
+  builder.createRetInstr(2);                      // 10
+  return fn;
+}
+
+TEST_F(VMTest, recursiveCalls) {
+  FileID file = srcMgr.loadFromString("foo()", "test");
+  BCFunction& fn = createRecursiveFunction(theModule, SourceRange(SourceLoc(file)));
+  VM vm(theModule);
+  FoxInt depth = 50;
+  VM::Register rtr = vm.run(fn, VM::Register(depth));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_EQ(rtr.intVal, depth);
+  // The VM should be able to run the function again
+  rtr = vm.run(fn, VM::Register(depth/2));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_EQ(rtr.intVal, depth/2);
+}
+
+TEST_F(VMTest, maxCallDepth) {
+  FileID file = srcMgr.loadFromString("foo()", "test");
+  BCFunction& fn = createRecursiveFunction(theModule, SourceRange(SourceLoc(file)));
+  std::stringstream ss;
+  DiagnosticEngine diagEngine(srcMgr, ss);
+  BCModule otherModule(srcMgr, diagEngine);
+  BCFunction& otherFn = createRecursiveFunction(otherModule, 
+                                                SourceRange(SourceLoc(file)));
+  {
+    VM vm(theModule);
+    EXPECT_EQ(vm.getMaxCallDepth(), VM::defaultMaxCallDepth);
+    vm.setMaxCallDepth(10);
+    EXPECT_EQ(vm.getMaxCallDepth(), 10u);
+    // 10 calls should be fine
+    VM::Register rtr = vm.run(fn, VM::Register(FoxInt(10)));
+    EXPECT_TRUE(vm.isAlive());
+    EXPECT_EQ(rtr.intVal, 10);
+  }
+  {
+    VM vm(otherModule);
+    vm.setMaxCallDepth(10);
+    // 11 calls should overflow
+    vm.run(otherFn, VM::Register(FoxInt(11)));
+    EXPECT_FALSE(vm.isAlive());
+    EXPECT_TRUE(diagEngine.hadAnyError());
+    EXPECT_NE(ss.str().find("stack overflow (maximum call depth of '10' "
+      "exceeded)"), std::string::npos) << ss.str();
+  }
+}
+
+TEST_F(VMTest, registerStackGrowth) {
+  FileID file = srcMgr.loadFromString("foo()", "test");
+  BCFunction& fn = createRecursiveFunction(theModule, SourceRange(SourceLoc(file)));
+  fn.setNumRegisters(4);
+  VM vm(theModule);
+  EXPECT_EQ(vm.getMaxRegisterStackSize(), VM::defaultMaxRegisterStackSize);
+  EXPECT_EQ(vm.getRegisterStack().size(), VM::registerStackChunkSize);
+  // Each call needs 2 more registers, so this needs more than one chunk.
+  FoxInt depth = VM::registerStackChunkSize;
+  VM::Register rtr = vm.run(fn, VM::Register(depth));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_EQ(rtr.intVal, depth);
+  EXPECT_GT(vm.getRegisterStack().size(), VM::registerStackChunkSize);
+  EXPECT_EQ(vm.getRegisterStack().size() % VM::registerStackChunkSize, 0u);
+}
+
+TEST_F(VMTest, maxRegisterStackSize) {
+  FileID file = srcMgr.loadFromString("foo()", "test");
+  std::stringstream ss;
+  DiagnosticEngine diagEngine(srcMgr, ss);
+  BCModule otherModule(srcMgr, diagEngine);
+  BCFunction& fn = createRecursiveFunction(otherModule, 
+                                           SourceRange(SourceLoc(file)));
+  fn.setNumRegisters(4);
+  VM vm(otherModule);
+  vm.setMaxRegisterStackSize(VM::registerStackChunkSize*2);
+  EXPECT_EQ(vm.getMaxRegisterStackSize(), VM::registerStackChunkSize*2);
+  // Each call needs 2 more registers, so this needs a stack of about
+  // 3 chunks.
+  vm.run(fn, VM::Register(FoxInt(VM::registerStackChunkSize*3/2)));
+  EXPECT_FALSE(vm.isAlive());
+  EXPECT_TRUE(diagEngine.hadAnyError());
+  EXPECT_NE(ss.str().find("stack overflow (the register stack cannot grow "
+    "beyond '8192' registers)"), std::string::npos) << ss.str();
+}
+
 TEST_F(VMTest, stringCreation) {
   VM vm(theModule);
   static constexpr char helloWorld[] = "Hello, World!";
   
   {
     theModule.addStringConstant("Hello, World!");
-    StringObject* string = vm.newStringObjectFromK(0);
+    StringObject* string = vm.getStringConstant(0);
     ASSERT_NE(string, nullptr);
     ASSERT_EQ(string->str(), helloWorld);
+    // String constants are only created once
+    EXPECT_EQ(vm.getStringConstant(0), string);
   }
 
   {
@@ -629,7 +1007,7 @@ TEST_F(VMTest, stringCreation) {
 
 TEST_F(VMTest, newArray) {
   builder.createNewRefArrayInstr(0, 16);
-  builder.createNewValueArrayInstr(1, 0);
+  builder.createNewValueArrayInstr(1, ArrayElemKind::Int, 0);
   builder.createRetVoidInstr();
 
   VM vm(theModule);
@@ -653,7 +1031,7 @@ TEST_F(VMTest, arrayCreation) {
   VM vm(theModule);
 
   {
-    ArrayObject* arr = vm.newValueArrayObject(10);
+    ArrayObject* arr = vm.newValueArrayObject(ArrayElemKind::Int, 10);
     ASSERT_NE(arr, nullptr);
     EXPECT_FALSE(arr->containsReferences());
     EXPECT_EQ(arr->size(), 0u);
@@ -667,6 +1045,595 @@ TEST_F(VMTest, arrayCreation) {
   }
 }
 
+TEST_F(VMTest, gcCollectsUnreachableObjects) {
+  VM vm(theModule);
+  StringObject* live = vm.newStringObject("live");
+  vm.newStringObject("dead");
+  vm.newValueArrayObject(ArrayElemKind::Int, 16);
+  EXPECT_EQ(vm.getNumObjects(), 3u);
+  vm.getRegisterStack()[0].object = live;
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumCollections(), 1u);
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  EXPECT_EQ(vm.getHeapSize(), live->getAllocatedSize());
+  EXPECT_EQ(live->str(), "live");
+  EXPECT_FALSE(live->isMarked());
+  // Nothing is reachable anymore
+  vm.getRegisterStack()[0] = VM::Register();
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 0u);
+  EXPECT_EQ(vm.getHeapSize(), 0u);
+}
+
+TEST_F(VMTest, gcTracesArraysOfReferences) {
+  VM vm(theModule);
+  // r0 = [[str0], [str1]], r1 = [str2 (as a value)]
+  ArrayObject* outer = vm.newRefArrayObject();
+  ArrayObject* inner0 = vm.newRefArrayObject();
+  ArrayObject* inner1 = vm.newRefArrayObject();
+  StringObject* str0 = vm.newStringObject("0");
+  StringObject* str1 = vm.newStringObject("1");
+  StringObject* str2 = vm.newStringObject("2");
+  ArrayObject* values = vm.newValueArrayObject(ArrayElemKind::Int);
+  outer->append(FoxAny(inner0));
+  outer->append(FoxAny(inner1));
+  inner0->append(FoxAny(str0));
+  inner1->append(FoxAny(str1));
+  // The elements of arrays of values aren't traced.
+  values->append(FoxAny(str2));
+  vm.getRegisterStack()[0].object = outer;
+  vm.getRegisterStack()[1].object = values;
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 6u);
+  // The objects that aren't referenced by a register may have been moved
+  // out of the nursery, so fetch them through the arrays.
+  auto getElem = [](Object* arr, std::size_t idx) {
+    return (*cast<ArrayObject>(arr))[idx].objectVal;
+  };
+  EXPECT_EQ(cast<StringObject>(getElem(getElem(outer, 0), 0))->str(), "0");
+  EXPECT_EQ(cast<StringObject>(getElem(getElem(outer, 1), 0))->str(), "1");
+  // Dropping the outer array makes every other reference array and their
+  // strings unreachable.
+  vm.getRegisterStack()[0] = VM::Register();
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+}
+
+TEST_F(VMTest, gcGlobalsAreRoots) {
+  // g0 = a new string
+  {
+    BCFunction& init = theModule.createGlobalVariable();
+    BCBuilder builder = init.createBCBuilder();
+    builder.createNewStringInstr(0);
+    builder.createRetInstr(0);
+  }
+  VM vm(theModule);
+  ASSERT_EQ(vm.getNumObjects(), 1u);
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  Object* global = vm.getGlobalVariables()[0].object;
+  EXPECT_EQ(cast<StringObject>(global)->str(), "");
+}
+
+TEST_F(VMTest, gcOptions) {
+  // g0 = a new string, g1 = a new string
+  for (int k = 0; k < 2; ++k) {
+    BCFunction& init = theModule.createGlobalVariable();
+    BCBuilder builder = init.createBCBuilder();
+    builder.createNewStringInstr(0);
+    builder.createRetInstr(0);
+  }
+  // The options apply to the initializers of the globals.
+  VM::GCOptions options;
+  options.threshold = 64;
+  options.nurserySize = 128;
+  options.stress = true;
+  options.debugAllocation = true;
+  VM vm(theModule, options);
+  EXPECT_EQ(vm.getGCThreshold(), 64u);
+  EXPECT_EQ(vm.getNurserySize(), 128u);
+  EXPECT_TRUE(vm.isGCStressEnabled());
+  EXPECT_TRUE(vm.isDebugAllocationEnabled());
+  EXPECT_EQ(vm.getNumCollections(), 2u);
+  EXPECT_EQ(vm.getNumObjects(), 2u);
+}
+
+TEST_F(VMTest, gcTriggers) {
+  // Creates 'r0' strings in a loop, and keeps the last one in r2.
+  BCFunction& fn = theModule.createFunction();
+  fn.setNumRegisters(3);
+  {
+    BCBuilder builder = fn.createBCBuilder();
+    builder.createStoreSmallIntInstr(1, 0);         // 0 r1 = 0
+    builder.createJumpIfNotLTIntInstr(1, 0, 3);     // 1 if !(r1 < r0) goto 6
+    builder.createNewStringInstr(2);                // 3 r2 = new string
+    builder.createAddIntImmInstr(1, 1, 1);          // 4 r1 += 1
+    builder.createJumpInstr(-5);                    // 5 goto 1
+    builder.createRetInstr(2);                      // 6
+  }
+  FoxInt numAllocs = 1000;
+  {
+    // The default threshold is never reached.
+    VM vm(theModule);
+    EXPECT_FALSE(vm.isGCStressEnabled());
+    EXPECT_EQ(vm.getGCThreshold(), VM::defaultGCThreshold);
+    vm.run(fn, VM::Register(numAllocs));
+    EXPECT_TRUE(vm.isAlive());
+    EXPECT_EQ(vm.getNumCollections(), 0u);
+    EXPECT_EQ(vm.getNumMinorCollections(), 0u);
+    EXPECT_EQ(vm.getNumObjects(), std::size_t(numAllocs));
+    EXPECT_EQ(vm.getNumYoungObjects(), std::size_t(numAllocs));
+  }
+  {
+    // Collect the young generation when it grows beyond 10 strings
+    VM vm(theModule);
+    std::size_t strSize = vm.newStringObject()->getAllocatedSize();
+    vm.setNurserySize(strSize*10);
+    EXPECT_EQ(vm.getNurserySize(), strSize*10);
+    vm.run(fn, VM::Register(numAllocs));
+    EXPECT_TRUE(vm.isAlive());
+    // The blocks promoted by minor collections also trigger full
+    // collections, but less often.
+    EXPECT_GT(vm.getNumMinorCollections(), 2*vm.getNumCollections());
+    EXPECT_LE(vm.getNumYoungObjects(), 10u);
+  }
+  {
+    // Collect when the heap grows beyond 10 strings
+    VM vm(theModule);
+    std::size_t strSize = vm.newStringObject()->getAllocatedSize();
+    vm.setGCThreshold(strSize*10);
+    EXPECT_EQ(vm.getGCThreshold(), strSize*10);
+    vm.run(fn, VM::Register(numAllocs));
+    EXPECT_TRUE(vm.isAlive());
+    EXPECT_GT(vm.getNumCollections(), 0u);
+    EXPECT_LE(vm.getNumObjects(), 10u);
+    EXPECT_LE(vm.getHeapSize(), strSize*10);
+  }
+  {
+    // Collect on every allocation
+    VM vm(theModule);
+    vm.setGCStress(true);
+    EXPECT_TRUE(vm.isGCStressEnabled());
+    VM::Register rtr = vm.run(fn, VM::Register(numAllocs));
+    EXPECT_TRUE(vm.isAlive());
+    EXPECT_EQ(vm.getNumCollections(), std::size_t(numAllocs));
+    // Only the string that was in r2 when the last string was allocated
+    // survived, plus the last string.
+    EXPECT_EQ(vm.getNumObjects(), 2u);
+    EXPECT_EQ(cast<StringObject>(rtr.object)->str(), "");
+  }
+}
+
+TEST_F(VMTest, gcArrayGrowth) {
+  // The elements of an array are part of the heap when it grows.
+  {
+    VM vm(theModule);
+    ArrayObject* arr = vm.newValueArrayObject(ArrayElemKind::Int);
+    vm.getRegisterStack()[0].object = arr;
+    for(FoxInt k = 0; k < 100; ++k)
+      vm.appendToArray(arr, FoxAny(k));
+    vm.reserveArray(arr, 1000);
+    EXPECT_GE(arr->capacity(), 1000u);
+    EXPECT_EQ(vm.getHeapSize(), arr->getAllocatedSize());
+    vm.collectGarbage();
+    EXPECT_EQ(vm.getHeapSize(), arr->getAllocatedSize());
+  }
+  // Creates 'r0' arrays of 'r1' ints in a loop, and drops them.
+  BCFunction& fn = theModule.createFunction();
+  fn.setNumRegisters(5);
+  {
+    BCBuilder builder = fn.createBCBuilder();
+    builder.createStoreSmallIntInstr(2, 0);         // 0 r2 = 0
+    builder.createJumpIfNotLTIntInstr(2, 0, 9);     // 1 if !(r2 < r0) goto 12
+    builder.createNewValueArrayInstr(3,             // 3 r3 = []
+      ArrayElemKind::Int, 0);
+    builder.createStoreSmallIntInstr(4, 0);         // 4 r4 = 0
+    builder.createJumpIfNotLTIntInstr(4, 1, 3);     // 5 if !(r4 < r1) goto 10
+    builder.createArrAppendInstr(3, 4);             // 7 r3.append(r4)
+    builder.createAddIntImmInstr(4, 4, 1);          // 8 r4 += 1
+    builder.createJumpInstr(-5);                    // 9 goto 5
+    builder.createAddIntImmInstr(2, 2, 1);          // 10 r2 += 1
+    builder.createJumpInstr(-11);                   // 11 goto 1
+    builder.createRetVoidInstr();                   // 12
+  }
+  // Collect when the heap grows beyond 2 arrays, which only happens if
+  // the growth of the arrays is counted.
+  VM vm(theModule);
+  FoxInt numElems = 1000;
+  std::size_t arrSize = sizeof(ArrayObject) + 
+    std::size_t(numElems)*getElemSize(ArrayElemKind::Int);
+  vm.setGCThreshold(arrSize*2);
+  VM::Register args[] = {VM::Register(FoxInt(100)), VM::Register(numElems)};
+  vm.run(fn, args);
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_GT(vm.getNumCollections(), 0u);
+  EXPECT_LE(vm.getHeapSize(), arrSize*4);
+  EXPECT_LE(vm.getNumObjects(), 4u);
+}
+
+TEST_F(VMTest, gcMinorCollections) {
+  VM vm(theModule);
+  StringObject* live = vm.newStringObject("live");
+  vm.newStringObject("dead");
+  EXPECT_TRUE(live->isYoung());
+  EXPECT_EQ(vm.getNumYoungObjects(), 2u);
+  vm.getRegisterStack()[0].object = live;
+  vm.collectYoungGeneration();
+  EXPECT_EQ(vm.getNumMinorCollections(), 1u);
+  EXPECT_EQ(vm.getNumCollections(), 0u);
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  EXPECT_EQ(vm.getNumYoungObjects(), 0u);
+  EXPECT_EQ(vm.getHeapSize(), live->getAllocatedSize());
+  // Objects referenced by registers are promoted without being moved.
+  EXPECT_FALSE(live->isYoung());
+  EXPECT_FALSE(live->isMarked());
+  EXPECT_EQ(live->str(), "live");
+  // Minor collections don't collect old objects.
+  vm.getRegisterStack()[0] = VM::Register();
+  vm.collectYoungGeneration();
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 0u);
+  EXPECT_EQ(vm.getHeapSize(), 0u);
+}
+
+TEST_F(VMTest, gcMinorCollectionsMoveObjects) {
+  VM vm(theModule);
+  // r0 = [str]
+  StringObject* str = vm.newStringObject("moved");
+  // Fill the first block of the nursery with garbage, so the string isn't
+  // in the same block as the array.
+  for(std::size_t k = 0; k <= (Nursery::blockSize/sizeof(StringObject)); ++k)
+    vm.newStringObject();
+  ArrayObject* arr = vm.newRefArrayObject();
+  arr->append(FoxAny(str));
+  vm.getRegisterStack()[0].object = arr;
+  vm.collectYoungGeneration();
+  EXPECT_EQ(vm.getNumObjects(), 2u);
+  EXPECT_FALSE(arr->isYoung());
+  // The string was only referenced by the array, so it has been moved.
+  Object* elem = (*arr)[0].objectVal;
+  EXPECT_NE(elem, str);
+  EXPECT_FALSE(elem->isYoung());
+  EXPECT_EQ(cast<StringObject>(elem)->str(), "moved");
+  // It has been allocated by the ObjectAllocator.
+  const ObjectAllocator& allocator = vm.getObjectAllocator();
+  EXPECT_EQ(allocator.getNumObjects(), 1u);
+  EXPECT_GE(allocator.getNumBytes(), 
+            cast<StringObject>(elem)->getAllocatedSize());
+  EXPECT_EQ(vm.getNumObjects(ObjectKind::StringObject), 1u);
+  EXPECT_EQ(vm.getNumObjects(ObjectKind::ArrayObject), 1u);
+  // Moved objects are collected by full collections.
+  arr->reset();
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  EXPECT_EQ(vm.getNumObjects(ObjectKind::StringObject), 0u);
+  EXPECT_EQ(allocator.getNumObjects(), 0u);
+  EXPECT_EQ(allocator.getNumBytes(), 0u);
+}
+
+TEST(ObjectAllocatorTest, sizeClasses) {
+  ObjectAllocator allocator;
+  // Objects are allocated in aligned cells, carved out of the arena.
+  void* a = allocator.allocate(1);
+  void* b = allocator.allocate(ObjectAllocator::cellAlign + 1);
+  void* c = allocator.allocate(ObjectAllocator::maxCellSize);
+  for (void* ptr : {a, b, c})
+    EXPECT_EQ(std::uintptr_t(ptr) % ObjectAllocator::cellAlign, 0u);
+  EXPECT_EQ(allocator.getNumObjects(), 3u);
+  EXPECT_EQ(allocator.getNumBytes(), 
+            3*ObjectAllocator::cellAlign + ObjectAllocator::maxCellSize);
+  EXPECT_EQ(allocator.getArenaSize(), ObjectAllocator::chunkSize);
+  // Freed cells are reused by the objects of the same size class.
+  allocator.deallocate(b, ObjectAllocator::cellAlign + 1);
+  EXPECT_EQ(allocator.allocate(2*ObjectAllocator::cellAlign), b);
+  EXPECT_NE(allocator.allocate(ObjectAllocator::cellAlign), b);
+  // Large objects are allocated with malloc.
+  void* large = allocator.allocate(ObjectAllocator::maxCellSize + 1);
+  EXPECT_EQ(allocator.getNumObjects(), 5u);
+  allocator.deallocate(large, ObjectAllocator::maxCellSize + 1);
+  EXPECT_EQ(allocator.getNumObjects(), 4u);
+  EXPECT_EQ(allocator.getArenaSize(), ObjectAllocator::chunkSize);
+  // New chunks are allocated when the arena is full.
+  std::size_t numCells = ObjectAllocator::chunkSize/ObjectAllocator::maxCellSize;
+  for (std::size_t k = 0; k < numCells; ++k)
+    allocator.allocate(ObjectAllocator::maxCellSize);
+  EXPECT_EQ(allocator.getArenaSize(), 2*ObjectAllocator::chunkSize);
+}
+
+TEST(ObjectAllocatorTest, debugMode) {
+  ObjectAllocator allocator;
+  allocator.setDebugMode(true);
+  EXPECT_TRUE(allocator.isDebugModeEnabled());
+  // Every object is allocated with malloc, and the arena isn't used.
+  void* a = allocator.allocate(24);
+  void* b = allocator.allocate(24);
+  EXPECT_EQ(allocator.getNumObjects(), 2u);
+  EXPECT_EQ(allocator.getNumBytes(), 48u);
+  EXPECT_EQ(allocator.getArenaSize(), 0u);
+  allocator.deallocate(a, 24);
+  allocator.deallocate(b, 24);
+  EXPECT_EQ(allocator.getNumObjects(), 0u);
+  EXPECT_EQ(allocator.getNumBytes(), 0u);
+}
+
+TEST_F(VMTest, gcLargeObjects) {
+  VM vm(theModule);
+  std::string bigStr(Nursery::maxObjectSize, 'a');
+  // Large strings are allocated directly in the old generation.
+  StringObject* big = vm.newStringObject(bigStr);
+  EXPECT_FALSE(big->isYoung());
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  EXPECT_EQ(vm.getNumYoungObjects(), 0u);
+  EXPECT_EQ(vm.getHeapSize(), big->getAllocatedSize());
+  EXPECT_EQ(big->str(), bigStr);
+  // Flattening a rope creates a large string from small ones.
+  StringObject* half = vm.newStringObject(bigStr.substr(bigStr.size()/2));
+  EXPECT_TRUE(half->isYoung());
+  StringObject* cat = vm.newStringObject(half, half);
+  vm.flatten(cat);
+  StringObject* flat = cat->getRopeOperands()[0];
+  EXPECT_FALSE(flat->isYoung());
+  EXPECT_EQ(flat->numBytes(), 2*half->numBytes());
+  // Large objects are only collected by full collections.
+  vm.getRegisterStack()[0].object = big;
+  vm.collectYoungGeneration();
+  EXPECT_EQ(vm.getNumObjects(), 2u);
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 1u);
+  EXPECT_EQ(big->str(), bigStr);
+}
+
+TEST_F(VMTest, gcTracesRopes) {
+  VM vm(theModule);
+  // Build a long rope by appending to it, and keep it in r0.
+  std::string expected;
+  StringObject* str = vm.newStringObject();
+  for (int k = 0; k < 100; ++k) {
+    std::string piece = "piece #" + std::to_string(k) + u8" (é) ";
+    expected += piece;
+    str = vm.newStringObject(str, vm.newStringObject(piece));
+  }
+  ASSERT_TRUE(str->isRope());
+  EXPECT_FALSE(str->isFlat());
+  EXPECT_EQ(str->numBytes(), expected.size());
+  EXPECT_EQ(str->length(), countCodepoints(expected));
+  vm.getRegisterStack()[0].object = str;
+  // The operands of the rope are only referenced by ropes, so they're moved
+  // out of the nursery.
+  vm.collectYoungGeneration();
+  EXPECT_EQ(vm.getNumYoungObjects(), 0u);
+  std::size_t numObjects = vm.getNumObjects();
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), numObjects);
+  std::string bytes(str->numBytes(), 0);
+  str->copyBytes(&bytes[0]);
+  EXPECT_EQ(bytes, expected);
+  // The old rope now references a young flat string, which replaces its
+  // operands.
+  ASSERT_FALSE(str->isYoung());
+  vm.flatten(str);
+  EXPECT_TRUE(str->isFlat());
+  EXPECT_TRUE(str->isRemembered());
+  EXPECT_EQ(str->str(), expected);
+  EXPECT_EQ(str->getChar(10), FoxChar(0xE9));
+  vm.collectYoungGeneration();
+  EXPECT_FALSE(str->isRemembered());
+  EXPECT_FALSE(str->getRopeOperands()[0]->isYoung());
+  // The operands are now dead.
+  vm.collectGarbage();
+  EXPECT_EQ(vm.getNumObjects(), 2u);
+  EXPECT_EQ(str->str(), expected);
+}
+
+TEST_F(VMTest, gcWriteBarrier) {
+  // Stores new strings in the old array in r0 with ArrAppend and ArrSet:
+  // r0 = [str1, str2], then r0[0] = str3
+  BCFunction& fn = theModule.createFunction();
+  fn.setNumRegisters(3);
+  {
+    BCBuilder builder = fn.createBCBuilder();
+    builder.createNewStringInstr(1);
+    builder.createArrAppendInstr(0, 1);
+    builder.createNewStringInstr(1);
+    builder.createArrAppendInstr(0, 1);
+    builder.createNewStringInstr(1);
+    builder.createStoreSmallIntInstr(2, 0);
+    builder.createArrSetInstr(0, 2, 1);
+    // Forget the last string, so it's only referenced by the array
+    builder.createStoreSmallIntInstr(1, 0);
+    builder.createRetVoidInstr();
+  }
+  VM vm(theModule);
+  ArrayObject* arr = vm.newRefArrayObject();
+  vm.getRegisterStack()[0].object = arr;
+  vm.collectYoungGeneration();
+  ASSERT_FALSE(arr->isYoung());
+  vm.run(fn, VM::Register(arr));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_TRUE(arr->isRemembered());
+  EXPECT_EQ(vm.getNumYoungObjects(), 3u);
+  vm.collectYoungGeneration();
+  EXPECT_FALSE(arr->isRemembered());
+  // The first string is dead, the others are referenced by the old array.
+  EXPECT_EQ(vm.getNumObjects(), 3u);
+  ASSERT_EQ(arr->size(), 2u);
+  EXPECT_FALSE((*arr)[0].objectVal->isYoung());
+  EXPECT_FALSE((*arr)[1].objectVal->isYoung());
+  EXPECT_NE((*arr)[0].objectVal, (*arr)[1].objectVal);
+}
+
+TEST_F(VMTest, arrayInstrs) {
+  // r0 = [5, 7]
+  builder.createNewValueArrayInstr(0, ArrayElemKind::Int, 2);
+  builder.createStoreSmallIntInstr(1, 5);
+  builder.createArrAppendInstr(0, 1);
+  builder.createStoreSmallIntInstr(1, 7);
+  builder.createArrAppendInstr(0, 1);
+  // r2 = r0.size()
+  builder.createArrSizeInstr(2, 0);
+  // r0[0] = 42
+  builder.createStoreSmallIntInstr(1, 0);
+  builder.createStoreSmallIntInstr(3, 42);
+  builder.createArrSetInstr(0, 1, 3);
+  // r3 = r0[1]
+  builder.createStoreSmallIntInstr(1, 1);
+  builder.createArrGetInstr(3, 0, 1);
+  // r1 = r0[r1 - 1] (dest = idx)
+  builder.createSubIntImmInstr(1, 1, 1);
+  builder.createArrGetInstr(1, 0, 1);
+  builder.createRetVoidInstr();
+
+  VM vm(theModule);
+  vm.run(instrs);
+  EXPECT_TRUE(vm.isAlive());
+  auto regs = vm.getRegisterStack();
+  ArrayObject* arr = cast<ArrayObject>(regs[0].object);
+  ASSERT_EQ(arr->size(), 2u);
+  EXPECT_EQ((*arr)[0].intVal, 42);
+  EXPECT_EQ((*arr)[1].intVal, 7);
+  EXPECT_EQ(regs[1].intVal, 42);
+  EXPECT_EQ(regs[2].intVal, 2);
+  EXPECT_EQ(regs[3].intVal, 7);
+}
+
+TEST_F(VMTest, LoadArrayK) {
+  theModule.addArrayConstant(ArrayElemKind::Double, 
+    {FoxAny(FoxDouble(0.5)), FoxAny(FoxDouble(-2.5))});
+  // r0 and r1 are 2 copies of the constant, then r1[0] = 0.0
+  builder.createLoadArrayKInstr(0, 0);
+  builder.createLoadArrayKInstr(1, 0);
+  builder.createStoreSmallIntInstr(2, 0);
+  builder.createIntToDoubleInstr(3, 2);
+  builder.createArrSetInstr(1, 2, 3);
+  builder.createRetVoidInstr();
+
+  VM vm(theModule);
+  vm.run(instrs);
+  EXPECT_TRUE(vm.isAlive());
+  auto regs = vm.getRegisterStack();
+  ArrayObject* r0 = cast<ArrayObject>(regs[0].object);
+  ArrayObject* r1 = cast<ArrayObject>(regs[1].object);
+  ASSERT_NE(r0, r1);
+  EXPECT_EQ(r0->getElemKind(), ArrayElemKind::Double);
+  ASSERT_EQ(r0->size(), 2u);
+  EXPECT_EQ((*r0)[0].doubleVal, 0.5);
+  EXPECT_EQ((*r0)[1].doubleVal, -2.5);
+  // Modifying a copy doesn't modify the constant or other copies.
+  ASSERT_EQ(r1->size(), 2u);
+  EXPECT_EQ((*r1)[0].doubleVal, 0.0);
+  EXPECT_EQ(theModule.getArrayConstant(0)[0].doubleVal, 0.5);
+}
+
+TEST_F(VMTest, ArrAppendRange) {
+  // r0 = [1, 2, 3], then r0.append(r1, r2, r3) with r1 = 4, r2 = 5, r3 = 6
+  theModule.addArrayConstant(ArrayElemKind::Int, 
+    {FoxAny(FoxInt(1)), FoxAny(FoxInt(2)), FoxAny(FoxInt(3))});
+  builder.createLoadArrayKInstr(0, 0);
+  builder.createStoreSmallIntInstr(1, 4);
+  builder.createStoreSmallIntInstr(2, 5);
+  builder.createStoreSmallIntInstr(3, 6);
+  builder.createArrAppendRangeInstr(0, 1, 3);
+  // r4 = [r0, r0]
+  builder.createNewRefArrayInstr(4, 0);
+  builder.createCopyInstr(5, 0);
+  builder.createCopyInstr(6, 0);
+  builder.createArrAppendRangeInstr(4, 5, 2);
+  builder.createRetVoidInstr();
+
+  VM vm(theModule);
+  vm.run(instrs);
+  EXPECT_TRUE(vm.isAlive());
+  auto regs = vm.getRegisterStack();
+  ArrayObject* r0 = cast<ArrayObject>(regs[0].object);
+  ASSERT_EQ(r0->size(), 6u);
+  for (std::size_t k = 0; k < 6; ++k)
+    EXPECT_EQ((*r0)[k].intVal, FoxInt(k+1)) << "element " << k;
+  ArrayObject* r4 = cast<ArrayObject>(regs[4].object);
+  ASSERT_EQ(r4->size(), 2u);
+  EXPECT_EQ((*r4)[0].objectVal, r0);
+  EXPECT_EQ((*r4)[1].objectVal, r0);
+}
+
+TEST_F(VMTest, stringInstrs) {
+  // r0 = "héllo"
+  theModule.addStringConstant(u8"héllo");
+  builder.createLoadStringKInstr(0, 0);
+  // r1 = r0.length()
+  builder.createStrLenInstr(1, 0);
+  // r2 = r0[1]
+  builder.createStoreSmallIntInstr(2, 1);
+  builder.createStrGetCharInstr(2, 0, 2);
+  // r3 = r0[4]
+  builder.createStoreSmallIntInstr(3, 4);
+  builder.createStrGetCharInstr(3, 0, 3);
+  builder.createRetVoidInstr();
+
+  VM vm(theModule);
+  vm.run(instrs);
+  EXPECT_TRUE(vm.isAlive());
+  auto regs = vm.getRegisterStack();
+  EXPECT_EQ(regs[1].intVal, 5);
+  EXPECT_EQ(FoxChar(regs[2].raw), FoxChar(0xE9));
+  EXPECT_EQ(FoxChar(regs[3].raw), FoxChar('o'));
+}
+
+TEST_F(VMTest, invalidSubscripts) {
+  FileID file = srcMgr.loadFromString("arr[idx]", "test");
+  SourceRange range(SourceLoc(file), 7);
+  // Runs 'op' with r0 = [0, 1, 2] (or "abc" if 'isString' is true)
+  // and r1 = idx. Returns the diagnostics emitted.
+  auto run = [&](FoxInt idx, bool isString, Opcode op) {
+    std::stringstream ss;
+    DiagnosticEngine diagEngine(srcMgr, ss);
+    BCModule otherModule(srcMgr, diagEngine);
+    otherModule.addStringConstant("abc");
+    BCFunction& fn = otherModule.createFunction();
+    fn.createDebugInfo();
+    BCBuilder builder = fn.createBCBuilder();
+    if (isString)
+      builder.createLoadStringKInstr(0, 0);
+    else {
+      builder.createNewValueArrayInstr(0, ArrayElemKind::Int, 3);
+      for (std::int16_t k = 0; k < 3; ++k) {
+        builder.createStoreSmallIntInstr(1, k);
+        builder.createArrAppendInstr(0, 1);
+      }
+    }
+    builder.createLoadIntKInstr(1, otherModule.addIntConstant(idx));
+    switch (op) {
+      case Opcode::ArrGet:
+        builder.createArrGetInstr(2, 0, 1);
+        break;
+      case Opcode::ArrSet:
+        builder.createArrSetInstr(0, 1, 1);
+        break;
+      case Opcode::StrGetChar:
+        builder.createStrGetCharInstr(2, 0, 1);
+        break;
+      default:
+        fox_unreachable("unexpected opcode");
+    }
+    builder.addDebugRange(builder.getLastInstrIter(), range);
+    builder.createRetVoidInstr();
+    VM vm(otherModule);
+    vm.run(fn);
+    EXPECT_FALSE(vm.isAlive());
+    EXPECT_TRUE(diagEngine.hadAnyError());
+    return ss.str();
+  };
+  std::string negIdx = "index was negative ('-1')";
+  std::string outOfRange =
+    "out-of-range (size of container is '3', index is '3')";
+  for (Opcode op : {Opcode::ArrGet, Opcode::ArrSet, Opcode::StrGetChar}) {
+    bool isString = (op == Opcode::StrGetChar);
+    std::string diags = run(-1, isString, op);
+    EXPECT_NE(diags.find(negIdx), std::string::npos) << diags;
+    diags = run(3, isString, op);
+    EXPECT_NE(diags.find(outOfRange), std::string::npos) << diags;
+  }
+}
+
 static void createSimpleIntGlobal(BCModule& theModule, FoxInt val) {
   BCFunction& fn = theModule.createGlobalVariable();
   BCBuilder builder = fn.createBCBuilder();
@@ -727,4 +1694,234 @@ TEST_F(VMTest, getSetGlobals) {
 
   EXPECT_EQ(getGlobal(0), g1);
   EXPECT_EQ(getGlobal(1), g0);
-}
\ No newline at end of file
+}
+
+TEST_F(VMTest, JITThreshold) {
+  VM vm(theModule);
+  if (JITFunction::isSupported()) {
+    EXPECT_EQ(vm.getJITThreshold(), VM::defaultJITThreshold);
+    vm.setJITThreshold(10);
+    EXPECT_EQ(vm.getJITThreshold(), 10u);
+  }
+  else 
+    EXPECT_EQ(vm.getJITThreshold(), 0u);
+  vm.setJITThreshold(0);
+  EXPECT_EQ(vm.getJITThreshold(), 0u);
+}
+
+TEST_F(VMTest, JITMatchesInterpreter) {
+  theModule.addIntConstant(std::numeric_limits<FoxInt>::min());
+  theModule.addDoubleConstant(-2.75);
+  createSimpleIntGlobal(theModule, 42);
+  // Inputs: r0-r2 are FoxInts, r3-r6 are FoxDoubles.
+  auto setInputs = [](VM& vm) {
+    auto regs = vm.getRegisterStack();
+    regs[0].intVal = 1000;
+    regs[1].intVal = -7;
+    regs[2].intVal = 0;
+    regs[3].doubleVal = 3.5;
+    regs[4].doubleVal = -0.25;
+    regs[5].doubleVal = std::numeric_limits<FoxDouble>::quiet_NaN();
+    regs[6].doubleVal = 3.5;
+  };
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(10, -1234);
+  builder.createCopyInstr(11, 4);
+  builder.createLoadIntKInstr(12, 0);
+  builder.createLoadDoubleKInstr(13, 0);
+  builder.createGetGlobalInstr(0, 14);
+  builder.createSetGlobalInstr(0, 1);
+  builder.createAddIntInstr(15, 0, 1);
+  builder.createSubIntInstr(16, 1, 0);
+  builder.createMulIntInstr(17, 0, 1);
+  builder.createDivIntInstr(18, 0, 1);
+  builder.createModIntInstr(19, 0, 1);
+  builder.createAddIntImmInstr(20, 1, -128);
+  builder.createSubIntImmInstr(21, 0, 127);
+  builder.createMulIntImmInstr(22, 1, -3);
+  builder.createNegIntInstr(23, 1);
+  builder.createAddDoubleInstr(24, 3, 4);
+  builder.createSubDoubleInstr(25, 3, 4);
+  builder.createMulDoubleInstr(26, 3, 4);
+  builder.createDivDoubleInstr(27, 3, 4);
+  builder.createNegDoubleInstr(28, 4);
+  builder.createIntToDoubleInstr(29, 1);
+  builder.createDoubleToIntInstr(30, 4);
+  // Comparisons, including comparisons with NaN (r5)
+  regaddr_t dest = 31;
+  for (auto ops : {std::make_pair(0, 1), std::make_pair(1, 0), 
+                   std::make_pair(1, 1)}) {
+    builder.createEqIntInstr(dest++, ops.first, ops.second);
+    builder.createLEIntInstr(dest++, ops.first, ops.second);
+    builder.createLTIntInstr(dest++, ops.first, ops.second);
+  }
+  for (auto ops : {std::make_pair(3, 4), std::make_pair(4, 3), 
+                   std::make_pair(3, 6), std::make_pair(3, 5)}) {
+    builder.createEqDoubleInstr(dest++, ops.first, ops.second);
+    builder.createLEDoubleInstr(dest++, ops.first, ops.second);
+    builder.createLTDoubleInstr(dest++, ops.first, ops.second);
+    builder.createGEDoubleInstr(dest++, ops.first, ops.second);
+    builder.createGTDoubleInstr(dest++, ops.first, ops.second);
+  }
+  for (auto ops : {std::make_pair(0, 1), std::make_pair(0, 2), 
+                   std::make_pair(2, 2)}) {
+    builder.createLAndInstr(dest++, ops.first, ops.second);
+    builder.createLOrInstr(dest++, ops.first, ops.second);
+    builder.createLNotInstr(dest++, ops.second);
+  }
+  // Jumps: every jump that is taken skips a StoreSmallInt.
+  auto createSkippedStore = [&]() {
+    builder.createStoreSmallIntInstr(dest++, 1);
+  };
+  builder.createJumpIfInstr(0, 1);      createSkippedStore();
+  builder.createJumpIfInstr(2, 1);      createSkippedStore();
+  builder.createJumpIfNotInstr(0, 1);   createSkippedStore();
+  builder.createJumpIfNotInstr(2, 1);   createSkippedStore();
+  builder.createJumpInstr(1);           createSkippedStore();
+  for (auto ops : {std::make_pair(0, 1), std::make_pair(1, 0), 
+                   std::make_pair(1, 1)}) {
+    builder.createJumpIfEqIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+    builder.createJumpIfNotEqIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+    builder.createJumpIfLTIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+    builder.createJumpIfNotLTIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+    builder.createJumpIfLEIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+    builder.createJumpIfNotLEIntInstr(ops.first, ops.second, 1);
+    createSkippedStore();
+  }
+  builder.createLoadFuncInstr(dest++, fn.getID());
+  builder.createLoadBuiltinFuncInstr(dest++, BuiltinKind::printInt);
+  // Instructions that aren't supported by the JIT, followed by 
+  // instructions that are.
+  builder.createPowIntInstr(dest++, 1, 1);
+  builder.createAddIntInstr(dest++, 0, 0);
+  builder.createRetVoidInstr();
+  ASSERT_LT(dest, 200);
+  fuseSuperinstructions(fn.getInstructions());
+  fn.setNumRegisters(dest);
+
+  // Run it with the interpreter
+  std::vector<VM::Register> expected;
+  {
+    VM vm(theModule);
+    vm.setJITThreshold(0);
+    setInputs(vm);
+    vm.run(fn);
+    EXPECT_EQ(fn.getJITFunction(), nullptr);
+    auto regs = vm.getRegisterStack();
+    expected.assign(regs.begin(), regs.begin()+dest);
+    expected.push_back(vm.getGlobalVariables()[0]);
+  }
+  // Run it with the JIT
+  VM vm(theModule);
+  vm.setJITThreshold(1);
+  setInputs(vm);
+  vm.run(fn);
+  EXPECT_TRUE(vm.isAlive());
+  if (JITFunction::isSupported()) {
+    EXPECT_NE(fn.getJITFunction(), nullptr);
+  }
+  auto regs = vm.getRegisterStack();
+  for (regaddr_t reg = 0; reg < dest; ++reg)
+    EXPECT_EQ(regs[reg].raw, expected[reg].raw) << "incorrect value for r" 
+                                                << unsigned(reg);
+  EXPECT_EQ(vm.getGlobalVariables()[0].raw, expected.back().raw);
+}
+
+TEST_F(VMTest, JITLoops) {
+  // Computes the sum of i*(i%7) for i from 0 to r0
+  BCFunction& fn = theModule.createFunction();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(1, 0);           // 0  r1 = i = 0
+  builder.createStoreSmallIntInstr(2, 0);           // 1  r2 = sum = 0
+  builder.createStoreSmallIntInstr(3, 7);           // 2  r3 = 7
+  builder.createJumpIfNotLEIntInstr(1, 0, 5);       // 3  if !(i <= n) goto 10
+  builder.createModIntInstr(4, 1, 3);               // 5  r4 = i % 7
+  builder.createMulIntInstr(4, 4, 1);               // 6  r4 *= i
+  builder.createAddIntInstr(2, 2, 4);               // 7  sum += r4
+  builder.createAddIntImmInstr(1, 1, 1);            // 8  i++
+  builder.createJumpInstr(-7);                      // 9  goto 3
+  builder.createRetInstr(2);                        // 10
+  fuseSuperinstructions(fn.getInstructions());
+
+  FoxInt n = 10000;
+  FoxInt expected = 0;
+  for (FoxInt i = 0; i <= n; ++i)
+    expected += i*(i%7);
+
+  VM vm(theModule);
+  // The function is only called once, so it must be compiled while the
+  // loop runs and entered at the target of the backward jump.
+  vm.setJITThreshold(100);
+  VM::Register rtr = vm.run(fn, VM::Register(n));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_EQ(rtr.intVal, expected);
+  if (JITFunction::isSupported()) {
+    EXPECT_NE(fn.getJITFunction(), nullptr);
+  }
+  // Run it again, in the native code this time.
+  rtr = vm.run(fn, VM::Register(n/2));
+  EXPECT_EQ(rtr.intVal, 
+    [&]() { 
+      FoxInt sum = 0;
+      for (FoxInt i = 0; i <= n/2; ++i)
+        sum += i*(i%7);
+      return sum;
+    }());
+}
+
+TEST_F(VMTest, JITRecursiveCalls) {
+  FileID file = srcMgr.loadFromString("foo()", "test");
+  BCFunction& fn = createRecursiveFunction(theModule, SourceRange(SourceLoc(file)));
+  VM vm(theModule);
+  vm.setJITThreshold(10);
+  FoxInt depth = 50;
+  VM::Register rtr = vm.run(fn, VM::Register(depth));
+  EXPECT_TRUE(vm.isAlive());
+  EXPECT_EQ(rtr.intVal, depth);
+  if (JITFunction::isSupported()) {
+    EXPECT_NE(fn.getJITFunction(), nullptr);
+  }
+  // Modifying the function discards its native code
+  fn.createBCBuilder();
+  EXPECT_EQ(fn.getJITFunction(), nullptr);
+}
+
+TEST_F(VMTest, JITDivisionByZero) {
+  // Divides 100 by (5 - i) for i from 0 to 10
+  FileID file = srcMgr.loadFromString("100/(5-i)", "test");
+  std::stringstream ss;
+  DiagnosticEngine diagEngine(srcMgr, ss);
+  BCModule otherModule(srcMgr, diagEngine);
+  BCFunction& fn = otherModule.createFunction();
+  DebugInfo& debugInfo = fn.createDebugInfo();
+  BCBuilder builder = fn.createBCBuilder();
+  builder.createStoreSmallIntInstr(0, 0);           // 0  r0 = i = 0
+  builder.createStoreSmallIntInstr(1, 10);          // 1  r1 = 10
+  builder.createStoreSmallIntInstr(2, 100);         // 2  r2 = 100
+  builder.createStoreSmallIntInstr(3, 5);           // 3  r3 = 5
+  builder.createJumpIfNotLTIntInstr(0, 1, 4);       // 4  if !(i < 10) goto 10
+  builder.createSubIntInstr(4, 3, 0);               // 6  r4 = 5 - i
+  builder.createDivIntInstr(5, 2, 4);               // 7  r5 = 100 / r4
+  debugInfo.addSourceRange(7, SourceRange(SourceLoc(file), 8));
+  builder.createAddIntImmInstr(0, 0, 1);            // 8  i++
+  builder.createJumpInstr(-6);                      // 9  goto 4
+  builder.createRetVoidInstr();                     // 10
+
+  VM vm(otherModule);
+  vm.setJITThreshold(2);
+  vm.run(fn);
+  if (JITFunction::isSupported()) {
+    EXPECT_NE(fn.getJITFunction(), nullptr);
+  }
+  // The division by zero is diagnosed by the interpreter
+  EXPECT_FALSE(vm.isAlive());
+  EXPECT_TRUE(diagEngine.hadAnyError());
+  EXPECT_NE(ss.str().find("division by zero"), std::string::npos) << ss.str();
+  EXPECT_EQ(vm.getRegisterStack()[0].intVal, 5);
+}